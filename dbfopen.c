@@ -13,6 +13,8 @@
 
 #include "shapefil_private.h"
 
+#include <float.h>
+#include <limits.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -68,6 +70,9 @@ CPL_INLINE static void CPL_IGNORE_RET_VAL_INT(CPL_UNUSED int unused)
 #define CPL_IGNORE_RET_VAL_INT(x) x
 #endif
 
+#define MIN(a, b) ((a < b) ? a : b)
+#define MAX(a, b) ((a > b) ? a : b)
+
 /************************************************************************/
 /*                           DBFWriteHeader()                           */
 /*                                                                      */
@@ -136,6 +141,80 @@ static void DBFWriteHeader(DBFHandle psDBF)
     }
 }
 
+/************************************************************************/
+/*                          DBFSyncReadAhead()                          */
+/*                                                                      */
+/*      Copy the current record into the read-ahead cache if it holds   */
+/*      it, once written.                                               */
+/************************************************************************/
+
+static void DBFSyncReadAhead(DBFHandle psDBF)
+{
+    if (psDBF->nCurrentRecord >= psDBF->nReadAheadFirst &&
+        psDBF->nCurrentRecord < psDBF->nReadAheadFirst + psDBF->nReadAheadCount)
+    {
+        memcpy(psDBF->pachReadAhead +
+                   STATIC_CAST(size_t,
+                               psDBF->nCurrentRecord - psDBF->nReadAheadFirst) *
+                       psDBF->nRecordLength,
+               psDBF->pszCurrentRecord, psDBF->nRecordLength);
+    }
+}
+
+/************************************************************************/
+/*                        DBFFlushWriteBuffer()                         */
+/*                                                                      */
+/*      Write out the appended records staged by DBFStageRecord().      */
+/************************************************************************/
+
+static bool DBFFlushWriteBuffer(DBFHandle psDBF)
+{
+    if (psDBF->nWriteBufUsed == 0)
+        return true;
+
+    const SAOffset nOffset =
+        psDBF->nRecordLength *
+            STATIC_CAST(SAOffset, psDBF->nWriteBufFirstRecord) +
+        psDBF->nHeaderLength;
+    const int nWriteBufUsed = psDBF->nWriteBufUsed;
+    psDBF->nWriteBufUsed = 0;
+
+    if ((psDBF->bRequireNextWriteSeek ||
+         psDBF->sHooks.FTell(psDBF->fp) != nOffset) &&
+        psDBF->sHooks.FSeek(psDBF->fp, nOffset, 0) != 0)
+    {
+        char szMessage[128];
+        snprintf(szMessage, sizeof(szMessage),
+                 "Failure seeking to position before writing DBF record %d.",
+                 psDBF->nWriteBufFirstRecord);
+        psDBF->sHooks.Error(szMessage);
+        return false;
+    }
+
+    if (psDBF->sHooks.FWrite(psDBF->pachWriteBuf, nWriteBufUsed, 1,
+                             psDBF->fp) != 1)
+    {
+        char szMessage[128];
+        snprintf(szMessage, sizeof(szMessage),
+                 "Failure writing DBF records %d to %d.",
+                 psDBF->nWriteBufFirstRecord,
+                 psDBF->nWriteBufFirstRecord +
+                     nWriteBufUsed / psDBF->nRecordLength - 1);
+        psDBF->sHooks.Error(szMessage);
+        return false;
+    }
+
+    psDBF->bRequireNextWriteSeek = FALSE;
+
+    if (psDBF->bWriteEndOfFileChar)
+    {
+        char ch = END_OF_FILE_CHARACTER;
+        psDBF->sHooks.FWrite(&ch, 1, 1, psDBF->fp);
+    }
+
+    return true;
+}
+
 /************************************************************************/
 /*                           DBFFlushRecord()                           */
 /*                                                                      */
@@ -144,6 +223,9 @@ static void DBFWriteHeader(DBFHandle psDBF)
 
 static bool DBFFlushRecord(DBFHandle psDBF)
 {
+    if (!DBFFlushWriteBuffer(psDBF))
+        return false;
+
     if (psDBF->bCurrentRecordModified && psDBF->nCurrentRecord > -1)
     {
         psDBF->bCurrentRecordModified = FALSE;
@@ -182,6 +264,8 @@ static bool DBFFlushRecord(DBFHandle psDBF)
             return false;
         }
 
+        DBFSyncReadAhead(psDBF);
+
         /* -------------------------------------------------------------------- */
         /*      If next op is also a write, allow possible skipping of FSeek.   */
         /* -------------------------------------------------------------------- */
@@ -200,6 +284,126 @@ static bool DBFFlushRecord(DBFHandle psDBF)
     return true;
 }
 
+/************************************************************************/
+/*                           DBFStageRecord()                           */
+/*                                                                      */
+/*      Same as DBFFlushRecord() before appending a record, except      */
+/*      that the current record is only copied to the write buffer      */
+/*      when it is the last one and follows the records buffered.       */
+/************************************************************************/
+
+static bool DBFStageRecord(DBFHandle psDBF)
+{
+    if (!psDBF->bCurrentRecordModified || psDBF->nCurrentRecord < 0 ||
+        psDBF->nCurrentRecord != psDBF->nRecords - 1 ||
+        psDBF->nWriteBufSize < psDBF->nRecordLength)
+        return DBFFlushRecord(psDBF);
+
+    if (psDBF->nWriteBufUsed > 0 &&
+        (psDBF->nWriteBufFirstRecord +
+                 psDBF->nWriteBufUsed / psDBF->nRecordLength !=
+             psDBF->nCurrentRecord ||
+         psDBF->nWriteBufSize - psDBF->nWriteBufUsed < psDBF->nRecordLength))
+    {
+        if (!DBFFlushWriteBuffer(psDBF))
+            return false;
+    }
+
+    if (psDBF->nWriteBufUsed == 0)
+        psDBF->nWriteBufFirstRecord = psDBF->nCurrentRecord;
+    memcpy(psDBF->pachWriteBuf + psDBF->nWriteBufUsed,
+           psDBF->pszCurrentRecord, psDBF->nRecordLength);
+    psDBF->nWriteBufUsed += psDBF->nRecordLength;
+    psDBF->bCurrentRecordModified = FALSE;
+
+    DBFSyncReadAhead(psDBF);
+
+    return true;
+}
+
+/************************************************************************/
+/*                           DBFReadAhead()                             */
+/*                                                                      */
+/*      Point the current record into the read-ahead cache, refilling   */
+/*      it from iRecord on if it does not hold it.                      */
+/************************************************************************/
+
+static bool DBFReadAhead(DBFHandle psDBF, int iRecord)
+{
+    if (iRecord < psDBF->nReadAheadFirst ||
+        iRecord >= psDBF->nReadAheadFirst + psDBF->nReadAheadCount)
+    {
+        if (psDBF->pachReadAhead == SHPLIB_NULLPTR)
+        {
+            psDBF->pachReadAhead = STATIC_CAST(
+                char *, malloc(STATIC_CAST(size_t, psDBF->nReadAheadRecords) *
+                               psDBF->nRecordLength));
+            if (psDBF->pachReadAhead == SHPLIB_NULLPTR)
+            {
+                psDBF->sHooks.Error("Not enough memory for DBF read-ahead.");
+                return false;
+            }
+        }
+
+        int nToRead = psDBF->nRecords - iRecord;
+        if (nToRead > psDBF->nReadAheadRecords)
+            nToRead = psDBF->nReadAheadRecords;
+
+        const SAOffset nRecordOffset =
+            psDBF->nRecordLength * STATIC_CAST(SAOffset, iRecord) +
+            psDBF->nHeaderLength;
+        const SAOffset nRead = SAReadAt(
+            &psDBF->sHooks, psDBF->fp, nRecordOffset, psDBF->pachReadAhead,
+            psDBF->nRecordLength * STATIC_CAST(SAOffset, nToRead));
+
+        /* Keep what was read of a truncated file */
+        psDBF->nReadAheadFirst = iRecord;
+        psDBF->nReadAheadCount = STATIC_CAST(
+            int, nRead / STATIC_CAST(SAOffset, psDBF->nRecordLength));
+        if (psDBF->nReadAheadCount == 0)
+        {
+            char szMessage[128];
+            snprintf(szMessage, sizeof(szMessage),
+                     "fread(%d) failed on DBF file.", psDBF->nRecordLength);
+            psDBF->sHooks.Error(szMessage);
+            return false;
+        }
+    }
+
+    psDBF->pszMappedRecord =
+        psDBF->pachReadAhead +
+        STATIC_CAST(size_t, iRecord - psDBF->nReadAheadFirst) *
+            psDBF->nRecordLength;
+    return true;
+}
+
+/************************************************************************/
+/*                        DBFDiscardReadAhead()                         */
+/*                                                                      */
+/*      Drop the read-ahead cache once the record layout has changed.   */
+/************************************************************************/
+
+static void DBFDiscardReadAhead(DBFHandle psDBF)
+{
+    free(psDBF->pachReadAhead);
+    psDBF->pachReadAhead = SHPLIB_NULLPTR;
+    psDBF->nReadAheadCount = 0;
+}
+
+/************************************************************************/
+/*                         DBFResetFieldIndex()                         */
+/*                                                                      */
+/*      Drop the field name hash table once the fields have changed.    */
+/*      It is rebuilt by the next DBFGetFieldIndex() call.              */
+/************************************************************************/
+
+static void DBFResetFieldIndex(DBFHandle psDBF)
+{
+    free(psDBF->panFieldIndexHash);
+    psDBF->panFieldIndexHash = SHPLIB_NULLPTR;
+    psDBF->nFieldIndexHashSize = 0;
+}
+
 /************************************************************************/
 /*                           DBFLoadRecord()                            */
 /************************************************************************/
@@ -215,18 +419,46 @@ static bool DBFLoadRecord(DBFHandle psDBF, int iRecord)
             psDBF->nRecordLength * STATIC_CAST(SAOffset, iRecord) +
             psDBF->nHeaderLength;
 
-        if (psDBF->sHooks.FSeek(psDBF->fp, nRecordOffset, SEEK_SET) != 0)
+        /* -------------------------------------------------------------------- */
+        /*      Point into the file mapping instead of copying if we can.       */
+        /* -------------------------------------------------------------------- */
+        psDBF->pszMappedRecord = SHPLIB_NULLPTR;
+        if (psDBF->sHooks.FGetMapping != SHPLIB_NULLPTR)
         {
-            char szMessage[128];
-            snprintf(szMessage, sizeof(szMessage),
-                     "fseek(%ld) failed on DBF file.",
-                     STATIC_CAST(long, nRecordOffset));
-            psDBF->sHooks.Error(szMessage);
-            return false;
+            SAOffset nMappingSize = 0;
+            const char *pachMapping = STATIC_CAST(
+                const char *,
+                psDBF->sHooks.FGetMapping(psDBF->fp, &nMappingSize));
+            if (pachMapping != SHPLIB_NULLPTR)
+            {
+                if (nRecordOffset > nMappingSize ||
+                    nMappingSize - nRecordOffset <
+                        STATIC_CAST(SAOffset, psDBF->nRecordLength))
+                {
+                    char szMessage[128];
+                    snprintf(szMessage, sizeof(szMessage),
+                             "fread(%d) failed on DBF file.",
+                             psDBF->nRecordLength);
+                    psDBF->sHooks.Error(szMessage);
+                    return false;
+                }
+
+                psDBF->pszMappedRecord = pachMapping + nRecordOffset;
+                psDBF->nCurrentRecord = iRecord;
+                psDBF->bRequireNextWriteSeek = TRUE;
+                return true;
+            }
         }
 
-        if (psDBF->sHooks.FRead(psDBF->pszCurrentRecord, psDBF->nRecordLength,
-                                1, psDBF->fp) != 1)
+        if (psDBF->nReadAheadRecords > 1)
+        {
+            if (!DBFReadAhead(psDBF, iRecord))
+                return false;
+        }
+        else if (SAReadAt(&psDBF->sHooks, psDBF->fp, nRecordOffset,
+                          psDBF->pszCurrentRecord,
+                          STATIC_CAST(SAOffset, psDBF->nRecordLength)) !=
+                 STATIC_CAST(SAOffset, psDBF->nRecordLength))
         {
             char szMessage[128];
             snprintf(szMessage, sizeof(szMessage),
@@ -245,6 +477,36 @@ static bool DBFLoadRecord(DBFHandle psDBF, int iRecord)
     return true;
 }
 
+/************************************************************************/
+/*                        DBFGetCurrentRecord()                         */
+/*                                                                      */
+/*      Return the bytes of the current record, wherever they live.     */
+/************************************************************************/
+
+static const char *DBFGetCurrentRecord(const DBFHandle psDBF)
+{
+    if (psDBF->pszMappedRecord != SHPLIB_NULLPTR)
+        return psDBF->pszMappedRecord;
+    return psDBF->pszCurrentRecord;
+}
+
+/************************************************************************/
+/*                      DBFDetachMappedRecord()                         */
+/*                                                                      */
+/*      Copy the current record out of the file mapping before it       */
+/*      gets modified.                                                  */
+/************************************************************************/
+
+static void DBFDetachMappedRecord(DBFHandle psDBF)
+{
+    if (psDBF->pszMappedRecord != SHPLIB_NULLPTR)
+    {
+        memcpy(psDBF->pszCurrentRecord, psDBF->pszMappedRecord,
+               psDBF->nRecordLength);
+        psDBF->pszMappedRecord = SHPLIB_NULLPTR;
+    }
+}
+
 /************************************************************************/
 /*                          DBFUpdateHeader()                           */
 /************************************************************************/
@@ -358,7 +620,7 @@ DBFHandle SHPAPI_CALL DBFOpenLL(const char *pszFilename, const char *pszAccess,
 
     DBFHandle psDBF = STATIC_CAST(DBFHandle, calloc(1, sizeof(DBFInfo)));
     psDBF->fp = psHooks->FOpen(pszFullname, pszAccess, psHooks->pvUserData);
-    memcpy(&(psDBF->sHooks), psHooks, sizeof(SAHooks));
+    SACopyHooks(&(psDBF->sHooks), psHooks);
 
     if (psDBF->fp == SHPLIB_NULLPTR)
     {
@@ -387,6 +649,7 @@ DBFHandle SHPAPI_CALL DBFOpenLL(const char *pszFilename, const char *pszAccess,
 
     psDBF->bNoHeader = FALSE;
     psDBF->nCurrentRecord = -1;
+    psDBF->pszMappedRecord = SHPLIB_NULLPTR;
     psDBF->bCurrentRecordModified = FALSE;
 
     /* -------------------------------------------------------------------- */
@@ -578,6 +841,9 @@ void SHPAPI_CALL DBFClose(DBFHandle psDBF)
     free(psDBF->pszHeader);
     free(psDBF->pszCurrentRecord);
     free(psDBF->pszCodePage);
+    free(psDBF->pachReadAhead);
+    free(psDBF->pachWriteBuf);
+    free(psDBF->panFieldIndexHash);
 
     free(psDBF);
 }
@@ -671,7 +937,7 @@ DBFHandle SHPAPI_CALL DBFCreateLL(const char *pszFilename,
     /* -------------------------------------------------------------------- */
     DBFHandle psDBF = STATIC_CAST(DBFHandle, calloc(1, sizeof(DBFInfo)));
 
-    memcpy(&(psDBF->sHooks), psHooks, sizeof(SAHooks));
+    SACopyHooks(&(psDBF->sHooks), psHooks);
     psDBF->fp = fp;
     psDBF->nRecords = 0;
     psDBF->nFields = 0;
@@ -686,6 +952,7 @@ DBFHandle SHPAPI_CALL DBFCreateLL(const char *pszFilename,
     psDBF->pszHeader = SHPLIB_NULLPTR;
 
     psDBF->nCurrentRecord = -1;
+    psDBF->pszMappedRecord = SHPLIB_NULLPTR;
     psDBF->bCurrentRecordModified = FALSE;
     psDBF->pszCurrentRecord = SHPLIB_NULLPTR;
 
@@ -766,6 +1033,8 @@ int SHPAPI_CALL DBFAddNativeFieldType(DBFHandle psDBF, const char *pszFieldName,
     if (!DBFFlushRecord(psDBF))
         return -1;
 
+    DBFResetFieldIndex(psDBF);
+
     if (psDBF->nHeaderLength + XBASE_FLDHDR_SZ > 65535)
     {
         char szMessage[128];
@@ -921,12 +1190,195 @@ int SHPAPI_CALL DBFAddNativeFieldType(DBFHandle psDBF, const char *pszFieldName,
     DBFUpdateHeader(psDBF);
 
     psDBF->nCurrentRecord = -1;
+    psDBF->pszMappedRecord = SHPLIB_NULLPTR;
+    DBFDiscardReadAhead(psDBF);
     psDBF->bCurrentRecordModified = FALSE;
     psDBF->bUpdated = TRUE;
 
     return (psDBF->nFields - 1);
 }
 
+/************************************************************************/
+/*                          DBFGetFieldView()                           */
+/*                                                                      */
+/*      Point a view at the value of a field in the record bytes: up    */
+/*      to its first NUL character, and without its leading and         */
+/*      trailing blanks if TRIM_DBF_WHITESPACE is defined.              */
+/************************************************************************/
+
+static void DBFGetFieldView(const DBFHandle psDBF, const char *pachRecord,
+                            int iField, DBFFieldView *psView)
+{
+    const char *pachValue = pachRecord + psDBF->panFieldOffset[iField];
+    int nLength = psDBF->panFieldSize[iField];
+
+    const char *pachNul =
+        STATIC_CAST(const char *, memchr(pachValue, '\0', nLength));
+    if (pachNul != SHPLIB_NULLPTR)
+        nLength = STATIC_CAST(int, pachNul - pachValue);
+
+#ifdef TRIM_DBF_WHITESPACE
+    while (nLength > 0 && *pachValue == ' ')
+    {
+        pachValue++;
+        nLength--;
+    }
+    while (nLength > 0 && pachValue[nLength - 1] == ' ')
+        nLength--;
+#endif
+
+    psView->pachValue = pachValue;
+    psView->nLength = nLength;
+}
+
+/************************************************************************/
+/*                          DBFParseInteger()                           */
+/*                                                                      */
+/*      Parse a blank padded numeric field value as atoi() would, for   */
+/*      the plain [blanks][sign]digits form.  Returns false for other   */
+/*      forms and values that could overflow, to be left to atoi().     */
+/************************************************************************/
+
+static bool DBFParseInteger(const char *pachValue, int nLength, int *pnValue)
+{
+    int i = 0;
+    while (i < nLength && pachValue[i] == ' ')
+        i++;
+
+    bool bNegative = false;
+    if (i < nLength && (pachValue[i] == '-' || pachValue[i] == '+'))
+    {
+        bNegative = pachValue[i] == '-';
+        i++;
+    }
+
+    const int iFirstDigit = i;
+    int nValue = 0;
+    for (; i < nLength && pachValue[i] >= '0' && pachValue[i] <= '9'; i++)
+    {
+        if (nValue > 99999999)
+            return false;
+        nValue = nValue * 10 + (pachValue[i] - '0');
+    }
+
+    /* Decimals are ignored, as by atoi() */
+    if (i == iFirstDigit ||
+        (i < nLength && pachValue[i] != ' ' && pachValue[i] != '.' &&
+         pachValue[i] != '\0'))
+        return false;
+
+    *pnValue = bNegative ? -nValue : nValue;
+    return true;
+}
+
+/************************************************************************/
+/*                           DBFParseDouble()                           */
+/*                                                                      */
+/*      Parse a blank padded numeric field value for the plain          */
+/*      [blanks][sign]digits[.digits] form.  The significant digits     */
+/*      are gathered in an integer, which is exactly converted when it  */
+/*      and the power of ten to apply are both exact doubles, as one    */
+/*      correctly rounded multiplication or division then yields the    */
+/*      same value as strtod().  Returns false otherwise, so that the   */
+/*      Atof hook is used.  Only called when the Atof hook is atof(),   */
+/*      so that a user supplied one is always honoured.                 */
+/************************************************************************/
+
+/* Largest integer below which all integers are exact doubles */
+#define DBF_MAX_EXACT_MANTISSA (STATIC_CAST(uint64_t, 1) << 53)
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+/* Powers of ten that are exact doubles */
+static const double adfPowersOf10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+#endif
+
+static bool DBFParseDouble(const char *pachValue, int nLength, double *pdfValue)
+{
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    const int nMaxPower =
+        STATIC_CAST(int, sizeof(adfPowersOf10) / sizeof(adfPowersOf10[0])) - 1;
+
+    int i = 0;
+    while (i < nLength && pachValue[i] == ' ')
+        i++;
+
+    bool bNegative = false;
+    if (i < nLength && (pachValue[i] == '-' || pachValue[i] == '+'))
+    {
+        bNegative = pachValue[i] == '-';
+        i++;
+    }
+
+    /* -------------------------------------------------------------------- */
+    /*      Gather the digits, deferring the zeros so that trailing ones    */
+    /*      do not use up the mantissa.                                     */
+    /* -------------------------------------------------------------------- */
+    uint64_t nMantissa = 0;
+    int nPendingZeros = 0;
+    int nDecimals = 0;
+    bool bHasDigits = false;
+    bool bHasPoint = false;
+    for (; i < nLength; i++)
+    {
+        const char ch = pachValue[i];
+        if (ch == '.' && !bHasPoint)
+        {
+            bHasPoint = true;
+            continue;
+        }
+        if (ch < '0' || ch > '9')
+            break;
+
+        bHasDigits = true;
+        if (bHasPoint)
+            nDecimals++;
+        if (ch == '0')
+        {
+            nPendingZeros++;
+            continue;
+        }
+
+        for (; nPendingZeros >= 0; nPendingZeros--)
+        {
+            if (nMantissa > DBF_MAX_EXACT_MANTISSA / 10)
+                return false;
+            nMantissa *= 10;
+        }
+        nPendingZeros = 0;
+        nMantissa += ch - '0';
+        if (nMantissa > DBF_MAX_EXACT_MANTISSA)
+            return false;
+    }
+
+    /* Exponents, and anything else strtod() might read, are left to it */
+    if (!bHasDigits ||
+        (i < nLength && pachValue[i] != ' ' && pachValue[i] != '\0'))
+        return false;
+
+    const int nExponent = nPendingZeros - nDecimals;
+    if (nMantissa == 0)
+        *pdfValue = 0.0;
+    else if (nExponent < -nMaxPower || nExponent > nMaxPower)
+        return false;
+    else if (nExponent < 0)
+        *pdfValue = STATIC_CAST(double, nMantissa) / adfPowersOf10[-nExponent];
+    else
+        *pdfValue = STATIC_CAST(double, nMantissa) * adfPowersOf10[nExponent];
+
+    if (bNegative)
+        *pdfValue = -*pdfValue;
+    return true;
+#else
+    /* Intermediate results with extra precision could be double rounded */
+    (void)pachValue;
+    (void)nLength;
+    (void)pdfValue;
+    return false;
+#endif
+}
+
 /************************************************************************/
 /*                          DBFReadAttribute()                          */
 /*                                                                      */
@@ -952,7 +1404,7 @@ static void *DBFReadAttribute(DBFHandle psDBF, int hEntity, int iField,
         return SHPLIB_NULLPTR;
 
     const unsigned char *pabyRec =
-        REINTERPRET_CAST(const unsigned char *, psDBF->pszCurrentRecord);
+        REINTERPRET_CAST(const unsigned char *, DBFGetCurrentRecord(psDBF));
 
     /* -------------------------------------------------------------------- */
     /*      Ensure we have room to extract the target field.                */
@@ -968,54 +1420,49 @@ static void *DBFReadAttribute(DBFHandle psDBF, int hEntity, int iField,
                 char *, realloc(psDBF->pszWorkField, psDBF->nWorkFieldLength));
     }
 
-    /* -------------------------------------------------------------------- */
-    /*      Extract the requested field.                                    */
-    /* -------------------------------------------------------------------- */
-    memcpy(psDBF->pszWorkField,
-           REINTERPRET_CAST(const char *, pabyRec) +
-               psDBF->panFieldOffset[iField],
-           psDBF->panFieldSize[iField]);
-    psDBF->pszWorkField[psDBF->panFieldSize[iField]] = '\0';
-
     void *pReturnField = psDBF->pszWorkField;
 
     /* -------------------------------------------------------------------- */
-    /*      Decode the field.                                               */
+    /*      Extract and decode the requested field.                         */
     /* -------------------------------------------------------------------- */
-    if (chReqType == 'I')
+    if (chReqType == 'I' || chReqType == 'N')
     {
-        psDBF->fieldValue.nIntField = atoi(psDBF->pszWorkField);
+        memcpy(psDBF->pszWorkField,
+               REINTERPRET_CAST(const char *, pabyRec) +
+                   psDBF->panFieldOffset[iField],
+               psDBF->panFieldSize[iField]);
+        psDBF->pszWorkField[psDBF->panFieldSize[iField]] = '\0';
 
-        pReturnField = &(psDBF->fieldValue.nIntField);
-    }
-    else if (chReqType == 'N')
-    {
-        psDBF->fieldValue.dfDoubleField =
-            psDBF->sHooks.Atof(psDBF->pszWorkField);
+        if (chReqType == 'I')
+        {
+            if (!DBFParseInteger(psDBF->pszWorkField,
+                                 psDBF->panFieldSize[iField],
+                                 &psDBF->fieldValue.nIntField))
+                psDBF->fieldValue.nIntField = atoi(psDBF->pszWorkField);
 
-        pReturnField = &(psDBF->fieldValue.dfDoubleField);
+            pReturnField = &(psDBF->fieldValue.nIntField);
+        }
+        else
+        {
+            if (psDBF->sHooks.Atof != atof ||
+                !DBFParseDouble(psDBF->pszWorkField,
+                                psDBF->panFieldSize[iField],
+                                &psDBF->fieldValue.dfDoubleField))
+                psDBF->fieldValue.dfDoubleField =
+                    psDBF->sHooks.Atof(psDBF->pszWorkField);
+
+            pReturnField = &(psDBF->fieldValue.dfDoubleField);
+        }
     }
-
-/* -------------------------------------------------------------------- */
-/*      Should we trim white space off the string attribute value?      */
-/* -------------------------------------------------------------------- */
-#ifdef TRIM_DBF_WHITESPACE
     else
     {
-        char *pchSrc = psDBF->pszWorkField;
-        char *pchDst = pchSrc;
-
-        while (*pchSrc == ' ')
-            pchSrc++;
-
-        while (*pchSrc != '\0')
-            *(pchDst++) = *(pchSrc++);
-        *pchDst = '\0';
-
-        while (pchDst != psDBF->pszWorkField && *(--pchDst) == ' ')
-            *pchDst = '\0';
+        /* Only the (trimmed) value is copied */
+        DBFFieldView sView;
+        DBFGetFieldView(psDBF, REINTERPRET_CAST(const char *, pabyRec), iField,
+                        &sView);
+        memcpy(psDBF->pszWorkField, sView.pachValue, sView.nLength);
+        psDBF->pszWorkField[sView.nLength] = '\0';
     }
-#endif
 
     return pReturnField;
 }
@@ -1069,6 +1516,30 @@ const char SHPAPI_CALL1(*)
                        DBFReadAttribute(psDBF, iRecord, iField, 'C'));
 }
 
+/************************************************************************/
+/*                       DBFReadAttributeView()                         */
+/*                                                                      */
+/*      Point a view at the value of a field, in the file mapping or    */
+/*      in the current record buffer, without copying it.               */
+/************************************************************************/
+
+int SHPAPI_CALL DBFReadAttributeView(DBFHandle psDBF, int iRecord, int iField,
+                                     DBFFieldView *psView)
+{
+    if (iRecord < 0 || iRecord >= psDBF->nRecords)
+        return FALSE;
+
+    if (iField < 0 || iField >= psDBF->nFields)
+        return FALSE;
+
+    if (!DBFLoadRecord(psDBF, iRecord))
+        return FALSE;
+
+    DBFGetFieldView(psDBF, DBFGetCurrentRecord(psDBF), iField, psView);
+
+    return TRUE;
+}
+
 /************************************************************************/
 /*                        DBFReadLogicalAttribute()                     */
 /*                                                                      */
@@ -1182,30 +1653,286 @@ int SHPAPI_CALL DBFIsAttributeNULL(const DBFHandle psDBF, int iRecord,
 }
 
 /************************************************************************/
-/*                          DBFGetFieldCount()                          */
+/*                        DBFReadNumericColumn()                        */
 /*                                                                      */
-/*      Return the number of fields in this table.                      */
+/*      Decode one field of nCount records starting at iFirst into      */
+/*      panValues or padfValues, the records being taken from the file  */
+/*      mapping, or read in blocks of DBF_COLUMN_BLOCK_SIZE bytes.      */
+/*      Returns the number of records read, or -1 on invalid            */
+/*      arguments.                                                      */
 /************************************************************************/
 
-int SHPAPI_CALL DBFGetFieldCount(const DBFHandle psDBF)
+/* Size of the blocks of records read at once by the column readers */
+#define DBF_COLUMN_BLOCK_SIZE (1024 * 1024)
+
+static int DBFReadNumericColumn(DBFHandle psDBF, int iField, int iFirst,
+                                int nCount, int *panValues, double *padfValues,
+                                unsigned char *pabyNullMask)
 {
-    return (psDBF->nFields);
-}
+    if (iField < 0 || iField >= psDBF->nFields || iFirst < 0 || nCount < 0 ||
+        iFirst > psDBF->nRecords || nCount > psDBF->nRecords - iFirst)
+        return -1;
 
-/************************************************************************/
-/*                         DBFGetRecordCount()                          */
-/*                                                                      */
-/*      Return the number of records in this table.                     */
-/************************************************************************/
+    if (nCount == 0)
+        return 0;
 
-int SHPAPI_CALL DBFGetRecordCount(const DBFHandle psDBF)
-{
-    return (psDBF->nRecords);
-}
+    if (pabyNullMask != SHPLIB_NULLPTR)
+        memset(pabyNullMask, 0, (STATIC_CAST(size_t, nCount) + 7) / 8);
 
-/************************************************************************/
-/*                          DBFGetFieldInfo()                           */
-/*                                                                      */
+    /* -------------------------------------------------------------------- */
+    /*      Make sure the file holds the current record if modified.        */
+    /* -------------------------------------------------------------------- */
+    if (!DBFFlushRecord(psDBF))
+        return 0;
+
+    const char *pachMapping = SHPLIB_NULLPTR;
+    SAOffset nMappingSize = 0;
+    if (psDBF->sHooks.FGetMapping != SHPLIB_NULLPTR)
+        pachMapping = STATIC_CAST(
+            const char *, psDBF->sHooks.FGetMapping(psDBF->fp, &nMappingSize));
+
+    int nRecordsPerBlock = DBF_COLUMN_BLOCK_SIZE / psDBF->nRecordLength;
+    if (nRecordsPerBlock < 1)
+        nRecordsPerBlock = 1;
+
+    char *pachBlock = SHPLIB_NULLPTR;
+    if (pachMapping == SHPLIB_NULLPTR)
+    {
+        if (nRecordsPerBlock > nCount)
+            nRecordsPerBlock = nCount;
+        pachBlock = STATIC_CAST(
+            char *, malloc(STATIC_CAST(size_t, nRecordsPerBlock) *
+                           psDBF->nRecordLength));
+        if (pachBlock == SHPLIB_NULLPTR)
+        {
+            psDBF->sHooks.Error("Not enough memory to read DBF column.");
+            return 0;
+        }
+    }
+
+    const char chType = psDBF->pachFieldType[iField];
+    char szValue[XBASE_FLD_MAX_WIDTH + 1];
+    int nRead = 0;
+
+    while (nRead < nCount)
+    {
+        int nBlockRecords = nCount - nRead;
+        if (nBlockRecords > nRecordsPerBlock)
+            nBlockRecords = nRecordsPerBlock;
+
+        const SAOffset nBlockOffset =
+            psDBF->nRecordLength * STATIC_CAST(SAOffset, iFirst + nRead) +
+            psDBF->nHeaderLength;
+        const SAOffset nBlockSize =
+            psDBF->nRecordLength * STATIC_CAST(SAOffset, nBlockRecords);
+
+        /* -------------------------------------------------------------------- */
+        /*      Point into the file mapping, or read the next block.            */
+        /* -------------------------------------------------------------------- */
+        const char *pachRecords;
+        if (pachMapping != SHPLIB_NULLPTR)
+        {
+            if (nBlockOffset > nMappingSize ||
+                nMappingSize - nBlockOffset < nBlockSize)
+                pachRecords = SHPLIB_NULLPTR;
+            else
+                pachRecords = pachMapping + nBlockOffset;
+        }
+        else
+        {
+            psDBF->bRequireNextWriteSeek = TRUE;
+            if (SAReadAt(&psDBF->sHooks, psDBF->fp, nBlockOffset, pachBlock,
+                         nBlockSize) != nBlockSize)
+                pachRecords = SHPLIB_NULLPTR;
+            else
+                pachRecords = pachBlock;
+        }
+
+        if (pachRecords == SHPLIB_NULLPTR)
+        {
+            char szMessage[128];
+            snprintf(szMessage, sizeof(szMessage),
+                     "fread(%d) failed on DBF file.",
+                     STATIC_CAST(int, nBlockSize));
+            psDBF->sHooks.Error(szMessage);
+            break;
+        }
+
+        /* -------------------------------------------------------------------- */
+        /*      Decode the field of each record of the block.                   */
+        /* -------------------------------------------------------------------- */
+        for (int i = 0; i < nBlockRecords; i++, nRead++)
+        {
+            DBFFieldView sView;
+            DBFGetFieldView(psDBF, pachRecords + i * psDBF->nRecordLength,
+                            iField, &sView);
+
+            /* The value is only copied when it needs to be NUL terminated */
+            bool bParsed;
+            if (panValues != SHPLIB_NULLPTR)
+                bParsed = DBFParseInteger(sView.pachValue, sView.nLength,
+                                          panValues + nRead);
+            else
+                bParsed = psDBF->sHooks.Atof == atof &&
+                          DBFParseDouble(sView.pachValue, sView.nLength,
+                                         padfValues + nRead);
+            if (!bParsed || pabyNullMask != SHPLIB_NULLPTR)
+            {
+                memcpy(szValue, sView.pachValue, sView.nLength);
+                szValue[sView.nLength] = '\0';
+            }
+
+            if (!bParsed)
+            {
+                if (panValues != SHPLIB_NULLPTR)
+                    panValues[nRead] = atoi(szValue);
+                else
+                    padfValues[nRead] = psDBF->sHooks.Atof(szValue);
+            }
+
+            if (pabyNullMask != SHPLIB_NULLPTR &&
+                DBFIsValueNULL(chType, szValue))
+                pabyNullMask[nRead / 8] |=
+                    STATIC_CAST(unsigned char, 1 << (nRead % 8));
+        }
+    }
+
+    free(pachBlock);
+
+    return nRead;
+}
+
+/************************************************************************/
+/*                        DBFReadIntegerColumn()                        */
+/*                                                                      */
+/*      Read an integer field of a range of records.                    */
+/************************************************************************/
+
+int SHPAPI_CALL DBFReadIntegerColumn(DBFHandle psDBF, int iField, int iFirst,
+                                     int nCount, int *panValues,
+                                     unsigned char *pabyNullMask)
+{
+    return DBFReadNumericColumn(psDBF, iField, iFirst, nCount, panValues,
+                                SHPLIB_NULLPTR, pabyNullMask);
+}
+
+/************************************************************************/
+/*                        DBFReadDoubleColumn()                         */
+/*                                                                      */
+/*      Read a double field of a range of records.                      */
+/************************************************************************/
+
+int SHPAPI_CALL DBFReadDoubleColumn(DBFHandle psDBF, int iField, int iFirst,
+                                    int nCount, double *padfValues,
+                                    unsigned char *pabyNullMask)
+{
+    return DBFReadNumericColumn(psDBF, iField, iFirst, nCount, SHPLIB_NULLPTR,
+                                padfValues, pabyNullMask);
+}
+
+/************************************************************************/
+/*                          DBFGetFieldCount()                          */
+/*                                                                      */
+/*      Return the number of fields in this table.                      */
+/************************************************************************/
+
+int SHPAPI_CALL DBFGetFieldCount(const DBFHandle psDBF)
+{
+    return (psDBF->nFields);
+}
+
+/************************************************************************/
+/*                         DBFGetRecordCount()                          */
+/*                                                                      */
+/*      Return the number of records in this table.                     */
+/************************************************************************/
+
+int SHPAPI_CALL DBFGetRecordCount(const DBFHandle psDBF)
+{
+    return (psDBF->nRecords);
+}
+
+/************************************************************************/
+/*                         DBFReserveRecords()                          */
+/*                                                                      */
+/*      Allocate the storage of the file for nRecords records, and the  */
+/*      end of file character, so that appends do not fragment it.     */
+/************************************************************************/
+
+int SHPAPI_CALL DBFReserveRecords(DBFHandle psDBF, int nRecords)
+{
+    if (nRecords < 0)
+        return FALSE;
+
+    /* Only a hint: failing to allocate the storage is not an error */
+    if (psDBF->sHooks.FReserve != SHPLIB_NULLPTR)
+        psDBF->sHooks.FReserve(
+            psDBF->fp, psDBF->nHeaderLength +
+                           STATIC_CAST(SAOffset, psDBF->nRecordLength) *
+                               nRecords +
+                           1);
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                       DBFSetWriteBufferSize()                        */
+/*                                                                      */
+/*      Set the size of the buffer accumulating appended records.       */
+/************************************************************************/
+
+int SHPAPI_CALL DBFSetWriteBufferSize(DBFHandle psDBF, int nBufferSize)
+{
+    if (nBufferSize < 0 || !DBFFlushWriteBuffer(psDBF))
+        return FALSE;
+
+    char *pachWriteBuf = SHPLIB_NULLPTR;
+    if (nBufferSize > 0)
+    {
+        pachWriteBuf = STATIC_CAST(char *, malloc(nBufferSize));
+        if (pachWriteBuf == SHPLIB_NULLPTR)
+        {
+            char szMessage[64];
+            snprintf(szMessage, sizeof(szMessage),
+                     "Not enough memory to allocate %d bytes", nBufferSize);
+            psDBF->sHooks.Error(szMessage);
+            return FALSE;
+        }
+    }
+
+    free(psDBF->pachWriteBuf);
+    psDBF->pachWriteBuf = pachWriteBuf;
+    psDBF->nWriteBufSize = nBufferSize;
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                       DBFSetReadAheadRecords()                       */
+/*                                                                      */
+/*      Set the number of records read per I/O by DBFLoadRecord().      */
+/************************************************************************/
+
+int SHPAPI_CALL DBFSetReadAheadRecords(DBFHandle psDBF, int nRecords)
+{
+    if (nRecords < 0 || (psDBF->nRecordLength > 0 &&
+                         nRecords > INT_MAX / psDBF->nRecordLength))
+        return FALSE;
+
+    DBFDiscardReadAhead(psDBF);
+    psDBF->nReadAheadRecords = nRecords;
+
+    /* The current record may point into the discarded cache */
+    if (psDBF->pszMappedRecord != SHPLIB_NULLPTR)
+        psDBF->nCurrentRecord = -1;
+    psDBF->pszMappedRecord = SHPLIB_NULLPTR;
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                          DBFGetFieldInfo()                           */
+/*                                                                      */
 /*      Return any requested information about the field.               */
 /*      pszFieldName must be at least XBASE_FLDNAME_LEN_READ+1 (=12)    */
 /*      bytes long.                                                     */
@@ -1257,6 +1984,87 @@ DBFFieldType SHPAPI_CALL DBFGetFieldInfo(const DBFHandle psDBF, int iField,
     }
 }
 
+/************************************************************************/
+/*                         DBFFormatNumeric()                           */
+/*                                                                      */
+/*      Format a value as snprintf("%*.*f") would, right justified in   */
+/*      nWidth characters at pachOut.  The value is scaled by the power */
+/*      of ten of the decimal count; when the scaled value is below     */
+/*      2^52, the error of that multiplication is small enough to tell  */
+/*      whether the exact value rounds to the same integer, and its     */
+/*      digits are then written directly.  Returns false, without      */
+/*      writing anything, for values it cannot format exactly or that   */
+/*      do not fit, so that the caller falls back to snprintf().        */
+/************************************************************************/
+
+static bool DBFFormatNumeric(char *pachOut, int nWidth, int nDecimals,
+                             double dfValue)
+{
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    const int nMaxPower =
+        STATIC_CAST(int, sizeof(adfPowersOf10) / sizeof(adfPowersOf10[0])) - 1;
+    if (nDecimals < 0 || nDecimals > nMaxPower)
+        return false;
+
+    const bool bNegative = signbit(dfValue) != 0;
+    const double dfScaled = fabs(dfValue) * adfPowersOf10[nDecimals];
+    /* Also rejects NaN and infinities */
+    if (!(dfScaled < STATIC_CAST(double, DBF_MAX_EXACT_MANTISSA / 2)))
+        return false;
+
+    /* -------------------------------------------------------------------- */
+    /*      The multiplication is off by at most half an ulp, which is      */
+    /*      below dfScaled * 2^-53: only round when the fractional part    */
+    /*      is clearly away from one half.                                  */
+    /* -------------------------------------------------------------------- */
+    const double dfFloor = floor(dfScaled);
+    const double dfFraction = dfScaled - dfFloor;
+    if (!(fabs(dfFraction - 0.5) > dfScaled * (1.0 / DBF_MAX_EXACT_MANTISSA)))
+        return false;
+
+    uint64_t nValue = STATIC_CAST(uint64_t, dfFloor);
+    if (dfFraction > 0.5)
+        nValue++;
+
+    /* -------------------------------------------------------------------- */
+    /*      Format the digits backwards, with at least one before the       */
+    /*      decimal point.                                                  */
+    /* -------------------------------------------------------------------- */
+    char szDigits[32];
+    int nDigits = 0;
+    do
+    {
+        szDigits[nDigits++] = STATIC_CAST(char, '0' + nValue % 10);
+        nValue /= 10;
+    } while (nValue != 0);
+    while (nDigits < nDecimals + 1)
+        szDigits[nDigits++] = '0';
+
+    const int nLength = (bNegative ? 1 : 0) + nDigits + (nDecimals > 0 ? 1 : 0);
+    if (nLength > nWidth)
+        return false;
+
+    int iOut = nWidth - nLength;
+    memset(pachOut, ' ', iOut);
+    if (bNegative)
+        pachOut[iOut++] = '-';
+    for (int i = nDigits - 1; i >= 0; i--)
+    {
+        if (i == nDecimals - 1)
+            pachOut[iOut++] = '.';
+        pachOut[iOut++] = szDigits[i];
+    }
+
+    return true;
+#else
+    (void)pachOut;
+    (void)nWidth;
+    (void)nDecimals;
+    (void)dfValue;
+    return false;
+#endif
+}
+
 /************************************************************************/
 /*                         DBFWriteAttribute()                          */
 /*                                                                      */
@@ -1280,7 +2088,7 @@ static bool DBFWriteAttribute(DBFHandle psDBF, int hEntity, int iField,
     /* -------------------------------------------------------------------- */
     if (hEntity == psDBF->nRecords)
     {
-        if (!DBFFlushRecord(psDBF))
+        if (!DBFStageRecord(psDBF))
             return false;
 
         psDBF->nRecords++;
@@ -1288,6 +2096,7 @@ static bool DBFWriteAttribute(DBFHandle psDBF, int hEntity, int iField,
             psDBF->pszCurrentRecord[i] = ' ';
 
         psDBF->nCurrentRecord = hEntity;
+        psDBF->pszMappedRecord = SHPLIB_NULLPTR;
     }
 
     /* -------------------------------------------------------------------- */
@@ -1296,6 +2105,7 @@ static bool DBFWriteAttribute(DBFHandle psDBF, int hEntity, int iField,
     /* -------------------------------------------------------------------- */
     if (!DBFLoadRecord(psDBF, hEntity))
         return false;
+    DBFDetachMappedRecord(psDBF);
 
     unsigned char *pabyRec =
         REINTERPRET_CAST(unsigned char *, psDBF->pszCurrentRecord);
@@ -1333,6 +2143,13 @@ static bool DBFWriteAttribute(DBFHandle psDBF, int hEntity, int iField,
             if (STATIC_CAST(int, sizeof(szSField)) - 2 < nWidth)
                 nWidth = sizeof(szSField) - 2;
 
+            if (DBFFormatNumeric(REINTERPRET_CAST(
+                                     char *,
+                                     pabyRec + psDBF->panFieldOffset[iField]),
+                                 nWidth, psDBF->panFieldDecimals[iField],
+                                 *STATIC_CAST(double *, pValue)))
+                break;
+
             char szFormat[20];
             snprintf(szFormat, sizeof(szFormat), "%%%d.%df", nWidth,
                      psDBF->panFieldDecimals[iField]);
@@ -1416,7 +2233,7 @@ int SHPAPI_CALL DBFWriteAttributeDirectly(DBFHandle psDBF, int hEntity,
     /* -------------------------------------------------------------------- */
     if (hEntity == psDBF->nRecords)
     {
-        if (!DBFFlushRecord(psDBF))
+        if (!DBFStageRecord(psDBF))
             return FALSE;
 
         psDBF->nRecords++;
@@ -1424,6 +2241,7 @@ int SHPAPI_CALL DBFWriteAttributeDirectly(DBFHandle psDBF, int hEntity,
             psDBF->pszCurrentRecord[i] = ' ';
 
         psDBF->nCurrentRecord = hEntity;
+        psDBF->pszMappedRecord = SHPLIB_NULLPTR;
     }
 
     /* -------------------------------------------------------------------- */
@@ -1432,6 +2250,7 @@ int SHPAPI_CALL DBFWriteAttributeDirectly(DBFHandle psDBF, int hEntity,
     /* -------------------------------------------------------------------- */
     if (!DBFLoadRecord(psDBF, hEntity))
         return FALSE;
+    DBFDetachMappedRecord(psDBF);
 
     if (iField >= 0)
     {
@@ -1577,7 +2396,7 @@ int SHPAPI_CALL DBFWriteTuple(DBFHandle psDBF, int hEntity,
     /* -------------------------------------------------------------------- */
     if (hEntity == psDBF->nRecords)
     {
-        if (!DBFFlushRecord(psDBF))
+        if (!DBFStageRecord(psDBF))
             return FALSE;
 
         psDBF->nRecords++;
@@ -1585,6 +2404,7 @@ int SHPAPI_CALL DBFWriteTuple(DBFHandle psDBF, int hEntity,
             psDBF->pszCurrentRecord[i] = ' ';
 
         psDBF->nCurrentRecord = hEntity;
+        psDBF->pszMappedRecord = SHPLIB_NULLPTR;
     }
 
     /* -------------------------------------------------------------------- */
@@ -1593,6 +2413,7 @@ int SHPAPI_CALL DBFWriteTuple(DBFHandle psDBF, int hEntity,
     /* -------------------------------------------------------------------- */
     if (!DBFLoadRecord(psDBF, hEntity))
         return FALSE;
+    DBFDetachMappedRecord(psDBF);
 
     unsigned char *pabyRec =
         REINTERPRET_CAST(unsigned char *, psDBF->pszCurrentRecord);
@@ -1620,7 +2441,7 @@ const char SHPAPI_CALL1(*) DBFReadTuple(DBFHandle psDBF, int hEntity)
     if (!DBFLoadRecord(psDBF, hEntity))
         return SHPLIB_NULLPTR;
 
-    return STATIC_CAST(const char *, psDBF->pszCurrentRecord);
+    return DBFGetCurrentRecord(psDBF);
 }
 
 /************************************************************************/
@@ -1699,6 +2520,59 @@ char SHPAPI_CALL DBFGetNativeFieldType(const DBFHandle psDBF, int iField)
     return ' ';
 }
 
+/************************************************************************/
+/*                          DBFHashFieldName()                          */
+/*                                                                      */
+/*      Case insensitive FNV-1a hash of a field name, folding case      */
+/*      with tolower() as STRCASECMP() does.                            */
+/************************************************************************/
+
+static unsigned int DBFHashFieldName(const char *pszFieldName)
+{
+    unsigned int nHash = 2166136261U;
+    for (; *pszFieldName != '\0'; pszFieldName++)
+    {
+        const int ch = tolower(STATIC_CAST(unsigned char, *pszFieldName));
+        nHash ^= STATIC_CAST(unsigned int, ch);
+        nHash *= 16777619U;
+    }
+    return nHash;
+}
+
+/************************************************************************/
+/*                       DBFBuildFieldIndexHash()                       */
+/*                                                                      */
+/*      Build the open addressing hash table of field names used by    */
+/*      DBFGetFieldIndex(). Fields are inserted in order, so that the   */
+/*      first of several fields with the same name is found first.     */
+/************************************************************************/
+
+static bool DBFBuildFieldIndexHash(DBFHandle psDBF)
+{
+    int nHashSize = 16;
+    while (nHashSize < 2 * psDBF->nFields)
+        nHashSize *= 2;
+
+    int *panHash = STATIC_CAST(int *, calloc(nHashSize, sizeof(int)));
+    if (panHash == SHPLIB_NULLPTR)
+        return false;
+
+    const unsigned int nMask = STATIC_CAST(unsigned int, nHashSize - 1);
+    char name[XBASE_FLDNAME_LEN_READ + 1];
+    for (int i = 0; i < psDBF->nFields; i++)
+    {
+        DBFGetFieldInfo(psDBF, i, name, SHPLIB_NULLPTR, SHPLIB_NULLPTR);
+        unsigned int iSlot = DBFHashFieldName(name) & nMask;
+        while (panHash[iSlot] != 0)
+            iSlot = (iSlot + 1) & nMask;
+        panHash[iSlot] = i + 1;
+    }
+
+    psDBF->panFieldIndexHash = panHash;
+    psDBF->nFieldIndexHashSize = nHashSize;
+    return true;
+}
+
 /************************************************************************/
 /*                          DBFGetFieldIndex()                          */
 /*                                                                      */
@@ -1712,8 +2586,24 @@ int SHPAPI_CALL DBFGetFieldIndex(const DBFHandle psDBF,
 {
     char name[XBASE_FLDNAME_LEN_READ + 1];
 
-    for (int i = 0; i < DBFGetFieldCount(psDBF); i++)
+    if (psDBF->panFieldIndexHash == SHPLIB_NULLPTR &&
+        !DBFBuildFieldIndexHash(psDBF))
     {
+        for (int i = 0; i < DBFGetFieldCount(psDBF); i++)
+        {
+            DBFGetFieldInfo(psDBF, i, name, SHPLIB_NULLPTR, SHPLIB_NULLPTR);
+            if (!STRCASECMP(pszFieldName, name))
+                return (i);
+        }
+        return (-1);
+    }
+
+    const unsigned int nMask =
+        STATIC_CAST(unsigned int, psDBF->nFieldIndexHashSize - 1);
+    for (unsigned int iSlot = DBFHashFieldName(pszFieldName) & nMask;
+         psDBF->panFieldIndexHash[iSlot] != 0; iSlot = (iSlot + 1) & nMask)
+    {
+        const int i = psDBF->panFieldIndexHash[iSlot] - 1;
         DBFGetFieldInfo(psDBF, i, name, SHPLIB_NULLPTR, SHPLIB_NULLPTR);
         if (!STRCASECMP(pszFieldName, name))
             return (i);
@@ -1745,7 +2635,7 @@ int SHPAPI_CALL DBFIsRecordDeleted(const DBFHandle psDBF, int iShape)
     /* -------------------------------------------------------------------- */
     /*      '*' means deleted.                                              */
     /* -------------------------------------------------------------------- */
-    return psDBF->pszCurrentRecord[0] == '*';
+    return DBFGetCurrentRecord(psDBF)[0] == '*';
 }
 
 /************************************************************************/
@@ -1767,6 +2657,7 @@ int SHPAPI_CALL DBFMarkRecordDeleted(DBFHandle psDBF, int iShape,
     /* -------------------------------------------------------------------- */
     if (!DBFLoadRecord(psDBF, iShape))
         return FALSE;
+    DBFDetachMappedRecord(psDBF);
 
     /* -------------------------------------------------------------------- */
     /*      Assign value, marking record as dirty if it changes.            */
@@ -1813,6 +2704,8 @@ int SHPAPI_CALL DBFDeleteField(DBFHandle psDBF, int iField)
     if (!DBFFlushRecord(psDBF))
         return FALSE;
 
+    DBFResetFieldIndex(psDBF);
+
     /* get information about field to be deleted */
     int nOldRecordLength = psDBF->nRecordLength;
     int nOldHeaderLength = psDBF->nHeaderLength;
@@ -1916,6 +2809,8 @@ int SHPAPI_CALL DBFDeleteField(DBFHandle psDBF, int iField)
     free(pszRecord);
 
     psDBF->nCurrentRecord = -1;
+    psDBF->pszMappedRecord = SHPLIB_NULLPTR;
+    DBFDiscardReadAhead(psDBF);
     psDBF->bCurrentRecordModified = FALSE;
     psDBF->bUpdated = TRUE;
 
@@ -1941,6 +2836,8 @@ int SHPAPI_CALL DBFReorderFields(DBFHandle psDBF, const int *panMap)
     if (!DBFFlushRecord(psDBF))
         return FALSE;
 
+    DBFResetFieldIndex(psDBF);
+
     /* a simple malloc() would be enough, but calloc() helps clang static
      * analyzer */
     int *panFieldOffsetNew =
@@ -2031,6 +2928,8 @@ int SHPAPI_CALL DBFReorderFields(DBFHandle psDBF, const int *panMap)
         free(panFieldDecimalsNew);
         free(pachFieldTypeNew);
         psDBF->nCurrentRecord = -1;
+        psDBF->pszMappedRecord = SHPLIB_NULLPTR;
+        DBFDiscardReadAhead(psDBF);
         psDBF->bCurrentRecordModified = FALSE;
         psDBF->bUpdated = FALSE;
         return FALSE;
@@ -2047,6 +2946,8 @@ int SHPAPI_CALL DBFReorderFields(DBFHandle psDBF, const int *panMap)
     psDBF->pachFieldType = pachFieldTypeNew;
 
     psDBF->nCurrentRecord = -1;
+    psDBF->pszMappedRecord = SHPLIB_NULLPTR;
+    DBFDiscardReadAhead(psDBF);
     psDBF->bCurrentRecordModified = FALSE;
     psDBF->bUpdated = TRUE;
 
@@ -2070,6 +2971,8 @@ int SHPAPI_CALL DBFAlterFieldDefn(DBFHandle psDBF, int iField,
     if (!DBFFlushRecord(psDBF))
         return FALSE;
 
+    DBFResetFieldIndex(psDBF);
+
     const char chFieldFill = DBFGetNullCharacter(chType);
 
     const char chOldType = psDBF->pachFieldType[iField];
@@ -2301,18 +3204,700 @@ int SHPAPI_CALL DBFAlterFieldDefn(DBFHandle psDBF, int iField,
     if (errorAbort)
     {
         psDBF->nCurrentRecord = -1;
+        psDBF->pszMappedRecord = SHPLIB_NULLPTR;
+        DBFDiscardReadAhead(psDBF);
         psDBF->bCurrentRecordModified = TRUE;
         psDBF->bUpdated = FALSE;
 
         return FALSE;
     }
     psDBF->nCurrentRecord = -1;
+    psDBF->pszMappedRecord = SHPLIB_NULLPTR;
+    DBFDiscardReadAhead(psDBF);
     psDBF->bCurrentRecordModified = FALSE;
     psDBF->bUpdated = TRUE;
 
     return TRUE;
 }
 
+/************************************************************************/
+/*                         DBFSchemaChangeInfo                          */
+/*                                                                      */
+/*      Pending field changes of a table. Each field of the new schema  */
+/*      remembers the field of the table it comes from (or is added     */
+/*      as NULL values), and the type and width changes to apply to     */
+/*      its values in turn, as DBFAlterFieldDefn() would.               */
+/************************************************************************/
+
+typedef struct
+{
+    char chType;
+    int nWidth;
+} DBFSchemaConversion;
+
+typedef struct
+{
+    char achDescriptor[XBASE_FLDHDR_SZ];
+    char chType;
+    int nWidth;
+    int nDecimals;
+
+    int iSourceField; /* -1 for added fields */
+    char chSourceType;
+    int nSourceWidth;
+
+    int nConversions;
+    DBFSchemaConversion *pasConversions;
+} DBFSchemaField;
+
+struct DBFSchemaChangeInfo
+{
+    DBFHandle psDBF;
+
+    int nFields;
+    DBFSchemaField *pasFields;
+    int nRecordLength;
+};
+
+/* Size of the buffers the records are streamed through on commit */
+#define DBF_SCHEMA_BUFFER_SIZE (1024 * 1024)
+
+/************************************************************************/
+/*                        DBFBeginSchemaChange()                        */
+/************************************************************************/
+
+DBFSchemaChange SHPAPI_CALL DBFBeginSchemaChange(DBFHandle psDBF)
+{
+    DBFSchemaChange psChange = STATIC_CAST(
+        DBFSchemaChange, calloc(1, sizeof(struct DBFSchemaChangeInfo)));
+    if (psChange == SHPLIB_NULLPTR)
+        return SHPLIB_NULLPTR;
+
+    psChange->pasFields = STATIC_CAST(
+        DBFSchemaField *,
+        calloc(MAX(1, psDBF->nFields), sizeof(DBFSchemaField)));
+    if (psChange->pasFields == SHPLIB_NULLPTR)
+    {
+        free(psChange);
+        return SHPLIB_NULLPTR;
+    }
+
+    psChange->psDBF = psDBF;
+    psChange->nFields = psDBF->nFields;
+    psChange->nRecordLength = psDBF->nRecordLength;
+    for (int i = 0; i < psDBF->nFields; i++)
+    {
+        DBFSchemaField *psField = psChange->pasFields + i;
+        memcpy(psField->achDescriptor,
+               psDBF->pszHeader + i * XBASE_FLDHDR_SZ, XBASE_FLDHDR_SZ);
+        psField->chType = psDBF->pachFieldType[i];
+        psField->nWidth = psDBF->panFieldSize[i];
+        psField->nDecimals = psDBF->panFieldDecimals[i];
+        psField->iSourceField = i;
+        psField->chSourceType = psField->chType;
+        psField->nSourceWidth = psField->nWidth;
+    }
+
+    return psChange;
+}
+
+/************************************************************************/
+/*                        DBFSchemaSetDescriptor()                      */
+/*                                                                      */
+/*      Fill the header descriptor of a field of the new schema.        */
+/************************************************************************/
+
+static void DBFSchemaSetDescriptor(DBFSchemaField *psField,
+                                   const char *pszFieldName)
+{
+    char *pszFInfo = psField->achDescriptor;
+
+    for (int i = 0; i < XBASE_FLDHDR_SZ; i++)
+        pszFInfo[i] = '\0';
+
+    strncpy(pszFInfo, pszFieldName, XBASE_FLDNAME_LEN_WRITE);
+
+    pszFInfo[11] = psField->chType;
+
+    if (psField->chType == 'C')
+    {
+        pszFInfo[16] = STATIC_CAST(unsigned char, psField->nWidth % 256);
+        pszFInfo[17] = STATIC_CAST(unsigned char, psField->nWidth / 256);
+    }
+    else
+    {
+        pszFInfo[16] = STATIC_CAST(unsigned char, psField->nWidth);
+        pszFInfo[17] = STATIC_CAST(unsigned char, psField->nDecimals);
+    }
+}
+
+/************************************************************************/
+/*                    DBFSchemaAddNativeFieldType()                     */
+/************************************************************************/
+
+int SHPAPI_CALL DBFSchemaAddNativeFieldType(DBFSchemaChange psChange,
+                                            const char *pszFieldName,
+                                            char chType, int nWidth,
+                                            int nDecimals)
+{
+    const DBFHandle psDBF = psChange->psDBF;
+
+    if (psDBF->nHeaderLength +
+            XBASE_FLDHDR_SZ * (psChange->nFields + 1 - psDBF->nFields) >
+        65535)
+    {
+        char szMessage[128];
+        snprintf(szMessage, sizeof(szMessage),
+                 "Cannot add field %s. Header length limit reached "
+                 "(max 65535 bytes, 2046 fields).",
+                 pszFieldName);
+        psDBF->sHooks.Error(szMessage);
+        return -1;
+    }
+
+    if (nWidth < 1)
+        return -1;
+
+    if (nWidth > XBASE_FLD_MAX_WIDTH)
+        nWidth = XBASE_FLD_MAX_WIDTH;
+
+    if (psChange->nRecordLength + nWidth > 65535)
+    {
+        char szMessage[128];
+        snprintf(szMessage, sizeof(szMessage),
+                 "Cannot add field %s. Record length limit reached "
+                 "(max 65535 bytes).",
+                 pszFieldName);
+        psDBF->sHooks.Error(szMessage);
+        return -1;
+    }
+
+    DBFSchemaField *pasFields = STATIC_CAST(
+        DBFSchemaField *,
+        realloc(psChange->pasFields,
+                sizeof(DBFSchemaField) * (psChange->nFields + 1)));
+    if (pasFields == SHPLIB_NULLPTR)
+        return -1;
+    psChange->pasFields = pasFields;
+
+    DBFSchemaField *psField = pasFields + psChange->nFields;
+    memset(psField, 0, sizeof(DBFSchemaField));
+    psField->chType = chType;
+    psField->nWidth = nWidth;
+    psField->nDecimals = nDecimals;
+    psField->iSourceField = -1;
+    psField->chSourceType = chType;
+    psField->nSourceWidth = nWidth;
+    DBFSchemaSetDescriptor(psField, pszFieldName);
+
+    psChange->nRecordLength += nWidth;
+    return psChange->nFields++;
+}
+
+/************************************************************************/
+/*                        DBFSchemaDeleteField()                        */
+/************************************************************************/
+
+int SHPAPI_CALL DBFSchemaDeleteField(DBFSchemaChange psChange, int iField)
+{
+    if (iField < 0 || iField >= psChange->nFields)
+        return FALSE;
+
+    DBFSchemaField *psField = psChange->pasFields + iField;
+    psChange->nRecordLength -= psField->nWidth;
+    free(psField->pasConversions);
+
+    psChange->nFields--;
+    memmove(psField, psField + 1,
+            sizeof(DBFSchemaField) * (psChange->nFields - iField));
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                       DBFSchemaReorderFields()                       */
+/************************************************************************/
+
+int SHPAPI_CALL DBFSchemaReorderFields(DBFSchemaChange psChange,
+                                       const int *panMap)
+{
+    if (psChange->nFields == 0)
+        return TRUE;
+
+    DBFSchemaField *pasFieldsNew = STATIC_CAST(
+        DBFSchemaField *, malloc(sizeof(DBFSchemaField) * psChange->nFields));
+    unsigned char *pabyUsed =
+        STATIC_CAST(unsigned char *, calloc(psChange->nFields, 1));
+    if (pasFieldsNew == SHPLIB_NULLPTR || pabyUsed == SHPLIB_NULLPTR)
+    {
+        free(pasFieldsNew);
+        free(pabyUsed);
+        return FALSE;
+    }
+
+    /* panMap must be a permutation of the fields */
+    for (int i = 0; i < psChange->nFields; i++)
+    {
+        if (panMap[i] < 0 || panMap[i] >= psChange->nFields ||
+            pabyUsed[panMap[i]])
+        {
+            free(pasFieldsNew);
+            free(pabyUsed);
+            return FALSE;
+        }
+        pabyUsed[panMap[i]] = 1;
+        pasFieldsNew[i] = psChange->pasFields[panMap[i]];
+    }
+
+    free(psChange->pasFields);
+    psChange->pasFields = pasFieldsNew;
+    free(pabyUsed);
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                      DBFSchemaAlterFieldDefn()                       */
+/************************************************************************/
+
+int SHPAPI_CALL DBFSchemaAlterFieldDefn(DBFSchemaChange psChange, int iField,
+                                        const char *pszFieldName, char chType,
+                                        int nWidth, int nDecimals)
+{
+    if (iField < 0 || iField >= psChange->nFields)
+        return FALSE;
+
+    if (nWidth < 1)
+        return FALSE;
+
+    if (nWidth > XBASE_FLD_MAX_WIDTH)
+        nWidth = XBASE_FLD_MAX_WIDTH;
+
+    DBFSchemaField *psField = psChange->pasFields + iField;
+    if (psChange->nRecordLength + nWidth - psField->nWidth > 65535)
+    {
+        char szMessage[128];
+        snprintf(szMessage, sizeof(szMessage),
+                 "Cannot alter field %s. Record length limit reached "
+                 "(max 65535 bytes).",
+                 pszFieldName);
+        psChange->psDBF->sHooks.Error(szMessage);
+        return FALSE;
+    }
+
+    /* -------------------------------------------------------------------- */
+    /*      Values are only rewritten when the type or width changes.      */
+    /* -------------------------------------------------------------------- */
+    if (chType != psField->chType || nWidth != psField->nWidth)
+    {
+        DBFSchemaConversion *pasConversions = STATIC_CAST(
+            DBFSchemaConversion *,
+            realloc(psField->pasConversions, sizeof(DBFSchemaConversion) *
+                                                 (psField->nConversions + 1)));
+        if (pasConversions == SHPLIB_NULLPTR)
+            return FALSE;
+        psField->pasConversions = pasConversions;
+        pasConversions[psField->nConversions].chType = chType;
+        pasConversions[psField->nConversions].nWidth = nWidth;
+        psField->nConversions++;
+    }
+
+    psChange->nRecordLength += nWidth - psField->nWidth;
+    psField->chType = chType;
+    psField->nWidth = nWidth;
+    psField->nDecimals = nDecimals;
+    DBFSchemaSetDescriptor(psField, pszFieldName);
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                        DBFAbortSchemaChange()                        */
+/************************************************************************/
+
+void SHPAPI_CALL DBFAbortSchemaChange(DBFSchemaChange psChange)
+{
+    if (psChange == SHPLIB_NULLPTR)
+        return;
+
+    for (int i = 0; i < psChange->nFields; i++)
+        free(psChange->pasFields[i].pasConversions);
+    free(psChange->pasFields);
+    free(psChange);
+}
+
+/************************************************************************/
+/*                       DBFSchemaConvertValue()                        */
+/*                                                                      */
+/*      Convert a field value, NUL terminated in pszOld, to a new type  */
+/*      and width the way DBFAlterFieldDefn() does.                     */
+/************************************************************************/
+
+static void DBFSchemaConvertValue(char chOldType, int nOldWidth,
+                                  const char *pszOld, char chType, int nWidth,
+                                  char *pszNew)
+{
+    if (DBFIsValueNULL(chOldType, pszOld))
+    {
+        memset(pszNew, DBFGetNullCharacter(chType), nWidth);
+    }
+    else if (nWidth < nOldWidth)
+    {
+        /* Strip leading spaces when truncating a numeric field */
+        if ((chOldType == 'N' || chOldType == 'F' || chOldType == 'D') &&
+            pszOld[0] == ' ')
+            memcpy(pszNew, pszOld + nOldWidth - nWidth, nWidth);
+        else
+            memcpy(pszNew, pszOld, nWidth);
+    }
+    else if (nWidth > nOldWidth)
+    {
+        if (chOldType == 'N' || chOldType == 'F')
+        {
+            /* Add leading spaces when expanding a numeric field */
+            memset(pszNew, ' ', nWidth - nOldWidth);
+            memcpy(pszNew + nWidth - nOldWidth, pszOld, nOldWidth);
+        }
+        else
+        {
+            /* Add trailing spaces */
+            memcpy(pszNew, pszOld, nOldWidth);
+            memset(pszNew + nOldWidth, ' ', nWidth - nOldWidth);
+        }
+    }
+    else
+    {
+        memcpy(pszNew, pszOld, nWidth);
+    }
+    pszNew[nWidth] = '\0';
+}
+
+/************************************************************************/
+/*                       DBFSchemaConvertRecord()                       */
+/*                                                                      */
+/*      Build a record of the new schema from one of the table.         */
+/************************************************************************/
+
+static void DBFSchemaConvertRecord(const DBFSchemaChange psChange,
+                                   const char *pachRecord, char *pachNew)
+{
+    const DBFHandle psDBF = psChange->psDBF;
+    char aszValue[2][XBASE_FLD_MAX_WIDTH + 1];
+
+    /* deletion flag */
+    pachNew[0] = pachRecord[0];
+    int nOffset = 1;
+
+    for (int i = 0; i < psChange->nFields; i++)
+    {
+        const DBFSchemaField *psField = psChange->pasFields + i;
+        if (psField->nConversions == 0)
+        {
+            if (psField->iSourceField < 0)
+                memset(pachNew + nOffset, DBFGetNullCharacter(psField->chType),
+                       psField->nWidth);
+            else
+                memcpy(pachNew + nOffset,
+                       pachRecord +
+                           psDBF->panFieldOffset[psField->iSourceField],
+                       psField->nWidth);
+            nOffset += psField->nWidth;
+            continue;
+        }
+
+        char *pszValue = aszValue[0];
+        if (psField->iSourceField < 0)
+            memset(pszValue, DBFGetNullCharacter(psField->chSourceType),
+                   psField->nSourceWidth);
+        else
+            memcpy(pszValue,
+                   pachRecord + psDBF->panFieldOffset[psField->iSourceField],
+                   psField->nSourceWidth);
+        pszValue[psField->nSourceWidth] = '\0';
+
+        char chType = psField->chSourceType;
+        int nWidth = psField->nSourceWidth;
+        for (int j = 0; j < psField->nConversions; j++)
+        {
+            const DBFSchemaConversion *psConversion =
+                psField->pasConversions + j;
+            char *pszNewValue =
+                pszValue == aszValue[0] ? aszValue[1] : aszValue[0];
+            DBFSchemaConvertValue(chType, nWidth, pszValue,
+                                  psConversion->chType, psConversion->nWidth,
+                                  pszNewValue);
+            pszValue = pszNewValue;
+            chType = psConversion->chType;
+            nWidth = psConversion->nWidth;
+        }
+
+        memcpy(pachNew + nOffset, pszValue, psField->nWidth);
+        nOffset += psField->nWidth;
+    }
+}
+
+/************************************************************************/
+/*                        DBFSchemaMoveRecords()                        */
+/*                                                                      */
+/*      Rewrite the records iFirst to iLast - 1 with the new schema,    */
+/*      in chunks of nChunkRecords, from the last chunk to the first    */
+/*      if bBackward.                                                   */
+/************************************************************************/
+
+static bool DBFSchemaMoveRecords(const DBFSchemaChange psChange,
+                                 int nNewHeaderLength, int iFirst, int iLast,
+                                 bool bBackward, int nChunkRecords,
+                                 char *pachOld, char *pachNew)
+{
+    const DBFHandle psDBF = psChange->psDBF;
+    const int nOldLength = psDBF->nRecordLength;
+    const int nNewLength = psChange->nRecordLength;
+    const int nChunks = (iLast - iFirst + nChunkRecords - 1) / nChunkRecords;
+
+    for (int iChunk = 0; iChunk < nChunks; iChunk++)
+    {
+        const int iChunkIndex = bBackward ? nChunks - 1 - iChunk : iChunk;
+        const int iStart = iFirst + iChunkIndex * nChunkRecords;
+        const int nCount = MIN(nChunkRecords, iLast - iStart);
+
+        const SAOffset nOldOffset =
+            nOldLength * STATIC_CAST(SAOffset, iStart) + psDBF->nHeaderLength;
+        const SAOffset nOldSize = nOldLength * STATIC_CAST(SAOffset, nCount);
+        if (SAReadAt(&psDBF->sHooks, psDBF->fp, nOldOffset, pachOld,
+                     nOldSize) != nOldSize)
+        {
+            psDBF->sHooks.Error("Failure reading .dbf records.");
+            return false;
+        }
+
+        for (int i = 0; i < nCount; i++)
+            DBFSchemaConvertRecord(psChange, pachOld + i * nOldLength,
+                                   pachNew + i * nNewLength);
+
+        const SAOffset nNewOffset =
+            nNewLength * STATIC_CAST(SAOffset, iStart) + nNewHeaderLength;
+        const SAOffset nNewSize = nNewLength * STATIC_CAST(SAOffset, nCount);
+        if (psDBF->sHooks.FSeek(psDBF->fp, nNewOffset, 0) != 0 ||
+            psDBF->sHooks.FWrite(pachNew, nNewSize, 1, psDBF->fp) != 1)
+        {
+            psDBF->sHooks.Error("Failure writing .dbf records.");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/************************************************************************/
+/*                       DBFSchemaRewriteRecords()                      */
+/*                                                                      */
+/*      Rewrite all the records in place in one pass. A record moves    */
+/*      by nHeaderDelta + iRecord * nRecordDelta bytes, a linear        */
+/*      function of its index: the records moving towards the end of   */
+/*      the file are processed first and backwards, so that they do    */
+/*      not overwrite records not read yet, then the others forwards.   */
+/************************************************************************/
+
+static bool DBFSchemaRewriteRecords(const DBFSchemaChange psChange,
+                                    int nNewHeaderLength)
+{
+    const DBFHandle psDBF = psChange->psDBF;
+    const int nRecords = psDBF->nRecords;
+    const int nHeaderDelta = nNewHeaderLength - psDBF->nHeaderLength;
+    const int nRecordDelta = psChange->nRecordLength - psDBF->nRecordLength;
+
+    /* -------------------------------------------------------------------- */
+    /*      Find the records [iUpFirst, iUpLast) moving forwards.           */
+    /* -------------------------------------------------------------------- */
+    int iUpFirst = 0;
+    int iUpLast = 0;
+    if (nRecordDelta == 0)
+    {
+        if (nHeaderDelta > 0)
+            iUpLast = nRecords;
+    }
+    else if (nRecordDelta < 0)
+    {
+        /* up to the first record with nHeaderDelta + i * nRecordDelta <= 0 */
+        if (nHeaderDelta > 0)
+            iUpLast = MIN(nRecords,
+                          (nHeaderDelta - nRecordDelta - 1) / -nRecordDelta);
+    }
+    else
+    {
+        /* from the first record with nHeaderDelta + i * nRecordDelta > 0 */
+        if (nHeaderDelta <= 0)
+            iUpFirst = MIN(nRecords, -nHeaderDelta / nRecordDelta + 1);
+        iUpLast = nRecords;
+    }
+
+    const int nMaxLength = MAX(psDBF->nRecordLength, psChange->nRecordLength);
+    const int nChunkRecords = MAX(1, DBF_SCHEMA_BUFFER_SIZE / nMaxLength);
+    char *pachOld = STATIC_CAST(
+        char *, malloc(STATIC_CAST(size_t, nChunkRecords) *
+                       psDBF->nRecordLength));
+    char *pachNew = STATIC_CAST(
+        char *, malloc(STATIC_CAST(size_t, nChunkRecords) *
+                       psChange->nRecordLength));
+    if (pachOld == SHPLIB_NULLPTR || pachNew == SHPLIB_NULLPTR)
+    {
+        psDBF->sHooks.Error("Out of memory rewriting .dbf records.");
+        free(pachOld);
+        free(pachNew);
+        return false;
+    }
+
+    bool bRet = DBFSchemaMoveRecords(psChange, nNewHeaderLength, iUpFirst,
+                                     iUpLast, true, nChunkRecords, pachOld,
+                                     pachNew);
+    if (bRet && iUpFirst > 0)
+        bRet = DBFSchemaMoveRecords(psChange, nNewHeaderLength, 0, iUpFirst,
+                                    false, nChunkRecords, pachOld, pachNew);
+    if (bRet && iUpLast < nRecords)
+        bRet = DBFSchemaMoveRecords(psChange, nNewHeaderLength, iUpLast,
+                                    nRecords, false, nChunkRecords, pachOld,
+                                    pachNew);
+
+    free(pachOld);
+    free(pachNew);
+
+    if (bRet && psDBF->bWriteEndOfFileChar)
+    {
+        char ch = END_OF_FILE_CHARACTER;
+        const SAOffset nEOFOffset =
+            psChange->nRecordLength * STATIC_CAST(SAOffset, nRecords) +
+            nNewHeaderLength;
+
+        psDBF->sHooks.FSeek(psDBF->fp, nEOFOffset, 0);
+        psDBF->sHooks.FWrite(&ch, 1, 1, psDBF->fp);
+    }
+
+    /* The file is not truncated when the records shrink: the bytes past */
+    /* the end of the new records remain, as with DBFDeleteField() */
+
+    return bRet;
+}
+
+/************************************************************************/
+/*                       DBFCommitSchemaChange()                        */
+/************************************************************************/
+
+int SHPAPI_CALL DBFCommitSchemaChange(DBFSchemaChange psChange)
+{
+    const DBFHandle psDBF = psChange->psDBF;
+
+    /* make sure that everything is written in .dbf */
+    if (!DBFFlushRecord(psDBF))
+    {
+        DBFAbortSchemaChange(psChange);
+        return FALSE;
+    }
+
+    DBFResetFieldIndex(psDBF);
+
+    /* -------------------------------------------------------------------- */
+    /*      Build the new field information.                                */
+    /* -------------------------------------------------------------------- */
+    const int nFields = psChange->nFields;
+    const size_t nAlloc = MAX(1, nFields);
+    int *panFieldOffsetNew = STATIC_CAST(int *, malloc(sizeof(int) * nAlloc));
+    int *panFieldSizeNew = STATIC_CAST(int *, malloc(sizeof(int) * nAlloc));
+    int *panFieldDecimalsNew = STATIC_CAST(int *, malloc(sizeof(int) * nAlloc));
+    char *pachFieldTypeNew = STATIC_CAST(char *, malloc(nAlloc));
+    char *pszHeaderNew = STATIC_CAST(char *, malloc(XBASE_FLDHDR_SZ * nAlloc));
+    char *pszCurrentRecordNew = STATIC_CAST(
+        char *, realloc(psDBF->pszCurrentRecord,
+                        MAX(psDBF->nRecordLength, psChange->nRecordLength)));
+    if (pszCurrentRecordNew != SHPLIB_NULLPTR)
+        psDBF->pszCurrentRecord = pszCurrentRecordNew;
+    if (panFieldOffsetNew == SHPLIB_NULLPTR ||
+        panFieldSizeNew == SHPLIB_NULLPTR ||
+        panFieldDecimalsNew == SHPLIB_NULLPTR ||
+        pachFieldTypeNew == SHPLIB_NULLPTR || pszHeaderNew == SHPLIB_NULLPTR ||
+        pszCurrentRecordNew == SHPLIB_NULLPTR)
+    {
+        psDBF->sHooks.Error("Out of memory changing .dbf fields.");
+        free(panFieldOffsetNew);
+        free(panFieldSizeNew);
+        free(panFieldDecimalsNew);
+        free(pachFieldTypeNew);
+        free(pszHeaderNew);
+        DBFAbortSchemaChange(psChange);
+        return FALSE;
+    }
+
+    int nOffset = 1;
+    for (int i = 0; i < nFields; i++)
+    {
+        const DBFSchemaField *psField = psChange->pasFields + i;
+        panFieldOffsetNew[i] = nOffset;
+        panFieldSizeNew[i] = psField->nWidth;
+        panFieldDecimalsNew[i] = psField->nDecimals;
+        pachFieldTypeNew[i] = psField->chType;
+        memcpy(pszHeaderNew + i * XBASE_FLDHDR_SZ, psField->achDescriptor,
+               XBASE_FLDHDR_SZ);
+        nOffset += psField->nWidth;
+    }
+
+    const int nNewHeaderLength =
+        psDBF->nHeaderLength + XBASE_FLDHDR_SZ * (nFields - psDBF->nFields);
+
+    /* -------------------------------------------------------------------- */
+    /*      Rewrite the records of an existing .dbf, with the old field     */
+    /*      information still in place.                                    */
+    /* -------------------------------------------------------------------- */
+    bool bRet = true;
+    if (!(psDBF->bNoHeader && psDBF->nRecords == 0))
+        bRet = DBFSchemaRewriteRecords(psChange, nNewHeaderLength);
+
+    psDBF->nCurrentRecord = -1;
+    psDBF->pszMappedRecord = SHPLIB_NULLPTR;
+    DBFDiscardReadAhead(psDBF);
+    psDBF->bCurrentRecordModified = FALSE;
+
+    /* -------------------------------------------------------------------- */
+    /*      Keep the old field information and header on failure, the      */
+    /*      records being partly rewritten.                                 */
+    /* -------------------------------------------------------------------- */
+    if (!bRet)
+    {
+        psDBF->sHooks.Error("Failure rewriting .dbf records: the records "
+                            "no longer match the .dbf header.");
+        free(panFieldOffsetNew);
+        free(panFieldSizeNew);
+        free(panFieldDecimalsNew);
+        free(pachFieldTypeNew);
+        free(pszHeaderNew);
+        DBFAbortSchemaChange(psChange);
+        return FALSE;
+    }
+
+    free(psDBF->panFieldOffset);
+    free(psDBF->panFieldSize);
+    free(psDBF->panFieldDecimals);
+    free(psDBF->pachFieldType);
+    free(psDBF->pszHeader);
+
+    psDBF->nFields = nFields;
+    psDBF->panFieldOffset = panFieldOffsetNew;
+    psDBF->panFieldSize = panFieldSizeNew;
+    psDBF->panFieldDecimals = panFieldDecimalsNew;
+    psDBF->pachFieldType = pachFieldTypeNew;
+    psDBF->pszHeader = pszHeaderNew;
+    psDBF->nHeaderLength = nNewHeaderLength;
+    psDBF->nRecordLength = psChange->nRecordLength;
+
+    DBFAbortSchemaChange(psChange);
+
+    /* force update of header with new header and record length */
+    psDBF->bNoHeader = TRUE;
+    DBFUpdateHeader(psDBF);
+
+    psDBF->bUpdated = TRUE;
+
+    return TRUE;
+}
+
 /************************************************************************/
 /*                    DBFSetWriteEndOfFileChar()                        */
 /************************************************************************/
@@ -12,7 +12,12 @@
  *
  */
 
-#include "shapefil.h"
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+/* for fallocate() */
+#define _GNU_SOURCE
+#endif
+
+#include "shapefil_private.h"
 
 #include <assert.h>
 #include <math.h>
@@ -21,6 +26,26 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if !defined(SHPAPI_WINDOWS) && (defined(__unix__) || defined(__APPLE__))
+#define SA_HAVE_MMAP
+#define SA_HAVE_PREAD
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#define SA_HAVE_FALLOCATE
+#include <fcntl.h>
+#endif
+
+#if defined(SA_HAVE_PREAD) && defined(__GLIBC__)
+/* for __fpending() */
+#define SA_HAVE_FPENDING
+#include <stdio_ext.h>
+#endif
+
 #ifdef SHPAPI_UTF8_HOOKS
 #ifdef SHPAPI_WINDOWS
 #define WIN32_LEAN_AND_MEAN
@@ -87,6 +112,73 @@ static void SADError(const char *message)
     fprintf(stderr, "%s\n", message);
 }
 
+#ifdef SA_HAVE_PREAD
+
+/************************************************************************/
+/*                            SAPReadFile()                             */
+/*                                                                      */
+/*      Positional read on the descriptor behind a stdio stream.        */
+/*      Pending buffered writes are flushed first so they are seen      */
+/*      by pread(). Where stdio cannot tell whether writes are          */
+/*      pending, the stream is always flushed, which on a stream last   */
+/*      read from drops its read buffer and costs a lseek(). The        */
+/*      stream position is left untouched.                              */
+/************************************************************************/
+
+static SAOffset SAPReadFile(FILE *fp, SAOffset offset, void *p, SAOffset size)
+{
+#ifdef SA_HAVE_FPENDING
+    if (__fpending(fp) != 0 && fflush(fp) != 0)
+        return 0;
+#else
+    if (fflush(fp) != 0)
+        return 0;
+#endif
+
+    const int fd = fileno(fp);
+    SAOffset nDone = 0;
+    while (nDone < size)
+    {
+        const ssize_t nRead =
+            pread(fd, (char *)p + nDone, (size_t)(size - nDone),
+                  (off_t)(offset + nDone));
+        if (nRead < 0 && errno == EINTR)
+            continue;
+        if (nRead <= 0)
+            break;
+        nDone += (SAOffset)nRead;
+    }
+    return nDone;
+}
+
+static SAOffset SADFReadAt(SAFile file, SAOffset offset, void *p, SAOffset size)
+{
+    return SAPReadFile((FILE *)file, offset, p, size);
+}
+
+#endif /* def SA_HAVE_PREAD */
+
+#ifdef SA_HAVE_FALLOCATE
+
+/************************************************************************/
+/*                          SAReserveFile()                             */
+/*                                                                      */
+/*      Allocate the blocks of a file up front, which limits its        */
+/*      fragmentation when it is then written by small appends.         */
+/************************************************************************/
+
+static int SAReserveFile(FILE *fp, SAOffset nSize)
+{
+    return fallocate(fileno(fp), FALLOC_FL_KEEP_SIZE, 0, (off_t)nSize);
+}
+
+static int SADFReserve(SAFile file, SAOffset nSize)
+{
+    return SAReserveFile((FILE *)file, nSize);
+}
+
+#endif /* def SA_HAVE_FALLOCATE */
+
 void SASetupDefaultHooks(SAHooks *psHooks)
 {
     psHooks->FOpen = SADFOpen;
@@ -101,6 +193,250 @@ void SASetupDefaultHooks(SAHooks *psHooks)
     psHooks->Error = SADError;
     psHooks->Atof = atof;
     psHooks->pvUserData = NULL;
+    psHooks->FGetMapping = NULL;
+#ifdef SA_HAVE_PREAD
+    psHooks->FReadAt = SADFReadAt;
+#else
+    psHooks->FReadAt = NULL;
+#endif
+#ifdef SA_HAVE_FALLOCATE
+    psHooks->FReserve = SADFReserve;
+#else
+    psHooks->FReserve = NULL;
+#endif
+}
+
+#ifdef SA_HAVE_MMAP
+
+/************************************************************************/
+/*                            SAMmapFile                                */
+/*                                                                      */
+/*      Files opened read-only are mapped in memory and all reads       */
+/*      are served from the mapping. Other files are handled through    */
+/*      stdio like with the default hooks.                              */
+/************************************************************************/
+
+/* Offsets with their top bit set are negative when SAOffset is defined */
+/* as a signed type, or wrapped around negative values otherwise */
+#define SA_IS_NEGATIVE_OFFSET(n)                                               \
+    (((n) >> (sizeof(SAOffset) * CHAR_BIT - 1)) != 0)
+
+typedef struct
+{
+    FILE *fp;
+    unsigned char *pabyData;
+    SAOffset nSize;
+    SAOffset nOffset;
+} SAMmapFile;
+
+static SAFile SAMFOpen(const char *pszFilename, const char *pszAccess,
+                       void *pvUserData)
+{
+    (void)pvUserData;
+    FILE *fp = fopen(pszFilename, pszAccess);
+    if (fp == NULL)
+        return NULL;
+
+    SAMmapFile *psFile = (SAMmapFile *)calloc(1, sizeof(SAMmapFile));
+    if (psFile == NULL)
+    {
+        fclose(fp);
+        return NULL;
+    }
+    psFile->fp = fp;
+
+    struct stat sStat;
+    if (pszAccess[0] == 'r' && strchr(pszAccess, '+') == NULL &&
+        fstat(fileno(fp), &sStat) == 0 && sStat.st_size > 0 &&
+        (unsigned long long)sStat.st_size <= (size_t)-1)
+    {
+        void *pData = mmap(NULL, (size_t)sStat.st_size, PROT_READ, MAP_SHARED,
+                           fileno(fp), 0);
+        if (pData != MAP_FAILED)
+        {
+            psFile->pabyData = (unsigned char *)pData;
+            psFile->nSize = (SAOffset)sStat.st_size;
+            /* The mapping stays valid once the descriptor is closed */
+            fclose(fp);
+            psFile->fp = NULL;
+        }
+    }
+
+    return (SAFile)psFile;
+}
+
+static SAOffset SAMFRead(void *p, SAOffset size, SAOffset nmemb, SAFile file)
+{
+    SAMmapFile *psFile = (SAMmapFile *)file;
+    if (psFile->pabyData == NULL)
+        return (SAOffset)fread(p, (size_t)size, (size_t)nmemb, psFile->fp);
+
+    if (size == 0 || psFile->nOffset >= psFile->nSize)
+        return 0;
+
+    SAOffset nBytes = size * nmemb;
+    if (nBytes > psFile->nSize - psFile->nOffset)
+        nBytes = psFile->nSize - psFile->nOffset;
+    memcpy(p, psFile->pabyData + psFile->nOffset, (size_t)nBytes);
+    psFile->nOffset += nBytes;
+    return nBytes / size;
+}
+
+static SAOffset SAMFWrite(const void *p, SAOffset size, SAOffset nmemb,
+                          SAFile file)
+{
+    SAMmapFile *psFile = (SAMmapFile *)file;
+    if (psFile->pabyData != NULL)
+        return 0;
+    return (SAOffset)fwrite(p, (size_t)size, (size_t)nmemb, psFile->fp);
+}
+
+static SAOffset SAMFSeek(SAFile file, SAOffset offset, int whence)
+{
+    SAMmapFile *psFile = (SAMmapFile *)file;
+    if (psFile->pabyData == NULL)
+        return SADFSeek((SAFile)psFile->fp, offset, whence);
+
+    SAOffset nNewOffset;
+    if (whence == SEEK_SET)
+        nNewOffset = offset;
+    else if (whence == SEEK_CUR)
+        nNewOffset = psFile->nOffset + offset;
+    else if (whence == SEEK_END)
+        nNewOffset = psFile->nSize + offset;
+    else
+        return (SAOffset)-1;
+    if (SA_IS_NEGATIVE_OFFSET(nNewOffset))
+        return (SAOffset)-1;
+    psFile->nOffset = nNewOffset;
+    return 0;
+}
+
+static SAOffset SAMFTell(SAFile file)
+{
+    SAMmapFile *psFile = (SAMmapFile *)file;
+    if (psFile->pabyData == NULL)
+        return SADFTell((SAFile)psFile->fp);
+    return psFile->nOffset;
+}
+
+static int SAMFFlush(SAFile file)
+{
+    SAMmapFile *psFile = (SAMmapFile *)file;
+    if (psFile->pabyData == NULL)
+        return fflush(psFile->fp);
+    return 0;
+}
+
+static int SAMFClose(SAFile file)
+{
+    SAMmapFile *psFile = (SAMmapFile *)file;
+    int nRet = 0;
+    if (psFile->pabyData != NULL)
+        nRet = munmap(psFile->pabyData, (size_t)psFile->nSize);
+    if (psFile->fp != NULL)
+        nRet = fclose(psFile->fp);
+    free(psFile);
+    return nRet;
+}
+
+static const void *SAMFGetMapping(SAFile file, SAOffset *pnSize)
+{
+    const SAMmapFile *psFile = (const SAMmapFile *)file;
+    if (pnSize != NULL)
+        *pnSize = psFile->pabyData != NULL ? psFile->nSize : 0;
+    return psFile->pabyData;
+}
+
+static SAOffset SAMFReadAt(SAFile file, SAOffset offset, void *p, SAOffset size)
+{
+    const SAMmapFile *psFile = (const SAMmapFile *)file;
+    if (psFile->pabyData == NULL)
+        return SAPReadFile(psFile->fp, offset, p, size);
+
+    if (SA_IS_NEGATIVE_OFFSET(offset) || offset >= psFile->nSize)
+        return 0;
+    if (size > psFile->nSize - offset)
+        size = psFile->nSize - offset;
+    memcpy(p, psFile->pabyData + offset, (size_t)size);
+    return size;
+}
+
+#ifdef SA_HAVE_FALLOCATE
+static int SAMFReserve(SAFile file, SAOffset nSize)
+{
+    const SAMmapFile *psFile = (const SAMmapFile *)file;
+    if (psFile->fp == NULL)
+        return -1;
+    return SAReserveFile(psFile->fp, nSize);
+}
+#endif
+
+#endif /* def SA_HAVE_MMAP */
+
+/************************************************************************/
+/*                          SASetupMmapHooks()                          */
+/************************************************************************/
+
+void SASetupMmapHooks(SAHooks *psHooks)
+{
+    SASetupDefaultHooks(psHooks);
+
+#ifdef SA_HAVE_MMAP
+    psHooks->FOpen = SAMFOpen;
+    psHooks->FRead = SAMFRead;
+    psHooks->FWrite = SAMFWrite;
+    psHooks->FSeek = SAMFSeek;
+    psHooks->FTell = SAMFTell;
+    psHooks->FFlush = SAMFFlush;
+    psHooks->FClose = SAMFClose;
+    psHooks->FGetMapping = SAMFGetMapping;
+    psHooks->FReadAt = SAMFReadAt;
+#ifdef SA_HAVE_FALLOCATE
+    psHooks->FReserve = SAMFReserve;
+#endif
+#endif
+}
+
+/************************************************************************/
+/*                            SACopyHooks()                             */
+/*                                                                      */
+/*      Copy the hooks of an application into those of a handle. The    */
+/*      optional hooks set by SASetupDefaultHooks() and                 */
+/*      SASetupMmapHooks() only work on the files opened by their own   */
+/*      FOpen(): they are dropped when FOpen() has been overridden,     */
+/*      typically to use another file handle type.                      */
+/************************************************************************/
+
+void SACopyHooks(SAHooks *psDest, const SAHooks *psSource)
+{
+    memcpy(psDest, psSource, sizeof(SAHooks));
+
+    if (psDest->FOpen != SADFOpen)
+    {
+#ifdef SA_HAVE_PREAD
+        if (psDest->FReadAt == SADFReadAt)
+            psDest->FReadAt = NULL;
+#endif
+#ifdef SA_HAVE_FALLOCATE
+        if (psDest->FReserve == SADFReserve)
+            psDest->FReserve = NULL;
+#endif
+    }
+
+#ifdef SA_HAVE_MMAP
+    if (psDest->FOpen != SAMFOpen)
+    {
+        if (psDest->FGetMapping == SAMFGetMapping)
+            psDest->FGetMapping = NULL;
+        if (psDest->FReadAt == SAMFReadAt)
+            psDest->FReadAt = NULL;
+#ifdef SA_HAVE_FALLOCATE
+        if (psDest->FReserve == SAMFReserve)
+            psDest->FReserve = NULL;
+#endif
+    }
+#endif
 }
 
 #ifdef SHPAPI_WINDOWS
@@ -181,5 +517,8 @@ void SASetupUtf8Hooks(SAHooks *psHooks)
 
     psHooks->Error = SADError;
     psHooks->Atof = atof;
+    psHooks->FGetMapping = NULL;
+    psHooks->FReadAt = NULL;
+    psHooks->FReserve = NULL;
 }
 #endif
@@ -147,11 +147,44 @@ extern "C"
         int (*Remove)(const char *filename, void *pvUserData);
 
         void (*Error)(const char *message);
+        /* Parses the numeric .dbf values. When left to atof(), the plain */
+        /* values are parsed by an exact equivalent instead. */
         double (*Atof)(const char *str);
         void *pvUserData;
+
+        /* The following hooks were added in the version 5 of the library */
+        /* ABI. Applications filling SAHooks member by member rather than */
+        /* through SASetupDefaultHooks() must set them, to NULL if unused. */
+
+        /* Optional (may be NULL). Returns a pointer to a read-only memory */
+        /* mapping of the whole file and sets *pnSize to its size, or      */
+        /* returns NULL if the file is not mapped. The mapping must remain */
+        /* valid until FClose() is called on the file. */
+        const void *(*FGetMapping)(SAFile file, SAOffset *pnSize);
+
+        /* Optional (may be NULL). Reads size bytes at offset without     */
+        /* moving the file position, and returns the number of bytes     */
+        /* read. Must see data previously written through FWrite(). When */
+        /* NULL, FSeek() followed by FRead() is used instead. */
+        /* The FReadAt(), FReserve() and FGetMapping() set by */
+        /* SASetupDefaultHooks() and SASetupMmapHooks() are ignored when */
+        /* FOpen() is overridden. */
+        SAOffset (*FReadAt)(SAFile file, SAOffset offset, void *p,
+                            SAOffset size);
+
+        /* Optional (may be NULL). Allocates the storage of the first nSize */
+        /* bytes of a file about to be written, without changing its size */
+        /* (storage past the final size may remain allocated). Returns 0 */
+        /* on success. */
+        int (*FReserve)(SAFile file, SAOffset nSize);
     } SAHooks;
 
     void SHPAPI_CALL SASetupDefaultHooks(SAHooks *psHooks);
+
+    /* Same as SASetupDefaultHooks(), except that files opened in read-only */
+    /* mode are memory mapped when the platform supports it, so that */
+    /* shapes and records can be decoded directly from the mapping. */
+    void SHPAPI_CALL SASetupMmapHooks(SAHooks *psHooks);
 #ifdef SHPAPI_UTF8_HOOKS
     void SHPAPI_CALL SASetupUtf8Hooks(SAHooks *psHooks);
 #endif
@@ -189,6 +222,19 @@ extern "C"
         unsigned char *pabyObjectBuf;
         int nObjectBufSize;
         SHPObject *psCachedObject;
+
+        unsigned char *pabyWriteBuf; /* see SHPSetWriteBufferSize() */
+        int nWriteBufSize;
+        int nWriteBufUsed;
+
+        char *pszSHXFilename;
+
+        /* In large file mode (see SHPSetLargeFileMode()), nFileSize and */
+        /* panRecOffset saturate at UINT_MAX and the actual values are */
+        /* nFileSize64 and panRecOffset64 */
+        int bLargeFile;
+        SAOffset nFileSize64;
+        SAOffset *panRecOffset64;
     } SHPInfo;
 
     typedef SHPInfo *SHPHandle;
@@ -264,6 +310,47 @@ extern "C"
         int bFastModeReadObject;
     };
 
+    /* -------------------------------------------------------------------- */
+    /*      SHPObjectView - read-only view of one shape, pointing into      */
+    /*      the record buffer (or file mapping) of the SHPHandle rather     */
+    /*      than owning decoded arrays.  It is filled by                    */
+    /*      SHPReadObjectView() and remains valid until the next read on    */
+    /*      the same handle.                                                */
+    /*                                                                      */
+    /*      The pointer members are not aligned and address the on-disk     */
+    /*      little endian encoding: pabyPartStart/pabyPartType hold         */
+    /*      nParts int32 values, pabyXY holds nVertices interleaved X,Y     */
+    /*      double pairs, pabyZ and pabyM hold nVertices doubles each (or   */
+    /*      are NULL when the shape has no Z or M values).                  */
+    /* -------------------------------------------------------------------- */
+    typedef struct
+    {
+        int nSHPType;
+
+        int nShapeId;
+
+        int nParts;
+        const unsigned char *pabyPartStart;
+        const unsigned char *pabyPartType; /* NULL unless SHPT_MULTIPATCH */
+
+        int nVertices;
+        const unsigned char *pabyXY;
+        const unsigned char *pabyZ;
+        const unsigned char *pabyM;
+
+        double dfXMin;
+        double dfYMin;
+        double dfZMin;
+        double dfMMin;
+
+        double dfXMax;
+        double dfYMax;
+        double dfZMax;
+        double dfMMax;
+
+        int bMeasureIsUsed;
+    } SHPObjectView;
+
     /* -------------------------------------------------------------------- */
     /*      SHP API Prototypes                                              */
     /* -------------------------------------------------------------------- */
@@ -283,12 +370,59 @@ extern "C"
                                   const char *pszAccess,
                                   const SAHooks *psHooks);
 
+    /* Called by SHPRestoreSHXEx() with the fraction of the .shp scanned. */
+    /* Returning FALSE interrupts the restore. */
+    typedef int (*SHPProgressCallback)(double dfComplete, void *pUserData);
+    /* Called by SHPRestoreSHXEx() for each record with its X/Y bounds as */
+    /* (xmin, ymin, xmax, ymax), all zero for null shapes. */
+    typedef void (*SHPRecordBoundsCallback)(int iShape,
+                                            const double *padfBounds,
+                                            void *pUserData);
+
+    /* Same as SHPRestoreSHX(), in a single buffered scan of the .shp. */
+    /* pfnProgress and pfnBounds may be NULL. */
+    int SHPAPI_CALL SHPRestoreSHXEx(const char *pszShapeFile,
+                                    const SAHooks *psHooks,
+                                    SHPProgressCallback pfnProgress,
+                                    SHPRecordBoundsCallback pfnBounds,
+                                    void *pUserData);
+
+    /* Rewrite the .shp with its records stored contiguously in record */
+    /* order, reclaiming the space left by rewritten records, and */
+    /* regenerate the .shx. Returns TRUE on success. */
+    int SHPAPI_CALL SHPCompact(const char *pszShapeFile);
+    int SHPAPI_CALL SHPCompactLL(const char *pszShapeFile,
+                                 const SAHooks *psHooks);
+
     /* If setting bFastMode = TRUE, the content of SHPReadObject() is owned by the SHPHandle. */
     /* So you cannot have 2 valid instances of SHPReadObject() simultaneously. */
     /* The SHPObject padfZ and padfM members may be NULL depending on the geometry */
     /* type. It is illegal to free at hand any of the pointer members of the SHPObject structure */
     void SHPAPI_CALL SHPSetFastModeReadObject(SHPHandle hSHP, int bFastMode);
 
+    /* Accumulate the records appended by SHPWriteObject() in a buffer of */
+    /* nBufferSize bytes that is written out in one I/O when full, before */
+    /* any read or rewrite, and by SHPWriteHeader() and SHPClose(). A size */
+    /* of 0 flushes and disables the buffer. Returns TRUE on success. */
+    int SHPAPI_CALL SHPSetWriteBufferSize(SHPHandle hSHP, int nBufferSize);
+
+    /* Size the record index for nRecords shapes, and allocate the storage */
+    /* of the .shx up front when the hooks allow it. Returns TRUE on */
+    /* success. */
+    int SHPAPI_CALL SHPReserveRecords(SHPHandle hSHP, int nRecords);
+
+    /* Keep the record offsets on 64 bits, so that the .shp can grow over */
+    /* 4 GB. When they overflow the 32 bit .shx fields, the offsets are */
+    /* also written to a .shx64 index next to the .shx, that is read by */
+    /* SHPOpen() with a 'x' in its access string. SHPCompact() and */
+    /* SHPRestoreSHX() write or remove it as well. Requires a 64 bit */
+    /* SAOffset. Returns TRUE on success. */
+    int SHPAPI_CALL SHPSetLargeFileMode(SHPHandle hSHP, int bLargeFile);
+
+    /* Number of bytes of the .shp not used by any record, that */
+    /* SHPCompact() would reclaim. */
+    SAOffset SHPAPI_CALL SHPGetWastedBytes(SHPHandle hSHP);
+
     SHPHandle SHPAPI_CALL SHPCreate(const char *pszShapeFile, int nShapeType);
     SHPHandle SHPAPI_CALL SHPCreateLL(const char *pszShapeFile, int nShapeType,
                                       const SAHooks *psHooks);
@@ -297,8 +431,107 @@ extern "C"
                                 double *padfMaxBound);
 
     SHPObject SHPAPI_CALL1(*) SHPReadObject(const SHPHandle hSHP, int iShape);
+    /* Fill *psView without allocating or copying coordinates. Returns */
+    /* FALSE on error. */
+    int SHPAPI_CALL SHPReadObjectView(const SHPHandle hSHP, int iShape,
+                                      SHPObjectView *psView);
+
+    /* Memory owning the objects returned by SHPReadObjects() */
+    typedef struct SHPObjectArenaInfo *SHPObjectArena;
+
+    SHPObjectArena SHPAPI_CALL SHPCreateObjectArena(void);
+    void SHPAPI_CALL SHPDestroyObjectArena(SHPObjectArena hArena);
+
+    /* Read nCount consecutive shapes into papsObjects, which entries are */
+    /* NULL for shapes that could not be read. The objects live in hArena */
+    /* until the next SHPReadObjects() call on it or its destruction, and */
+    /* must not be passed to SHPDestroyObject(). */
+    /* Returns the number of shapes read, or -1 on invalid arguments. */
+    int SHPAPI_CALL SHPReadObjects(const SHPHandle hSHP, int iFirst,
+                                   int nCount, SHPObjectArena hArena,
+                                   SHPObject **papsObjects);
+
+    /* Read the X/Y bounds of a shape without its vertices */
+    int SHPAPI_CALL SHPReadObjectBounds(const SHPHandle hSHP, int iShape,
+                                        double *padfMin, double *padfMax);
+    /* Fill padfBounds with (xmin, ymin, xmax, ymax) for nCount shapes */
+    /* starting at iFirst. Returns the number of shapes read, or -1 on */
+    /* invalid arguments. */
+    int SHPAPI_CALL SHPReadObjectsBounds(const SHPHandle hSHP, int iFirst,
+                                         int nCount, double *padfBounds);
+
+    /* Sequential scan of the .shp alone, walking the record headers */
+    /* without opening the .shx */
+    typedef struct SHPScanInfo *SHPScanHandle;
+
+    SHPScanHandle SHPAPI_CALL SHPScanOpen(const char *pszShapeFile);
+    SHPScanHandle SHPAPI_CALL SHPScanOpenLL(const char *pszShapeFile,
+                                            const SAHooks *psHooks);
+    void SHPAPI_CALL SHPScanGetInfo(const SHPScanHandle hScan,
+                                    int *pnShapeType, double *padfMinBound,
+                                    double *padfMaxBound);
+    /* Return the next shape (to be freed with SHPDestroyObject()), or NULL */
+    /* at the end. Unreadable records are reported and skipped. */
+    SHPObject SHPAPI_CALL1(*) SHPScanNext(SHPScanHandle hScan);
+    /* Same as SHPScanNext(), filling a view valid until the next call. */
+    int SHPAPI_CALL SHPScanNextView(SHPScanHandle hScan, SHPObjectView *psView);
+    void SHPAPI_CALL SHPScanClose(SHPScanHandle hScan);
+
+    /* Readers share the record index of a handle and have their own */
+    /* buffers: one reader per thread allows concurrent reads, provided */
+    /* the handle is neither read through nor modified meanwhile. The */
+    /* hooks must provide FReadAt() or map the .shp file. */
+    typedef struct SHPReaderInfo *SHPReader;
+
+    SHPReader SHPAPI_CALL SHPCreateReader(SHPHandle hSHP);
+    SHPObject SHPAPI_CALL1(*) SHPReaderReadObject(SHPReader hReader,
+                                                  int iShape);
+    int SHPAPI_CALL SHPReaderReadObjectView(SHPReader hReader, int iShape,
+                                            SHPObjectView *psView);
+    void SHPAPI_CALL SHPDestroyReader(SHPReader hReader);
+
+    /* Called by SHPReadObjectsParallel() for each shape, which is owned */
+    /* by the callee (NULL if the record is unreadable). Returning FALSE */
+    /* stops the read. */
+    typedef int (*SHPReadObjectsCallback)(int iShape, SHPObject *psObject,
+                                          void *pUserData);
+
+/* Deliver shapes as soon as decoded, rather than in record order */
+#define SHP_READ_UNORDERED 0x1
+
+    /* Decode shapes on nThreads worker threads (one per processor if */
+    /* <= 0). The callback and the Error hook are only invoked from the */
+    /* calling thread. Returns the number of shapes delivered, or -1 on */
+    /* error. */
+    int SHPAPI_CALL SHPReadObjectsParallel(SHPHandle hSHP, int iFirst,
+                                           int nCount, int nThreads,
+                                           int nFlags,
+                                           SHPReadObjectsCallback pfnCallback,
+                                           void *pUserData);
     int SHPAPI_CALL SHPWriteObject(SHPHandle hSHP, int iShape,
                                    const SHPObject *psObject);
+    /* Same as SHPWriteObject() on SHPCreateObject(nSHPType, -1, ...), */
+    /* encoding straight from the arrays. padfMinBound and padfMaxBound */
+    /* (X, Y, Z, M) may be NULL to compute the extents from the arrays. */
+    int SHPAPI_CALL SHPWriteObjectFromArrays(
+        SHPHandle hSHP, int iShape, int nSHPType, int nParts,
+        const int *panPartStart, const int *panPartType, int nVertices,
+        const double *padfX, const double *padfY, const double *padfZ,
+        const double *padfM, const double *padfMinBound,
+        const double *padfMaxBound);
+    /* Same as SHPWriteObjectFromArrays() with X,Y pairs in padfXY */
+    int SHPAPI_CALL SHPWriteObjectFromInterleavedXY(
+        SHPHandle hSHP, int iShape, int nSHPType, int nParts,
+        const int *panPartStart, const int *panPartType, int nVertices,
+        const double *padfXY, const double *padfZ, const double *padfM,
+        const double *padfMinBound, const double *padfMaxBound);
+    /* Append nCount shapes, encoded on nThreads threads (one per */
+    /* processor if <= 0) and written in large sequential writes. Returns */
+    /* the number of shapes written, less than nCount on error, or -1 on */
+    /* invalid arguments. */
+    int SHPAPI_CALL SHPWriteObjects(SHPHandle hSHP,
+                                    SHPObject *const *papsObjects, int nCount,
+                                    int nThreads);
 
     void SHPAPI_CALL SHPDestroyObject(SHPObject *psObject);
     void SHPAPI_CALL SHPComputeExtents(SHPObject *psObject);
@@ -465,6 +698,29 @@ extern "C"
         int bWriteEndOfFileChar; /* defaults to TRUE */
 
         int bRequireNextWriteSeek;
+
+        /* Points into the file mapping or the read-ahead cache when the */
+        /* current record has been loaded from it (see */
+        /* SAHooks.FGetMapping), NULL otherwise */
+        const char *pszMappedRecord;
+
+        /* Consecutive records read at once, see DBFSetReadAheadRecords() */
+        int nReadAheadRecords;
+        char *pachReadAhead;
+        int nReadAheadFirst;
+        int nReadAheadCount;
+
+        /* Appended records not written yet, see DBFSetWriteBufferSize() */
+        char *pachWriteBuf;
+        int nWriteBufSize;
+        int nWriteBufUsed;
+        int nWriteBufFirstRecord;
+
+        /* Open addressing hash table of field indices + 1 (0 for empty */
+        /* slots) by field name, see DBFGetFieldIndex(). NULL until the */
+        /* first lookup, and after any change of the fields. */
+        int *panFieldIndexHash;
+        int nFieldIndexHashSize;
     } DBFInfo;
 
     typedef DBFInfo *DBFHandle;
@@ -502,6 +758,21 @@ extern "C"
 
     int SHPAPI_CALL DBFGetFieldCount(const DBFHandle psDBF);
     int SHPAPI_CALL DBFGetRecordCount(const DBFHandle psDBF);
+    /* Allocate the storage of the file for nRecords records up front when */
+    /* the hooks allow it, to be called once the fields are defined. */
+    /* Returns TRUE on success. */
+    int SHPAPI_CALL DBFReserveRecords(DBFHandle psDBF, int nRecords);
+    /* Read nRecords consecutive records per I/O, to be served from memory */
+    /* by the following reads, which speeds up sequential scans. A count */
+    /* of 0 or 1 disables the cache. Not used when the file is mapped. */
+    /* Returns TRUE on success. */
+    int SHPAPI_CALL DBFSetReadAheadRecords(DBFHandle psDBF, int nRecords);
+    /* Accumulate the records appended at the end of the file in a buffer */
+    /* of nBufferSize bytes that is written out in one I/O when full, */
+    /* before any read or other write, and by DBFUpdateHeader() and */
+    /* DBFClose(). A size of 0 flushes and disables the buffer. Returns */
+    /* TRUE on success. */
+    int SHPAPI_CALL DBFSetWriteBufferSize(DBFHandle psDBF, int nBufferSize);
     int SHPAPI_CALL DBFAddField(DBFHandle hDBF, const char *pszFieldName,
                                 DBFFieldType eType, int nWidth, int nDecimals);
 
@@ -517,6 +788,38 @@ extern "C"
                                       const char *pszFieldName, char chType,
                                       int nWidth, int nDecimals);
 
+    /* Field changes batched in memory and applied by */
+    /* DBFCommitSchemaChange() in a single streaming pass over the records, */
+    /* with the same effect as the matching DBFAddNativeFieldType(), */
+    /* DBFDeleteField(), DBFReorderFields() and DBFAlterFieldDefn() calls */
+    /* in turn. Field indices refer to the fields as changed so far. The */
+    /* fields of the table must not be changed otherwise meanwhile. */
+    typedef struct DBFSchemaChangeInfo *DBFSchemaChange;
+
+    DBFSchemaChange SHPAPI_CALL DBFBeginSchemaChange(DBFHandle psDBF);
+    /* Returns the index of the new field, or -1 on error */
+    int SHPAPI_CALL DBFSchemaAddNativeFieldType(DBFSchemaChange hChange,
+                                                const char *pszFieldName,
+                                                char chType, int nWidth,
+                                                int nDecimals);
+    int SHPAPI_CALL DBFSchemaDeleteField(DBFSchemaChange hChange, int iField);
+    /* panMap must be a permutation of the field indices */
+    int SHPAPI_CALL DBFSchemaReorderFields(DBFSchemaChange hChange,
+                                           const int *panMap);
+    int SHPAPI_CALL DBFSchemaAlterFieldDefn(DBFSchemaChange hChange,
+                                            int iField,
+                                            const char *pszFieldName,
+                                            char chType, int nWidth,
+                                            int nDecimals);
+    /* Rewrite the records in place and free hChange. As with the single */
+    /* field functions, the file is not truncated when the records shrink, */
+    /* and a failure while rewriting leaves the records in an undefined */
+    /* state, the header and field information being left unchanged. */
+    /* Returns TRUE on success. */
+    int SHPAPI_CALL DBFCommitSchemaChange(DBFSchemaChange hChange);
+    /* Free hChange without changing the table */
+    void SHPAPI_CALL DBFAbortSchemaChange(DBFSchemaChange hChange);
+
     DBFFieldType SHPAPI_CALL DBFGetFieldInfo(const DBFHandle psDBF, int iField,
                                              char *pszFieldName, int *pnWidth,
                                              int *pnDecimals);
@@ -536,6 +839,34 @@ extern "C"
                                              int iField);
     int SHPAPI_CALL DBFIsAttributeNULL(const DBFHandle hDBF, int iShape,
                                        int iField);
+    /* Value of a field as returned by DBFReadStringAttribute(), pointing */
+    /* into the record bytes and not NUL terminated */
+    typedef struct
+    {
+        const char *pachValue;
+        int nLength;
+    } DBFFieldView;
+
+    /* Fill *psView without copying the value, which stays valid until the */
+    /* next call on hDBF. With the hooks of SASetupMmapHooks(), it points */
+    /* into the file mapping. Returns FALSE on error. */
+    int SHPAPI_CALL DBFReadAttributeView(DBFHandle hDBF, int iShape,
+                                         int iField, DBFFieldView *psView);
+
+    /* Read field iField of nCount records starting at iFirst into */
+    /* panValues/padfValues, as DBFReadIntegerAttribute() and */
+    /* DBFReadDoubleAttribute() would. Bit i of pabyNullMask, if not NULL */
+    /* and (nCount + 7) / 8 bytes long, is set if the value of record */
+    /* iFirst + i is NULL. Returns the number of records read, or -1 on */
+    /* invalid arguments. */
+    int SHPAPI_CALL DBFReadIntegerColumn(DBFHandle hDBF, int iField,
+                                         int iFirst, int nCount,
+                                         int *panValues,
+                                         unsigned char *pabyNullMask);
+    int SHPAPI_CALL DBFReadDoubleColumn(DBFHandle hDBF, int iField,
+                                        int iFirst, int nCount,
+                                        double *padfValues,
+                                        unsigned char *pabyNullMask);
 
     int SHPAPI_CALL DBFWriteIntegerAttribute(DBFHandle hDBF, int iShape,
                                              int iField, int nFieldValue);
@@ -53,6 +53,7 @@
 
 #include "shapefil.h"
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 /************************************************************************/
@@ -114,4 +115,28 @@
         _n64 = _SHP_SWAP64(_n64);                                              \
         memcpy(_ld, &_n64, 8);                                                 \
     } while (0)
+
+/* Copy psSource to psDest, dropping the optional hooks of */
+/* SASetupDefaultHooks() and SASetupMmapHooks() that do not match FOpen() */
+void SACopyHooks(SAHooks *psDest, const SAHooks *psSource);
+
+/************************************************************************/
+/*                              SAReadAt()                              */
+/*                                                                      */
+/*      Read nSize bytes at nOffset, through the FReadAt() hook when    */
+/*      available, and with a FSeek() + FRead() pair otherwise.         */
+/*      Returns the number of bytes read.                               */
+/************************************************************************/
+
+static inline SAOffset SAReadAt(const SAHooks *psHooks, SAFile fp,
+                                SAOffset nOffset, void *p, SAOffset nSize)
+{
+    if (psHooks->FReadAt != SHPLIB_NULLPTR)
+        return psHooks->FReadAt(fp, nOffset, p, nSize);
+
+    if (psHooks->FSeek(fp, nOffset, SEEK_SET) != 0)
+        return 0;
+    return psHooks->FRead(p, 1, nSize, fp);
+}
+
 #endif /* ndef SHAPEFILE_PRIVATE_H_INCLUDED */
@@ -0,0 +1,56 @@
+/******************************************************************************
+ *
+ * Project:  Shapelib
+ * Purpose:  Utility to reclaim the space left in a .shp by rewritten shapes.
+ *
+ ******************************************************************************
+ *
+ * SPDX-License-Identifier: MIT OR LGPL-2.0-or-later
+ ******************************************************************************
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "shapefil.h"
+
+int main(int argc, char **argv)
+{
+    /* -------------------------------------------------------------------- */
+    /*      Display a usage message.                                        */
+    /* -------------------------------------------------------------------- */
+    if (argc != 2)
+    {
+        printf("shpcompact shp_file\n");
+        exit(1);
+    }
+
+    /* -------------------------------------------------------------------- */
+    /*      Report the space to reclaim.                                    */
+    /* -------------------------------------------------------------------- */
+    /* Large file mode accounts for the whole of files over 4 GB */
+    SHPHandle hSHP = SHPOpen(argv[1], sizeof(SAOffset) >= 8 ? "rbx" : "rb");
+
+    if (hSHP == NULL)
+    {
+        printf("Unable to open:%s\n", argv[1]);
+        exit(1);
+    }
+
+    const SAOffset nWastedBytes = SHPGetWastedBytes(hSHP);
+    SHPClose(hSHP);
+
+    /* -------------------------------------------------------------------- */
+    /*      Rewrite the shapefile.                                          */
+    /* -------------------------------------------------------------------- */
+    if (!SHPCompact(argv[1]))
+    {
+        printf("Unable to compact:%s\n", argv[1]);
+        exit(1);
+    }
+
+    printf("%.0f bytes reclaimed.\n", (double)nWastedBytes);
+
+    exit(0);
+}
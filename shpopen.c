@@ -23,6 +23,36 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* Worker threads of SHPReadObjectsParallel(), unless SHP_NO_THREADS */
+#if !defined(SHP_NO_THREADS)
+#if defined(SHPAPI_WINDOWS)
+#define SHP_WIN32_THREADS
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(SHP_HAVE_PTHREAD)
+#define SHP_POSIX_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#endif
+
+/* SSE2 (x86-64 baseline) and NEON vertex kernels, unless SHP_NO_SIMD */
+#if !defined(SHP_NO_SIMD) && !defined(SHP_BIG_ENDIAN)
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SHP_USE_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define SHP_USE_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
 #ifndef FALSE
 #define FALSE 0
 #define TRUE 1
@@ -52,6 +82,540 @@
     " Use SHPRestoreSHX() to restore or create it."
 #endif
 
+/************************************************************************/
+/*                            SHPGetDouble()                            */
+/*                                                                      */
+/*      Fetch a little endian double from a (possibly unaligned)        */
+/*      record position.                                                */
+/************************************************************************/
+
+static double SHPGetDouble(const unsigned char *pabyData)
+{
+    double dfValue;
+#if defined(SHP_BIG_ENDIAN)
+    SHP_SWAPDOUBLE_CPY(&dfValue, pabyData);
+#else
+    memcpy(&dfValue, pabyData, 8);
+#endif
+    return dfValue;
+}
+
+/************************************************************************/
+/*                            SHPGetInt32()                             */
+/*                                                                      */
+/*      Fetch a little endian int32 from a (possibly unaligned)         */
+/*      record position.                                                */
+/************************************************************************/
+
+static int SHPGetInt32(const unsigned char *pabyData)
+{
+    int nValue;
+    memcpy(&nValue, pabyData, 4);
+#if defined(SHP_BIG_ENDIAN)
+    SHP_SWAP32(&nValue);
+#endif
+    return nValue;
+}
+
+/************************************************************************/
+/*                            SHPPutDouble()                            */
+/*                                                                      */
+/*      Store a double as little endian at a (possibly unaligned)       */
+/*      record position.                                                */
+/************************************************************************/
+
+static void SHPPutDouble(unsigned char *pabyData, double dfValue)
+{
+#if defined(SHP_BIG_ENDIAN)
+    SHP_SWAPDOUBLE_CPY(pabyData, &dfValue);
+#else
+    memcpy(pabyData, &dfValue, 8);
+#endif
+}
+
+/************************************************************************/
+/*                            SHPGetDoubles()                           */
+/*                                                                      */
+/*      Fetch an array of little endian doubles.  On big endian hosts   */
+/*      the swap loop has no branch, so that compilers vectorize it.    */
+/************************************************************************/
+
+static void SHPGetDoubles(double *padfValues, const unsigned char *pabyData,
+                          uint32_t nValues)
+{
+#if defined(SHP_BIG_ENDIAN)
+    for (uint32_t i = 0; i < nValues; i++)
+    {
+        uint64_t nValue;
+        memcpy(&nValue, pabyData + 8 * i, 8);
+        nValue = _SHP_SWAP64(nValue);
+        memcpy(padfValues + i, &nValue, 8);
+    }
+#else
+    memcpy(padfValues, pabyData, 8 * STATIC_CAST(size_t, nValues));
+#endif
+}
+
+/************************************************************************/
+/*                            SHPPutDoubles()                           */
+/*                                                                      */
+/*      Store an array of doubles as little endian.                     */
+/************************************************************************/
+
+static void SHPPutDoubles(unsigned char *pabyData, const double *padfValues,
+                          uint32_t nValues)
+{
+#if defined(SHP_BIG_ENDIAN)
+    for (uint32_t i = 0; i < nValues; i++)
+    {
+        uint64_t nValue;
+        memcpy(&nValue, padfValues + i, 8);
+        nValue = _SHP_SWAP64(nValue);
+        memcpy(pabyData + 8 * i, &nValue, 8);
+    }
+#else
+    memcpy(pabyData, padfValues, 8 * STATIC_CAST(size_t, nValues));
+#endif
+}
+
+/************************************************************************/
+/*                          SHPDeinterleaveXY()                         */
+/*                                                                      */
+/*      Split the little endian X,Y pairs of a record into X and Y      */
+/*      arrays.                                                         */
+/************************************************************************/
+
+static void SHPDeinterleaveXY(const unsigned char *pabyXY, double *padfX,
+                              double *padfY, uint32_t nPoints)
+{
+    uint32_t i = 0;
+#if defined(SHP_USE_SSE2)
+    for (; i + 2 <= nPoints; i += 2)
+    {
+        const __m128d v0 =
+            _mm_loadu_pd(REINTERPRET_CAST(const double *, pabyXY + 16 * i));
+        const __m128d v1 = _mm_loadu_pd(
+            REINTERPRET_CAST(const double *, pabyXY + 16 * i + 16));
+        _mm_storeu_pd(padfX + i, _mm_unpacklo_pd(v0, v1));
+        _mm_storeu_pd(padfY + i, _mm_unpackhi_pd(v0, v1));
+    }
+#elif defined(SHP_USE_NEON)
+    for (; i + 2 <= nPoints; i += 2)
+    {
+        const float64x2x2_t v =
+            vld2q_f64(REINTERPRET_CAST(const double *, pabyXY + 16 * i));
+        vst1q_f64(padfX + i, v.val[0]);
+        vst1q_f64(padfY + i, v.val[1]);
+    }
+#endif
+    for (; i < nPoints; i++)
+    {
+        padfX[i] = SHPGetDouble(pabyXY + 16 * i);
+        padfY[i] = SHPGetDouble(pabyXY + 16 * i + 8);
+    }
+}
+
+/************************************************************************/
+/*                           SHPInterleaveXY()                          */
+/*                                                                      */
+/*      Write X and Y arrays as the little endian X,Y pairs of a        */
+/*      record.                                                         */
+/************************************************************************/
+
+static void SHPInterleaveXY(const double *padfX, const double *padfY,
+                            unsigned char *pabyXY, uint32_t nPoints)
+{
+    uint32_t i = 0;
+#if defined(SHP_USE_SSE2)
+    for (; i + 2 <= nPoints; i += 2)
+    {
+        const __m128d vX = _mm_loadu_pd(padfX + i);
+        const __m128d vY = _mm_loadu_pd(padfY + i);
+        _mm_storeu_pd(REINTERPRET_CAST(double *, pabyXY + 16 * i),
+                      _mm_unpacklo_pd(vX, vY));
+        _mm_storeu_pd(REINTERPRET_CAST(double *, pabyXY + 16 * i + 16),
+                      _mm_unpackhi_pd(vX, vY));
+    }
+#elif defined(SHP_USE_NEON)
+    for (; i + 2 <= nPoints; i += 2)
+    {
+        float64x2x2_t v;
+        v.val[0] = vld1q_f64(padfX + i);
+        v.val[1] = vld1q_f64(padfY + i);
+        vst2q_f64(REINTERPRET_CAST(double *, pabyXY + 16 * i), v);
+    }
+#endif
+    for (; i < nPoints; i++)
+    {
+        SHPPutDouble(pabyXY + 16 * i, padfX[i]);
+        SHPPutDouble(pabyXY + 16 * i + 8, padfY[i]);
+    }
+}
+
+/************************************************************************/
+/*                           SHPExtendRange()                           */
+/*                                                                      */
+/*      Extend [*pdfMin, *pdfMax] with nValues values, with the same    */
+/*      result as applying MIN()/MAX() in sequence, except that the     */
+/*      vector path may return 0.0 where MIN()/MAX() return -0.0, or    */
+/*      the reverse, as it compares the values in another order.  It    */
+/*      would also differ with NaN, so it is discarded when one is met. */
+/************************************************************************/
+
+static void SHPExtendRange(const double *padfValues, int nValues,
+                           double *pdfMin, double *pdfMax)
+{
+    double dfMin = *pdfMin;
+    double dfMax = *pdfMax;
+    int i = 0;
+
+#if defined(SHP_USE_SSE2)
+    if (nValues >= 8 && !isnan(dfMin) && !isnan(dfMax))
+    {
+        __m128d vMin0 = _mm_set1_pd(dfMin);
+        __m128d vMin1 = vMin0;
+        __m128d vMax0 = _mm_set1_pd(dfMax);
+        __m128d vMax1 = vMax0;
+        __m128d vNaN = _mm_setzero_pd();
+        for (; i + 4 <= nValues; i += 4)
+        {
+            const __m128d v0 = _mm_loadu_pd(padfValues + i);
+            const __m128d v1 = _mm_loadu_pd(padfValues + i + 2);
+            vMin0 = _mm_min_pd(vMin0, v0);
+            vMin1 = _mm_min_pd(vMin1, v1);
+            vMax0 = _mm_max_pd(vMax0, v0);
+            vMax1 = _mm_max_pd(vMax1, v1);
+            vNaN = _mm_or_pd(vNaN, _mm_cmpunord_pd(v0, v1));
+        }
+
+        if (_mm_movemask_pd(vNaN) != 0)
+        {
+            i = 0;
+        }
+        else
+        {
+            __m128d vMin = _mm_min_pd(vMin0, vMin1);
+            __m128d vMax = _mm_max_pd(vMax0, vMax1);
+            vMin = _mm_min_sd(vMin, _mm_unpackhi_pd(vMin, vMin));
+            vMax = _mm_max_sd(vMax, _mm_unpackhi_pd(vMax, vMax));
+            dfMin = _mm_cvtsd_f64(vMin);
+            dfMax = _mm_cvtsd_f64(vMax);
+        }
+    }
+#elif defined(SHP_USE_NEON)
+    if (nValues >= 8 && !isnan(dfMin) && !isnan(dfMax))
+    {
+        float64x2_t vMin0 = vdupq_n_f64(dfMin);
+        float64x2_t vMin1 = vMin0;
+        float64x2_t vMax0 = vdupq_n_f64(dfMax);
+        float64x2_t vMax1 = vMax0;
+        uint64x2_t vOrdered = vdupq_n_u64(~STATIC_CAST(uint64_t, 0));
+        for (; i + 4 <= nValues; i += 4)
+        {
+            const float64x2_t v0 = vld1q_f64(padfValues + i);
+            const float64x2_t v1 = vld1q_f64(padfValues + i + 2);
+            vMin0 = vminq_f64(vMin0, v0);
+            vMin1 = vminq_f64(vMin1, v1);
+            vMax0 = vmaxq_f64(vMax0, v0);
+            vMax1 = vmaxq_f64(vMax1, v1);
+            vOrdered = vandq_u64(vOrdered, vandq_u64(vceqq_f64(v0, v0),
+                                                     vceqq_f64(v1, v1)));
+        }
+
+        if ((vgetq_lane_u64(vOrdered, 0) & vgetq_lane_u64(vOrdered, 1)) !=
+            ~STATIC_CAST(uint64_t, 0))
+        {
+            i = 0;
+        }
+        else
+        {
+            dfMin = vminvq_f64(vminq_f64(vMin0, vMin1));
+            dfMax = vmaxvq_f64(vmaxq_f64(vMax0, vMax1));
+        }
+    }
+#endif
+
+    for (; i < nValues; i++)
+    {
+        dfMin = MIN(dfMin, padfValues[i]);
+        dfMax = MAX(dfMax, padfValues[i]);
+    }
+
+    *pdfMin = dfMin;
+    *pdfMax = dfMax;
+}
+
+/************************************************************************/
+/*                         SHPGetRecordOffset()                         */
+/*                                                                      */
+/*      Accessors of the record offsets and file size, which are        */
+/*      kept on 64 bits in large file mode.                             */
+/************************************************************************/
+
+static SAOffset SHPGetRecordOffset(const SHPInfo *psSHP, int hEntity)
+{
+    if (psSHP->bLargeFile)
+        return psSHP->panRecOffset64[hEntity];
+    return psSHP->panRecOffset[hEntity];
+}
+
+static void SHPStoreRecordOffset(SHPInfo *psSHP, int hEntity, SAOffset nOffset)
+{
+    if (psSHP->bLargeFile)
+        psSHP->panRecOffset64[hEntity] = nOffset;
+    psSHP->panRecOffset[hEntity] =
+        STATIC_CAST(unsigned int, MIN(nOffset, UINT_MAX));
+}
+
+static SAOffset SHPGetFileSize(const SHPInfo *psSHP)
+{
+    if (psSHP->bLargeFile)
+        return psSHP->nFileSize64;
+    return psSHP->nFileSize;
+}
+
+static void SHPStoreFileSize(SHPInfo *psSHP, SAOffset nFileSize)
+{
+    psSHP->nFileSize64 = nFileSize;
+    psSHP->nFileSize = STATIC_CAST(unsigned int, MIN(nFileSize, UINT_MAX));
+}
+
+/* Maximum size of the .shp, beyond which records cannot be appended */
+static SAOffset SHPGetMaxFileSize(const SHPInfo *psSHP)
+{
+    if (psSHP->bLargeFile)
+        return ~STATIC_CAST(SAOffset, 0);
+    return UINT_MAX;
+}
+
+/************************************************************************/
+/*                        SHPFlushWriteBuffer()                         */
+/*                                                                      */
+/*      Write out the appended records accumulated in the write         */
+/*      buffer, which end at the current end of the .shp file.          */
+/************************************************************************/
+
+static int SHPFlushWriteBuffer(SHPHandle psSHP)
+{
+    if (psSHP->nWriteBufUsed == 0)
+        return TRUE;
+
+    const SAOffset nOffset = SHPGetFileSize(psSHP) - psSHP->nWriteBufUsed;
+
+    if ((psSHP->sHooks.FTell(psSHP->fpSHP) != nOffset &&
+         psSHP->sHooks.FSeek(psSHP->fpSHP, nOffset, 0) != 0) ||
+        psSHP->sHooks.FWrite(psSHP->pabyWriteBuf, psSHP->nWriteBufUsed, 1,
+                             psSHP->fpSHP) < 1)
+    {
+        char szErrorMsg[200];
+
+        snprintf(szErrorMsg, sizeof(szErrorMsg),
+                 "Error in psSHP->sHooks.FWrite() while writing %d buffered "
+                 "bytes to .shp file: %s",
+                 psSHP->nWriteBufUsed, strerror(errno));
+        szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+        psSHP->sHooks.Error(szErrorMsg);
+        return FALSE;
+    }
+
+    psSHP->nWriteBufUsed = 0;
+    return TRUE;
+}
+
+/************************************************************************/
+/*                      SHPGetOffsetIndexFilename()                     */
+/*                                                                      */
+/*      The .shx64 index of large file mode holds the 64 bit offsets    */
+/*      of the records, when they overflow the 32 bit fields of the     */
+/*      .shx.  It is made of a 16 byte header (the "SHX64" magic padded */
+/*      with zeros to 8 bytes, the number of records as a little        */
+/*      endian 32 bit integer and 4 zero bytes) followed by the byte    */
+/*      offset of each record as a little endian 64 bit integer.        */
+/************************************************************************/
+
+#define SHP_OFFSET_INDEX_MAGIC "SHX64"
+#define SHP_OFFSET_INDEX_HEADER_SIZE 16
+
+/* Number of .shx64 entries read at once */
+#define SHP_OFFSET_INDEX_PAGE_RECORDS 4096
+
+static char *SHPGetOffsetIndexFilename(const char *pszSHXFilename)
+{
+    const size_t nLen = strlen(pszSHXFilename);
+    char *pszFilename = STATIC_CAST(char *, malloc(nLen + 3));
+    if (pszFilename == SHPLIB_NULLPTR)
+        return SHPLIB_NULLPTR;
+    memcpy(pszFilename, pszSHXFilename, nLen);
+    memcpy(pszFilename + nLen, "64", 3);
+    return pszFilename;
+}
+
+/************************************************************************/
+/*                      SHPWriteOffsetIndexFile()                       */
+/*                                                                      */
+/*      Write the .shx64 index pszFilename if some of the record        */
+/*      offsets overflow the .shx, and remove it otherwise.             */
+/************************************************************************/
+
+static int SHPWriteOffsetIndexFile(const SAHooks *psHooks,
+                                   const char *pszFilename,
+                                   const SAOffset *panOffsets, int nRecords)
+{
+    bool bOverflow = false;
+    for (int i = 0; !bOverflow && i < nRecords; i++)
+        bOverflow = panOffsets[i] / 2 > UINT_MAX;
+
+    if (!bOverflow)
+    {
+        psHooks->Remove(pszFilename, psHooks->pvUserData);
+        return TRUE;
+    }
+
+    const size_t nIndexSize =
+        SHP_OFFSET_INDEX_HEADER_SIZE + 8 * STATIC_CAST(size_t, nRecords);
+    unsigned char *pabyIndex =
+        STATIC_CAST(unsigned char *, calloc(1, nIndexSize));
+    if (pabyIndex == SHPLIB_NULLPTR)
+    {
+        psHooks->Error("Out of memory writing .shx64 file");
+        return FALSE;
+    }
+
+    memcpy(pabyIndex, SHP_OFFSET_INDEX_MAGIC, strlen(SHP_OFFSET_INDEX_MAGIC));
+    uint32_t i32 = nRecords;
+    ByteCopy(&i32, pabyIndex + 8, 4);
+#if defined(SHP_BIG_ENDIAN)
+    SHP_SWAP32(pabyIndex + 8);
+#endif
+
+    for (int i = 0; i < nRecords; i++)
+    {
+        unsigned char *pabyEntry = pabyIndex + SHP_OFFSET_INDEX_HEADER_SIZE +
+                                   8 * STATIC_CAST(size_t, i);
+        const uint64_t nOffset = panOffsets[i];
+        ByteCopy(&nOffset, pabyEntry, 8);
+#if defined(SHP_BIG_ENDIAN)
+        SHP_SWAP64(pabyEntry);
+#endif
+    }
+
+    SAFile fp = psHooks->FOpen(pszFilename, "wb", psHooks->pvUserData);
+    int bRet = fp != SHPLIB_NULLPTR &&
+               psHooks->FWrite(pabyIndex, nIndexSize, 1, fp) == 1;
+    if (fp != SHPLIB_NULLPTR && psHooks->FClose(fp) != 0)
+        bRet = FALSE;
+    if (!bRet)
+    {
+        const size_t nMessageLen = strlen(pszFilename) + 256;
+        char *pszMessage = STATIC_CAST(char *, malloc(nMessageLen));
+        snprintf(pszMessage, nMessageLen, "Failure writing %s: %s",
+                 pszFilename, strerror(errno));
+        psHooks->Error(pszMessage);
+        free(pszMessage);
+    }
+
+    free(pabyIndex);
+    return bRet;
+}
+
+/************************************************************************/
+/*                        SHPWriteOffsetIndex()                         */
+/*                                                                      */
+/*      In large file mode, write the .shx64 index if some record       */
+/*      offsets overflow the .shx, and remove it otherwise.             */
+/************************************************************************/
+
+static int SHPWriteOffsetIndex(SHPHandle psSHP)
+{
+    if (!psSHP->bLargeFile || psSHP->pszSHXFilename == SHPLIB_NULLPTR)
+        return TRUE;
+
+    char *pszFilename = SHPGetOffsetIndexFilename(psSHP->pszSHXFilename);
+    if (pszFilename == SHPLIB_NULLPTR)
+    {
+        psSHP->sHooks.Error("Out of memory writing .shx64 file");
+        return FALSE;
+    }
+
+    const int bRet = SHPWriteOffsetIndexFile(
+        &psSHP->sHooks, pszFilename, psSHP->panRecOffset64, psSHP->nRecords);
+    free(pszFilename);
+    return bRet;
+}
+
+/************************************************************************/
+/*                         SHPReadOffsetIndex()                         */
+/*                                                                      */
+/*      Replace the record offsets loaded from the .shx by the ones     */
+/*      of the .shx64 index.  The low bits of the offsets must agree,   */
+/*      which detects an index left over by a writer unaware of it.     */
+/************************************************************************/
+
+static int SHPReadOffsetIndex(SHPHandle psSHP, SAFile fp,
+                              const char *pszFilename)
+{
+    unsigned char *pabyPage = STATIC_CAST(
+        unsigned char *, malloc(8 * SHP_OFFSET_INDEX_PAGE_RECORDS));
+    if (pabyPage == SHPLIB_NULLPTR)
+    {
+        psSHP->sHooks.Error("Out of memory reading .shx64 file");
+        return FALSE;
+    }
+
+    bool bOK =
+        psSHP->sHooks.FRead(pabyPage, SHP_OFFSET_INDEX_HEADER_SIZE, 1, fp) ==
+            1 &&
+        memcmp(pabyPage, SHP_OFFSET_INDEX_MAGIC,
+               strlen(SHP_OFFSET_INDEX_MAGIC)) == 0;
+    if (bOK)
+    {
+        uint32_t nRecords;
+        memcpy(&nRecords, pabyPage + 8, 4);
+#if defined(SHP_BIG_ENDIAN)
+        SHP_SWAP32(&nRecords);
+#endif
+        bOK = nRecords == STATIC_CAST(uint32_t, psSHP->nRecords);
+    }
+
+    for (int iFirst = 0; bOK && iFirst < psSHP->nRecords;
+         iFirst += SHP_OFFSET_INDEX_PAGE_RECORDS)
+    {
+        const int nCount =
+            MIN(SHP_OFFSET_INDEX_PAGE_RECORDS, psSHP->nRecords - iFirst);
+        bOK = STATIC_CAST(int, psSHP->sHooks.FRead(pabyPage, 8, nCount, fp)) ==
+              nCount;
+        for (int i = 0; bOK && i < nCount; i++)
+        {
+            uint64_t nOffset;
+            memcpy(&nOffset, pabyPage + 8 * i, 8);
+#if defined(SHP_BIG_ENDIAN)
+            SHP_SWAP64(&nOffset);
+#endif
+            SAOffset *pnOffset = psSHP->panRecOffset64 + iFirst + i;
+            bOK = STATIC_CAST(uint32_t, nOffset / 2) ==
+                  STATIC_CAST(uint32_t, *pnOffset / 2);
+            *pnOffset = STATIC_CAST(SAOffset, nOffset);
+        }
+    }
+    free(pabyPage);
+
+    if (!bOK)
+    {
+        const size_t nMessageLen = strlen(pszFilename) + 256;
+        char *pszMessage = STATIC_CAST(char *, malloc(nMessageLen));
+        snprintf(pszMessage, nMessageLen,
+                 "%s is corrupt, or does not match the .shx file.",
+                 pszFilename);
+        psSHP->sHooks.Error(pszMessage);
+        free(pszMessage);
+        return FALSE;
+    }
+
+    for (int i = 0; i < psSHP->nRecords; i++)
+        SHPStoreRecordOffset(psSHP, i, psSHP->panRecOffset64[i]);
+    return TRUE;
+}
+
 /************************************************************************/
 /*                          SHPWriteHeader()                            */
 /*                                                                      */
@@ -61,6 +625,9 @@
 
 void SHPAPI_CALL SHPWriteHeader(SHPHandle psSHP)
 {
+    if (!SHPFlushWriteBuffer(psSHP))
+        return;
+
     if (psSHP->fpSHX == SHPLIB_NULLPTR)
     {
         psSHP->sHooks.Error("SHPWriteHeader failed : SHX file is closed");
@@ -75,7 +642,8 @@ void SHPAPI_CALL SHPWriteHeader(SHPHandle psSHP)
     abyHeader[2] = 0x27; /* magic cookie */
     abyHeader[3] = 0x0a;
 
-    uint32_t i32 = psSHP->nFileSize / 2; /* file size */
+    uint32_t i32 = /* file size */
+        STATIC_CAST(uint32_t, MIN(SHPGetFileSize(psSHP) / 2, UINT_MAX));
     ByteCopy(&i32, abyHeader + 24, 4);
 #if !defined(SHP_BIG_ENDIAN)
     SHP_SWAP32(abyHeader + 24);
@@ -189,7 +757,8 @@ void SHPAPI_CALL SHPWriteHeader(SHPHandle psSHP)
 
     for (int i = 0; i < psSHP->nRecords; i++)
     {
-        panSHX[i * 2] = psSHP->panRecOffset[i] / 2;
+        /* Overflows in large file mode, see SHPWriteOffsetIndex() */
+        panSHX[i * 2] = STATIC_CAST(uint32_t, SHPGetRecordOffset(psSHP, i) / 2);
         panSHX[i * 2 + 1] = psSHP->panRecSize[i] / 2;
 #if !defined(SHP_BIG_ENDIAN)
         SHP_SWAP32(panSHX + i * 2);
@@ -211,6 +780,8 @@ void SHPAPI_CALL SHPWriteHeader(SHPHandle psSHP)
 
     free(panSHX);
 
+    SHPWriteOffsetIndex(psSHP);
+
     /* -------------------------------------------------------------------- */
     /*      Flush to disk.                                                  */
     /* -------------------------------------------------------------------- */
@@ -218,6 +789,9 @@ void SHPAPI_CALL SHPWriteHeader(SHPHandle psSHP)
     psSHP->sHooks.FFlush(psSHP->fpSHX);
 }
 
+/* Maximum number of records accepted in a .shx */
+#define SHP_MAX_RECORDS 256000000
+
 /************************************************************************/
 /*                              SHPOpen()                               */
 /************************************************************************/
@@ -264,25 +838,44 @@ SHPHandle SHPAPI_CALL SHPOpenLL(const char *pszLayer, const char *pszAccess,
     /*      ensure the result string indicates binary to avoid common       */
     /*      problems on Windows.                                            */
     /* -------------------------------------------------------------------- */
+    /* A 'x' selects the large file mode, see SHPSetLargeFileMode() */
+    const bool bLargeFile = strchr(pszAccess, 'x') != SHPLIB_NULLPTR;
+    char szAccess[8];
+    size_t nAccessLen = 0;
+    for (const char *pszIter = pszAccess;
+         *pszIter != '\0' && nAccessLen + 1 < sizeof(szAccess); pszIter++)
+    {
+        if (*pszIter != 'x')
+            szAccess[nAccessLen++] = *pszIter;
+    }
+    szAccess[nAccessLen] = '\0';
+
     bool bLazySHXLoading = false;
-    if (strcmp(pszAccess, "rb+") == 0 || strcmp(pszAccess, "r+b") == 0 ||
-        strcmp(pszAccess, "r+") == 0)
+    if (strcmp(szAccess, "rb+") == 0 || strcmp(szAccess, "r+b") == 0 ||
+        strcmp(szAccess, "r+") == 0)
     {
         pszAccess = "r+b";
     }
     else
     {
-        bLazySHXLoading = strchr(pszAccess, 'l') != SHPLIB_NULLPTR;
+        bLazySHXLoading = strchr(szAccess, 'l') != SHPLIB_NULLPTR;
         pszAccess = "rb";
     }
 
+    if (bLargeFile && sizeof(SAOffset) < 8)
+    {
+        psHooks->Error("Large file mode requires 64 bit file offsets.");
+        return SHPLIB_NULLPTR;
+    }
+
     /* -------------------------------------------------------------------- */
     /*  Initialize the info structure.                  */
     /* -------------------------------------------------------------------- */
     SHPHandle psSHP = STATIC_CAST(SHPHandle, calloc(1, sizeof(SHPInfo)));
 
     psSHP->bUpdated = FALSE;
-    memcpy(&(psSHP->sHooks), psHooks, sizeof(SAHooks));
+    psSHP->bLargeFile = bLargeFile;
+    SACopyHooks(&(psSHP->sHooks), psHooks);
 
     /* -------------------------------------------------------------------- */
     /*  Open the .shp and .shx files.  Note that files pulled from  */
@@ -347,7 +940,26 @@ SHPHandle SHPAPI_CALL SHPOpenLL(const char *pszLayer, const char *pszAccess,
         return SHPLIB_NULLPTR;
     }
 
-    free(pszFullname);
+    psSHP->pszSHXFilename = pszFullname;
+
+    /* The whole .shx is loaded when there is a .shx64 index to apply */
+    bool bHasOffsetIndex = false;
+    if (bLargeFile)
+    {
+        char *pszIndexFilename =
+            SHPGetOffsetIndexFilename(psSHP->pszSHXFilename);
+        SAFile fpIndex = SHPLIB_NULLPTR;
+        if (pszIndexFilename != SHPLIB_NULLPTR)
+            fpIndex = psSHP->sHooks.FOpen(pszIndexFilename, "rb",
+                                          psSHP->sHooks.pvUserData);
+        if (fpIndex != SHPLIB_NULLPTR)
+        {
+            bHasOffsetIndex = true;
+            bLazySHXLoading = false;
+            psSHP->sHooks.FClose(fpIndex);
+        }
+        free(pszIndexFilename);
+    }
 
     /* -------------------------------------------------------------------- */
     /*  Read the file size from the SHP file.               */
@@ -359,6 +971,7 @@ SHPHandle SHPAPI_CALL SHPOpenLL(const char *pszLayer, const char *pszAccess,
         psSHP->sHooks.FClose(psSHP->fpSHP);
         psSHP->sHooks.FClose(psSHP->fpSHX);
         free(pabyBuf);
+        free(psSHP->pszSHXFilename);
         free(psSHP);
 
         return SHPLIB_NULLPTR;
@@ -371,6 +984,11 @@ SHPHandle SHPAPI_CALL SHPOpenLL(const char *pszLayer, const char *pszAccess,
     else
         psSHP->nFileSize = (UINT_MAX / 2) * 2;
 
+    /* The header cannot hold the size of files over 8 GB */
+    psSHP->nFileSize64 = psSHP->nFileSize;
+    if (bLargeFile && psSHP->sHooks.FSeek(psSHP->fpSHP, 0, 2) == 0)
+        SHPStoreFileSize(psSHP, psSHP->sHooks.FTell(psSHP->fpSHP));
+
     /* -------------------------------------------------------------------- */
     /*  Read SHX file Header info                                           */
     /* -------------------------------------------------------------------- */
@@ -382,6 +1000,7 @@ SHPHandle SHPAPI_CALL SHPOpenLL(const char *pszLayer, const char *pszAccess,
         psSHP->sHooks.FClose(psSHP->fpSHP);
         psSHP->sHooks.FClose(psSHP->fpSHX);
         free(pabyBuf);
+        free(psSHP->pszSHXFilename);
         free(psSHP);
 
         return SHPLIB_NULLPTR;
@@ -393,7 +1012,7 @@ SHPHandle SHPAPI_CALL SHPOpenLL(const char *pszLayer, const char *pszAccess,
 
     psSHP->nShapeType = pabyBuf[32];
 
-    if (psSHP->nRecords < 0 || psSHP->nRecords > 256000000)
+    if (psSHP->nRecords < 0 || psSHP->nRecords > SHP_MAX_RECORDS)
     {
         char szErrorMsg[200];
 
@@ -405,6 +1024,7 @@ SHPHandle SHPAPI_CALL SHPOpenLL(const char *pszLayer, const char *pszAccess,
         psSHP->sHooks.Error(szErrorMsg);
         psSHP->sHooks.FClose(psSHP->fpSHP);
         psSHP->sHooks.FClose(psSHP->fpSHX);
+        free(psSHP->pszSHXFilename);
         free(psSHP);
         free(pabyBuf);
 
@@ -492,6 +1112,9 @@ SHPHandle SHPAPI_CALL SHPOpenLL(const char *pszLayer, const char *pszAccess,
     psSHP->panRecSize =
         STATIC_CAST(unsigned int *,
                     malloc(sizeof(unsigned int) * MAX(1, psSHP->nMaxRecords)));
+    if (bLargeFile)
+        psSHP->panRecOffset64 = STATIC_CAST(
+            SAOffset *, malloc(sizeof(SAOffset) * MAX(1, psSHP->nMaxRecords)));
     if (bLazySHXLoading)
         pabyBuf = SHPLIB_NULLPTR;
     else
@@ -500,6 +1123,7 @@ SHPHandle SHPAPI_CALL SHPOpenLL(const char *pszLayer, const char *pszAccess,
 
     if (psSHP->panRecOffset == SHPLIB_NULLPTR ||
         psSHP->panRecSize == SHPLIB_NULLPTR ||
+        (bLargeFile && psSHP->panRecOffset64 == SHPLIB_NULLPTR) ||
         (!bLazySHXLoading && pabyBuf == SHPLIB_NULLPTR))
     {
         char szErrorMsg[200];
@@ -517,8 +1141,10 @@ SHPHandle SHPAPI_CALL SHPOpenLL(const char *pszLayer, const char *pszAccess,
             free(psSHP->panRecOffset);
         if (psSHP->panRecSize)
             free(psSHP->panRecSize);
+        free(psSHP->panRecOffset64);
         if (pabyBuf)
             free(pabyBuf);
+        free(psSHP->pszSHXFilename);
         free(psSHP);
         return SHPLIB_NULLPTR;
     }
@@ -529,6 +1155,9 @@ SHPHandle SHPAPI_CALL SHPOpenLL(const char *pszLayer, const char *pszAccess,
                sizeof(unsigned int) * MAX(1, psSHP->nMaxRecords));
         memset(psSHP->panRecSize, 0,
                sizeof(unsigned int) * MAX(1, psSHP->nMaxRecords));
+        if (bLargeFile)
+            memset(psSHP->panRecOffset64, 0,
+                   sizeof(SAOffset) * MAX(1, psSHP->nMaxRecords));
         free(pabyBuf);  // sometimes make cppcheck happy, but
         return (psSHP);
     }
@@ -549,7 +1178,9 @@ SHPHandle SHPAPI_CALL SHPOpenLL(const char *pszLayer, const char *pszAccess,
         psSHP->sHooks.FClose(psSHP->fpSHX);
         free(psSHP->panRecOffset);
         free(psSHP->panRecSize);
+        free(psSHP->panRecOffset64);
         free(pabyBuf);
+        free(psSHP->pszSHXFilename);
         free(psSHP);
 
         return SHPLIB_NULLPTR;
@@ -576,7 +1207,7 @@ SHPHandle SHPAPI_CALL SHPOpenLL(const char *pszLayer, const char *pszAccess,
         SHP_SWAP32(&nLength);
 #endif
 
-        if (nOffset > STATIC_CAST(unsigned int, INT_MAX))
+        if (!bLargeFile && nOffset > STATIC_CAST(unsigned int, INT_MAX))
         {
             char str[128];
             snprintf(str, sizeof(str), "Invalid offset for entity %d", i);
@@ -598,12 +1229,36 @@ SHPHandle SHPAPI_CALL SHPOpenLL(const char *pszLayer, const char *pszAccess,
             free(pabyBuf);
             return SHPLIB_NULLPTR;
         }
-        psSHP->panRecOffset[i] = nOffset * 2;
+        SHPStoreRecordOffset(psSHP, i, STATIC_CAST(SAOffset, nOffset) * 2);
         psSHP->panRecSize[i] = nLength * 2;
     }
     free(pabyBuf);
 
-    return (psSHP);
+    /* -------------------------------------------------------------------- */
+    /*      Apply the .shx64 index of large file mode.                      */
+    /* -------------------------------------------------------------------- */
+    if (bHasOffsetIndex)
+    {
+        char *pszIndexFilename =
+            SHPGetOffsetIndexFilename(psSHP->pszSHXFilename);
+        SAFile fpIndex =
+            pszIndexFilename == SHPLIB_NULLPTR
+                ? SHPLIB_NULLPTR
+                : psSHP->sHooks.FOpen(pszIndexFilename, "rb",
+                                      psSHP->sHooks.pvUserData);
+        const int bOK = fpIndex != SHPLIB_NULLPTR &&
+                        SHPReadOffsetIndex(psSHP, fpIndex, pszIndexFilename);
+        if (fpIndex != SHPLIB_NULLPTR)
+            psSHP->sHooks.FClose(fpIndex);
+        free(pszIndexFilename);
+        if (!bOK)
+        {
+            SHPClose(psSHP);
+            return SHPLIB_NULLPTR;
+        }
+    }
+
+    return (psSHP);
 }
 
 /************************************************************************/
@@ -640,221 +1295,11 @@ SHPHandle SHPAPI_CALL SHPOpenLLEx(const char *pszLayer, const char *pszAccess,
 int SHPAPI_CALL SHPRestoreSHX(const char *pszLayer, const char *pszAccess,
                               const SAHooks *psHooks)
 {
-    /* -------------------------------------------------------------------- */
-    /*      Ensure the access string is one of the legal ones.  We          */
-    /*      ensure the result string indicates binary to avoid common       */
-    /*      problems on Windows.                                            */
-    /* -------------------------------------------------------------------- */
-    if (strcmp(pszAccess, "rb+") == 0 || strcmp(pszAccess, "r+b") == 0 ||
-        strcmp(pszAccess, "r+") == 0)
-    {
-        pszAccess = "r+b";
-    }
-    else
-    {
-        pszAccess = "rb";
-    }
-
-    /* -------------------------------------------------------------------- */
-    /*  Open the .shp file.  Note that files pulled from                    */
-    /*  a PC to Unix with upper case filenames won't work!                  */
-    /* -------------------------------------------------------------------- */
-    const int nLenWithoutExtension = SHPGetLenWithoutExtension(pszLayer);
-    char *pszFullname = STATIC_CAST(char *, malloc(nLenWithoutExtension + 5));
-    memcpy(pszFullname, pszLayer, nLenWithoutExtension);
-    memcpy(pszFullname + nLenWithoutExtension, ".shp", 5);
-    SAFile fpSHP = psHooks->FOpen(pszFullname, pszAccess, psHooks->pvUserData);
-    if (fpSHP == SHPLIB_NULLPTR)
-    {
-        memcpy(pszFullname + nLenWithoutExtension, ".SHP", 5);
-        fpSHP = psHooks->FOpen(pszFullname, pszAccess, psHooks->pvUserData);
-    }
-
-    if (fpSHP == SHPLIB_NULLPTR)
-    {
-        const size_t nMessageLen = strlen(pszFullname) * 2 + 256;
-        char *pszMessage = STATIC_CAST(char *, malloc(nMessageLen));
-
-        pszFullname[nLenWithoutExtension] = 0;
-        snprintf(pszMessage, nMessageLen, "Unable to open %s.shp or %s.SHP.",
-                 pszFullname, pszFullname);
-        psHooks->Error(pszMessage);
-        free(pszMessage);
-
-        free(pszFullname);
-
-        return (0);
-    }
-
-    /* -------------------------------------------------------------------- */
-    /*  Read the file size from the SHP file.                               */
-    /* -------------------------------------------------------------------- */
-    unsigned char *pabyBuf = STATIC_CAST(unsigned char *, malloc(100));
-    if (psHooks->FRead(pabyBuf, 100, 1, fpSHP) != 1)
-    {
-        psHooks->Error(".shp file is unreadable, or corrupt.");
-        psHooks->FClose(fpSHP);
-
-        free(pabyBuf);
-        free(pszFullname);
-
-        return (0);
-    }
-
-    unsigned int nSHPFilesize = (STATIC_CAST(unsigned int, pabyBuf[24]) << 24) |
-                                (pabyBuf[25] << 16) | (pabyBuf[26] << 8) |
-                                pabyBuf[27];
-    if (nSHPFilesize < UINT_MAX / 2)
-        nSHPFilesize *= 2;
-    else
-        nSHPFilesize = (UINT_MAX / 2) * 2;
-
-    memcpy(pszFullname + nLenWithoutExtension, ".shx", 5);
-    const char pszSHXAccess[] = "w+b";
-    SAFile fpSHX =
-        psHooks->FOpen(pszFullname, pszSHXAccess, psHooks->pvUserData);
-    if (fpSHX == SHPLIB_NULLPTR)
-    {
-        size_t nMessageLen = strlen(pszFullname) * 2 + 256;
-        char *pszMessage = STATIC_CAST(char *, malloc(nMessageLen));
-        pszFullname[nLenWithoutExtension] = 0;
-        snprintf(pszMessage, nMessageLen,
-                 "Error opening file %s.shx for writing", pszFullname);
-        psHooks->Error(pszMessage);
-        free(pszMessage);
-
-        psHooks->FClose(fpSHP);
-
-        free(pabyBuf);
-        free(pszFullname);
-
-        return (0);
-    }
-
-    /* -------------------------------------------------------------------- */
-    /*  Open SHX and create it using SHP file content.                      */
-    /* -------------------------------------------------------------------- */
-    psHooks->FSeek(fpSHP, 100, 0);
-    char *pabySHXHeader = STATIC_CAST(char *, malloc(100));
-    memcpy(pabySHXHeader, pabyBuf, 100);
-    psHooks->FWrite(pabySHXHeader, 100, 1, fpSHX);
-    free(pabyBuf);
-
-    // unsigned int nCurrentRecordOffset = 0;
-    unsigned int nCurrentSHPOffset = 100;
-    unsigned int nRealSHXContentSize = 100;
-    int nRetCode = TRUE;
-    unsigned int nRecordOffset = 50;
-
-    while (nCurrentSHPOffset < nSHPFilesize)
-    {
-        unsigned int niRecord = 0;
-        unsigned int nRecordLength = 0;
-        int nSHPType;
-
-        if (psHooks->FRead(&niRecord, 4, 1, fpSHP) == 1 &&
-            psHooks->FRead(&nRecordLength, 4, 1, fpSHP) == 1 &&
-            psHooks->FRead(&nSHPType, 4, 1, fpSHP) == 1)
-        {
-            char abyReadRecord[8];
-            unsigned int nRecordOffsetBE = nRecordOffset;
-
-#if !defined(SHP_BIG_ENDIAN)
-            SHP_SWAP32(&nRecordOffsetBE);
-#endif
-            memcpy(abyReadRecord, &nRecordOffsetBE, 4);
-            memcpy(abyReadRecord + 4, &nRecordLength, 4);
-
-#if !defined(SHP_BIG_ENDIAN)
-            SHP_SWAP32(&nRecordLength);
-#endif
-#if defined(SHP_BIG_ENDIAN)
-            SHP_SWAP32(&nSHPType);
-#endif
-
-            // Sanity check on record length
-            if (nRecordLength < 1 ||
-                nRecordLength > (nSHPFilesize - (nCurrentSHPOffset + 8)) / 2)
-            {
-                char szErrorMsg[200];
-                snprintf(szErrorMsg, sizeof(szErrorMsg),
-                         "Error parsing .shp to restore .shx. "
-                         "Invalid record length = %u at record starting at "
-                         "offset %u",
-                         nRecordLength, nCurrentSHPOffset);
-                psHooks->Error(szErrorMsg);
-
-                nRetCode = FALSE;
-                break;
-            }
-
-            // Sanity check on record type
-            if (nSHPType != SHPT_NULL && nSHPType != SHPT_POINT &&
-                nSHPType != SHPT_ARC && nSHPType != SHPT_POLYGON &&
-                nSHPType != SHPT_MULTIPOINT && nSHPType != SHPT_POINTZ &&
-                nSHPType != SHPT_ARCZ && nSHPType != SHPT_POLYGONZ &&
-                nSHPType != SHPT_MULTIPOINTZ && nSHPType != SHPT_POINTM &&
-                nSHPType != SHPT_ARCM && nSHPType != SHPT_POLYGONM &&
-                nSHPType != SHPT_MULTIPOINTM && nSHPType != SHPT_MULTIPATCH)
-            {
-                char szErrorMsg[200];
-                snprintf(szErrorMsg, sizeof(szErrorMsg),
-                         "Error parsing .shp to restore .shx. "
-                         "Invalid shape type = %d at record starting at "
-                         "offset %u",
-                         nSHPType, nCurrentSHPOffset);
-                psHooks->Error(szErrorMsg);
-
-                nRetCode = FALSE;
-                break;
-            }
-
-            psHooks->FWrite(abyReadRecord, 8, 1, fpSHX);
-
-            nRecordOffset += nRecordLength + 4;
-            // nCurrentRecordOffset += 8;
-            nCurrentSHPOffset += 8 + nRecordLength * 2;
-
-            psHooks->FSeek(fpSHP, nCurrentSHPOffset, 0);
-            nRealSHXContentSize += 8;
-        }
-        else
-        {
-            char szErrorMsg[200];
-            snprintf(szErrorMsg, sizeof(szErrorMsg),
-                     "Error parsing .shp to restore .shx. "
-                     "Cannot read first bytes of record starting at "
-                     "offset %u",
-                     nCurrentSHPOffset);
-            psHooks->Error(szErrorMsg);
-
-            nRetCode = FALSE;
-            break;
-        }
-    }
-    if (nRetCode && nCurrentSHPOffset != nSHPFilesize)
-    {
-        psHooks->Error("Error parsing .shp to restore .shx. "
-                       "Not expected number of bytes");
-
-        nRetCode = FALSE;
-    }
-
-    nRealSHXContentSize /= 2;  // Bytes counted -> WORDs
-#if !defined(SHP_BIG_ENDIAN)
-    SHP_SWAP32(&nRealSHXContentSize);
-#endif
-
-    psHooks->FSeek(fpSHX, 24, 0);
-    psHooks->FWrite(&nRealSHXContentSize, 4, 1, fpSHX);
-
-    psHooks->FClose(fpSHP);
-    psHooks->FClose(fpSHX);
+    /* The .shp is only read, whatever the access requested */
+    (void)pszAccess;
 
-    free(pszFullname);
-    free(pabySHXHeader);
-
-    return nRetCode;
+    return SHPRestoreSHXEx(pszLayer, psHooks, SHPLIB_NULLPTR, SHPLIB_NULLPTR,
+                           SHPLIB_NULLPTR);
 }
 
 /************************************************************************/
@@ -873,12 +1318,17 @@ void SHPAPI_CALL SHPClose(SHPHandle psSHP)
     /* -------------------------------------------------------------------- */
     if (psSHP->bUpdated)
         SHPWriteHeader(psSHP);
+    else
+        SHPFlushWriteBuffer(psSHP);
 
     /* -------------------------------------------------------------------- */
     /*      Free all resources, and close files.                            */
     /* -------------------------------------------------------------------- */
     free(psSHP->panRecOffset);
     free(psSHP->panRecSize);
+    free(psSHP->panRecOffset64);
+    free(psSHP->pabyWriteBuf);
+    free(psSHP->pszSHXFilename);
 
     if (psSHP->fpSHX != SHPLIB_NULLPTR)
         psSHP->sHooks.FClose(psSHP->fpSHX);
@@ -924,6 +1374,93 @@ void SHPAPI_CALL SHPSetFastModeReadObject(SHPHandle hSHP, int bFastMode)
     hSHP->bFastModeReadObject = bFastMode;
 }
 
+/************************************************************************/
+/*                       SHPSetWriteBufferSize()                        */
+/*                                                                      */
+/*      Bulk loads otherwise issue one small write per appended         */
+/*      record.                                                         */
+/************************************************************************/
+
+int SHPAPI_CALL SHPSetWriteBufferSize(SHPHandle hSHP, int nBufferSize)
+{
+    if (nBufferSize < 0 || !SHPFlushWriteBuffer(hSHP))
+        return FALSE;
+
+    unsigned char *pabyWriteBuf = SHPLIB_NULLPTR;
+    if (nBufferSize > 0)
+    {
+        pabyWriteBuf = STATIC_CAST(unsigned char *, malloc(nBufferSize));
+        if (pabyWriteBuf == SHPLIB_NULLPTR)
+        {
+            char szErrorMsg[64];
+
+            snprintf(szErrorMsg, sizeof(szErrorMsg),
+                     "Not enough memory to allocate %d bytes", nBufferSize);
+            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+            hSHP->sHooks.Error(szErrorMsg);
+            return FALSE;
+        }
+    }
+
+    free(hSHP->pabyWriteBuf);
+    hSHP->pabyWriteBuf = pabyWriteBuf;
+    hSHP->nWriteBufSize = nBufferSize;
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                        SHPSetLargeFileMode()                         */
+/************************************************************************/
+
+int SHPAPI_CALL SHPSetLargeFileMode(SHPHandle hSHP, int bLargeFile)
+{
+    if (!bLargeFile == !hSHP->bLargeFile)
+        return TRUE;
+
+    /* -------------------------------------------------------------------- */
+    /*      Leaving the large file mode is only possible while the          */
+    /*      offsets fit in 32 bits.                                         */
+    /* -------------------------------------------------------------------- */
+    if (!bLargeFile)
+    {
+        if (hSHP->nFileSize64 > UINT_MAX)
+        {
+            hSHP->sHooks.Error("Cannot leave large file mode: "
+                               "the .shp file is larger than 4 GB.");
+            return FALSE;
+        }
+
+        free(hSHP->panRecOffset64);
+        hSHP->panRecOffset64 = SHPLIB_NULLPTR;
+        hSHP->bLargeFile = FALSE;
+        return TRUE;
+    }
+
+    if (sizeof(SAOffset) < 8)
+    {
+        hSHP->sHooks.Error("Large file mode requires 64 bit file offsets.");
+        return FALSE;
+    }
+
+    SAOffset *panRecOffset64 = STATIC_CAST(
+        SAOffset *, malloc(sizeof(SAOffset) * MAX(1, hSHP->nMaxRecords)));
+    if (panRecOffset64 == SHPLIB_NULLPTR)
+    {
+        hSHP->sHooks.Error("Not enough memory to allocate requested memory");
+        return FALSE;
+    }
+
+    for (int i = 0; i < hSHP->nRecords; i++)
+        panRecOffset64[i] = hSHP->panRecOffset[i];
+
+    hSHP->panRecOffset64 = panRecOffset64;
+    hSHP->nFileSize64 = hSHP->nFileSize;
+    hSHP->bLargeFile = TRUE;
+
+    return TRUE;
+}
+
 /************************************************************************/
 /*                             SHPGetInfo()                             */
 /*                                                                      */
@@ -1011,9 +1548,6 @@ SHPHandle SHPAPI_CALL SHPCreateLL(const char *pszLayer, int nShapeType,
         return SHPLIB_NULLPTR;
     }
 
-    free(pszFullname);
-    pszFullname = SHPLIB_NULLPTR;
-
     /* -------------------------------------------------------------------- */
     /*      Prepare header block for .shp file.                             */
     /* -------------------------------------------------------------------- */
@@ -1092,10 +1626,11 @@ SHPHandle SHPAPI_CALL SHPCreateLL(const char *pszLayer, int nShapeType,
     SHPHandle psSHP = STATIC_CAST(SHPHandle, calloc(1, sizeof(SHPInfo)));
 
     psSHP->bUpdated = FALSE;
-    memcpy(&(psSHP->sHooks), psHooks, sizeof(SAHooks));
+    SACopyHooks(&(psSHP->sHooks), psHooks);
 
     psSHP->fpSHP = fpSHP;
     psSHP->fpSHX = fpSHX;
+    psSHP->pszSHXFilename = pszFullname;
     psSHP->nShapeType = nShapeType;
     psSHP->nFileSize = 100;
     psSHP->panRecOffset =
@@ -1113,6 +1648,7 @@ SHPHandle SHPAPI_CALL SHPCreateLL(const char *pszLayer, int nShapeType,
             free(psSHP->panRecOffset);
         if (psSHP->panRecSize)
             free(psSHP->panRecSize);
+        free(psSHP->pszSHXFilename);
         free(psSHP);
         return SHPLIB_NULLPTR;
     }
@@ -1160,19 +1696,43 @@ void SHPAPI_CALL SHPComputeExtents(SHPObject *psObject)
         psObject->dfYMin = psObject->dfYMax = psObject->padfY[0];
         psObject->dfZMin = psObject->dfZMax = psObject->padfZ[0];
         psObject->dfMMin = psObject->dfMMax = psObject->padfM[0];
+
+        SHPExtendRange(psObject->padfX, psObject->nVertices, &psObject->dfXMin,
+                       &psObject->dfXMax);
+        SHPExtendRange(psObject->padfY, psObject->nVertices, &psObject->dfYMin,
+                       &psObject->dfYMax);
+        SHPExtendRange(psObject->padfZ, psObject->nVertices, &psObject->dfZMin,
+                       &psObject->dfZMax);
+        SHPExtendRange(psObject->padfM, psObject->nVertices, &psObject->dfMMin,
+                       &psObject->dfMMax);
     }
+}
 
-    for (int i = 0; i < psObject->nVertices; i++)
-    {
-        psObject->dfXMin = MIN(psObject->dfXMin, psObject->padfX[i]);
-        psObject->dfYMin = MIN(psObject->dfYMin, psObject->padfY[i]);
-        psObject->dfZMin = MIN(psObject->dfZMin, psObject->padfZ[i]);
-        psObject->dfMMin = MIN(psObject->dfMMin, psObject->padfM[i]);
+/************************************************************************/
+/*                        SHPGetTypeDimensions()                        */
+/*                                                                      */
+/*      Establish whether a shape type has Z, and M values.             */
+/************************************************************************/
 
-        psObject->dfXMax = MAX(psObject->dfXMax, psObject->padfX[i]);
-        psObject->dfYMax = MAX(psObject->dfYMax, psObject->padfY[i]);
-        psObject->dfZMax = MAX(psObject->dfZMax, psObject->padfZ[i]);
-        psObject->dfMMax = MAX(psObject->dfMMax, psObject->padfM[i]);
+static void SHPGetTypeDimensions(int nSHPType, bool *pbHasZ, bool *pbHasM)
+{
+    if (nSHPType == SHPT_ARCM || nSHPType == SHPT_POINTM ||
+        nSHPType == SHPT_POLYGONM || nSHPType == SHPT_MULTIPOINTM)
+    {
+        *pbHasM = true;
+        *pbHasZ = false;
+    }
+    else if (nSHPType == SHPT_ARCZ || nSHPType == SHPT_POINTZ ||
+             nSHPType == SHPT_POLYGONZ || nSHPType == SHPT_MULTIPOINTZ ||
+             nSHPType == SHPT_MULTIPATCH)
+    {
+        *pbHasM = true;
+        *pbHasZ = true;
+    }
+    else
+    {
+        *pbHasM = false;
+        *pbHasZ = false;
     }
 }
 
@@ -1198,27 +1758,9 @@ SHPObject SHPAPI_CALL1(*)
     /* -------------------------------------------------------------------- */
     /*      Establish whether this shape type has M, and Z values.          */
     /* -------------------------------------------------------------------- */
-    bool bHasM;
     bool bHasZ;
-
-    if (nSHPType == SHPT_ARCM || nSHPType == SHPT_POINTM ||
-        nSHPType == SHPT_POLYGONM || nSHPType == SHPT_MULTIPOINTM)
-    {
-        bHasM = true;
-        bHasZ = false;
-    }
-    else if (nSHPType == SHPT_ARCZ || nSHPType == SHPT_POINTZ ||
-             nSHPType == SHPT_POLYGONZ || nSHPType == SHPT_MULTIPOINTZ ||
-             nSHPType == SHPT_MULTIPATCH)
-    {
-        bHasM = true;
-        bHasZ = true;
-    }
-    else
-    {
-        bHasM = false;
-        bHasZ = false;
-    }
+    bool bHasM;
+    SHPGetTypeDimensions(nSHPType, &bHasZ, &bHasM);
 
     /* -------------------------------------------------------------------- */
     /*      Capture parts.  Note that part type is optional, and            */
@@ -1309,76 +1851,108 @@ SHPObject SHPAPI_CALL1(*)
 }
 
 /************************************************************************/
-/*                           SHPWriteObject()                           */
+/*                         SHPGrowRecordIndex()                         */
 /*                                                                      */
-/*      Write out the vertices of a new structure.  Note that it is     */
-/*      only possible to write vertices at the end of the file.         */
+/*      Make room for nMinRecords entries in the in memory index.       */
 /************************************************************************/
 
-int SHPAPI_CALL SHPWriteObject(SHPHandle psSHP, int nShapeId,
-                               const SHPObject *psObject)
+static int SHPGrowRecordIndex(SHPHandle psSHP, int nMinRecords)
 {
-    psSHP->bUpdated = TRUE;
-
-    /* -------------------------------------------------------------------- */
-    /*      Ensure that shape object matches the type of the file it is     */
-    /*      being written to.                                               */
-    /* -------------------------------------------------------------------- */
-    assert(psObject->nSHPType == psSHP->nShapeType ||
-           psObject->nSHPType == SHPT_NULL);
-
-    /* -------------------------------------------------------------------- */
-    /*      Ensure that -1 is used for appends.  Either blow an             */
-    /*      assertion, or if they are disabled, set the shapeid to -1       */
-    /*      for appends.                                                    */
-    /* -------------------------------------------------------------------- */
-    assert(nShapeId == -1 || (nShapeId >= 0 && nShapeId < psSHP->nRecords));
+    if (nMinRecords <= psSHP->nMaxRecords)
+        return TRUE;
+
+    /* This cannot overflow given that we check that the file size does
+     * not grow over 4 GB, and the minimum size of a record is 12 bytes,
+     * hence the maximm value for nMaxRecords is 357,913,941. In large
+     * file mode, the number of records is limited to what SHPOpen()
+     * accepts.
+     */
+    if (psSHP->bLargeFile && nMinRecords > SHP_MAX_RECORDS)
+    {
+        char str[128];
+        snprintf(str, sizeof(str),
+                 "Failed to write shape object. "
+                 "The maximum number of records of %d has been reached.",
+                 SHP_MAX_RECORDS);
+        str[sizeof(str) - 1] = '\0';
+        psSHP->sHooks.Error(str);
+        return FALSE;
+    }
 
-    if (nShapeId != -1 && nShapeId >= psSHP->nRecords)
-        nShapeId = -1;
+    int nNewMaxRecords = psSHP->nMaxRecords + psSHP->nMaxRecords / 3 + 100;
+    if (nNewMaxRecords < nMinRecords)
+        nNewMaxRecords = nMinRecords;
 
-    /* -------------------------------------------------------------------- */
-    /*      Add the new entity to the in memory index.                      */
-    /* -------------------------------------------------------------------- */
-    if (nShapeId == -1 && psSHP->nRecords + 1 > psSHP->nMaxRecords)
+    unsigned int *panRecOffsetNew = STATIC_CAST(
+        unsigned int *,
+        realloc(psSHP->panRecOffset, sizeof(unsigned int) * nNewMaxRecords));
+    if (panRecOffsetNew == SHPLIB_NULLPTR)
     {
-        /* This cannot overflow given that we check that the file size does
-         * not grow over 4 GB, and the minimum size of a record is 12 bytes,
-         * hence the maximm value for nMaxRecords is 357,913,941
-         */
-        int nNewMaxRecords = psSHP->nMaxRecords + psSHP->nMaxRecords / 3 + 100;
-        unsigned int *panRecOffsetNew;
-        unsigned int *panRecSizeNew;
-
-        panRecOffsetNew = STATIC_CAST(
-            unsigned int *, realloc(psSHP->panRecOffset,
-                                    sizeof(unsigned int) * nNewMaxRecords));
-        if (panRecOffsetNew == SHPLIB_NULLPTR)
-        {
-            psSHP->sHooks.Error("Failed to write shape object. "
-                                "Memory allocation error.");
-            return -1;
-        }
-        psSHP->panRecOffset = panRecOffsetNew;
+        psSHP->sHooks.Error("Failed to write shape object. "
+                            "Memory allocation error.");
+        return FALSE;
+    }
+    psSHP->panRecOffset = panRecOffsetNew;
 
-        panRecSizeNew = STATIC_CAST(
-            unsigned int *,
-            realloc(psSHP->panRecSize, sizeof(unsigned int) * nNewMaxRecords));
-        if (panRecSizeNew == SHPLIB_NULLPTR)
+    unsigned int *panRecSizeNew = STATIC_CAST(
+        unsigned int *,
+        realloc(psSHP->panRecSize, sizeof(unsigned int) * nNewMaxRecords));
+    if (panRecSizeNew == SHPLIB_NULLPTR)
+    {
+        psSHP->sHooks.Error("Failed to write shape object. "
+                            "Memory allocation error.");
+        return FALSE;
+    }
+    psSHP->panRecSize = panRecSizeNew;
+
+    if (psSHP->bLargeFile)
+    {
+        SAOffset *panRecOffset64New = STATIC_CAST(
+            SAOffset *,
+            realloc(psSHP->panRecOffset64, sizeof(SAOffset) * nNewMaxRecords));
+        if (panRecOffset64New == SHPLIB_NULLPTR)
         {
             psSHP->sHooks.Error("Failed to write shape object. "
                                 "Memory allocation error.");
-            return -1;
+            return FALSE;
         }
-        psSHP->panRecSize = panRecSizeNew;
-
-        psSHP->nMaxRecords = nNewMaxRecords;
+        psSHP->panRecOffset64 = panRecOffset64New;
     }
 
-    /* -------------------------------------------------------------------- */
-    /*      Initialize record.                                              */
-    /* -------------------------------------------------------------------- */
+    psSHP->nMaxRecords = nNewMaxRecords;
+    return TRUE;
+}
+
+/************************************************************************/
+/*                         SHPReserveRecords()                          */
+/*                                                                      */
+/*      Avoid growing the record index repeatedly, and fragmenting the  */
+/*      .shx, when the final number of shapes is known up front.        */
+/************************************************************************/
+
+int SHPAPI_CALL SHPReserveRecords(SHPHandle hSHP, int nRecords)
+{
+    if (nRecords < 0 || !SHPGrowRecordIndex(hSHP, nRecords))
+        return FALSE;
+
+    /* Only a hint: failing to allocate the storage is not an error */
+    if (hSHP->fpSHX != SHPLIB_NULLPTR &&
+        hSHP->sHooks.FReserve != SHPLIB_NULLPTR)
+        hSHP->sHooks.FReserve(hSHP->fpSHX,
+                              100 + 8 * STATIC_CAST(SAOffset, nRecords));
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                        SHPGetRecordMaxSize()                         */
+/*                                                                      */
+/*      Upper bound of the encoded size of a shape, header included.    */
+/*      Returns FALSE if the shape is too big to be written.            */
+/************************************************************************/
 
+static int SHPGetRecordMaxSize(const SHPObject *psObject, size_t *pnMaxSize)
+{
     /* The following computation cannot overflow on 32-bit platforms given that
      * the user had to allocate arrays of at least that size. */
     size_t nRecMaxSize =
@@ -1387,25 +1961,50 @@ int SHPAPI_CALL SHPWriteObject(SHPHandle psSHP, int nShapeId,
      * geometries. */
     const unsigned nExtraSpaceForGeomHeader = 128;
     if (nRecMaxSize > UINT_MAX - nExtraSpaceForGeomHeader)
-    {
-        psSHP->sHooks.Error("Failed to write shape object. Too big geometry.");
-        return -1;
-    }
-    nRecMaxSize += nExtraSpaceForGeomHeader;
-    unsigned char *pabyRec = STATIC_CAST(unsigned char *, malloc(nRecMaxSize));
-    if (pabyRec == SHPLIB_NULLPTR)
-    {
-        psSHP->sHooks.Error("Failed to write shape object. "
-                            "Memory allocation error.");
-        return -1;
-    }
+        return FALSE;
+
+    *pnMaxSize = nRecMaxSize + nExtraSpaceForGeomHeader;
+    return TRUE;
+}
+
+/************************************************************************/
+/*                            SHPEncodeXY()                             */
+/*                                                                      */
+/*      Write the X,Y pairs of a shape, from padfXY if not NULL.        */
+/************************************************************************/
+
+static void SHPEncodeXY(const SHPObject *psObject, const double *padfXY,
+                        unsigned char *pabyXY)
+{
+    const uint32_t nPoints = STATIC_CAST(uint32_t, psObject->nVertices);
+    if (padfXY != SHPLIB_NULLPTR)
+        SHPPutDoubles(pabyXY, padfXY, 2 * nPoints);
+    else
+        SHPInterleaveXY(psObject->padfX, psObject->padfY, pabyXY, nPoints);
+}
+
+/************************************************************************/
+/*                          SHPEncodeRecord()                           */
+/*                                                                      */
+/*      Encode a shape as record number nRecordNumber in pabyRec, which */
+/*      holds at least SHPGetRecordMaxSize() bytes.  Returns the size   */
+/*      of the record, header included.  Only reads psObject, so        */
+/*      records may be encoded concurrently.                            */
+/*                                                                      */
+/*      The vertices are taken from padfXY (X,Y pairs) instead of       */
+/*      padfX/padfY when it is not NULL.  A NULL padfZ is written as    */
+/*      zeros, and a NULL panPartType as SHPP_RING.                     */
+/************************************************************************/
+
+static unsigned int SHPEncodeRecord(const SHPObject *psObject,
+                                    const double *padfXY, int nRecordNumber,
+                                    unsigned char *pabyRec)
+{
+    unsigned int nRecordSize = 0;
 
     /* -------------------------------------------------------------------- */
     /*      Extract vertices for a Polygon or Arc.                          */
     /* -------------------------------------------------------------------- */
-    unsigned int nRecordSize = 0;
-    const bool bFirstFeature = psSHP->nRecords == 0;
-
     if (psObject->nSHPType == SHPT_POLYGON ||
         psObject->nSHPType == SHPT_POLYGONZ ||
         psObject->nSHPType == SHPT_POLYGONM || psObject->nSHPType == SHPT_ARC ||
@@ -1445,13 +2044,15 @@ int SHPAPI_CALL SHPWriteObject(SHPHandle psSHP, int nShapeId,
          */
         if (psObject->nSHPType == SHPT_MULTIPATCH)
         {
-            memcpy(pabyRec + nRecordSize, psObject->panPartType,
-                   4 * psObject->nParts);
             for (int i = 0; i < psObject->nParts; i++)
             {
+                uint32_t nPartType = psObject->panPartType
+                                         ? psObject->panPartType[i]
+                                         : SHPP_RING;
 #if defined(SHP_BIG_ENDIAN)
-                SHP_SWAP32(pabyRec + nRecordSize);
+                SHP_SWAP32(&nPartType);
 #endif
+                ByteCopy(&nPartType, pabyRec + nRecordSize, 4);
                 nRecordSize += 4;
             }
         }
@@ -1459,18 +2060,8 @@ int SHPAPI_CALL SHPWriteObject(SHPHandle psSHP, int nShapeId,
         /*
          * Write the (x,y) vertex values.
          */
-        for (int i = 0; i < psObject->nVertices; i++)
-        {
-            ByteCopy(psObject->padfX + i, pabyRec + nRecordSize, 8);
-            ByteCopy(psObject->padfY + i, pabyRec + nRecordSize + 8, 8);
-
-#if defined(SHP_BIG_ENDIAN)
-            SHP_SWAP64(pabyRec + nRecordSize);
-            SHP_SWAP64(pabyRec + nRecordSize + 8);
-#endif
-
-            nRecordSize += 2 * 8;
-        }
+        SHPEncodeXY(psObject, padfXY, pabyRec + nRecordSize);
+        nRecordSize += 2 * 8 * psObject->nVertices;
 
         /*
          * Write the Z coordinates (if any).
@@ -1491,14 +2082,12 @@ int SHPAPI_CALL SHPWriteObject(SHPHandle psSHP, int nShapeId,
 #endif
             nRecordSize += 8;
 
-            for (int i = 0; i < psObject->nVertices; i++)
-            {
-                ByteCopy(psObject->padfZ + i, pabyRec + nRecordSize, 8);
-#if defined(SHP_BIG_ENDIAN)
-                SHP_SWAP64(pabyRec + nRecordSize);
-#endif
-                nRecordSize += 8;
-            }
+            if (psObject->padfZ != SHPLIB_NULLPTR)
+                SHPPutDoubles(pabyRec + nRecordSize, psObject->padfZ,
+                              STATIC_CAST(uint32_t, psObject->nVertices));
+            else
+                memset(pabyRec + nRecordSize, 0, 8 * psObject->nVertices);
+            nRecordSize += 8 * psObject->nVertices;
         }
 
         /*
@@ -1525,14 +2114,9 @@ int SHPAPI_CALL SHPWriteObject(SHPHandle psSHP, int nShapeId,
 #endif
             nRecordSize += 8;
 
-            for (int i = 0; i < psObject->nVertices; i++)
-            {
-                ByteCopy(psObject->padfM + i, pabyRec + nRecordSize, 8);
-#if defined(SHP_BIG_ENDIAN)
-                SHP_SWAP64(pabyRec + nRecordSize);
-#endif
-                nRecordSize += 8;
-            }
+            SHPPutDoubles(pabyRec + nRecordSize, psObject->padfM,
+                          STATIC_CAST(uint32_t, psObject->nVertices));
+            nRecordSize += 8 * psObject->nVertices;
         }
     }
 
@@ -1552,16 +2136,7 @@ int SHPAPI_CALL SHPWriteObject(SHPHandle psSHP, int nShapeId,
 #endif
         ByteCopy(&nPoints, pabyRec + 44, 4);
 
-        for (int i = 0; i < psObject->nVertices; i++)
-        {
-            ByteCopy(psObject->padfX + i, pabyRec + 48 + i * 16, 8);
-            ByteCopy(psObject->padfY + i, pabyRec + 48 + i * 16 + 8, 8);
-
-#if defined(SHP_BIG_ENDIAN)
-            SHP_SWAP64(pabyRec + 48 + i * 16);
-            SHP_SWAP64(pabyRec + 48 + i * 16 + 8);
-#endif
-        }
+        SHPEncodeXY(psObject, padfXY, pabyRec + 48);
 
         nRecordSize = 48 + 16 * psObject->nVertices;
 
@@ -1579,14 +2154,12 @@ int SHPAPI_CALL SHPWriteObject(SHPHandle psSHP, int nShapeId,
 #endif
             nRecordSize += 8;
 
-            for (int i = 0; i < psObject->nVertices; i++)
-            {
-                ByteCopy(psObject->padfZ + i, pabyRec + nRecordSize, 8);
-#if defined(SHP_BIG_ENDIAN)
-                SHP_SWAP64(pabyRec + nRecordSize);
-#endif
-                nRecordSize += 8;
-            }
+            if (psObject->padfZ != SHPLIB_NULLPTR)
+                SHPPutDoubles(pabyRec + nRecordSize, psObject->padfZ,
+                              STATIC_CAST(uint32_t, psObject->nVertices));
+            else
+                memset(pabyRec + nRecordSize, 0, 8 * psObject->nVertices);
+            nRecordSize += 8 * psObject->nVertices;
         }
 
         if (psObject->bMeasureIsUsed &&
@@ -1605,14 +2178,9 @@ int SHPAPI_CALL SHPWriteObject(SHPHandle psSHP, int nShapeId,
 #endif
             nRecordSize += 8;
 
-            for (int i = 0; i < psObject->nVertices; i++)
-            {
-                ByteCopy(psObject->padfM + i, pabyRec + nRecordSize, 8);
-#if defined(SHP_BIG_ENDIAN)
-                SHP_SWAP64(pabyRec + nRecordSize);
-#endif
-                nRecordSize += 8;
-            }
+            SHPPutDoubles(pabyRec + nRecordSize, psObject->padfM,
+                          STATIC_CAST(uint32_t, psObject->nVertices));
+            nRecordSize += 8 * psObject->nVertices;
         }
     }
 
@@ -1623,22 +2191,15 @@ int SHPAPI_CALL SHPWriteObject(SHPHandle psSHP, int nShapeId,
              psObject->nSHPType == SHPT_POINTZ ||
              psObject->nSHPType == SHPT_POINTM)
     {
-        ByteCopy(psObject->padfX, pabyRec + 12, 8);
-        ByteCopy(psObject->padfY, pabyRec + 20, 8);
-
-#if defined(SHP_BIG_ENDIAN)
-        SHP_SWAP64(pabyRec + 12);
-        SHP_SWAP64(pabyRec + 20);
-#endif
+        SHPPutDouble(pabyRec + 12, padfXY ? padfXY[0] : psObject->padfX[0]);
+        SHPPutDouble(pabyRec + 20, padfXY ? padfXY[1] : psObject->padfY[0]);
 
         nRecordSize = 28;
 
         if (psObject->nSHPType == SHPT_POINTZ)
         {
-            ByteCopy(psObject->padfZ, pabyRec + nRecordSize, 8);
-#if defined(SHP_BIG_ENDIAN)
-            SHP_SWAP64(pabyRec + nRecordSize);
-#endif
+            SHPPutDouble(pabyRec + nRecordSize,
+                         psObject->padfZ ? psObject->padfZ[0] : 0.0);
             nRecordSize += 8;
         }
 
@@ -1666,52 +2227,10 @@ int SHPAPI_CALL SHPWriteObject(SHPHandle psSHP, int nShapeId,
         assert(false);
     }
 
-    /* -------------------------------------------------------------------- */
-    /*      Establish where we are going to put this record. If we are      */
-    /*      rewriting the last record of the file, then we can update it in */
-    /*      place. Otherwise if rewriting an existing record, and it will   */
-    /*      fit, then put it  back where the original came from.  Otherwise */
-    /*      write at the end.                                               */
-    /* -------------------------------------------------------------------- */
-    SAOffset nRecordOffset;
-    bool bAppendToLastRecord = false;
-    bool bAppendToFile = false;
-    if (nShapeId != -1 &&
-        psSHP->panRecOffset[nShapeId] + psSHP->panRecSize[nShapeId] + 8 ==
-            psSHP->nFileSize)
-    {
-        nRecordOffset = psSHP->panRecOffset[nShapeId];
-        bAppendToLastRecord = true;
-    }
-    else if (nShapeId == -1 || psSHP->panRecSize[nShapeId] < nRecordSize - 8)
-    {
-        if (psSHP->nFileSize > UINT_MAX - nRecordSize)
-        {
-            char str[255];
-            snprintf(str, sizeof(str),
-                     "Failed to write shape object. "
-                     "The maximum file size of %u has been reached. "
-                     "The current record of size %u cannot be added.",
-                     psSHP->nFileSize, nRecordSize);
-            str[sizeof(str) - 1] = '\0';
-            psSHP->sHooks.Error(str);
-            free(pabyRec);
-            return -1;
-        }
-
-        bAppendToFile = true;
-        nRecordOffset = psSHP->nFileSize;
-    }
-    else
-    {
-        nRecordOffset = psSHP->panRecOffset[nShapeId];
-    }
-
     /* -------------------------------------------------------------------- */
     /*      Set the shape type, record number, and record size.             */
     /* -------------------------------------------------------------------- */
-    uint32_t i32 =
-        (nShapeId < 0) ? psSHP->nRecords + 1 : nShapeId + 1; /* record # */
+    uint32_t i32 = nRecordNumber; /* record # */
 #if !defined(SHP_BIG_ENDIAN)
     SHP_SWAP32(&i32);
 #endif
@@ -1729,65 +2248,18 @@ int SHPAPI_CALL SHPWriteObject(SHPHandle psSHP, int nShapeId,
 #endif
     ByteCopy(&i32, pabyRec + 8, 4);
 
-    /* -------------------------------------------------------------------- */
-    /*      Write out record.                                               */
-    /* -------------------------------------------------------------------- */
-
-    /* -------------------------------------------------------------------- */
-    /*      Guard FSeek with check for whether we're already at position;   */
-    /*      no-op FSeeks defeat network filesystems' write buffering.       */
-    /* -------------------------------------------------------------------- */
-    if (psSHP->sHooks.FTell(psSHP->fpSHP) != nRecordOffset)
-    {
-        if (psSHP->sHooks.FSeek(psSHP->fpSHP, nRecordOffset, 0) != 0)
-        {
-            char szErrorMsg[200];
-
-            snprintf(szErrorMsg, sizeof(szErrorMsg),
-                     "Error in psSHP->sHooks.FSeek() while writing object to "
-                     ".shp file: %s",
-                     strerror(errno));
-            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
-            psSHP->sHooks.Error(szErrorMsg);
-
-            free(pabyRec);
-            return -1;
-        }
-    }
-    if (psSHP->sHooks.FWrite(pabyRec, nRecordSize, 1, psSHP->fpSHP) < 1)
-    {
-        char szErrorMsg[200];
-
-        snprintf(szErrorMsg, sizeof(szErrorMsg),
-                 "Error in psSHP->sHooks.FWrite() while writing object of %u "
-                 "bytes to .shp file: %s",
-                 nRecordSize, strerror(errno));
-        szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
-        psSHP->sHooks.Error(szErrorMsg);
-
-        free(pabyRec);
-        return -1;
-    }
-
-    free(pabyRec);
-
-    if (bAppendToLastRecord)
-    {
-        psSHP->nFileSize = psSHP->panRecOffset[nShapeId] + nRecordSize;
-    }
-    else if (bAppendToFile)
-    {
-        if (nShapeId == -1)
-            nShapeId = psSHP->nRecords++;
+    return nRecordSize;
+}
 
-        psSHP->panRecOffset[nShapeId] = psSHP->nFileSize;
-        psSHP->nFileSize += nRecordSize;
-    }
-    psSHP->panRecSize[nShapeId] = nRecordSize - 8;
+/************************************************************************/
+/*                        SHPExtendFileBounds()                         */
+/*                                                                      */
+/*      Expand file wide bounds based on a shape written to the file.   */
+/************************************************************************/
 
-    /* -------------------------------------------------------------------- */
-    /*      Expand file wide bounds based on this shape.                    */
-    /* -------------------------------------------------------------------- */
+static void SHPExtendFileBounds(SHPHandle psSHP, const SHPObject *psObject,
+                                bool bFirstFeature)
+{
     if (bFirstFeature)
     {
         if (psObject->nSHPType == SHPT_NULL || psObject->nVertices == 0)
@@ -1808,885 +2280,4202 @@ int SHPAPI_CALL SHPWriteObject(SHPHandle psSHP, int nShapeId,
         }
     }
 
-    for (int i = 0; i < psObject->nVertices; i++)
-    {
-        psSHP->adBoundsMin[0] = MIN(psSHP->adBoundsMin[0], psObject->padfX[i]);
-        psSHP->adBoundsMin[1] = MIN(psSHP->adBoundsMin[1], psObject->padfY[i]);
-        psSHP->adBoundsMax[0] = MAX(psSHP->adBoundsMax[0], psObject->padfX[i]);
-        psSHP->adBoundsMax[1] = MAX(psSHP->adBoundsMax[1], psObject->padfY[i]);
-        if (psObject->padfZ)
-        {
-            psSHP->adBoundsMin[2] =
-                MIN(psSHP->adBoundsMin[2], psObject->padfZ[i]);
-            psSHP->adBoundsMax[2] =
-                MAX(psSHP->adBoundsMax[2], psObject->padfZ[i]);
-        }
-        if (psObject->padfM)
-        {
-            psSHP->adBoundsMin[3] =
-                MIN(psSHP->adBoundsMin[3], psObject->padfM[i]);
-            psSHP->adBoundsMax[3] =
-                MAX(psSHP->adBoundsMax[3], psObject->padfM[i]);
-        }
-    }
-
-    return (nShapeId);
-}
-
-/************************************************************************/
-/*                         SHPAllocBuffer()                             */
-/************************************************************************/
-
-static void *SHPAllocBuffer(unsigned char **pBuffer, int nSize)
-{
-    if (pBuffer == SHPLIB_NULLPTR)
-        return calloc(1, nSize);
-
-    unsigned char *pRet = *pBuffer;
-    if (pRet == SHPLIB_NULLPTR)
-        return SHPLIB_NULLPTR;
-
-    (*pBuffer) += nSize;
-    return pRet;
+    SHPExtendRange(psObject->padfX, psObject->nVertices,
+                   &psSHP->adBoundsMin[0], &psSHP->adBoundsMax[0]);
+    SHPExtendRange(psObject->padfY, psObject->nVertices,
+                   &psSHP->adBoundsMin[1], &psSHP->adBoundsMax[1]);
+    if (psObject->padfZ)
+        SHPExtendRange(psObject->padfZ, psObject->nVertices,
+                       &psSHP->adBoundsMin[2], &psSHP->adBoundsMax[2]);
+    if (psObject->padfM)
+        SHPExtendRange(psObject->padfM, psObject->nVertices,
+                       &psSHP->adBoundsMin[3], &psSHP->adBoundsMax[3]);
 }
 
 /************************************************************************/
-/*                    SHPReallocObjectBufIfNecessary()                  */
+/*                    SHPExtendFileBoundsFromExtents()                  */
+/*                                                                      */
+/*      Same as SHPExtendFileBounds() from the extents of the shape,    */
+/*      its missing Z or M values being taken as zeros.                 */
 /************************************************************************/
 
-static unsigned char *SHPReallocObjectBufIfNecessary(SHPHandle psSHP,
-                                                     int nObjectBufSize)
+static void SHPExtendFileBoundsFromExtents(SHPHandle psSHP,
+                                           const SHPObject *psObject,
+                                           bool bFirstFeature)
 {
-    if (nObjectBufSize == 0)
-    {
-        nObjectBufSize = 4 * sizeof(double);
-    }
+    const double adfMin[4] = {psObject->dfXMin, psObject->dfYMin,
+                              psObject->dfZMin, psObject->dfMMin};
+    const double adfMax[4] = {psObject->dfXMax, psObject->dfYMax,
+                              psObject->dfZMax, psObject->dfMMax};
+    const bool bEmpty =
+        psObject->nSHPType == SHPT_NULL || psObject->nVertices == 0;
 
-    unsigned char *pBuffer;
-    if (nObjectBufSize > psSHP->nObjectBufSize)
+    for (int i = 0; i < 4; i++)
     {
-        pBuffer = STATIC_CAST(unsigned char *,
-                              realloc(psSHP->pabyObjectBuf, nObjectBufSize));
-        if (pBuffer != SHPLIB_NULLPTR)
+        if (bFirstFeature)
+            psSHP->adBoundsMin[i] = psSHP->adBoundsMax[i] =
+                bEmpty ? 0.0 : adfMin[i];
+        if (psObject->nVertices > 0)
         {
-            psSHP->pabyObjectBuf = pBuffer;
-            psSHP->nObjectBufSize = nObjectBufSize;
+            psSHP->adBoundsMin[i] = MIN(psSHP->adBoundsMin[i], adfMin[i]);
+            psSHP->adBoundsMax[i] = MAX(psSHP->adBoundsMax[i], adfMax[i]);
         }
     }
-    else
-    {
-        pBuffer = psSHP->pabyObjectBuf;
-    }
-
-    return pBuffer;
 }
 
 /************************************************************************/
-/*                          SHPReadObject()                             */
+/*                           SHPWriteShape()                            */
 /*                                                                      */
-/*      Read the vertices, parts, and other non-attribute information   */
-/*      for one shape.                                                  */
+/*      Implementation of SHPWriteObject(), with the vertices taken     */
+/*      from padfXY when not NULL (see SHPEncodeRecord()), and the      */
+/*      file bounds extended from the extents of the shape if           */
+/*      bBoundsFromExtents.                                             */
 /************************************************************************/
 
-SHPObject SHPAPI_CALL1(*) SHPReadObject(const SHPHandle psSHP, int hEntity)
+static int SHPWriteShape(SHPHandle psSHP, int nShapeId,
+                         const SHPObject *psObject, const double *padfXY,
+                         bool bBoundsFromExtents)
 {
+    psSHP->bUpdated = TRUE;
+
     /* -------------------------------------------------------------------- */
-    /*      Validate the record/entity number.                              */
+    /*      Ensure that shape object matches the type of the file it is     */
+    /*      being written to.                                               */
     /* -------------------------------------------------------------------- */
-    if (hEntity < 0 || hEntity >= psSHP->nRecords)
-        return SHPLIB_NULLPTR;
+    assert(psObject->nSHPType == psSHP->nShapeType ||
+           psObject->nSHPType == SHPT_NULL);
 
     /* -------------------------------------------------------------------- */
-    /*      Read offset/length from SHX loading if necessary.               */
+    /*      Ensure that -1 is used for appends.  Either blow an             */
+    /*      assertion, or if they are disabled, set the shapeid to -1       */
+    /*      for appends.                                                    */
     /* -------------------------------------------------------------------- */
-    if (psSHP->panRecOffset[hEntity] == 0 && psSHP->fpSHX != SHPLIB_NULLPTR)
-    {
-        unsigned int nOffset;
-        unsigned int nLength;
+    assert(nShapeId == -1 || (nShapeId >= 0 && nShapeId < psSHP->nRecords));
 
-        if (psSHP->sHooks.FSeek(psSHP->fpSHX, 100 + 8 * hEntity, 0) != 0 ||
-            psSHP->sHooks.FRead(&nOffset, 1, 4, psSHP->fpSHX) != 4 ||
-            psSHP->sHooks.FRead(&nLength, 1, 4, psSHP->fpSHX) != 4)
-        {
-            char str[128];
-            snprintf(str, sizeof(str),
-                     "Error in fseek()/fread() reading object from .shx file "
-                     "at offset %d",
-                     100 + 8 * hEntity);
-            str[sizeof(str) - 1] = '\0';
+    if (nShapeId != -1 && nShapeId >= psSHP->nRecords)
+        nShapeId = -1;
 
-            psSHP->sHooks.Error(str);
-            return SHPLIB_NULLPTR;
-        }
-#if !defined(SHP_BIG_ENDIAN)
-        SHP_SWAP32(&nOffset);
-        SHP_SWAP32(&nLength);
-#endif
+    /* -------------------------------------------------------------------- */
+    /*      Rewritten records may be in the write buffer.                   */
+    /* -------------------------------------------------------------------- */
+    if (nShapeId != -1 && !SHPFlushWriteBuffer(psSHP))
+        return -1;
 
-        if (nOffset > STATIC_CAST(unsigned int, INT_MAX))
-        {
-            char str[128];
-            snprintf(str, sizeof(str), "Invalid offset for entity %d", hEntity);
-            str[sizeof(str) - 1] = '\0';
+    /* -------------------------------------------------------------------- */
+    /*      Add the new entity to the in memory index.                      */
+    /* -------------------------------------------------------------------- */
+    if (nShapeId == -1 && !SHPGrowRecordIndex(psSHP, psSHP->nRecords + 1))
+        return -1;
 
-            psSHP->sHooks.Error(str);
-            return SHPLIB_NULLPTR;
-        }
-        if (nLength > STATIC_CAST(unsigned int, INT_MAX / 2 - 4))
+    /* -------------------------------------------------------------------- */
+    /*      Initialize record.                                              */
+    /* -------------------------------------------------------------------- */
+    size_t nRecMaxSize;
+    if (!SHPGetRecordMaxSize(psObject, &nRecMaxSize))
+    {
+        psSHP->sHooks.Error("Failed to write shape object. Too big geometry.");
+        return -1;
+    }
+    unsigned char *pabyRec = STATIC_CAST(unsigned char *, malloc(nRecMaxSize));
+    if (pabyRec == SHPLIB_NULLPTR)
+    {
+        psSHP->sHooks.Error("Failed to write shape object. "
+                            "Memory allocation error.");
+        return -1;
+    }
+
+    const bool bFirstFeature = psSHP->nRecords == 0;
+    const unsigned int nRecordSize = SHPEncodeRecord(
+        psObject, padfXY,
+        (nShapeId < 0) ? psSHP->nRecords + 1 : nShapeId + 1, pabyRec);
+
+    /* -------------------------------------------------------------------- */
+    /*      Establish where we are going to put this record. If we are      */
+    /*      rewriting the last record of the file, then we can update it in */
+    /*      place. Otherwise if rewriting an existing record, and it will   */
+    /*      fit, then put it  back where the original came from.  Otherwise */
+    /*      write at the end.                                               */
+    /* -------------------------------------------------------------------- */
+    SAOffset nRecordOffset;
+    bool bAppendToLastRecord = false;
+    bool bAppendToFile = false;
+    const SAOffset nFileSize = SHPGetFileSize(psSHP);
+    if (nShapeId != -1 && SHPGetRecordOffset(psSHP, nShapeId) +
+                                  psSHP->panRecSize[nShapeId] + 8 ==
+                              nFileSize)
+    {
+        nRecordOffset = SHPGetRecordOffset(psSHP, nShapeId);
+        bAppendToLastRecord = true;
+    }
+    else if (nShapeId == -1 || psSHP->panRecSize[nShapeId] < nRecordSize - 8)
+    {
+        if (nFileSize > SHPGetMaxFileSize(psSHP) - nRecordSize)
         {
-            char str[128];
-            snprintf(str, sizeof(str), "Invalid length for entity %d", hEntity);
+            char str[255];
+            snprintf(str, sizeof(str),
+                     "Failed to write shape object. "
+                     "The maximum file size of %.0f has been reached. "
+                     "The current record of size %u cannot be added.",
+                     STATIC_CAST(double, nFileSize), nRecordSize);
             str[sizeof(str) - 1] = '\0';
-
             psSHP->sHooks.Error(str);
-            return SHPLIB_NULLPTR;
+            free(pabyRec);
+            return -1;
         }
 
-        psSHP->panRecOffset[hEntity] = nOffset * 2;
-        psSHP->panRecSize[hEntity] = nLength * 2;
+        bAppendToFile = true;
+        nRecordOffset = nFileSize;
+    }
+    else
+    {
+        nRecordOffset = SHPGetRecordOffset(psSHP, nShapeId);
     }
 
     /* -------------------------------------------------------------------- */
-    /*      Ensure our record buffer is large enough.                       */
+    /*      Write out record.                                               */
+    /* -------------------------------------------------------------------- */
+
     /* -------------------------------------------------------------------- */
-    const int nEntitySize = psSHP->panRecSize[hEntity] + 8;
-    if (nEntitySize > psSHP->nBufSize)
+    /*      Appended records that fit go to the write buffer, if any.       */
+    /* -------------------------------------------------------------------- */
+    if (bAppendToFile && psSHP->pabyWriteBuf != SHPLIB_NULLPTR &&
+        nRecordSize <= STATIC_CAST(unsigned int, psSHP->nWriteBufSize))
     {
-        int nNewBufSize = nEntitySize;
-        if (nNewBufSize < INT_MAX - nNewBufSize / 3)
-            nNewBufSize += nNewBufSize / 3;
-        else
-            nNewBufSize = INT_MAX;
+        if (nRecordSize > STATIC_CAST(unsigned int, psSHP->nWriteBufSize -
+                                                        psSHP->nWriteBufUsed) &&
+            !SHPFlushWriteBuffer(psSHP))
+        {
+            free(pabyRec);
+            return -1;
+        }
 
-        /* Before allocating too much memory, check that the file is big enough */
-        /* and do not trust the file size in the header the first time we */
-        /* need to allocate more than 10 MB */
-        if (nNewBufSize >= 10 * 1024 * 1024)
+        memcpy(psSHP->pabyWriteBuf + psSHP->nWriteBufUsed, pabyRec,
+               nRecordSize);
+        psSHP->nWriteBufUsed += nRecordSize;
+    }
+    else
+    {
+        if (!SHPFlushWriteBuffer(psSHP))
         {
-            if (psSHP->nBufSize < 10 * 1024 * 1024)
-            {
-                SAOffset nFileSize;
-                psSHP->sHooks.FSeek(psSHP->fpSHP, 0, 2);
-                nFileSize = psSHP->sHooks.FTell(psSHP->fpSHP);
-                if (nFileSize >= UINT_MAX)
-                    psSHP->nFileSize = UINT_MAX;
-                else
-                    psSHP->nFileSize = STATIC_CAST(unsigned int, nFileSize);
-            }
+            free(pabyRec);
+            return -1;
+        }
 
-            if (psSHP->panRecOffset[hEntity] >= psSHP->nFileSize ||
-                /* We should normally use nEntitySize instead of*/
-                /* psSHP->panRecSize[hEntity] in the below test, but because of */
-                /* the case of non conformant .shx files detailed a bit below, */
-                /* let be more tolerant */
-                psSHP->panRecSize[hEntity] >
-                    psSHP->nFileSize - psSHP->panRecOffset[hEntity])
+        /* ---------------------------------------------------------------- */
+        /*      Guard FSeek with check for whether we're already at         */
+        /*      position; no-op FSeeks defeat network filesystems' write    */
+        /*      buffering.                                                  */
+        /* ---------------------------------------------------------------- */
+        if (psSHP->sHooks.FTell(psSHP->fpSHP) != nRecordOffset)
+        {
+            if (psSHP->sHooks.FSeek(psSHP->fpSHP, nRecordOffset, 0) != 0)
             {
-                char str[128];
-                snprintf(str, sizeof(str),
-                         "Error in fread() reading object of size %d at offset "
-                         "%u from .shp file",
-                         nEntitySize, psSHP->panRecOffset[hEntity]);
-                str[sizeof(str) - 1] = '\0';
+                char szErrorMsg[200];
 
-                psSHP->sHooks.Error(str);
-                return SHPLIB_NULLPTR;
+                snprintf(szErrorMsg, sizeof(szErrorMsg),
+                         "Error in psSHP->sHooks.FSeek() while writing "
+                         "object to .shp file: %s",
+                         strerror(errno));
+                szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+                psSHP->sHooks.Error(szErrorMsg);
+
+                free(pabyRec);
+                return -1;
             }
         }
-
-        unsigned char *pabyRecNew =
-            STATIC_CAST(unsigned char *, realloc(psSHP->pabyRec, nNewBufSize));
-        if (pabyRecNew == SHPLIB_NULLPTR)
+        if (psSHP->sHooks.FWrite(pabyRec, nRecordSize, 1, psSHP->fpSHP) < 1)
         {
-            char szErrorMsg[160];
+            char szErrorMsg[200];
+
             snprintf(szErrorMsg, sizeof(szErrorMsg),
-                     "Not enough memory to allocate requested memory "
-                     "(nNewBufSize=%d). "
-                     "Probably broken SHP file",
-                     nNewBufSize);
+                     "Error in psSHP->sHooks.FWrite() while writing object "
+                     "of %u bytes to .shp file: %s",
+                     nRecordSize, strerror(errno));
             szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
             psSHP->sHooks.Error(szErrorMsg);
-            return SHPLIB_NULLPTR;
-        }
 
-        /* Only set new buffer size after successful alloc */
-        psSHP->pabyRec = pabyRecNew;
-        psSHP->nBufSize = nNewBufSize;
+            free(pabyRec);
+            return -1;
+        }
     }
 
-    /* In case we were not able to reallocate the buffer on a previous step */
-    if (psSHP->pabyRec == SHPLIB_NULLPTR)
+    free(pabyRec);
+
+    if (bAppendToLastRecord)
     {
-        return SHPLIB_NULLPTR;
+        SHPStoreFileSize(psSHP, nRecordOffset + nRecordSize);
+    }
+    else if (bAppendToFile)
+    {
+        if (nShapeId == -1)
+            nShapeId = psSHP->nRecords++;
+
+        SHPStoreRecordOffset(psSHP, nShapeId, nFileSize);
+        SHPStoreFileSize(psSHP, nFileSize + nRecordSize);
     }
+    psSHP->panRecSize[nShapeId] = nRecordSize - 8;
 
     /* -------------------------------------------------------------------- */
-    /*      Read the record.                                                */
+    /*      Expand file wide bounds based on this shape.                    */
     /* -------------------------------------------------------------------- */
-    if (psSHP->sHooks.FSeek(psSHP->fpSHP, psSHP->panRecOffset[hEntity], 0) != 0)
-    {
-        /*
-         * TODO - mloskot: Consider detailed diagnostics of shape file,
-         * for example to detect if file is truncated.
-         */
-        char str[128];
-        snprintf(str, sizeof(str),
-                 "Error in fseek() reading object from .shp file at offset %u",
-                 psSHP->panRecOffset[hEntity]);
-        str[sizeof(str) - 1] = '\0';
+    if (bBoundsFromExtents)
+        SHPExtendFileBoundsFromExtents(psSHP, psObject, bFirstFeature);
+    else
+        SHPExtendFileBounds(psSHP, psObject, bFirstFeature);
 
-        psSHP->sHooks.Error(str);
-        return SHPLIB_NULLPTR;
-    }
+    return (nShapeId);
+}
 
-    const int nBytesRead = STATIC_CAST(
-        int, psSHP->sHooks.FRead(psSHP->pabyRec, 1, nEntitySize, psSHP->fpSHP));
+/************************************************************************/
+/*                           SHPWriteObject()                           */
+/*                                                                      */
+/*      Write out the vertices of a new structure.  Note that it is     */
+/*      only possible to write vertices at the end of the file.         */
+/************************************************************************/
 
-    /* Special case for a shapefile whose .shx content length field is not equal */
-    /* to the content length field of the .shp, which is a violation of "The */
-    /* content length stored in the index record is the same as the value stored in the main */
-    /* file record header." (http://www.esri.com/library/whitepapers/pdfs/shapefile.pdf, page 24) */
-    /* Actually in that case the .shx content length is equal to the .shp content length + */
-    /* 4 (16 bit words), representing the 8 bytes of the record header... */
-    if (nBytesRead >= 8 && nBytesRead == nEntitySize - 8)
-    {
-        /* Do a sanity check */
-        int nSHPContentLength;
-        memcpy(&nSHPContentLength, psSHP->pabyRec + 4, 4);
-#if !defined(SHP_BIG_ENDIAN)
-        SHP_SWAP32(&(nSHPContentLength));
-#endif
-        if (nSHPContentLength < 0 || nSHPContentLength > INT_MAX / 2 - 4 ||
-            2 * nSHPContentLength + 8 != nBytesRead)
-        {
-            char str[128];
-            snprintf(str, sizeof(str),
-                     "Sanity check failed when trying to recover from "
-                     "inconsistent .shx/.shp with shape %d",
-                     hEntity);
-            str[sizeof(str) - 1] = '\0';
+int SHPAPI_CALL SHPWriteObject(SHPHandle psSHP, int nShapeId,
+                               const SHPObject *psObject)
+{
+    return SHPWriteShape(psSHP, nShapeId, psObject, SHPLIB_NULLPTR, false);
+}
 
-            psSHP->sHooks.Error(str);
-            return SHPLIB_NULLPTR;
-        }
-    }
-    else if (nBytesRead != nEntitySize)
-    {
-        /*
-         * TODO - mloskot: Consider detailed diagnostics of shape file,
-         * for example to detect if file is truncated.
-         */
-        char str[128];
-        snprintf(str, sizeof(str),
-                 "Error in fread() reading object of size %d at offset %u from "
-                 ".shp file",
-                 nEntitySize, psSHP->panRecOffset[hEntity]);
-        str[sizeof(str) - 1] = '\0';
+/************************************************************************/
+/*                           SHPWriteArrays()                           */
+/*                                                                      */
+/*      Write a shape described by caller owned arrays, with the same   */
+/*      result as SHPWriteObject() on the object SHPCreateObject()      */
+/*      would create from them, but without copying them.               */
+/************************************************************************/
 
-        psSHP->sHooks.Error(str);
-        return SHPLIB_NULLPTR;
-    }
+static int SHPWriteArrays(SHPHandle psSHP, int nShapeId, int nSHPType,
+                          int nParts, const int *panPartStart,
+                          const int *panPartType, int nVertices,
+                          const double *padfX, const double *padfY,
+                          const double *padfXY, const double *padfZ,
+                          const double *padfM, const double *padfMinBound,
+                          const double *padfMaxBound)
+{
+    static const int anSinglePartStart[1] = {0};
 
-    if (8 + 4 > nEntitySize)
+    const bool bHasParts =
+        nSHPType == SHPT_ARC || nSHPType == SHPT_POLYGON ||
+        nSHPType == SHPT_ARCM || nSHPType == SHPT_POLYGONM ||
+        nSHPType == SHPT_ARCZ || nSHPType == SHPT_POLYGONZ ||
+        nSHPType == SHPT_MULTIPATCH;
+    const bool bIsPoint = nSHPType == SHPT_POINT || nSHPType == SHPT_POINTZ ||
+                          nSHPType == SHPT_POINTM;
+
+    if (nVertices < 0 || nParts < 0 || (bIsPoint && nVertices == 0) ||
+        (nVertices > 0 && padfXY == SHPLIB_NULLPTR &&
+         (padfX == SHPLIB_NULLPTR || padfY == SHPLIB_NULLPTR)) ||
+        (bHasParts && nParts > 1 && panPartStart == SHPLIB_NULLPTR) ||
+        (bHasParts && nParts > 0 && panPartStart != SHPLIB_NULLPTR &&
+         panPartStart[0] != 0))
     {
-        char szErrorMsg[160];
-        snprintf(szErrorMsg, sizeof(szErrorMsg),
-                 "Corrupted .shp file : shape %d : nEntitySize = %d", hEntity,
-                 nEntitySize);
-        szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
-        psSHP->sHooks.Error(szErrorMsg);
-        return SHPLIB_NULLPTR;
+        psSHP->sHooks.Error("Failed to write shape object. "
+                            "Invalid vertex or part arrays.");
+        return -1;
     }
-    int nSHPType;
-    memcpy(&nSHPType, psSHP->pabyRec + 8, 4);
 
-#if defined(SHP_BIG_ENDIAN)
-    SHP_SWAP32(&(nSHPType));
-#endif
+    bool bHasZ;
+    bool bHasM;
+    SHPGetTypeDimensions(nSHPType, &bHasZ, &bHasM);
 
     /* -------------------------------------------------------------------- */
-    /*      Allocate and minimally initialize the object.                   */
+    /*      Describe the arrays, which are only read.                       */
     /* -------------------------------------------------------------------- */
-    SHPObject *psShape;
-    if (psSHP->bFastModeReadObject)
-    {
-        if (psSHP->psCachedObject->bFastModeReadObject)
-        {
-            psSHP->sHooks.Error("Invalid read pattern in fast read mode. "
-                                "SHPDestroyObject() should be called.");
-            return SHPLIB_NULLPTR;
-        }
+    SHPObject sObject;
+    memset(&sObject, 0, sizeof(sObject));
+    sObject.nSHPType = nSHPType;
+    sObject.nShapeId = nShapeId;
 
-        psShape = psSHP->psCachedObject;
-        memset(psShape, 0, sizeof(SHPObject));
+    if (bHasParts)
+    {
+        sObject.nParts = MAX(1, nParts);
+        if (nParts == 0 || panPartStart == SHPLIB_NULLPTR)
+            panPartStart = anSinglePartStart;
+        sObject.panPartStart = CONST_CAST(int *, panPartStart);
+        if (nParts > 0)
+            sObject.panPartType = CONST_CAST(int *, panPartType);
     }
-    else
+
+    sObject.nVertices = nVertices;
+    sObject.padfX = CONST_CAST(double *, padfX);
+    sObject.padfY = CONST_CAST(double *, padfY);
+    if (bHasZ)
+        sObject.padfZ = CONST_CAST(double *, padfZ);
+    if (bHasM && padfM != SHPLIB_NULLPTR)
     {
-        psShape = STATIC_CAST(SHPObject *, calloc(1, sizeof(SHPObject)));
+        sObject.padfM = CONST_CAST(double *, padfM);
+        sObject.bMeasureIsUsed = TRUE;
     }
-    psShape->nShapeId = hEntity;
-    psShape->nSHPType = nSHPType;
-    psShape->bMeasureIsUsed = FALSE;
-    psShape->bFastModeReadObject = psSHP->bFastModeReadObject;
 
-    /* ==================================================================== */
-    /*  Extract vertices for a Polygon or Arc.                              */
-    /* ==================================================================== */
-    if (psShape->nSHPType == SHPT_POLYGON || psShape->nSHPType == SHPT_ARC ||
-        psShape->nSHPType == SHPT_POLYGONZ ||
-        psShape->nSHPType == SHPT_POLYGONM || psShape->nSHPType == SHPT_ARCZ ||
-        psShape->nSHPType == SHPT_ARCM || psShape->nSHPType == SHPT_MULTIPATCH)
+    /* -------------------------------------------------------------------- */
+    /*      Take the extents from the caller, or compute them.              */
+    /* -------------------------------------------------------------------- */
+    if (padfMinBound != SHPLIB_NULLPTR && padfMaxBound != SHPLIB_NULLPTR)
     {
-        if (40 + 8 + 4 > nEntitySize)
+        sObject.dfXMin = padfMinBound[0];
+        sObject.dfYMin = padfMinBound[1];
+        sObject.dfZMin = padfMinBound[2];
+        sObject.dfMMin = padfMinBound[3];
+        sObject.dfXMax = padfMaxBound[0];
+        sObject.dfYMax = padfMaxBound[1];
+        sObject.dfZMax = padfMaxBound[2];
+        sObject.dfMMax = padfMaxBound[3];
+    }
+    else if (nVertices > 0)
+    {
+        if (padfXY != SHPLIB_NULLPTR)
         {
-            char szErrorMsg[160];
-            snprintf(szErrorMsg, sizeof(szErrorMsg),
-                     "Corrupted .shp file : shape %d : nEntitySize = %d",
-                     hEntity, nEntitySize);
-            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
-            psSHP->sHooks.Error(szErrorMsg);
-            SHPDestroyObject(psShape);
-            return SHPLIB_NULLPTR;
+            sObject.dfXMin = sObject.dfXMax = padfXY[0];
+            sObject.dfYMin = sObject.dfYMax = padfXY[1];
+            for (int i = 1; i < nVertices; i++)
+            {
+                sObject.dfXMin = MIN(sObject.dfXMin, padfXY[2 * i]);
+                sObject.dfXMax = MAX(sObject.dfXMax, padfXY[2 * i]);
+                sObject.dfYMin = MIN(sObject.dfYMin, padfXY[2 * i + 1]);
+                sObject.dfYMax = MAX(sObject.dfYMax, padfXY[2 * i + 1]);
+            }
         }
-        /* -------------------------------------------------------------------- */
-        /*      Get the X/Y bounds.                                             */
-        /* -------------------------------------------------------------------- */
-#if defined(SHP_BIG_ENDIAN)
-        SHP_SWAPDOUBLE_CPY(&psShape->dfXMin, psSHP->pabyRec + 8 + 4);
-        SHP_SWAPDOUBLE_CPY(&psShape->dfYMin, psSHP->pabyRec + 8 + 12);
-        SHP_SWAPDOUBLE_CPY(&psShape->dfXMax, psSHP->pabyRec + 8 + 20);
-        SHP_SWAPDOUBLE_CPY(&psShape->dfYMax, psSHP->pabyRec + 8 + 28);
-#else
-        memcpy(&psShape->dfXMin, psSHP->pabyRec + 8 + 4, 8);
-        memcpy(&psShape->dfYMin, psSHP->pabyRec + 8 + 12, 8);
-        memcpy(&psShape->dfXMax, psSHP->pabyRec + 8 + 20, 8);
-        memcpy(&psShape->dfYMax, psSHP->pabyRec + 8 + 28, 8);
-#endif
-
-        /* -------------------------------------------------------------------- */
-        /*      Extract part/point count, and build vertex and part arrays      */
-        /*      to proper size.                                                 */
-        /* -------------------------------------------------------------------- */
-        uint32_t nPoints;
-        memcpy(&nPoints, psSHP->pabyRec + 40 + 8, 4);
-        uint32_t nParts;
-        memcpy(&nParts, psSHP->pabyRec + 36 + 8, 4);
-
-#if defined(SHP_BIG_ENDIAN)
-        SHP_SWAP32(&nPoints);
-        SHP_SWAP32(&nParts);
-#endif
-
-        /* nPoints and nParts are unsigned */
-        if (/* nPoints < 0 || nParts < 0 || */
-            nPoints > 50 * 1000 * 1000 || nParts > 10 * 1000 * 1000)
+        else
         {
-            char szErrorMsg[160];
-            snprintf(szErrorMsg, sizeof(szErrorMsg),
-                     "Corrupted .shp file : shape %d, nPoints=%u, nParts=%u.",
-                     hEntity, nPoints, nParts);
-            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
-            psSHP->sHooks.Error(szErrorMsg);
-            SHPDestroyObject(psShape);
-            return SHPLIB_NULLPTR;
+            sObject.dfXMin = sObject.dfXMax = padfX[0];
+            sObject.dfYMin = sObject.dfYMax = padfY[0];
+            SHPExtendRange(padfX, nVertices, &sObject.dfXMin, &sObject.dfXMax);
+            SHPExtendRange(padfY, nVertices, &sObject.dfYMin, &sObject.dfYMax);
         }
-
-        /* With the previous checks on nPoints and nParts, */
-        /* we should not overflow here and after */
-        /* since 50 M * (16 + 8 + 8) = 1 600 MB */
-        int nRequiredSize = 44 + 8 + 4 * nParts + 16 * nPoints;
-        if (psShape->nSHPType == SHPT_POLYGONZ ||
-            psShape->nSHPType == SHPT_ARCZ ||
-            psShape->nSHPType == SHPT_MULTIPATCH)
+        if (sObject.padfZ != SHPLIB_NULLPTR)
         {
-            nRequiredSize += 16 + 8 * nPoints;
+            sObject.dfZMin = sObject.dfZMax = sObject.padfZ[0];
+            SHPExtendRange(sObject.padfZ, nVertices, &sObject.dfZMin,
+                           &sObject.dfZMax);
         }
-        if (psShape->nSHPType == SHPT_MULTIPATCH)
+        if (sObject.padfM != SHPLIB_NULLPTR)
         {
-            nRequiredSize += 4 * nParts;
+            sObject.dfMMin = sObject.dfMMax = sObject.padfM[0];
+            SHPExtendRange(sObject.padfM, nVertices, &sObject.dfMMin,
+                           &sObject.dfMMax);
         }
-        if (nRequiredSize > nEntitySize)
+    }
+
+    return SHPWriteShape(psSHP, nShapeId, &sObject, padfXY, true);
+}
+
+/************************************************************************/
+/*                      SHPWriteObjectFromArrays()                      */
+/************************************************************************/
+
+int SHPAPI_CALL SHPWriteObjectFromArrays(
+    SHPHandle psSHP, int nShapeId, int nSHPType, int nParts,
+    const int *panPartStart, const int *panPartType, int nVertices,
+    const double *padfX, const double *padfY, const double *padfZ,
+    const double *padfM, const double *padfMinBound,
+    const double *padfMaxBound)
+{
+    return SHPWriteArrays(psSHP, nShapeId, nSHPType, nParts, panPartStart,
+                          panPartType, nVertices, padfX, padfY,
+                          SHPLIB_NULLPTR, padfZ, padfM, padfMinBound,
+                          padfMaxBound);
+}
+
+/************************************************************************/
+/*                  SHPWriteObjectFromInterleavedXY()                   */
+/************************************************************************/
+
+int SHPAPI_CALL SHPWriteObjectFromInterleavedXY(
+    SHPHandle psSHP, int nShapeId, int nSHPType, int nParts,
+    const int *panPartStart, const int *panPartType, int nVertices,
+    const double *padfXY, const double *padfZ, const double *padfM,
+    const double *padfMinBound, const double *padfMaxBound)
+{
+    return SHPWriteArrays(psSHP, nShapeId, nSHPType, nParts, panPartStart,
+                          panPartType, nVertices, SHPLIB_NULLPTR,
+                          SHPLIB_NULLPTR, padfXY, padfZ, padfM, padfMinBound,
+                          padfMaxBound);
+}
+/************************************************************************/
+/*                         SHPAllocBuffer()                             */
+/************************************************************************/
+
+static void *SHPAllocBuffer(unsigned char **pBuffer, int nSize)
+{
+    if (pBuffer == SHPLIB_NULLPTR)
+        return calloc(1, nSize);
+
+    unsigned char *pRet = *pBuffer;
+    if (pRet == SHPLIB_NULLPTR)
+        return SHPLIB_NULLPTR;
+
+    (*pBuffer) += nSize;
+    return pRet;
+}
+
+/************************************************************************/
+/*                    SHPReallocObjectBufIfNecessary()                  */
+/************************************************************************/
+
+static unsigned char *SHPReallocObjectBufIfNecessary(SHPHandle psSHP,
+                                                     int nObjectBufSize)
+{
+    if (nObjectBufSize == 0)
+    {
+        nObjectBufSize = 4 * sizeof(double);
+    }
+
+    unsigned char *pBuffer;
+    if (nObjectBufSize > psSHP->nObjectBufSize)
+    {
+        pBuffer = STATIC_CAST(unsigned char *,
+                              realloc(psSHP->pabyObjectBuf, nObjectBufSize));
+        if (pBuffer != SHPLIB_NULLPTR)
         {
-            char szErrorMsg[160];
-            snprintf(szErrorMsg, sizeof(szErrorMsg),
-                     "Corrupted .shp file : shape %d, nPoints=%u, nParts=%u, "
-                     "nEntitySize=%d.",
-                     hEntity, nPoints, nParts, nEntitySize);
-            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
-            psSHP->sHooks.Error(szErrorMsg);
-            SHPDestroyObject(psShape);
-            return SHPLIB_NULLPTR;
+            psSHP->pabyObjectBuf = pBuffer;
+            psSHP->nObjectBufSize = nObjectBufSize;
         }
+    }
+    else
+    {
+        pBuffer = psSHP->pabyObjectBuf;
+    }
+
+    return pBuffer;
+}
+
+/************************************************************************/
+/*                            SHPByteWindow                             */
+/*                                                                      */
+/*      A span of the .shp file already available in memory: either    */
+/*      the whole file mapping, or a range read by SHPReadObjects().    */
+/************************************************************************/
+
+typedef struct
+{
+    const unsigned char *pabyData;
+    SAOffset nOffset;
+    SAOffset nSize;
+} SHPByteWindow;
+
+/************************************************************************/
+/*                            SHPReaderInfo                             */
+/*                                                                      */
+/*      A reader shares the record index of its handle, which is        */
+/*      fully loaded when the reader is created, and owns its record    */
+/*      buffer, so that readers can be used from different threads.     */
+/************************************************************************/
 
-        unsigned char *pBuffer = SHPLIB_NULLPTR;
-        unsigned char **ppBuffer = SHPLIB_NULLPTR;
+struct SHPReaderInfo
+{
+    SHPHandle hSHP;
+
+    unsigned char *pabyRec;
+    int nBufSize;
+};
+
+/************************************************************************/
+/*                        SHPReadRecordBytes()                          */
+/*                                                                      */
+/*      Fetch the raw bytes (record header included) of one record.     */
+/*      When the record starts inside psWindow, or the .shp is memory   */
+/*      mapped (see SAHooks.FGetMapping), the returned pointer points   */
+/*      into that memory, otherwise the record is read into the buffer  */
+/*      of psReader, or psSHP->pabyRec if psReader is NULL.  The        */
+/*      number of bytes actually available is returned in *pnBytesRead. */
+/************************************************************************/
+
+static const unsigned char *SHPReadRecordBytes(SHPHandle psSHP, int hEntity,
+                                               int nEntitySize,
+                                               const SHPByteWindow *psWindow,
+                                               SHPReader psReader,
+                                               int *pnBytesRead)
+{
+    /* Appended records may still be in the write buffer */
+    if (psReader == SHPLIB_NULLPTR && !SHPFlushWriteBuffer(psSHP))
+        return SHPLIB_NULLPTR;
+
+    const SAOffset nOffset = SHPGetRecordOffset(psSHP, hEntity);
 
-        if (psShape->bFastModeReadObject)
+    /* -------------------------------------------------------------------- */
+    /*      Decode straight from the mapping if there is one.               */
+    /* -------------------------------------------------------------------- */
+    SHPByteWindow sMapping;
+    if ((psWindow == SHPLIB_NULLPTR || nOffset < psWindow->nOffset ||
+         nOffset - psWindow->nOffset >= psWindow->nSize) &&
+        psSHP->sHooks.FGetMapping != SHPLIB_NULLPTR)
+    {
+        sMapping.nOffset = 0;
+        sMapping.nSize = 0;
+        sMapping.pabyData = STATIC_CAST(
+            const unsigned char *,
+            psSHP->sHooks.FGetMapping(psSHP->fpSHP, &sMapping.nSize));
+        if (sMapping.pabyData != SHPLIB_NULLPTR)
         {
-            const int nObjectBufSize =
-                4 * sizeof(double) * nPoints + 2 * sizeof(int) * nParts;
-            pBuffer = SHPReallocObjectBufIfNecessary(psSHP, nObjectBufSize);
-            ppBuffer = &pBuffer;
+            if (nOffset >= sMapping.nSize)
+            {
+                char str[128];
+                snprintf(str, sizeof(str),
+                         "Error in fseek() reading object from .shp file at "
+                         "offset %.0f",
+                         STATIC_CAST(double, nOffset));
+                str[sizeof(str) - 1] = '\0';
+
+                psSHP->sHooks.Error(str);
+                return SHPLIB_NULLPTR;
+            }
+            psWindow = &sMapping;
         }
+    }
 
-        psShape->nVertices = nPoints;
-        psShape->padfX = STATIC_CAST(
-            double *, SHPAllocBuffer(ppBuffer, sizeof(double) * nPoints));
-        psShape->padfY = STATIC_CAST(
-            double *, SHPAllocBuffer(ppBuffer, sizeof(double) * nPoints));
-        psShape->padfZ = STATIC_CAST(
-            double *, SHPAllocBuffer(ppBuffer, sizeof(double) * nPoints));
-        psShape->padfM = STATIC_CAST(
-            double *, SHPAllocBuffer(ppBuffer, sizeof(double) * nPoints));
+    /* -------------------------------------------------------------------- */
+    /*      Serve the record from memory if it is available.                */
+    /* -------------------------------------------------------------------- */
+    if (psWindow != SHPLIB_NULLPTR && nOffset >= psWindow->nOffset &&
+        nOffset - psWindow->nOffset < psWindow->nSize)
+    {
+        const SAOffset nWindowOffset = nOffset - psWindow->nOffset;
+        if (psWindow->nSize - nWindowOffset <
+            STATIC_CAST(SAOffset, nEntitySize))
+            *pnBytesRead =
+                STATIC_CAST(int, psWindow->nSize - nWindowOffset);
+        else
+            *pnBytesRead = nEntitySize;
+        return psWindow->pabyData + nWindowOffset;
+    }
 
-        psShape->nParts = nParts;
-        psShape->panPartStart =
-            STATIC_CAST(int *, SHPAllocBuffer(ppBuffer, nParts * sizeof(int)));
-        psShape->panPartType =
-            STATIC_CAST(int *, SHPAllocBuffer(ppBuffer, nParts * sizeof(int)));
+    /* -------------------------------------------------------------------- */
+    /*      Ensure our record buffer is large enough.                       */
+    /* -------------------------------------------------------------------- */
+    unsigned char **ppabyRec = &psSHP->pabyRec;
+    int *pnBufSize = &psSHP->nBufSize;
+    if (psReader != SHPLIB_NULLPTR)
+    {
+        ppabyRec = &psReader->pabyRec;
+        pnBufSize = &psReader->nBufSize;
+    }
+
+    if (nEntitySize > *pnBufSize)
+    {
+        int nNewBufSize = nEntitySize;
+        if (nNewBufSize < INT_MAX - nNewBufSize / 3)
+            nNewBufSize += nNewBufSize / 3;
+        else
+            nNewBufSize = INT_MAX;
+
+        /* Before allocating too much memory, check that the file is big enough */
+        /* and do not trust the file size in the header the first time we */
+        /* need to allocate more than 10 MB. Readers must not modify the */
+        /* handle: SHPCreateReader() has already refreshed the file size. */
+        if (nNewBufSize >= 10 * 1024 * 1024)
+        {
+            if (psReader == SHPLIB_NULLPTR && *pnBufSize < 10 * 1024 * 1024)
+            {
+                psSHP->sHooks.FSeek(psSHP->fpSHP, 0, 2);
+                SHPStoreFileSize(psSHP, psSHP->sHooks.FTell(psSHP->fpSHP));
+            }
+
+            const SAOffset nFileSize = SHPGetFileSize(psSHP);
+            if (nOffset >= nFileSize ||
+                /* We should normally use nEntitySize instead of*/
+                /* psSHP->panRecSize[hEntity] in the below test, but because of */
+                /* the case of non conformant .shx files detailed a bit below, */
+                /* let be more tolerant */
+                psSHP->panRecSize[hEntity] > nFileSize - nOffset)
+            {
+                char str[128];
+                snprintf(str, sizeof(str),
+                         "Error in fread() reading object of size %d at offset "
+                         "%.0f from .shp file",
+                         nEntitySize, STATIC_CAST(double, nOffset));
+                str[sizeof(str) - 1] = '\0';
+
+                psSHP->sHooks.Error(str);
+                return SHPLIB_NULLPTR;
+            }
+        }
 
-        if (psShape->padfX == SHPLIB_NULLPTR ||
-            psShape->padfY == SHPLIB_NULLPTR ||
-            psShape->padfZ == SHPLIB_NULLPTR ||
-            psShape->padfM == SHPLIB_NULLPTR ||
-            psShape->panPartStart == SHPLIB_NULLPTR ||
-            psShape->panPartType == SHPLIB_NULLPTR)
+        unsigned char *pabyRecNew =
+            STATIC_CAST(unsigned char *, realloc(*ppabyRec, nNewBufSize));
+        if (pabyRecNew == SHPLIB_NULLPTR)
         {
             char szErrorMsg[160];
             snprintf(szErrorMsg, sizeof(szErrorMsg),
                      "Not enough memory to allocate requested memory "
-                     "(nPoints=%u, nParts=%u) for shape %d. "
+                     "(nNewBufSize=%d). "
                      "Probably broken SHP file",
-                     nPoints, nParts, hEntity);
+                     nNewBufSize);
             szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
             psSHP->sHooks.Error(szErrorMsg);
-            SHPDestroyObject(psShape);
             return SHPLIB_NULLPTR;
         }
 
-        for (int i = 0; STATIC_CAST(uint32_t, i) < nParts; i++)
-            psShape->panPartType[i] = SHPP_RING;
+        /* Only set new buffer size after successful alloc */
+        *ppabyRec = pabyRecNew;
+        *pnBufSize = nNewBufSize;
+    }
 
-        /* -------------------------------------------------------------------- */
-        /*      Copy out the part array from the record.                        */
-        /* -------------------------------------------------------------------- */
-        memcpy(psShape->panPartStart, psSHP->pabyRec + 44 + 8, 4 * nParts);
-        for (int i = 0; STATIC_CAST(uint32_t, i) < nParts; i++)
-        {
-#if defined(SHP_BIG_ENDIAN)
-            SHP_SWAP32(psShape->panPartStart + i);
-#endif
+    /* In case we were not able to reallocate the buffer on a previous step */
+    if (*ppabyRec == SHPLIB_NULLPTR)
+    {
+        return SHPLIB_NULLPTR;
+    }
 
-            /* We check that the offset is inside the vertex array */
-            if (psShape->panPartStart[i] < 0 ||
-                (psShape->panPartStart[i] >= psShape->nVertices &&
-                 psShape->nVertices > 0) ||
-                (psShape->panPartStart[i] > 0 && psShape->nVertices == 0))
-            {
-                char szErrorMsg[160];
-                snprintf(szErrorMsg, sizeof(szErrorMsg),
-                         "Corrupted .shp file : shape %d : panPartStart[%d] = "
-                         "%d, nVertices = %d",
-                         hEntity, i, psShape->panPartStart[i],
-                         psShape->nVertices);
-                szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
-                psSHP->sHooks.Error(szErrorMsg);
-                SHPDestroyObject(psShape);
-                return SHPLIB_NULLPTR;
-            }
-            if (i > 0 &&
-                psShape->panPartStart[i] <= psShape->panPartStart[i - 1])
-            {
-                char szErrorMsg[160];
-                snprintf(szErrorMsg, sizeof(szErrorMsg),
-                         "Corrupted .shp file : shape %d : panPartStart[%d] = "
-                         "%d, panPartStart[%d] = %d",
-                         hEntity, i, psShape->panPartStart[i], i - 1,
-                         psShape->panPartStart[i - 1]);
-                szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
-                psSHP->sHooks.Error(szErrorMsg);
-                SHPDestroyObject(psShape);
-                return SHPLIB_NULLPTR;
-            }
-        }
+    /* -------------------------------------------------------------------- */
+    /*      Read the record.                                                */
+    /* -------------------------------------------------------------------- */
+    *pnBytesRead = STATIC_CAST(
+        int, SAReadAt(&psSHP->sHooks, psSHP->fpSHP, nOffset, *ppabyRec,
+                      STATIC_CAST(SAOffset, nEntitySize)));
 
-        int nOffset = 44 + 8 + 4 * nParts;
+    return *ppabyRec;
+}
 
-        /* -------------------------------------------------------------------- */
-        /*      If this is a multipatch, we will also have parts types.         */
-        /* -------------------------------------------------------------------- */
-        if (psShape->nSHPType == SHPT_MULTIPATCH)
-        {
-            memcpy(psShape->panPartType, psSHP->pabyRec + nOffset, 4 * nParts);
-            for (int i = 0; STATIC_CAST(uint32_t, i) < nParts; i++)
-            {
-#if defined(SHP_BIG_ENDIAN)
-                SHP_SWAP32(psShape->panPartType + i);
+/************************************************************************/
+/*                         SHPSetRecordOffset()                         */
+/*                                                                      */
+/*      Validate and store the offset/length of a record from its      */
+/*      8 byte .shx entry.                                              */
+/************************************************************************/
+
+static int SHPSetRecordOffset(SHPHandle psSHP, int hEntity,
+                              const unsigned char *pabyEntry,
+                              int bReportErrors)
+{
+    unsigned int nOffset;
+    unsigned int nLength;
+    memcpy(&nOffset, pabyEntry, 4);
+    memcpy(&nLength, pabyEntry + 4, 4);
+#if !defined(SHP_BIG_ENDIAN)
+    SHP_SWAP32(&nOffset);
+    SHP_SWAP32(&nLength);
 #endif
-            }
 
-            nOffset += 4 * nParts;
+    if (!psSHP->bLargeFile && nOffset > STATIC_CAST(unsigned int, INT_MAX))
+    {
+        if (bReportErrors)
+        {
+            char str[128];
+            snprintf(str, sizeof(str), "Invalid offset for entity %d", hEntity);
+            str[sizeof(str) - 1] = '\0';
+
+            psSHP->sHooks.Error(str);
+        }
+        return FALSE;
+    }
+    if (nLength > STATIC_CAST(unsigned int, INT_MAX / 2 - 4))
+    {
+        if (bReportErrors)
+        {
+            char str[128];
+            snprintf(str, sizeof(str), "Invalid length for entity %d", hEntity);
+            str[sizeof(str) - 1] = '\0';
+
+            psSHP->sHooks.Error(str);
         }
+        return FALSE;
+    }
+
+    SHPStoreRecordOffset(psSHP, hEntity, STATIC_CAST(SAOffset, nOffset) * 2);
+    psSHP->panRecSize[hEntity] = nLength * 2;
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                        SHPLoadRecordOffset()                         */
+/*                                                                      */
+/*      Read offset/length of a record from the .shx if it has not      */
+/*      been loaded yet.  The .shx is read by pages of records, and     */
+/*      the entries of the page not loaded yet are loaded as well.      */
+/************************************************************************/
+
+/* Number of .shx entries read at once in lazy loading mode */
+#define SHP_SHX_PAGE_RECORDS 4096
+
+static int SHPLoadRecordOffset(SHPHandle psSHP, int hEntity)
+{
+    if (SHPGetRecordOffset(psSHP, hEntity) != 0 ||
+        psSHP->fpSHX == SHPLIB_NULLPTR)
+        return TRUE;
+
+    const int iFirst = hEntity - hEntity % SHP_SHX_PAGE_RECORDS;
+    const int nCount = MIN(SHP_SHX_PAGE_RECORDS, psSHP->nRecords - iFirst);
+
+    unsigned char *pabyPage =
+        STATIC_CAST(unsigned char *, malloc(8 * STATIC_CAST(size_t, nCount)));
+    if (pabyPage == SHPLIB_NULLPTR)
+    {
+        psSHP->sHooks.Error("Out of memory reading .shx file");
+        return FALSE;
+    }
+
+    /* A short read leaves the entries past the end of the .shx unloaded */
+    const int nRead = STATIC_CAST(
+        int, SAReadAt(&psSHP->sHooks, psSHP->fpSHX,
+                      100 + 8 * STATIC_CAST(SAOffset, iFirst), pabyPage,
+                      8 * STATIC_CAST(SAOffset, nCount)) /
+                 8);
+
+    for (int i = 0; i < nRead; i++)
+    {
+        /* Records written since the .shx was last flushed are only */
+        /* known in memory */
+        if (iFirst + i != hEntity && SHPGetRecordOffset(psSHP, iFirst + i) == 0)
+            SHPSetRecordOffset(psSHP, iFirst + i, pabyPage + 8 * i, FALSE);
+    }
+
+    int bRet = FALSE;
+    if (hEntity - iFirst < nRead)
+    {
+        bRet = SHPSetRecordOffset(psSHP, hEntity,
+                                  pabyPage + 8 * (hEntity - iFirst), TRUE);
+    }
+    else
+    {
+        char str[128];
+        snprintf(str, sizeof(str),
+                 "Error in fseek()/fread() reading object from .shx file "
+                 "at offset %d",
+                 100 + 8 * hEntity);
+        str[sizeof(str) - 1] = '\0';
+
+        psSHP->sHooks.Error(str);
+    }
+
+    free(pabyPage);
+    return bRet;
+}
+
+/************************************************************************/
+/*                      SHPLoadAllRecordOffsets()                       */
+/*                                                                      */
+/*      Load all the record offsets not loaded yet (lazy .shx           */
+/*      loading).                                                       */
+/************************************************************************/
+
+static int SHPLoadAllRecordOffsets(SHPHandle psSHP)
+{
+    for (int i = 0; psSHP->fpSHX != SHPLIB_NULLPTR && i < psSHP->nRecords; i++)
+    {
+        if (!SHPLoadRecordOffset(psSHP, i))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/************************************************************************/
+/*                          SHPGetWastedBytes()                         */
+/*                                                                      */
+/*      Return the number of bytes of the .shp not used by any          */
+/*      record, such as the former location of records rewritten       */
+/*      at the end of the file by SHPWriteObject().                     */
+/************************************************************************/
+
+SAOffset SHPAPI_CALL SHPGetWastedBytes(SHPHandle psSHP)
+{
+    if (!SHPLoadAllRecordOffsets(psSHP))
+        return 0;
+
+    SAOffset nUsedBytes = 100;
+    for (int i = 0; i < psSHP->nRecords; i++)
+        nUsedBytes += STATIC_CAST(SAOffset, psSHP->panRecSize[i]) + 8;
+
+    const SAOffset nFileSize = SHPGetFileSize(psSHP);
+    if (nUsedBytes >= nFileSize)
+        return 0;
+    return nFileSize - nUsedBytes;
+}
+
+/* Size of the buffer the records are streamed through by SHPCompact() */
+#define SHP_COMPACT_BUFFER_SIZE (1024 * 1024)
+
+/************************************************************************/
+/*                        SHPCompactRecords()                           */
+/*                                                                      */
+/*      Write the header and the records of psSHP in record order to    */
+/*      fpOut, and return the new offset of each record.                */
+/************************************************************************/
+
+static int SHPCompactRecords(SHPHandle psSHP, SAFile fpOut,
+                             unsigned char **ppabyBuf, size_t *pnBufSize,
+                             SAOffset *panNewOffset, SAOffset *pnNewFileSize)
+{
+    const SAHooks *psHooks = &psSHP->sHooks;
+    unsigned char abyHeader[100];
+
+    if (SAReadAt(psHooks, psSHP->fpSHP, 0, abyHeader, 100) != 100)
+    {
+        psHooks->Error(".shp file is unreadable, or corrupt.");
+        return FALSE;
+    }
+
+    SAOffset nNewFileSize = 100;
+    size_t nBufUsed = 0;
+
+    for (int i = 0; i < psSHP->nRecords; i++)
+    {
+        const size_t nRecordSize =
+            STATIC_CAST(size_t, psSHP->panRecSize[i]) + 8;
+        const SAOffset nRecordOffset = SHPGetRecordOffset(psSHP, i);
+        if (nRecordOffset < 100 ||
+            nRecordOffset + nRecordSize > SHPGetFileSize(psSHP))
+        {
+            char szErrorMsg[128];
+            snprintf(szErrorMsg, sizeof(szErrorMsg),
+                     "Invalid offset or length for entity %d", i);
+            psHooks->Error(szErrorMsg);
+            return FALSE;
+        }
+
+        /* The header is written last, once the file length is known */
+        if (nBufUsed + nRecordSize > *pnBufSize)
+        {
+            if (nBufUsed > 0 &&
+                (psHooks->FSeek(fpOut, nNewFileSize - nBufUsed, 0) != 0 ||
+                 psHooks->FWrite(*ppabyBuf, nBufUsed, 1, fpOut) != 1))
+            {
+                psHooks->Error("Failure writing compacted .shp file.");
+                return FALSE;
+            }
+            nBufUsed = 0;
+
+            if (nRecordSize > *pnBufSize)
+            {
+                unsigned char *pabyNewBuf = STATIC_CAST(
+                    unsigned char *, realloc(*ppabyBuf, nRecordSize));
+                if (pabyNewBuf == SHPLIB_NULLPTR)
+                {
+                    psHooks->Error("Out of memory compacting .shp file.");
+                    return FALSE;
+                }
+                *ppabyBuf = pabyNewBuf;
+                *pnBufSize = nRecordSize;
+            }
+        }
+
+        unsigned char *pabyRec = *ppabyBuf + nBufUsed;
+        if (SAReadAt(psHooks, psSHP->fpSHP, nRecordOffset, pabyRec,
+                     nRecordSize) != nRecordSize)
+        {
+            char szErrorMsg[128];
+            snprintf(szErrorMsg, sizeof(szErrorMsg),
+                     "Error reading entity %d from .shp file", i);
+            psHooks->Error(szErrorMsg);
+            return FALSE;
+        }
+
+        /* Renumber the record, and make its header agree with the .shx */
+        uint32_t i32 = i + 1;
+        ByteCopy(&i32, pabyRec, 4);
+        i32 = psSHP->panRecSize[i] / 2;
+        ByteCopy(&i32, pabyRec + 4, 4);
+#if !defined(SHP_BIG_ENDIAN)
+        SHP_SWAP32(pabyRec);
+        SHP_SWAP32(pabyRec + 4);
+#endif
+
+        panNewOffset[i] = nNewFileSize;
+        nNewFileSize += nRecordSize;
+        nBufUsed += nRecordSize;
+    }
+
+    /* The header cannot hold the size of files over 8 GB */
+    uint32_t i32 = STATIC_CAST(uint32_t, MIN(nNewFileSize / 2, UINT_MAX));
+    ByteCopy(&i32, abyHeader + 24, 4);
+#if !defined(SHP_BIG_ENDIAN)
+    SHP_SWAP32(abyHeader + 24);
+#endif
+
+    if ((nBufUsed > 0 &&
+         (psHooks->FSeek(fpOut, nNewFileSize - nBufUsed, 0) != 0 ||
+          psHooks->FWrite(*ppabyBuf, nBufUsed, 1, fpOut) != 1)) ||
+        psHooks->FSeek(fpOut, 0, 0) != 0 ||
+        psHooks->FWrite(abyHeader, 100, 1, fpOut) != 1)
+    {
+        psHooks->Error("Failure writing compacted .shp file.");
+        return FALSE;
+    }
+
+    *pnNewFileSize = nNewFileSize;
+    return TRUE;
+}
+
+/************************************************************************/
+/*                         SHPOpenForRewrite()                          */
+/*                                                                      */
+/*      Truncate and open for writing the existing file of the layer    */
+/*      with the pszExt or pszEXT extension, or create it with the      */
+/*      pszExt extension.                                               */
+/************************************************************************/
+
+static SAFile SHPOpenForRewrite(const SAHooks *psHooks, char *pszFullname,
+                                int nLenWithoutExtension, const char *pszExt,
+                                const char *pszEXT)
+{
+    memcpy(pszFullname + nLenWithoutExtension, pszEXT, 5);
+    SAFile fp = psHooks->FOpen(pszFullname, "rb", psHooks->pvUserData);
+    if (fp != SHPLIB_NULLPTR)
+        psHooks->FClose(fp);
+    else
+        memcpy(pszFullname + nLenWithoutExtension, pszExt, 5);
+
+    return psHooks->FOpen(pszFullname, "wb", psHooks->pvUserData);
+}
+
+/************************************************************************/
+/*                         SHPCompactCopyFile()                         */
+/*                                                                      */
+/*      Copy the nSize first bytes of fpIn to the file of the layer     */
+/*      with the pszExt or pszEXT extension.                            */
+/************************************************************************/
+
+static int SHPCompactCopyFile(const SAHooks *psHooks, SAFile fpIn,
+                              SAOffset nSize, char *pszFullname,
+                              int nLenWithoutExtension, const char *pszExt,
+                              const char *pszEXT, unsigned char *pabyBuf,
+                              size_t nBufSize)
+{
+    SAFile fpOut = SHPOpenForRewrite(psHooks, pszFullname,
+                                     nLenWithoutExtension, pszExt, pszEXT);
+    if (fpOut == SHPLIB_NULLPTR)
+        return FALSE;
+
+    int bRet = psHooks->FSeek(fpIn, 0, 0) == 0;
+    while (bRet && nSize > 0)
+    {
+        const size_t nChunk =
+            STATIC_CAST(size_t, MIN(nSize, STATIC_CAST(SAOffset, nBufSize)));
+        bRet = psHooks->FRead(pabyBuf, nChunk, 1, fpIn) == 1 &&
+               psHooks->FWrite(pabyBuf, nChunk, 1, fpOut) == 1;
+        nSize -= nChunk;
+    }
+
+    if (psHooks->FClose(fpOut) != 0)
+        bRet = FALSE;
+    return bRet;
+}
+
+/************************************************************************/
+/*                         SHPCompactWriteSHX()                         */
+/*                                                                      */
+/*      Write the .shx matching the compacted .shp, whose header is     */
+/*      read back from fpSHP.                                           */
+/************************************************************************/
+
+static int SHPCompactWriteSHX(const SAHooks *psHooks, SAFile fpSHP,
+                              const SAOffset *panNewOffset, int nRecords,
+                              SAOffset nNewFileSize, SAFile fpSHX,
+                              unsigned char *pabyBuf, size_t nBufSize)
+{
+    unsigned char abyHeader[100];
+    if (psHooks->FSeek(fpSHP, 0, 0) != 0 ||
+        psHooks->FRead(abyHeader, 100, 1, fpSHP) != 1)
+        return FALSE;
+
+    uint32_t i32 = 50 + 4 * nRecords;
+    ByteCopy(&i32, abyHeader + 24, 4);
+#if !defined(SHP_BIG_ENDIAN)
+    SHP_SWAP32(abyHeader + 24);
+#endif
+    if (psHooks->FWrite(abyHeader, 100, 1, fpSHX) != 1)
+        return FALSE;
+
+    /* Record sizes follow from the offsets as records are contiguous */
+    const int nEntriesPerChunk = STATIC_CAST(int, nBufSize / 8);
+    for (int iFirst = 0; iFirst < nRecords; iFirst += nEntriesPerChunk)
+    {
+        const int nCount = MIN(nEntriesPerChunk, nRecords - iFirst);
+        for (int i = 0; i < nCount; i++)
+        {
+            const int iRecord = iFirst + i;
+            const SAOffset nEnd = iRecord + 1 < nRecords
+                                      ? panNewOffset[iRecord + 1]
+                                      : nNewFileSize;
+            /* Only the low bits of offsets over 8 GB, as SHPWriteHeader() */
+            uint32_t i32Offset =
+                STATIC_CAST(uint32_t, panNewOffset[iRecord] / 2);
+            uint32_t i32Length =
+                STATIC_CAST(uint32_t, (nEnd - panNewOffset[iRecord] - 8) / 2);
+#if !defined(SHP_BIG_ENDIAN)
+            SHP_SWAP32(&i32Offset);
+            SHP_SWAP32(&i32Length);
+#endif
+            ByteCopy(&i32Offset, pabyBuf + 8 * i, 4);
+            ByteCopy(&i32Length, pabyBuf + 8 * i + 4, 4);
+        }
+
+        if (psHooks->FWrite(pabyBuf, 8 * STATIC_CAST(size_t, nCount), 1,
+                            fpSHX) != 1)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                          SHPCompactError()                           */
+/*                                                                      */
+/*      Report an error about the file of the layer with the pszExt     */
+/*      extension.                                                      */
+/************************************************************************/
+
+static void SHPCompactError(const SAHooks *psHooks, const char *pszMessage,
+                            const char *pszLayer, int nLenWithoutExtension,
+                            const char *pszExt)
+{
+    const size_t nMessageLen =
+        strlen(pszMessage) + nLenWithoutExtension + strlen(pszExt) + 3;
+    char *pszFullMessage = STATIC_CAST(char *, malloc(nMessageLen));
+    snprintf(pszFullMessage, nMessageLen, "%s %.*s%s.", pszMessage,
+             nLenWithoutExtension, pszLayer, pszExt);
+    psHooks->Error(pszFullMessage);
+    free(pszFullMessage);
+}
+
+/************************************************************************/
+/*                            SHPCompact()                              */
+/*                                                                      */
+/*      Rewrite the .shp of a layer with its records stored             */
+/*      contiguously in record order, and regenerate the .shx.          */
+/************************************************************************/
+
+int SHPAPI_CALL SHPCompact(const char *pszLayer)
+{
+    SAHooks sHooks;
+
+    SASetupDefaultHooks(&sHooks);
+
+    return SHPCompactLL(pszLayer, &sHooks);
+}
+
+int SHPAPI_CALL SHPCompactLL(const char *pszLayer, const SAHooks *psHooks)
+{
+    /* Large file mode reads the .shx64 index, and the real file size */
+    SHPHandle psSHP =
+        SHPOpenLL(pszLayer, sizeof(SAOffset) >= 8 ? "rbx" : "rb", psHooks);
+    if (psSHP == SHPLIB_NULLPTR)
+        return FALSE;
+
+    /* -------------------------------------------------------------------- */
+    /*      Stream the records to a temporary file.  The hooks offer no     */
+    /*      rename, so this file is then copied over the .shp.              */
+    /* -------------------------------------------------------------------- */
+    const int nLenWithoutExtension = SHPGetLenWithoutExtension(pszLayer);
+    char *pszTmpname = STATIC_CAST(char *, malloc(nLenWithoutExtension + 9));
+    memcpy(pszTmpname, pszLayer, nLenWithoutExtension);
+    memcpy(pszTmpname + nLenWithoutExtension, ".shp.tmp", 9);
+    char *pszFullname = STATIC_CAST(char *, malloc(nLenWithoutExtension + 5));
+    memcpy(pszFullname, pszLayer, nLenWithoutExtension);
+
+    const int nRecords = psSHP->nRecords;
+    size_t nBufSize = SHP_COMPACT_BUFFER_SIZE;
+    unsigned char *pabyBuf = STATIC_CAST(unsigned char *, malloc(nBufSize));
+    SAOffset *panNewOffset = STATIC_CAST(
+        SAOffset *,
+        malloc(sizeof(SAOffset) * STATIC_CAST(size_t, MAX(1, nRecords))));
+    if (pabyBuf == SHPLIB_NULLPTR || panNewOffset == SHPLIB_NULLPTR)
+    {
+        psHooks->Error("Out of memory compacting .shp file.");
+        free(pabyBuf);
+        free(panNewOffset);
+        free(pszFullname);
+        free(pszTmpname);
+        SHPClose(psSHP);
+        return FALSE;
+    }
+
+    SAFile fpTmp = psHooks->FOpen(pszTmpname, "w+b", psHooks->pvUserData);
+    if (fpTmp == SHPLIB_NULLPTR)
+    {
+        SHPCompactError(psHooks, "Unable to create", pszLayer,
+                        nLenWithoutExtension, ".shp.tmp");
+    }
+
+    SAOffset nNewFileSize = 0;
+    int bRet = fpTmp != SHPLIB_NULLPTR &&
+               SHPCompactRecords(psSHP, fpTmp, &pabyBuf, &nBufSize,
+                                 panNewOffset, &nNewFileSize);
+    SHPClose(psSHP);
+
+    if (!bRet)
+    {
+        if (fpTmp != SHPLIB_NULLPTR)
+        {
+            psHooks->FClose(fpTmp);
+            psHooks->Remove(pszTmpname, psHooks->pvUserData);
+        }
+    }
+    else
+    {
+        /* ---------------------------------------------------------------- */
+        /*      Replace the .shp, and regenerate the .shx.  A failure to    */
+        /*      replace the .shp leaves the temporary file in place.        */
+        /* ---------------------------------------------------------------- */
+        bRet = SHPCompactCopyFile(psHooks, fpTmp, nNewFileSize, pszFullname,
+                                  nLenWithoutExtension, ".shp", ".SHP",
+                                  pabyBuf, nBufSize);
+        if (!bRet)
+        {
+            SHPCompactError(psHooks,
+                            "Failure writing .shp file. "
+                            "Its compacted content is left in",
+                            pszLayer, nLenWithoutExtension, ".shp.tmp");
+            psHooks->FClose(fpTmp);
+        }
+        else
+        {
+            SAFile fpSHX = SHPOpenForRewrite(
+                psHooks, pszFullname, nLenWithoutExtension, ".shx", ".SHX");
+            bRet = fpSHX != SHPLIB_NULLPTR &&
+                   SHPCompactWriteSHX(psHooks, fpTmp, panNewOffset, nRecords,
+                                      nNewFileSize, fpSHX, pabyBuf, nBufSize);
+            if (fpSHX != SHPLIB_NULLPTR && psHooks->FClose(fpSHX) != 0)
+                bRet = FALSE;
+            if (!bRet)
+            {
+                SHPCompactError(psHooks, "Failure writing", pszLayer,
+                                nLenWithoutExtension, ".shx");
+            }
+            else
+            {
+                /* Write, or remove, the .shx64 index next to the .shx */
+                char *pszIndexFilename = SHPGetOffsetIndexFilename(pszFullname);
+                bRet = pszIndexFilename != SHPLIB_NULLPTR &&
+                       SHPWriteOffsetIndexFile(psHooks, pszIndexFilename,
+                                               panNewOffset, nRecords);
+                free(pszIndexFilename);
+            }
+
+            psHooks->FClose(fpTmp);
+            psHooks->Remove(pszTmpname, psHooks->pvUserData);
+        }
+    }
+
+    free(pabyBuf);
+    free(panNewOffset);
+    free(pszFullname);
+    free(pszTmpname);
+
+    return bRet;
+}
+
+/************************************************************************/
+/*                         SHPCheckRecordSize()                         */
+/*                                                                      */
+/*      Check the nBytesRead bytes fetched for a record expected to     */
+/*      hold nEntitySize bytes (header included) according to the       */
+/*      .shx, and return its usable size, or -1 after reporting an      */
+/*      error.                                                          */
+/************************************************************************/
+
+static int SHPCheckRecordSize(SHPHandle psSHP, int hEntity,
+                              const unsigned char *pabyRec, int nEntitySize,
+                              int nBytesRead)
+{
+    /* Special case for a shapefile whose .shx content length field is not equal */
+    /* to the content length field of the .shp, which is a violation of "The */
+    /* content length stored in the index record is the same as the value stored in the main */
+    /* file record header." (http://www.esri.com/library/whitepapers/pdfs/shapefile.pdf, page 24) */
+    /* Actually in that case the .shx content length is equal to the .shp content length + */
+    /* 4 (16 bit words), representing the 8 bytes of the record header... */
+    if (nBytesRead >= 8 && nBytesRead == nEntitySize - 8)
+    {
+        /* Do a sanity check */
+        int nSHPContentLength;
+        memcpy(&nSHPContentLength, pabyRec + 4, 4);
+#if !defined(SHP_BIG_ENDIAN)
+        SHP_SWAP32(&(nSHPContentLength));
+#endif
+        if (nSHPContentLength < 0 || nSHPContentLength > INT_MAX / 2 - 4 ||
+            2 * nSHPContentLength + 8 != nBytesRead)
+        {
+            char str[128];
+            snprintf(str, sizeof(str),
+                     "Sanity check failed when trying to recover from "
+                     "inconsistent .shx/.shp with shape %d",
+                     hEntity);
+            str[sizeof(str) - 1] = '\0';
+
+            psSHP->sHooks.Error(str);
+            return -1;
+        }
+
+        /* Only the bytes actually read belong to the record */
+        nEntitySize = nBytesRead;
+    }
+    else if (nBytesRead != nEntitySize)
+    {
+        /*
+         * TODO - mloskot: Consider detailed diagnostics of shape file,
+         * for example to detect if file is truncated.
+         */
+        char str[128];
+        snprintf(str, sizeof(str),
+                 "Error in fread() reading object of size %d at offset %.0f "
+                 "from .shp file",
+                 nEntitySize,
+                 STATIC_CAST(double, SHPGetRecordOffset(psSHP, hEntity)));
+        str[sizeof(str) - 1] = '\0';
+
+        psSHP->sHooks.Error(str);
+        return -1;
+    }
+
+    if (8 + 4 > nEntitySize)
+    {
+        char szErrorMsg[160];
+        snprintf(szErrorMsg, sizeof(szErrorMsg),
+                 "Corrupted .shp file : shape %d : nEntitySize = %d", hEntity,
+                 nEntitySize);
+        szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+        psSHP->sHooks.Error(szErrorMsg);
+        return -1;
+    }
+
+    return nEntitySize;
+}
+
+/************************************************************************/
+/*                          SHPFetchRecord()                            */
+/*                                                                      */
+/*      Validate the shape id, resolve its offset and size from the     */
+/*      .shx if it has not been loaded yet, and fetch the record        */
+/*      bytes, from psWindow when it covers the record.  On success     */
+/*      *pnEntitySize is set to the usable size of the record, header   */
+/*      included.  With a psReader, the handle is left untouched.       */
+/************************************************************************/
+
+static const unsigned char *SHPFetchRecord(SHPHandle psSHP, int hEntity,
+                                           const SHPByteWindow *psWindow,
+                                           SHPReader psReader,
+                                           int *pnEntitySize)
+{
+    /* -------------------------------------------------------------------- */
+    /*      Validate the record/entity number.                              */
+    /* -------------------------------------------------------------------- */
+    if (hEntity < 0 || hEntity >= psSHP->nRecords)
+        return SHPLIB_NULLPTR;
+
+    /* -------------------------------------------------------------------- */
+    /*      Read offset/length from SHX loading if necessary.               */
+    /* -------------------------------------------------------------------- */
+    if (psReader == SHPLIB_NULLPTR && !SHPLoadRecordOffset(psSHP, hEntity))
+        return SHPLIB_NULLPTR;
+
+    /* -------------------------------------------------------------------- */
+    /*      Fetch the record bytes.                                         */
+    /* -------------------------------------------------------------------- */
+    int nEntitySize = psSHP->panRecSize[hEntity] + 8;
+    int nBytesRead = 0;
+    const unsigned char *pabyRec =
+        SHPReadRecordBytes(psSHP, hEntity, nEntitySize, psWindow, psReader,
+                           &nBytesRead);
+    if (pabyRec == SHPLIB_NULLPTR)
+        return SHPLIB_NULLPTR;
+
+    nEntitySize =
+        SHPCheckRecordSize(psSHP, hEntity, pabyRec, nEntitySize, nBytesRead);
+    if (nEntitySize < 0)
+        return SHPLIB_NULLPTR;
+
+    *pnEntitySize = nEntitySize;
+    return pabyRec;
+}
+
+/************************************************************************/
+/*                          SHPParseRecord()                            */
+/*                                                                      */
+/*      Validate the layout of a record and fill a view pointing into   */
+/*      its bytes.  Nothing is allocated or copied apart from the       */
+/*      bounds.                                                         */
+/************************************************************************/
+
+static int SHPParseRecord(const SAHooks *psHooks, int hEntity,
+                          const unsigned char *pabyRec, int nEntitySize,
+                          SHPObjectView *psView)
+{
+    memset(psView, 0, sizeof(SHPObjectView));
+    psView->nShapeId = hEntity;
+    psView->nSHPType = SHPGetInt32(pabyRec + 8);
+
+    const int nSHPType = psView->nSHPType;
+
+    /* ==================================================================== */
+    /*  Extract vertices for a Polygon or Arc.                              */
+    /* ==================================================================== */
+    if (nSHPType == SHPT_POLYGON || nSHPType == SHPT_ARC ||
+        nSHPType == SHPT_POLYGONZ || nSHPType == SHPT_POLYGONM ||
+        nSHPType == SHPT_ARCZ || nSHPType == SHPT_ARCM ||
+        nSHPType == SHPT_MULTIPATCH)
+    {
+        if (40 + 8 + 4 > nEntitySize)
+        {
+            char szErrorMsg[160];
+            snprintf(szErrorMsg, sizeof(szErrorMsg),
+                     "Corrupted .shp file : shape %d : nEntitySize = %d",
+                     hEntity, nEntitySize);
+            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+            psHooks->Error(szErrorMsg);
+            return FALSE;
+        }
+        /* -------------------------------------------------------------------- */
+        /*      Get the X/Y bounds.                                             */
+        /* -------------------------------------------------------------------- */
+        psView->dfXMin = SHPGetDouble(pabyRec + 8 + 4);
+        psView->dfYMin = SHPGetDouble(pabyRec + 8 + 12);
+        psView->dfXMax = SHPGetDouble(pabyRec + 8 + 20);
+        psView->dfYMax = SHPGetDouble(pabyRec + 8 + 28);
+
+        /* -------------------------------------------------------------------- */
+        /*      Extract part/point count.                                       */
+        /* -------------------------------------------------------------------- */
+        uint32_t nPoints;
+        memcpy(&nPoints, pabyRec + 40 + 8, 4);
+        uint32_t nParts;
+        memcpy(&nParts, pabyRec + 36 + 8, 4);
+
+#if defined(SHP_BIG_ENDIAN)
+        SHP_SWAP32(&nPoints);
+        SHP_SWAP32(&nParts);
+#endif
+
+        /* nPoints and nParts are unsigned */
+        if (/* nPoints < 0 || nParts < 0 || */
+            nPoints > 50 * 1000 * 1000 || nParts > 10 * 1000 * 1000)
+        {
+            char szErrorMsg[160];
+            snprintf(szErrorMsg, sizeof(szErrorMsg),
+                     "Corrupted .shp file : shape %d, nPoints=%u, nParts=%u.",
+                     hEntity, nPoints, nParts);
+            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+            psHooks->Error(szErrorMsg);
+            return FALSE;
+        }
+
+        /* With the previous checks on nPoints and nParts, */
+        /* we should not overflow here and after */
+        /* since 50 M * (16 + 8 + 8) = 1 600 MB */
+        int nRequiredSize = 44 + 8 + 4 * nParts + 16 * nPoints;
+        if (nSHPType == SHPT_POLYGONZ || nSHPType == SHPT_ARCZ ||
+            nSHPType == SHPT_MULTIPATCH)
+        {
+            nRequiredSize += 16 + 8 * nPoints;
+        }
+        if (nSHPType == SHPT_MULTIPATCH)
+        {
+            nRequiredSize += 4 * nParts;
+        }
+        if (nRequiredSize > nEntitySize)
+        {
+            char szErrorMsg[160];
+            snprintf(szErrorMsg, sizeof(szErrorMsg),
+                     "Corrupted .shp file : shape %d, nPoints=%u, nParts=%u, "
+                     "nEntitySize=%d.",
+                     hEntity, nPoints, nParts, nEntitySize);
+            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+            psHooks->Error(szErrorMsg);
+            return FALSE;
+        }
+
+        psView->nVertices = nPoints;
+        psView->nParts = nParts;
+        psView->pabyPartStart = pabyRec + 44 + 8;
+
+        /* -------------------------------------------------------------------- */
+        /*      Check the part array.                                           */
+        /* -------------------------------------------------------------------- */
+        int nPrevPartStart = 0;
+        for (int i = 0; STATIC_CAST(uint32_t, i) < nParts; i++)
+        {
+            const int nPartStart = SHPGetInt32(psView->pabyPartStart + 4 * i);
+
+            /* We check that the offset is inside the vertex array */
+            if (nPartStart < 0 ||
+                (nPartStart >= psView->nVertices && psView->nVertices > 0) ||
+                (nPartStart > 0 && psView->nVertices == 0))
+            {
+                char szErrorMsg[160];
+                snprintf(szErrorMsg, sizeof(szErrorMsg),
+                         "Corrupted .shp file : shape %d : panPartStart[%d] = "
+                         "%d, nVertices = %d",
+                         hEntity, i, nPartStart, psView->nVertices);
+                szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+                psHooks->Error(szErrorMsg);
+                return FALSE;
+            }
+            if (i > 0 && nPartStart <= nPrevPartStart)
+            {
+                char szErrorMsg[160];
+                snprintf(szErrorMsg, sizeof(szErrorMsg),
+                         "Corrupted .shp file : shape %d : panPartStart[%d] = "
+                         "%d, panPartStart[%d] = %d",
+                         hEntity, i, nPartStart, i - 1, nPrevPartStart);
+                szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+                psHooks->Error(szErrorMsg);
+                return FALSE;
+            }
+            nPrevPartStart = nPartStart;
+        }
+
+        int nOffset = 44 + 8 + 4 * nParts;
+
+        /* -------------------------------------------------------------------- */
+        /*      If this is a multipatch, we will also have parts types.         */
+        /* -------------------------------------------------------------------- */
+        if (nSHPType == SHPT_MULTIPATCH)
+        {
+            psView->pabyPartType = pabyRec + nOffset;
+            nOffset += 4 * nParts;
+        }
+
+        psView->pabyXY = pabyRec + nOffset;
+        nOffset += 16 * nPoints;
+
+        /* -------------------------------------------------------------------- */
+        /*      If we have a Z coordinate, collect that now.                    */
+        /* -------------------------------------------------------------------- */
+        if (nSHPType == SHPT_POLYGONZ || nSHPType == SHPT_ARCZ ||
+            nSHPType == SHPT_MULTIPATCH)
+        {
+            psView->dfZMin = SHPGetDouble(pabyRec + nOffset);
+            psView->dfZMax = SHPGetDouble(pabyRec + nOffset + 8);
+            psView->pabyZ = pabyRec + nOffset + 16;
+
+            nOffset += 16 + 8 * nPoints;
+        }
+
+        /* -------------------------------------------------------------------- */
+        /*      If we have a M measure value, then read it now.  We assume      */
+        /*      that the measure can be present for any shape if the size is    */
+        /*      big enough, but really it will only occur for the Z shapes      */
+        /*      (options), and the M shapes.                                    */
+        /* -------------------------------------------------------------------- */
+        if (nEntitySize >= STATIC_CAST(int, nOffset + 16 + 8 * nPoints))
+        {
+            psView->dfMMin = SHPGetDouble(pabyRec + nOffset);
+            psView->dfMMax = SHPGetDouble(pabyRec + nOffset + 8);
+            psView->pabyM = pabyRec + nOffset + 16;
+            psView->bMeasureIsUsed = TRUE;
+        }
+    }
+
+    /* ==================================================================== */
+    /*  Extract vertices for a MultiPoint.                                  */
+    /* ==================================================================== */
+    else if (nSHPType == SHPT_MULTIPOINT || nSHPType == SHPT_MULTIPOINTM ||
+             nSHPType == SHPT_MULTIPOINTZ)
+    {
+        if (44 + 4 > nEntitySize)
+        {
+            char szErrorMsg[160];
+            snprintf(szErrorMsg, sizeof(szErrorMsg),
+                     "Corrupted .shp file : shape %d : nEntitySize = %d",
+                     hEntity, nEntitySize);
+            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+            psHooks->Error(szErrorMsg);
+            return FALSE;
+        }
+        uint32_t nPoints;
+        memcpy(&nPoints, pabyRec + 44, 4);
+
+#if defined(SHP_BIG_ENDIAN)
+        SHP_SWAP32(&nPoints);
+#endif
+
+        /* nPoints is unsigned */
+        if (/* nPoints < 0 || */ nPoints > 50 * 1000 * 1000)
+        {
+            char szErrorMsg[160];
+            snprintf(szErrorMsg, sizeof(szErrorMsg),
+                     "Corrupted .shp file : shape %d : nPoints = %u", hEntity,
+                     nPoints);
+            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+            psHooks->Error(szErrorMsg);
+            return FALSE;
+        }
+
+        int nRequiredSize = 48 + nPoints * 16;
+        if (nSHPType == SHPT_MULTIPOINTZ)
+        {
+            nRequiredSize += 16 + nPoints * 8;
+        }
+        if (nRequiredSize > nEntitySize)
+        {
+            char szErrorMsg[160];
+            snprintf(szErrorMsg, sizeof(szErrorMsg),
+                     "Corrupted .shp file : shape %d : nPoints = %u, "
+                     "nEntitySize = %d",
+                     hEntity, nPoints, nEntitySize);
+            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+            psHooks->Error(szErrorMsg);
+            return FALSE;
+        }
+
+        psView->nVertices = nPoints;
+        psView->pabyXY = pabyRec + 48;
+
+        int nOffset = 48 + 16 * nPoints;
+
+        /* -------------------------------------------------------------------- */
+        /*      Get the X/Y bounds.                                             */
+        /* -------------------------------------------------------------------- */
+        psView->dfXMin = SHPGetDouble(pabyRec + 8 + 4);
+        psView->dfYMin = SHPGetDouble(pabyRec + 8 + 12);
+        psView->dfXMax = SHPGetDouble(pabyRec + 8 + 20);
+        psView->dfYMax = SHPGetDouble(pabyRec + 8 + 28);
+
+        /* -------------------------------------------------------------------- */
+        /*      If we have a Z coordinate, collect that now.                    */
+        /* -------------------------------------------------------------------- */
+        if (nSHPType == SHPT_MULTIPOINTZ)
+        {
+            psView->dfZMin = SHPGetDouble(pabyRec + nOffset);
+            psView->dfZMax = SHPGetDouble(pabyRec + nOffset + 8);
+            psView->pabyZ = pabyRec + nOffset + 16;
+
+            nOffset += 16 + 8 * nPoints;
+        }
+
+        /* -------------------------------------------------------------------- */
+        /*      If we have a M measure value, then read it now.  We assume      */
+        /*      that the measure can be present for any shape if the size is    */
+        /*      big enough, but really it will only occur for the Z shapes      */
+        /*      (options), and the M shapes.                                    */
+        /* -------------------------------------------------------------------- */
+        if (nEntitySize >= STATIC_CAST(int, nOffset + 16 + 8 * nPoints))
+        {
+            psView->dfMMin = SHPGetDouble(pabyRec + nOffset);
+            psView->dfMMax = SHPGetDouble(pabyRec + nOffset + 8);
+            psView->pabyM = pabyRec + nOffset + 16;
+            psView->bMeasureIsUsed = TRUE;
+        }
+    }
+
+    /* ==================================================================== */
+    /*      Extract vertices for a point.                                   */
+    /* ==================================================================== */
+    else if (nSHPType == SHPT_POINT || nSHPType == SHPT_POINTM ||
+             nSHPType == SHPT_POINTZ)
+    {
+        if (20 + 8 + ((nSHPType == SHPT_POINTZ) ? 8 : 0) > nEntitySize)
+        {
+            char szErrorMsg[160];
+            snprintf(szErrorMsg, sizeof(szErrorMsg),
+                     "Corrupted .shp file : shape %d : nEntitySize = %d",
+                     hEntity, nEntitySize);
+            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+            psHooks->Error(szErrorMsg);
+            return FALSE;
+        }
+
+        psView->nVertices = 1;
+        psView->pabyXY = pabyRec + 12;
+
+        int nOffset = 20 + 8;
+
+        /* -------------------------------------------------------------------- */
+        /*      If we have a Z coordinate, collect that now.                    */
+        /* -------------------------------------------------------------------- */
+        if (nSHPType == SHPT_POINTZ)
+        {
+            psView->pabyZ = pabyRec + nOffset;
+            nOffset += 8;
+        }
+
+        /* -------------------------------------------------------------------- */
+        /*      If we have a M measure value, then read it now.  We assume      */
+        /*      that the measure can be present for any shape if the size is    */
+        /*      big enough, but really it will only occur for the Z shapes      */
+        /*      (options), and the M shapes.                                    */
+        /* -------------------------------------------------------------------- */
+        if (nEntitySize >= nOffset + 8)
+        {
+            psView->pabyM = pabyRec + nOffset;
+            psView->bMeasureIsUsed = TRUE;
+        }
+
+        /* -------------------------------------------------------------------- */
+        /*      Since no extents are supplied in the record, we will apply      */
+        /*      them from the single vertex.                                    */
+        /* -------------------------------------------------------------------- */
+        psView->dfXMin = psView->dfXMax = SHPGetDouble(psView->pabyXY);
+        psView->dfYMin = psView->dfYMax = SHPGetDouble(psView->pabyXY + 8);
+        if (psView->pabyZ != SHPLIB_NULLPTR)
+            psView->dfZMin = psView->dfZMax = SHPGetDouble(psView->pabyZ);
+        if (psView->pabyM != SHPLIB_NULLPTR)
+            psView->dfMMin = psView->dfMMax = SHPGetDouble(psView->pabyM);
+    }
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                        SHPReadObjectView()                           */
+/*                                                                      */
+/*      Expose one shape without decoding it into a SHPObject.  The     */
+/*      view points into the record buffer or file mapping, and is      */
+/*      only valid until the next read on this handle.                  */
+/************************************************************************/
+
+int SHPAPI_CALL SHPReadObjectView(const SHPHandle psSHP, int hEntity,
+                                  SHPObjectView *psView)
+{
+    int nEntitySize = 0;
+    const unsigned char *pabyRec =
+        SHPFetchRecord(psSHP, hEntity, SHPLIB_NULLPTR, SHPLIB_NULLPTR,
+                       &nEntitySize);
+    if (pabyRec == SHPLIB_NULLPTR)
+        return FALSE;
+
+    return SHPParseRecord(&psSHP->sHooks, hEntity, pabyRec, nEntitySize,
+                          psView);
+}
+
+/************************************************************************/
+/*                           SHPDecodeView()                            */
+/*                                                                      */
+/*      Decode a view into a zero initialized object.  The vertex and   */
+/*      part arrays are carved from *ppBuffer when it is not NULL (it   */
+/*      must then hold SHPGetDecodedSize() bytes), and individually     */
+/*      allocated otherwise.  With bFastMode, absent Z or M arrays are  */
+/*      left NULL, as documented for SHPSetFastModeReadObject().        */
+/************************************************************************/
+
+static int SHPGetDecodedSize(const SHPObjectView *psView)
+{
+    if (psView->nSHPType == SHPT_POINT || psView->nSHPType == SHPT_POINTM ||
+        psView->nSHPType == SHPT_POINTZ || psView->pabyXY == SHPLIB_NULLPTR)
+        return 0;
+
+    return 4 * sizeof(double) * psView->nVertices +
+           2 * sizeof(int) * psView->nParts;
+}
+
+static int SHPDecodeView(const SAHooks *psHooks,
+                         const SHPObjectView *psView, SHPObject *psShape,
+                         unsigned char **ppBuffer, int bFastMode)
+{
+    const int hEntity = psView->nShapeId;
+
+    psShape->nShapeId = hEntity;
+    psShape->nSHPType = psView->nSHPType;
+    psShape->bMeasureIsUsed = psView->bMeasureIsUsed;
+
+    psShape->dfXMin = psView->dfXMin;
+    psShape->dfYMin = psView->dfYMin;
+    psShape->dfZMin = psView->dfZMin;
+    psShape->dfMMin = psView->dfMMin;
+    psShape->dfXMax = psView->dfXMax;
+    psShape->dfYMax = psView->dfYMax;
+    psShape->dfZMax = psView->dfZMax;
+    psShape->dfMMax = psView->dfMMax;
+
+    /* ==================================================================== */
+    /*      A point keeps its single vertex in the bounds unless the        */
+    /*      arrays are individually allocated.                              */
+    /* ==================================================================== */
+    if (psView->nSHPType == SHPT_POINT || psView->nSHPType == SHPT_POINTM ||
+        psView->nSHPType == SHPT_POINTZ)
+    {
+        psShape->nVertices = 1;
+        if (ppBuffer != SHPLIB_NULLPTR)
+        {
+            psShape->padfX = &(psShape->dfXMin);
+            psShape->padfY = &(psShape->dfYMin);
+            psShape->padfZ = &(psShape->dfZMin);
+            psShape->padfM = &(psShape->dfMMin);
+        }
+        else
+        {
+            psShape->padfX = STATIC_CAST(double *, calloc(1, sizeof(double)));
+            psShape->padfY = STATIC_CAST(double *, calloc(1, sizeof(double)));
+            psShape->padfZ = STATIC_CAST(double *, calloc(1, sizeof(double)));
+            psShape->padfM = STATIC_CAST(double *, calloc(1, sizeof(double)));
+
+            psShape->padfX[0] = psView->dfXMin;
+            psShape->padfY[0] = psView->dfYMin;
+            psShape->padfZ[0] = psView->dfZMin;
+            psShape->padfM[0] = psView->dfMMin;
+        }
+
+        return TRUE;
+    }
+
+    /* ==================================================================== */
+    /*      Nothing more to do for null (or unknown) shapes.                */
+    /* ==================================================================== */
+    if (psView->pabyXY == SHPLIB_NULLPTR)
+        return TRUE;
+
+    /* ==================================================================== */
+    /*      Build vertex and part arrays to proper size for a polygon,      */
+    /*      arc or multipoint.                                              */
+    /* ==================================================================== */
+    const int bHasParts = psView->pabyPartStart != SHPLIB_NULLPTR;
+    const uint32_t nPoints = STATIC_CAST(uint32_t, psView->nVertices);
+    const uint32_t nParts = STATIC_CAST(uint32_t, psView->nParts);
+
+    psShape->nVertices = nPoints;
+    psShape->padfX = STATIC_CAST(
+        double *, SHPAllocBuffer(ppBuffer, sizeof(double) * nPoints));
+    psShape->padfY = STATIC_CAST(
+        double *, SHPAllocBuffer(ppBuffer, sizeof(double) * nPoints));
+    psShape->padfZ = STATIC_CAST(
+        double *, SHPAllocBuffer(ppBuffer, sizeof(double) * nPoints));
+    psShape->padfM = STATIC_CAST(
+        double *, SHPAllocBuffer(ppBuffer, sizeof(double) * nPoints));
+
+    if (bHasParts)
+    {
+        psShape->nParts = nParts;
+        psShape->panPartStart =
+            STATIC_CAST(int *, SHPAllocBuffer(ppBuffer, nParts * sizeof(int)));
+        psShape->panPartType =
+            STATIC_CAST(int *, SHPAllocBuffer(ppBuffer, nParts * sizeof(int)));
+    }
+
+    if (psShape->padfX == SHPLIB_NULLPTR || psShape->padfY == SHPLIB_NULLPTR ||
+        psShape->padfZ == SHPLIB_NULLPTR || psShape->padfM == SHPLIB_NULLPTR ||
+        (bHasParts && (psShape->panPartStart == SHPLIB_NULLPTR ||
+                       psShape->panPartType == SHPLIB_NULLPTR)))
+    {
+        char szErrorMsg[160];
+        if (bHasParts)
+            snprintf(szErrorMsg, sizeof(szErrorMsg),
+                     "Not enough memory to allocate requested memory "
+                     "(nPoints=%u, nParts=%u) for shape %d. "
+                     "Probably broken SHP file",
+                     nPoints, nParts, hEntity);
+        else
+            snprintf(szErrorMsg, sizeof(szErrorMsg),
+                     "Not enough memory to allocate requested memory "
+                     "(nPoints=%u) for shape %d. "
+                     "Probably broken SHP file",
+                     nPoints, hEntity);
+        szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+        psHooks->Error(szErrorMsg);
+        return FALSE;
+    }
+
+    /* -------------------------------------------------------------------- */
+    /*      Copy out the part arrays from the record.                       */
+    /* -------------------------------------------------------------------- */
+    for (int i = 0; bHasParts && STATIC_CAST(uint32_t, i) < nParts; i++)
+    {
+        psShape->panPartStart[i] = SHPGetInt32(psView->pabyPartStart + 4 * i);
+        psShape->panPartType[i] =
+            psView->pabyPartType != SHPLIB_NULLPTR
+                ? SHPGetInt32(psView->pabyPartType + 4 * i)
+                : SHPP_RING;
+    }
+
+    /* -------------------------------------------------------------------- */
+    /*      Copy out the vertices from the record.                          */
+    /* -------------------------------------------------------------------- */
+    SHPDeinterleaveXY(psView->pabyXY, psShape->padfX, psShape->padfY, nPoints);
+
+    /* -------------------------------------------------------------------- */
+    /*      Then the Z and M values if there are some.                      */
+    /* -------------------------------------------------------------------- */
+    if (psView->pabyZ != SHPLIB_NULLPTR)
+    {
+        SHPGetDoubles(psShape->padfZ, psView->pabyZ, nPoints);
+    }
+    else if (bFastMode)
+    {
+        psShape->padfZ = SHPLIB_NULLPTR;
+    }
+    else if (ppBuffer != SHPLIB_NULLPTR)
+    {
+        memset(psShape->padfZ, 0, 8 * nPoints);
+    }
+
+    if (psView->pabyM != SHPLIB_NULLPTR)
+    {
+        SHPGetDoubles(psShape->padfM, psView->pabyM, nPoints);
+    }
+    else if (bFastMode)
+    {
+        psShape->padfM = SHPLIB_NULLPTR;
+    }
+    else if (ppBuffer != SHPLIB_NULLPTR)
+    {
+        memset(psShape->padfM, 0, 8 * nPoints);
+    }
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                          SHPReadObject()                             */
+/*                                                                      */
+/*      Read the vertices, parts, and other non-attribute information   */
+/*      for one shape.                                                  */
+/************************************************************************/
+
+SHPObject SHPAPI_CALL1(*) SHPReadObject(const SHPHandle psSHP, int hEntity)
+{
+    int nEntitySize = 0;
+    const unsigned char *pabyRec =
+        SHPFetchRecord(psSHP, hEntity, SHPLIB_NULLPTR, SHPLIB_NULLPTR,
+                       &nEntitySize);
+    if (pabyRec == SHPLIB_NULLPTR)
+        return SHPLIB_NULLPTR;
+
+    if (psSHP->bFastModeReadObject &&
+        psSHP->psCachedObject->bFastModeReadObject)
+    {
+        psSHP->sHooks.Error("Invalid read pattern in fast read mode. "
+                            "SHPDestroyObject() should be called.");
+        return SHPLIB_NULLPTR;
+    }
+
+    SHPObjectView sView;
+    if (!SHPParseRecord(&psSHP->sHooks, hEntity, pabyRec, nEntitySize, &sView))
+        return SHPLIB_NULLPTR;
+
+    /* -------------------------------------------------------------------- */
+    /*      Allocate and minimally initialize the object.                   */
+    /* -------------------------------------------------------------------- */
+    SHPObject *psShape;
+    unsigned char *pBuffer = SHPLIB_NULLPTR;
+    unsigned char **ppBuffer = SHPLIB_NULLPTR;
+
+    if (psSHP->bFastModeReadObject)
+    {
+        psShape = psSHP->psCachedObject;
+        memset(psShape, 0, sizeof(SHPObject));
+
+        pBuffer =
+            SHPReallocObjectBufIfNecessary(psSHP, SHPGetDecodedSize(&sView));
+        ppBuffer = &pBuffer;
+    }
+    else
+    {
+        psShape = STATIC_CAST(SHPObject *, calloc(1, sizeof(SHPObject)));
+    }
+    psShape->bFastModeReadObject = psSHP->bFastModeReadObject;
+
+    if (!SHPDecodeView(&psSHP->sHooks, &sView, psShape, ppBuffer,
+                       psSHP->bFastModeReadObject))
+    {
+        SHPDestroyObject(psShape);
+        return SHPLIB_NULLPTR;
+    }
+
+    return (psShape);
+}
+
+/************************************************************************/
+/*                          SHPCreateReader()                           */
+/*                                                                      */
+/*      Create a reader on a handle.  Each reader has its own record    */
+/*      buffer and reads through positional I/O or the file mapping,    */
+/*      so distinct readers of the same handle can be used from         */
+/*      distinct threads, as long as the handle itself is neither       */
+/*      read nor modified meanwhile.                                    */
+/************************************************************************/
+
+SHPReader SHPAPI_CALL SHPCreateReader(SHPHandle psSHP)
+{
+    if (psSHP == SHPLIB_NULLPTR)
+        return SHPLIB_NULLPTR;
+
+    if (psSHP->sHooks.FReadAt == SHPLIB_NULLPTR &&
+        (psSHP->sHooks.FGetMapping == SHPLIB_NULLPTR ||
+         psSHP->sHooks.FGetMapping(psSHP->fpSHP, SHPLIB_NULLPTR) ==
+             SHPLIB_NULLPTR))
+    {
+        psSHP->sHooks.Error("SHPCreateReader() requires I/O hooks with "
+                            "FReadAt() or a memory mapped .shp file");
+        return SHPLIB_NULLPTR;
+    }
+
+    /* -------------------------------------------------------------------- */
+    /*      Complete the shared state now, so that readers never have to    */
+    /*      modify the handle.                                              */
+    /* -------------------------------------------------------------------- */
+    if (!SHPFlushWriteBuffer(psSHP) || !SHPLoadAllRecordOffsets(psSHP))
+        return SHPLIB_NULLPTR;
+
+    if (psSHP->sHooks.FSeek(psSHP->fpSHP, 0, 2) == 0)
+    {
+        SHPStoreFileSize(psSHP, psSHP->sHooks.FTell(psSHP->fpSHP));
+    }
+
+    SHPReader psReader =
+        STATIC_CAST(SHPReader, calloc(1, sizeof(struct SHPReaderInfo)));
+    if (psReader == SHPLIB_NULLPTR)
+    {
+        psSHP->sHooks.Error("Out of memory creating shape reader");
+        return SHPLIB_NULLPTR;
+    }
+    psReader->hSHP = psSHP;
+
+    return psReader;
+}
+
+/************************************************************************/
+/*                        SHPReaderReadObject()                         */
+/************************************************************************/
+
+SHPObject SHPAPI_CALL1(*) SHPReaderReadObject(SHPReader psReader, int hEntity)
+{
+    const SHPHandle psSHP = psReader->hSHP;
+
+    int nEntitySize = 0;
+    const unsigned char *pabyRec =
+        SHPFetchRecord(psSHP, hEntity, SHPLIB_NULLPTR, psReader, &nEntitySize);
+    if (pabyRec == SHPLIB_NULLPTR)
+        return SHPLIB_NULLPTR;
+
+    SHPObjectView sView;
+    if (!SHPParseRecord(&psSHP->sHooks, hEntity, pabyRec, nEntitySize, &sView))
+        return SHPLIB_NULLPTR;
+
+    SHPObject *psShape = STATIC_CAST(SHPObject *, calloc(1, sizeof(SHPObject)));
+    if (psShape == SHPLIB_NULLPTR)
+        return SHPLIB_NULLPTR;
+
+    if (!SHPDecodeView(&psSHP->sHooks, &sView, psShape, SHPLIB_NULLPTR, FALSE))
+    {
+        SHPDestroyObject(psShape);
+        return SHPLIB_NULLPTR;
+    }
+
+    return psShape;
+}
+
+/************************************************************************/
+/*                      SHPReaderReadObjectView()                       */
+/*                                                                      */
+/*      Same as SHPReadObjectView(), the view being valid until the     */
+/*      next read on this reader.                                       */
+/************************************************************************/
+
+int SHPAPI_CALL SHPReaderReadObjectView(SHPReader psReader, int hEntity,
+                                        SHPObjectView *psView)
+{
+    int nEntitySize = 0;
+    const unsigned char *pabyRec = SHPFetchRecord(
+        psReader->hSHP, hEntity, SHPLIB_NULLPTR, psReader, &nEntitySize);
+    if (pabyRec == SHPLIB_NULLPTR)
+        return FALSE;
+
+    return SHPParseRecord(&psReader->hSHP->sHooks, hEntity, pabyRec,
+                          nEntitySize, psView);
+}
+
+/************************************************************************/
+/*                          SHPDestroyReader()                          */
+/************************************************************************/
+
+void SHPAPI_CALL SHPDestroyReader(SHPReader psReader)
+{
+    if (psReader == SHPLIB_NULLPTR)
+        return;
+
+    free(psReader->pabyRec);
+    free(psReader);
+}
+
+/************************************************************************/
+/*                          SHPObjectArenaInfo                          */
+/*                                                                      */
+/*      Memory backing the objects returned by SHPReadObjects().  All   */
+/*      objects of a batch are carved from one block, which is reused   */
+/*      by the next batch; extra blocks are only chained while the      */
+/*      first one is too small, and merged on the next reset.           */
+/************************************************************************/
+
+typedef struct SHPArenaBlock
+{
+    struct SHPArenaBlock *psPrev;
+    size_t nSize;
+    size_t nUsed;
+} SHPArenaBlock;
+
+struct SHPObjectArenaInfo
+{
+    SHPArenaBlock *psBlock;
+
+    unsigned char *pabyWindow; /* .shp byte range of the current batch */
+    int nWindowBufSize;
+};
+
+/* Largest .shp byte range read at once by SHPReadObjects() */
+#define SHP_READ_WINDOW_MAX (16 * 1024 * 1024)
+
+/* Block payloads are kept 8-byte aligned for the double arrays */
+#define SHP_ARENA_ALIGN(n)                                                     \
+    ((STATIC_CAST(size_t, n) + 7) & ~STATIC_CAST(size_t, 7))
+#define SHP_ARENA_HEADER_SIZE SHP_ARENA_ALIGN(sizeof(SHPArenaBlock))
+
+/************************************************************************/
+/*                        SHPCreateObjectArena()                        */
+/************************************************************************/
+
+SHPObjectArena SHPAPI_CALL SHPCreateObjectArena(void)
+{
+    return STATIC_CAST(SHPObjectArena,
+                       calloc(1, sizeof(struct SHPObjectArenaInfo)));
+}
+
+/************************************************************************/
+/*                          SHPArenaReset()                             */
+/*                                                                      */
+/*      Make the whole arena available again, merging chained blocks    */
+/*      into a single one large enough for the previous batch.          */
+/************************************************************************/
+
+static void SHPArenaReset(SHPObjectArena hArena)
+{
+    SHPArenaBlock *psBlock = hArena->psBlock;
+    if (psBlock == SHPLIB_NULLPTR)
+        return;
+
+    if (psBlock->psPrev == SHPLIB_NULLPTR)
+    {
+        psBlock->nUsed = 0;
+        return;
+    }
+
+    size_t nTotal = 0;
+    while (psBlock != SHPLIB_NULLPTR)
+    {
+        SHPArenaBlock *psPrev = psBlock->psPrev;
+        nTotal += psBlock->nSize;
+        free(psBlock);
+        psBlock = psPrev;
+    }
+
+    hArena->psBlock = STATIC_CAST(
+        SHPArenaBlock *, malloc(SHP_ARENA_HEADER_SIZE + nTotal));
+    if (hArena->psBlock != SHPLIB_NULLPTR)
+    {
+        hArena->psBlock->psPrev = SHPLIB_NULLPTR;
+        hArena->psBlock->nSize = nTotal;
+        hArena->psBlock->nUsed = 0;
+    }
+}
+
+/************************************************************************/
+/*                          SHPArenaAlloc()                             */
+/************************************************************************/
+
+static void *SHPArenaAlloc(SHPObjectArena hArena, size_t nSize)
+{
+    nSize = SHP_ARENA_ALIGN(nSize);
+
+    SHPArenaBlock *psBlock = hArena->psBlock;
+    if (psBlock == SHPLIB_NULLPTR || psBlock->nSize - psBlock->nUsed < nSize)
+    {
+        size_t nNewSize = 64 * 1024;
+        if (psBlock != SHPLIB_NULLPTR && nNewSize < 2 * psBlock->nSize)
+            nNewSize = 2 * psBlock->nSize;
+        if (nNewSize < nSize)
+            nNewSize = nSize;
+
+        SHPArenaBlock *psNewBlock = STATIC_CAST(
+            SHPArenaBlock *, malloc(SHP_ARENA_HEADER_SIZE + nNewSize));
+        if (psNewBlock == SHPLIB_NULLPTR)
+            return SHPLIB_NULLPTR;
+        psNewBlock->psPrev = psBlock;
+        psNewBlock->nSize = nNewSize;
+        psNewBlock->nUsed = 0;
+        hArena->psBlock = psBlock = psNewBlock;
+    }
+
+    unsigned char *pabyRet = REINTERPRET_CAST(unsigned char *, psBlock) +
+                             SHP_ARENA_HEADER_SIZE + psBlock->nUsed;
+    psBlock->nUsed += nSize;
+    return pabyRet;
+}
+
+/************************************************************************/
+/*                       SHPDestroyObjectArena()                        */
+/************************************************************************/
+
+void SHPAPI_CALL SHPDestroyObjectArena(SHPObjectArena hArena)
+{
+    if (hArena == SHPLIB_NULLPTR)
+        return;
+
+    SHPArenaBlock *psBlock = hArena->psBlock;
+    while (psBlock != SHPLIB_NULLPTR)
+    {
+        SHPArenaBlock *psPrev = psBlock->psPrev;
+        free(psBlock);
+        psBlock = psPrev;
+    }
+
+    free(hArena->pabyWindow);
+    free(hArena);
+}
+
+/************************************************************************/
+/*                          SHPReadWindow()                             */
+/*                                                                      */
+/*      Read in one I/O the .shp bytes of the records [iFirst, iEnd[    */
+/*      that are laid out contiguously, up to SHP_READ_WINDOW_MAX       */
+/*      bytes.  Returns the index following the last covered record,    */
+/*      or iFirst when nothing could be read (the records are then      */
+/*      fetched one by one).                                            */
+/************************************************************************/
+
+static int SHPReadWindow(SHPHandle psSHP, SHPObjectArena hArena, int iFirst,
+                         int iEnd, SHPByteWindow *psWindow)
+{
+    if (!SHPFlushWriteBuffer(psSHP))
+        return iFirst;
+
+    const SAOffset nStart = SHPGetRecordOffset(psSHP, iFirst);
+    SAOffset nEnd = nStart;
+    int iNext = iFirst;
+
+    while (iNext < iEnd)
+    {
+        if (!SHPLoadRecordOffset(psSHP, iNext))
+            break;
+
+        const SAOffset nOffset = SHPGetRecordOffset(psSHP, iNext);
+        const unsigned int nSize = psSHP->panRecSize[iNext] + 8;
+        if (nOffset != nEnd || nSize > SHP_READ_WINDOW_MAX ||
+            nEnd - nStart > SHP_READ_WINDOW_MAX - nSize)
+            break;
+
+        nEnd += nSize;
+        iNext++;
+    }
+
+    if (iNext == iFirst)
+        return iFirst;
+
+    const int nWindowSize = STATIC_CAST(int, nEnd - nStart);
+    if (nWindowSize > hArena->nWindowBufSize)
+    {
+        unsigned char *pabyNewWindow = STATIC_CAST(
+            unsigned char *, realloc(hArena->pabyWindow, nWindowSize));
+        if (pabyNewWindow == SHPLIB_NULLPTR)
+            return iFirst;
+        hArena->pabyWindow = pabyNewWindow;
+        hArena->nWindowBufSize = nWindowSize;
+    }
+
+    psWindow->pabyData = hArena->pabyWindow;
+    psWindow->nOffset = nStart;
+    psWindow->nSize = SAReadAt(&psSHP->sHooks, psSHP->fpSHP, nStart,
+                               hArena->pabyWindow, nWindowSize);
+    return iNext;
+}
+
+/************************************************************************/
+/*                          SHPReadObjects()                            */
+/*                                                                      */
+/*      Read the nCount shapes starting at iFirst into papsObjects.     */
+/*      Contiguous records are read in a single I/O, and all the        */
+/*      objects are decoded into hArena, which is reset first: objects  */
+/*      from a previous call on the same arena become invalid.          */
+/************************************************************************/
+
+int SHPAPI_CALL SHPReadObjects(const SHPHandle psSHP, int iFirst, int nCount,
+                               SHPObjectArena hArena, SHPObject **papsObjects)
+{
+    if (hArena == SHPLIB_NULLPTR || iFirst < 0 || nCount < 0 ||
+        iFirst > psSHP->nRecords || nCount > psSHP->nRecords - iFirst)
+        return -1;
+
+    SHPArenaReset(hArena);
+
+    SAOffset nMappingSize = 0;
+    const int bMapped =
+        psSHP->sHooks.FGetMapping != SHPLIB_NULLPTR &&
+        psSHP->sHooks.FGetMapping(psSHP->fpSHP, &nMappingSize) !=
+            SHPLIB_NULLPTR;
+
+    const int iEnd = iFirst + nCount;
+    int nRead = 0;
+    SHPByteWindow sWindow;
+    int iWindowEnd = iFirst;
+
+    for (int hEntity = iFirst; hEntity < iEnd; hEntity++)
+    {
+        SHPObject **ppsObject = papsObjects + (hEntity - iFirst);
+        *ppsObject = SHPLIB_NULLPTR;
+
+        /* -------------------------------------------------------------------- */
+        /*      Read the next run of contiguous records when needed.            */
+        /* -------------------------------------------------------------------- */
+        const SHPByteWindow *psWindow = SHPLIB_NULLPTR;
+        if (hEntity < iWindowEnd)
+        {
+            psWindow = &sWindow;
+        }
+        else if (!bMapped && SHPLoadRecordOffset(psSHP, hEntity))
+        {
+            iWindowEnd = SHPReadWindow(psSHP, hArena, hEntity, iEnd, &sWindow);
+            if (hEntity < iWindowEnd)
+                psWindow = &sWindow;
+        }
+
+        int nEntitySize = 0;
+        const unsigned char *pabyRec =
+            SHPFetchRecord(psSHP, hEntity, psWindow, SHPLIB_NULLPTR,
+                           &nEntitySize);
+        if (pabyRec == SHPLIB_NULLPTR)
+            continue;
+
+        SHPObjectView sView;
+        if (!SHPParseRecord(&psSHP->sHooks, hEntity, pabyRec, nEntitySize,
+                            &sView))
+            continue;
+
+        /* -------------------------------------------------------------------- */
+        /*      Decode into the arena.                                          */
+        /* -------------------------------------------------------------------- */
+        const size_t nObjectSize = SHP_ARENA_ALIGN(sizeof(SHPObject));
+        unsigned char *pBuffer = STATIC_CAST(
+            unsigned char *,
+            SHPArenaAlloc(hArena, nObjectSize + SHPGetDecodedSize(&sView)));
+        if (pBuffer == SHPLIB_NULLPTR)
+        {
+            char szErrorMsg[160];
+            snprintf(szErrorMsg, sizeof(szErrorMsg),
+                     "Not enough memory to allocate requested memory "
+                     "for shape %d.",
+                     hEntity);
+            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+            psSHP->sHooks.Error(szErrorMsg);
+            continue;
+        }
+
+        SHPObject *psShape = REINTERPRET_CAST(SHPObject *, pBuffer);
+        memset(psShape, 0, sizeof(SHPObject));
+        /* Make SHPDestroyObject() a no-op on arena objects */
+        psShape->bFastModeReadObject = TRUE;
+        pBuffer += nObjectSize;
+
+        if (SHPDecodeView(&psSHP->sHooks, &sView, psShape, &pBuffer, FALSE))
+        {
+            *ppsObject = psShape;
+            nRead++;
+        }
+    }
+
+    return nRead;
+}
+
+/************************************************************************/
+/*                      Thread support primitives.                      */
+/*                                                                      */
+/*      Without thread support, SHPReadObjectsParallel() decodes and    */
+/*      SHPWriteObjects() encodes in the calling thread, and the        */
+/*      primitives are never waited on.                                 */
+/************************************************************************/
+
+#if defined(SHP_WIN32_THREADS)
+typedef CRITICAL_SECTION SHPMutex;
+typedef CONDITION_VARIABLE SHPCond;
+typedef HANDLE SHPThread;
+#define SHP_HAVE_THREADS
+#elif defined(SHP_POSIX_THREADS)
+typedef pthread_mutex_t SHPMutex;
+typedef pthread_cond_t SHPCond;
+typedef pthread_t SHPThread;
+#define SHP_HAVE_THREADS
+#else
+typedef int SHPMutex;
+typedef int SHPCond;
+typedef int SHPThread;
+#endif
+
+static void SHPMutexInit(SHPMutex *psMutex)
+{
+#if defined(SHP_WIN32_THREADS)
+    InitializeCriticalSection(psMutex);
+#elif defined(SHP_POSIX_THREADS)
+    pthread_mutex_init(psMutex, SHPLIB_NULLPTR);
+#else
+    (void)psMutex;
+#endif
+}
+
+static void SHPMutexDestroy(SHPMutex *psMutex)
+{
+#if defined(SHP_WIN32_THREADS)
+    DeleteCriticalSection(psMutex);
+#elif defined(SHP_POSIX_THREADS)
+    pthread_mutex_destroy(psMutex);
+#else
+    (void)psMutex;
+#endif
+}
+
+static void SHPMutexLock(SHPMutex *psMutex)
+{
+#if defined(SHP_WIN32_THREADS)
+    EnterCriticalSection(psMutex);
+#elif defined(SHP_POSIX_THREADS)
+    pthread_mutex_lock(psMutex);
+#else
+    (void)psMutex;
+#endif
+}
+
+static void SHPMutexUnlock(SHPMutex *psMutex)
+{
+#if defined(SHP_WIN32_THREADS)
+    LeaveCriticalSection(psMutex);
+#elif defined(SHP_POSIX_THREADS)
+    pthread_mutex_unlock(psMutex);
+#else
+    (void)psMutex;
+#endif
+}
+
+static void SHPCondInit(SHPCond *psCond)
+{
+#if defined(SHP_WIN32_THREADS)
+    InitializeConditionVariable(psCond);
+#elif defined(SHP_POSIX_THREADS)
+    pthread_cond_init(psCond, SHPLIB_NULLPTR);
+#else
+    (void)psCond;
+#endif
+}
+
+static void SHPCondDestroy(SHPCond *psCond)
+{
+#if defined(SHP_POSIX_THREADS)
+    pthread_cond_destroy(psCond);
+#else
+    (void)psCond;
+#endif
+}
+
+static void SHPCondWait(SHPCond *psCond, SHPMutex *psMutex)
+{
+#if defined(SHP_WIN32_THREADS)
+    SleepConditionVariableCS(psCond, psMutex, INFINITE);
+#elif defined(SHP_POSIX_THREADS)
+    pthread_cond_wait(psCond, psMutex);
+#else
+    (void)psCond;
+    (void)psMutex;
+#endif
+}
+
+static void SHPCondBroadcast(SHPCond *psCond)
+{
+#if defined(SHP_WIN32_THREADS)
+    WakeAllConditionVariable(psCond);
+#elif defined(SHP_POSIX_THREADS)
+    pthread_cond_broadcast(psCond);
+#else
+    (void)psCond;
+#endif
+}
+
+#ifdef SHP_HAVE_THREADS
+/* Default number of worker threads: the number of online processors */
+static int SHPGetCPUCount(void)
+{
+#if defined(SHP_WIN32_THREADS)
+    SYSTEM_INFO sInfo;
+    GetSystemInfo(&sInfo);
+    return STATIC_CAST(int, sInfo.dwNumberOfProcessors);
+#elif defined(_SC_NPROCESSORS_ONLN)
+    const long nCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+    return nCPUs > 0 ? STATIC_CAST(int, MIN(nCPUs, INT_MAX)) : 1;
+#else
+    return 1;
+#endif
+}
+#endif
+
+/* A function to run on a thread, and its argument */
+typedef struct
+{
+    void (*pfnRun)(void *pData);
+    void *pData;
+} SHPThreadJob;
+
+#if defined(SHP_WIN32_THREADS)
+static DWORD WINAPI SHPThreadMain(LPVOID pJob)
+{
+    const SHPThreadJob *psJob = STATIC_CAST(const SHPThreadJob *, pJob);
+    psJob->pfnRun(psJob->pData);
+    return 0;
+}
+#elif defined(SHP_POSIX_THREADS)
+static void *SHPThreadMain(void *pJob)
+{
+    const SHPThreadJob *psJob = STATIC_CAST(const SHPThreadJob *, pJob);
+    psJob->pfnRun(psJob->pData);
+    return SHPLIB_NULLPTR;
+}
+#endif
+
+/* psJob must remain valid until the thread is joined */
+static int SHPStartThread(SHPThread *phThread, SHPThreadJob *psJob)
+{
+#if defined(SHP_WIN32_THREADS)
+    *phThread = CreateThread(SHPLIB_NULLPTR, 0, SHPThreadMain, psJob, 0,
+                             SHPLIB_NULLPTR);
+    return *phThread != SHPLIB_NULLPTR;
+#elif defined(SHP_POSIX_THREADS)
+    return pthread_create(phThread, SHPLIB_NULLPTR, SHPThreadMain, psJob) == 0;
+#else
+    (void)phThread;
+    (void)psJob;
+    return FALSE;
+#endif
+}
+
+static void SHPJoinThread(SHPThread hThread)
+{
+#if defined(SHP_WIN32_THREADS)
+    WaitForSingleObject(hThread, INFINITE);
+    CloseHandle(hThread);
+#elif defined(SHP_POSIX_THREADS)
+    pthread_join(hThread, SHPLIB_NULLPTR);
+#else
+    (void)hThread;
+#endif
+}
+
+/************************************************************************/
+/*                          SHPParallelChunk                            */
+/*                                                                      */
+/*      A run of consecutive records of SHPReadObjectsParallel().  The  */
+/*      calling thread fetches the raw record bytes (from the file      */
+/*      mapping, or read in a private buffer), a worker decodes them,   */
+/*      and the calling thread hands the objects to the callback.       */
+/************************************************************************/
+
+/* Upper bounds of the records and bytes of a chunk */
+#define SHP_PARALLEL_CHUNK_RECORDS 256
+#define SHP_PARALLEL_CHUNK_BYTES (4 * 1024 * 1024)
+/* Chunks in flight per worker, bounding memory use and reordering */
+#define SHP_PARALLEL_CHUNKS_PER_THREAD 4
+#define SHP_PARALLEL_MAX_THREADS 256
+
+typedef enum
+{
+    SHP_CHUNK_FREE,
+    SHP_CHUNK_FETCHED,
+    SHP_CHUNK_DECODING,
+    SHP_CHUNK_DECODED
+} SHPChunkState;
+
+typedef struct
+{
+    SHPChunkState eState;
+    int nSequence;
+
+    int iFirst;
+    int nRecords;
+    const unsigned char **papabyRec; /* NULL for unreadable records */
+    int *panRecSize;
+    SHPObject **papsObjects;
+    bool *pabDecodeFailed; /* error not reported yet by a worker */
+
+    unsigned char *pabyData; /* NULL when records point into the mapping */
+    size_t nDataBufSize;
+} SHPParallelChunk;
+
+typedef struct
+{
+    SAHooks sWorkerHooks; /* with an Error() hook that reports nothing */
+
+    SHPMutex hMutex;
+    SHPCond hCond; /* signaled on any chunk state change */
+    int bNoMoreChunks;
+    int bAbort; /* the remaining chunks are not needed */
+
+    SHPParallelChunk *pasChunks;
+    int nChunks;
+} SHPParallelContext;
+
+/************************************************************************/
+/*                      SHPParallelIgnoreError()                        */
+/*                                                                      */
+/*      Error() hook of the workers.  The user hook may not be thread   */
+/*      safe, so the records whose decoding fails are decoded again by  */
+/*      the calling thread, which reports the error.                    */
+/************************************************************************/
+
+static void SHPParallelIgnoreError(const char *message)
+{
+    (void)message;
+}
+
+/************************************************************************/
+/*                      SHPParallelDecodeRecord()                       */
+/************************************************************************/
+
+static SHPObject *SHPParallelDecodeRecord(const SAHooks *psHooks,
+                                          const SHPParallelChunk *psChunk,
+                                          int i)
+{
+    if (psChunk->papabyRec[i] == SHPLIB_NULLPTR)
+        return SHPLIB_NULLPTR;
+
+    SHPObjectView sView;
+    if (!SHPParseRecord(psHooks, psChunk->iFirst + i, psChunk->papabyRec[i],
+                        psChunk->panRecSize[i], &sView))
+        return SHPLIB_NULLPTR;
+
+    SHPObject *psShape = STATIC_CAST(SHPObject *, calloc(1, sizeof(SHPObject)));
+    if (psShape != SHPLIB_NULLPTR &&
+        !SHPDecodeView(psHooks, &sView, psShape, SHPLIB_NULLPTR, FALSE))
+    {
+        SHPDestroyObject(psShape);
+        psShape = SHPLIB_NULLPTR;
+    }
+    return psShape;
+}
+
+/************************************************************************/
+/*                      SHPParallelDecodeChunk()                        */
+/************************************************************************/
+
+static void SHPParallelDecodeChunk(const SAHooks *psHooks,
+                                   SHPParallelChunk *psChunk)
+{
+    for (int i = 0; i < psChunk->nRecords; i++)
+    {
+        psChunk->papsObjects[i] = SHPParallelDecodeRecord(psHooks, psChunk, i);
+        psChunk->pabDecodeFailed[i] =
+            psChunk->papsObjects[i] == SHPLIB_NULLPTR &&
+            psChunk->papabyRec[i] != SHPLIB_NULLPTR &&
+            psHooks->Error == SHPParallelIgnoreError;
+    }
+}
+
+/************************************************************************/
+/*                        SHPParallelWorker()                           */
+/*                                                                      */
+/*      Decode fetched chunks, oldest first, until told to stop.        */
+/************************************************************************/
+
+static void SHPParallelWorker(void *pContext)
+{
+    SHPParallelContext *psContext = STATIC_CAST(SHPParallelContext *, pContext);
+
+    SHPMutexLock(&psContext->hMutex);
+    while (true)
+    {
+        SHPParallelChunk *psChunk = SHPLIB_NULLPTR;
+        for (int i = 0; i < psContext->nChunks; i++)
+        {
+            SHPParallelChunk *psCandidate = psContext->pasChunks + i;
+            if (psCandidate->eState == SHP_CHUNK_FETCHED &&
+                (psChunk == SHPLIB_NULLPTR ||
+                 psCandidate->nSequence < psChunk->nSequence))
+                psChunk = psCandidate;
+        }
+
+        if (psContext->bAbort)
+            break;
+        if (psChunk == SHPLIB_NULLPTR)
+        {
+            if (psContext->bNoMoreChunks)
+                break;
+            SHPCondWait(&psContext->hCond, &psContext->hMutex);
+            continue;
+        }
+
+        psChunk->eState = SHP_CHUNK_DECODING;
+        SHPMutexUnlock(&psContext->hMutex);
+
+        SHPParallelDecodeChunk(&psContext->sWorkerHooks, psChunk);
+
+        SHPMutexLock(&psContext->hMutex);
+        psChunk->eState = SHP_CHUNK_DECODED;
+        SHPCondBroadcast(&psContext->hCond);
+    }
+    SHPMutexUnlock(&psContext->hMutex);
+}
+
+/************************************************************************/
+/*                       SHPParallelFetchChunk()                        */
+/*                                                                      */
+/*      Fetch the raw bytes of the records from iFirst (and before      */
+/*      iEnd) into a free chunk, contiguous records being read in one   */
+/*      I/O.  Runs in the calling thread, which owns the handle.        */
+/*      Returns FALSE on out of memory.                                 */
+/************************************************************************/
+
+static int SHPParallelFetchChunk(SHPHandle psSHP, SHPParallelChunk *psChunk,
+                                 int iFirst, int iEnd)
+{
+    /* -------------------------------------------------------------------- */
+    /*      Select the records of the chunk, whose size is -1 when its      */
+    /*      offset cannot be read from the .shx.                            */
+    /* -------------------------------------------------------------------- */
+    size_t nDataSize = 0;
+    int nRecords = 0;
+    while (iFirst + nRecords < iEnd && nRecords < SHP_PARALLEL_CHUNK_RECORDS)
+    {
+        const int hEntity = iFirst + nRecords;
+        int nEntitySize = -1;
+        if (SHPLoadRecordOffset(psSHP, hEntity))
+            nEntitySize = STATIC_CAST(int, psSHP->panRecSize[hEntity] + 8);
+        const size_t nSize = STATIC_CAST(size_t, MAX(nEntitySize, 0));
+        if (nRecords > 0 && nDataSize + nSize > SHP_PARALLEL_CHUNK_BYTES)
+            break;
+        psChunk->panRecSize[nRecords] = nEntitySize;
+        nDataSize += nSize;
+        nRecords++;
+    }
+
+    psChunk->iFirst = iFirst;
+    psChunk->nRecords = nRecords;
+
+    SAOffset nMappingSize = 0;
+    const unsigned char *pabyMapping = SHPLIB_NULLPTR;
+    if (psSHP->sHooks.FGetMapping != SHPLIB_NULLPTR)
+        pabyMapping = STATIC_CAST(
+            const unsigned char *,
+            psSHP->sHooks.FGetMapping(psSHP->fpSHP, &nMappingSize));
+
+    if (pabyMapping == SHPLIB_NULLPTR && nDataSize > psChunk->nDataBufSize)
+    {
+        free(psChunk->pabyData);
+        psChunk->pabyData = STATIC_CAST(unsigned char *, malloc(nDataSize));
+        psChunk->nDataBufSize = psChunk->pabyData ? nDataSize : 0;
+        if (psChunk->pabyData == SHPLIB_NULLPTR)
+            return FALSE;
+    }
+
+    /* -------------------------------------------------------------------- */
+    /*      Fetch the bytes, with one read per run of contiguous records.   */
+    /* -------------------------------------------------------------------- */
+    size_t nDataOffset = 0;
+    int i = 0;
+    while (i < nRecords)
+    {
+        if (psChunk->panRecSize[i] < 0)
+        {
+            psChunk->papabyRec[i++] = SHPLIB_NULLPTR;
+            continue;
+        }
+
+        const SAOffset nOffset = SHPGetRecordOffset(psSHP, iFirst + i);
+        SAOffset nRunSize = psChunk->panRecSize[i];
+        int iRunEnd = i + 1;
+        while (iRunEnd < nRecords && psChunk->panRecSize[iRunEnd] >= 0 &&
+               SHPGetRecordOffset(psSHP, iFirst + iRunEnd) ==
+                   nOffset + nRunSize)
+        {
+            nRunSize += psChunk->panRecSize[iRunEnd];
+            iRunEnd++;
+        }
+
+        const unsigned char *pabyRun;
+        SAOffset nRunRead;
+        if (pabyMapping != SHPLIB_NULLPTR)
+        {
+            pabyRun = pabyMapping + MIN(nOffset, nMappingSize);
+            nRunRead = nOffset < nMappingSize
+                           ? MIN(nRunSize, nMappingSize - nOffset)
+                           : 0;
+        }
+        else
+        {
+            pabyRun = psChunk->pabyData + nDataOffset;
+            nRunRead = SAReadAt(&psSHP->sHooks, psSHP->fpSHP, nOffset,
+                                psChunk->pabyData + nDataOffset, nRunSize);
+            nDataOffset += nRunSize;
+        }
+
+        /* Dispatch the bytes of the run to its records */
+        SAOffset nRecStart = 0;
+        for (; i < iRunEnd; i++)
+        {
+            const int nEntitySize = psChunk->panRecSize[i];
+            const int nBytesRead =
+                nRecStart >= nRunRead
+                    ? 0
+                    : STATIC_CAST(int, MIN(STATIC_CAST(SAOffset, nEntitySize),
+                                           nRunRead - nRecStart));
+            const unsigned char *pabyRec = pabyRun + nRecStart;
+            nRecStart += nEntitySize;
+
+            psChunk->panRecSize[i] = SHPCheckRecordSize(
+                psSHP, iFirst + i, pabyRec, nEntitySize, nBytesRead);
+            psChunk->papabyRec[i] =
+                psChunk->panRecSize[i] >= 0 ? pabyRec : SHPLIB_NULLPTR;
+        }
+    }
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                       SHPReadObjectsParallel()                       */
+/*                                                                      */
+/*      Decode the nCount shapes starting at iFirst with nThreads       */
+/*      worker threads (the number of processors if <= 0), and pass    */
+/*      each of them to pfnCallback, which takes ownership of it (NULL  */
+/*      for unreadable records).  The callback is always invoked from   */
+/*      the calling thread, in record order unless SHP_READ_UNORDERED   */
+/*      is set in nFlags, and stops the read by returning FALSE.  The   */
+/*      Error() hook is only called from the calling thread as well.    */
+/*      Returns the number of callback invocations, or -1 on error.     */
+/************************************************************************/
+
+int SHPAPI_CALL SHPReadObjectsParallel(SHPHandle psSHP, int iFirst,
+                                       int nCount, int nThreads, int nFlags,
+                                       SHPReadObjectsCallback pfnCallback,
+                                       void *pUserData)
+{
+    if (pfnCallback == SHPLIB_NULLPTR || iFirst < 0 || nCount < 0 ||
+        iFirst > psSHP->nRecords || nCount > psSHP->nRecords - iFirst)
+        return -1;
+
+    if (!SHPFlushWriteBuffer(psSHP))
+        return -1;
+
+    const bool bOrdered = (nFlags & SHP_READ_UNORDERED) == 0;
+    const int iEnd = iFirst + nCount;
+
+    /* -------------------------------------------------------------------- */
+    /*      Set up the chunks and the workers.                              */
+    /* -------------------------------------------------------------------- */
+#ifdef SHP_HAVE_THREADS
+    if (nThreads <= 0)
+        nThreads = SHPGetCPUCount();
+    nThreads = MIN(nThreads, SHP_PARALLEL_MAX_THREADS);
+    /* Do not start more workers than there are chunks */
+    nThreads = MIN(nThreads, (nCount + SHP_PARALLEL_CHUNK_RECORDS - 1) /
+                                 SHP_PARALLEL_CHUNK_RECORDS);
+#else
+    nThreads = 0;
+#endif
+
+    SHPParallelContext sContext;
+    memset(&sContext, 0, sizeof(sContext));
+    sContext.sWorkerHooks = psSHP->sHooks;
+    sContext.sWorkerHooks.Error = SHPParallelIgnoreError;
+    sContext.nChunks = MAX(1, nThreads * SHP_PARALLEL_CHUNKS_PER_THREAD);
+    sContext.pasChunks =
+        STATIC_CAST(SHPParallelChunk *,
+                    calloc(sContext.nChunks, sizeof(SHPParallelChunk)));
+    bool bOK = sContext.pasChunks != SHPLIB_NULLPTR;
+    for (int i = 0; bOK && i < sContext.nChunks; i++)
+    {
+        SHPParallelChunk *psChunk = sContext.pasChunks + i;
+        psChunk->papabyRec = STATIC_CAST(
+            const unsigned char **,
+            malloc(SHP_PARALLEL_CHUNK_RECORDS * sizeof(unsigned char *)));
+        psChunk->panRecSize = STATIC_CAST(
+            int *, malloc(SHP_PARALLEL_CHUNK_RECORDS * sizeof(int)));
+        psChunk->papsObjects = STATIC_CAST(
+            SHPObject **,
+            malloc(SHP_PARALLEL_CHUNK_RECORDS * sizeof(SHPObject *)));
+        psChunk->pabDecodeFailed = STATIC_CAST(
+            bool *, malloc(SHP_PARALLEL_CHUNK_RECORDS * sizeof(bool)));
+        bOK = psChunk->papabyRec != SHPLIB_NULLPTR &&
+              psChunk->panRecSize != SHPLIB_NULLPTR &&
+              psChunk->papsObjects != SHPLIB_NULLPTR &&
+              psChunk->pabDecodeFailed != SHPLIB_NULLPTR;
+    }
+
+    SHPThread *pahThreads = SHPLIB_NULLPTR;
+    int nStarted = 0;
+    if (bOK && nThreads > 0)
+    {
+        pahThreads =
+            STATIC_CAST(SHPThread *, malloc(nThreads * sizeof(SHPThread)));
+        bOK = pahThreads != SHPLIB_NULLPTR;
+    }
+
+    if (!bOK)
+        psSHP->sHooks.Error("Out of memory in SHPReadObjectsParallel()");
+
+    SHPThreadJob sJob;
+    sJob.pfnRun = SHPParallelWorker;
+    sJob.pData = &sContext;
+
+    SHPMutexInit(&sContext.hMutex);
+    SHPCondInit(&sContext.hCond);
+    while (bOK && nStarted < nThreads &&
+           SHPStartThread(pahThreads + nStarted, &sJob))
+        nStarted++;
+
+    /* -------------------------------------------------------------------- */
+    /*      Fetch chunks while some are free, and deliver decoded ones.     */
+    /*      Without workers, chunks are decoded as soon as fetched.         */
+    /* -------------------------------------------------------------------- */
+    int nDelivered = 0;
+    int iNext = iFirst;
+    int nNextSequence = 0;
+    int nNextToDeliver = 0;
+    bool bStop = !bOK;
+
+    while (!bStop)
+    {
+        for (int i = 0; !bStop && iNext < iEnd && i < sContext.nChunks; i++)
+        {
+            SHPParallelChunk *psChunk = sContext.pasChunks + i;
+            SHPMutexLock(&sContext.hMutex);
+            const bool bFree = psChunk->eState == SHP_CHUNK_FREE;
+            SHPMutexUnlock(&sContext.hMutex);
+            if (!bFree)
+                continue;
+
+            if (!SHPParallelFetchChunk(psSHP, psChunk, iNext, iEnd))
+            {
+                psSHP->sHooks.Error(
+                    "Out of memory in SHPReadObjectsParallel()");
+                bOK = FALSE;
+                bStop = TRUE;
+                break;
+            }
+            iNext += psChunk->nRecords;
+
+            if (nStarted == 0)
+                SHPParallelDecodeChunk(&psSHP->sHooks, psChunk);
+
+            SHPMutexLock(&sContext.hMutex);
+            psChunk->nSequence = nNextSequence++;
+            psChunk->eState =
+                nStarted == 0 ? SHP_CHUNK_DECODED : SHP_CHUNK_FETCHED;
+            SHPCondBroadcast(&sContext.hCond);
+            SHPMutexUnlock(&sContext.hMutex);
+        }
+        if (bStop || nNextToDeliver == nNextSequence)
+            break;
+
+        /* Wait for the next chunk to deliver */
+        SHPParallelChunk *psChunk = SHPLIB_NULLPTR;
+        SHPMutexLock(&sContext.hMutex);
+        while (psChunk == SHPLIB_NULLPTR)
+        {
+            for (int i = 0; i < sContext.nChunks; i++)
+            {
+                SHPParallelChunk *psCandidate = sContext.pasChunks + i;
+                if (psCandidate->eState == SHP_CHUNK_DECODED &&
+                    (!bOrdered || psCandidate->nSequence == nNextToDeliver))
+                {
+                    psChunk = psCandidate;
+                    break;
+                }
+            }
+            if (psChunk == SHPLIB_NULLPTR)
+                SHPCondWait(&sContext.hCond, &sContext.hMutex);
+        }
+        SHPMutexUnlock(&sContext.hMutex);
+
+        for (int i = 0; i < psChunk->nRecords; i++)
+        {
+            SHPObject *psShape = psChunk->papsObjects[i];
+            psChunk->papsObjects[i] = SHPLIB_NULLPTR;
+            if (bStop)
+            {
+                SHPDestroyObject(psShape);
+                continue;
+            }
+            /* Decode again to report the error from this thread */
+            if (psChunk->pabDecodeFailed[i])
+                psShape = SHPParallelDecodeRecord(&psSHP->sHooks, psChunk, i);
+            nDelivered++;
+            if (!pfnCallback(psChunk->iFirst + i, psShape, pUserData))
+                bStop = TRUE;
+        }
+        nNextToDeliver++;
+
+        SHPMutexLock(&sContext.hMutex);
+        psChunk->eState = SHP_CHUNK_FREE;
+        SHPMutexUnlock(&sContext.hMutex);
+    }
+
+    /* -------------------------------------------------------------------- */
+    /*      Stop the workers, and free the undelivered objects.             */
+    /* -------------------------------------------------------------------- */
+    SHPMutexLock(&sContext.hMutex);
+    sContext.bNoMoreChunks = TRUE;
+    sContext.bAbort = bStop;
+    SHPCondBroadcast(&sContext.hCond);
+    SHPMutexUnlock(&sContext.hMutex);
+    for (int i = 0; i < nStarted; i++)
+        SHPJoinThread(pahThreads[i]);
+    free(pahThreads);
+    SHPCondDestroy(&sContext.hCond);
+    SHPMutexDestroy(&sContext.hMutex);
+
+    for (int i = 0;
+         sContext.pasChunks != SHPLIB_NULLPTR && i < sContext.nChunks; i++)
+    {
+        SHPParallelChunk *psChunk = sContext.pasChunks + i;
+        if (psChunk->eState == SHP_CHUNK_DECODED)
+        {
+            for (int j = 0; j < psChunk->nRecords; j++)
+                SHPDestroyObject(psChunk->papsObjects[j]);
+        }
+        free(psChunk->papabyRec);
+        free(psChunk->panRecSize);
+        free(psChunk->papsObjects);
+        free(psChunk->pabDecodeFailed);
+        free(psChunk->pabyData);
+    }
+    free(sContext.pasChunks);
+
+    if (!bOK && nDelivered == 0)
+        return -1;
+    return nDelivered;
+}
+
+/************************************************************************/
+/*                            SHPEncodeSlice                            */
+/*                                                                      */
+/*      A run of consecutive shapes of SHPWriteObjects().  The calling  */
+/*      thread splits the shapes in slices, a worker encodes each of    */
+/*      them into its own buffer, and the calling thread writes them    */
+/*      in order while the next ones are being encoded.                 */
+/************************************************************************/
+
+/* Upper bound of the records of a slice, whose bytes are bounded by */
+/* SHP_PARALLEL_CHUNK_BYTES */
+#define SHP_ENCODE_SLICE_RECORDS 4096
+/* Slices in flight per thread: one being encoded, one waiting to be */
+/* written */
+#define SHP_ENCODE_SLICES_PER_THREAD 2
+
+typedef enum
+{
+    SHP_SLICE_FREE,
+    SHP_SLICE_SPLIT,
+    SHP_SLICE_ENCODING,
+    SHP_SLICE_ENCODED
+} SHPSliceState;
+
+typedef struct
+{
+    SHPSliceState eState;
+    int nSequence;
+
+    SHPObject *const *papsObjects;
+    int nObjects;
+    int nFirstRecordNumber;
+    unsigned int *panRecSize; /* set to the size of the encoded records */
+
+    size_t nMaxDataSize; /* sum of SHPGetRecordMaxSize() */
+    unsigned char *pabyData;
+    size_t nDataBufSize;
+    size_t nDataSize;
+    int bOK; /* FALSE on out of memory */
+} SHPEncodeSlice;
+
+typedef struct
+{
+    SHPMutex hMutex;
+    SHPCond hCond; /* signaled on any slice state change */
+    int bNoMoreSlices;
+    int bAbort; /* the remaining slices are not needed */
+
+    SHPEncodeSlice *pasSlices;
+    int nSlices;
+} SHPEncodeContext;
+
+/************************************************************************/
+/*                         SHPEncodeSliceRun()                          */
+/************************************************************************/
+
+static void SHPEncodeSliceRun(SHPEncodeSlice *psSlice)
+{
+    psSlice->nDataSize = 0;
+    if (psSlice->nMaxDataSize > psSlice->nDataBufSize)
+    {
+        unsigned char *pabyNewData = STATIC_CAST(
+            unsigned char *, realloc(psSlice->pabyData, psSlice->nMaxDataSize));
+        if (pabyNewData == SHPLIB_NULLPTR)
+        {
+            psSlice->bOK = FALSE;
+            return;
+        }
+        psSlice->pabyData = pabyNewData;
+        psSlice->nDataBufSize = psSlice->nMaxDataSize;
+    }
+
+    for (int i = 0; i < psSlice->nObjects; i++)
+    {
+        psSlice->panRecSize[i] = SHPEncodeRecord(
+            psSlice->papsObjects[i], SHPLIB_NULLPTR,
+            psSlice->nFirstRecordNumber + i,
+            psSlice->pabyData + psSlice->nDataSize);
+        psSlice->nDataSize += psSlice->panRecSize[i];
+    }
+    psSlice->bOK = TRUE;
+}
+
+/************************************************************************/
+/*                          SHPEncodeWorker()                           */
+/*                                                                      */
+/*      Encode split slices, oldest first, until told to stop.          */
+/************************************************************************/
+
+static void SHPEncodeWorker(void *pContext)
+{
+    SHPEncodeContext *psContext = STATIC_CAST(SHPEncodeContext *, pContext);
+
+    SHPMutexLock(&psContext->hMutex);
+    while (true)
+    {
+        SHPEncodeSlice *psSlice = SHPLIB_NULLPTR;
+        for (int i = 0; i < psContext->nSlices; i++)
+        {
+            SHPEncodeSlice *psCandidate = psContext->pasSlices + i;
+            if (psCandidate->eState == SHP_SLICE_SPLIT &&
+                (psSlice == SHPLIB_NULLPTR ||
+                 psCandidate->nSequence < psSlice->nSequence))
+                psSlice = psCandidate;
+        }
+
+        if (psContext->bAbort)
+            break;
+        if (psSlice == SHPLIB_NULLPTR)
+        {
+            if (psContext->bNoMoreSlices)
+                break;
+            SHPCondWait(&psContext->hCond, &psContext->hMutex);
+            continue;
+        }
+
+        psSlice->eState = SHP_SLICE_ENCODING;
+        SHPMutexUnlock(&psContext->hMutex);
+
+        SHPEncodeSliceRun(psSlice);
+
+        SHPMutexLock(&psContext->hMutex);
+        psSlice->eState = SHP_SLICE_ENCODED;
+        SHPCondBroadcast(&psContext->hCond);
+    }
+    SHPMutexUnlock(&psContext->hMutex);
+}
+
+/************************************************************************/
+/*                          SHPWriteSlice()                             */
+/*                                                                      */
+/*      Append the records of an encoded slice in one I/O, and index    */
+/*      them.  Returns FALSE on error, after appending the records      */
+/*      that fit in the maximum file size.                              */
+/************************************************************************/
+
+static int SHPWriteSlice(SHPHandle psSHP, const SHPEncodeSlice *psSlice)
+{
+    if (!psSlice->bOK)
+    {
+        psSHP->sHooks.Error("Out of memory in SHPWriteObjects()");
+        return FALSE;
+    }
+
+    /* Only write the records that fit in the maximum file size */
+    int bOK = TRUE;
+    const SAOffset nFileSize = SHPGetFileSize(psSHP);
+    int nObjects = 0;
+    size_t nDataSize = 0;
+    while (nObjects < psSlice->nObjects &&
+           psSlice->panRecSize[nObjects] <=
+               SHPGetMaxFileSize(psSHP) - nFileSize - nDataSize)
+    {
+        nDataSize += psSlice->panRecSize[nObjects];
+        nObjects++;
+    }
+    if (nObjects < psSlice->nObjects)
+    {
+        char str[255];
+        snprintf(str, sizeof(str),
+                 "Failed to write shape object. "
+                 "The maximum file size of %.0f has been reached. "
+                 "The current record of size %u cannot be added.",
+                 STATIC_CAST(double, nFileSize + nDataSize),
+                 psSlice->panRecSize[nObjects]);
+        str[sizeof(str) - 1] = '\0';
+        psSHP->sHooks.Error(str);
+        bOK = FALSE;
+    }
+
+    if (nDataSize > 0 &&
+        ((psSHP->sHooks.FTell(psSHP->fpSHP) != nFileSize &&
+          psSHP->sHooks.FSeek(psSHP->fpSHP, nFileSize, 0) != 0) ||
+         psSHP->sHooks.FWrite(psSlice->pabyData, nDataSize, 1,
+                              psSHP->fpSHP) < 1))
+    {
+        char szErrorMsg[200];
+
+        snprintf(szErrorMsg, sizeof(szErrorMsg),
+                 "Error in psSHP->sHooks.FWrite() while writing %u "
+                 "bytes to .shp file: %s",
+                 STATIC_CAST(unsigned int, nDataSize), strerror(errno));
+        szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+        psSHP->sHooks.Error(szErrorMsg);
+        return FALSE;
+    }
+
+    for (int i = 0; i < nObjects; i++)
+    {
+        const int nShapeId = psSHP->nRecords;
+        const SAOffset nOffset = SHPGetFileSize(psSHP);
+        SHPStoreRecordOffset(psSHP, nShapeId, nOffset);
+        SHPStoreFileSize(psSHP, nOffset + psSHP->panRecSize[nShapeId]);
+        psSHP->panRecSize[nShapeId] -= 8;
+        SHPExtendFileBounds(psSHP, psSlice->papsObjects[i], nShapeId == 0);
+        psSHP->nRecords++;
+    }
+
+    return bOK;
+}
+
+/************************************************************************/
+/*                          SHPWriteObjects()                           */
+/*                                                                      */
+/*      Append nCount shapes.  The shapes are split in slices encoded   */
+/*      concurrently by workers started for the whole call, and each    */
+/*      slice is written in one I/O, in order, while the next ones are  */
+/*      being encoded.                                                  */
+/************************************************************************/
+
+int SHPAPI_CALL SHPWriteObjects(SHPHandle psSHP, SHPObject *const *papsObjects,
+                                int nCount, int nThreads)
+{
+    if (nCount < 0 || (nCount > 0 && papsObjects == SHPLIB_NULLPTR) ||
+        nCount > INT_MAX - psSHP->nRecords)
+        return -1;
+
+    for (int i = 0; i < nCount; i++)
+    {
+        assert(papsObjects[i]->nSHPType == psSHP->nShapeType ||
+               papsObjects[i]->nSHPType == SHPT_NULL);
+    }
+
+    psSHP->bUpdated = TRUE;
+
+    /* -------------------------------------------------------------------- */
+    /*      Reserve the in memory index for all the shapes at once.         */
+    /* -------------------------------------------------------------------- */
+    if (!SHPFlushWriteBuffer(psSHP) ||
+        !SHPGrowRecordIndex(psSHP, psSHP->nRecords + nCount))
+        return -1;
+
+    /* -------------------------------------------------------------------- */
+    /*      Set up the slices.  The workers are started as slices get       */
+    /*      split, and the calling thread encodes the slices no worker has  */
+    /*      taken when it needs them.                                       */
+    /* -------------------------------------------------------------------- */
+#ifdef SHP_HAVE_THREADS
+    if (nThreads <= 0)
+        nThreads = SHPGetCPUCount();
+    nThreads = MIN(nThreads, SHP_PARALLEL_MAX_THREADS);
+    const int nWorkers = MAX(0, nThreads - 1);
+#else
+    (void)nThreads;
+    const int nWorkers = 0;
+#endif
+
+    SHPEncodeContext sContext;
+    memset(&sContext, 0, sizeof(sContext));
+    sContext.nSlices = SHP_ENCODE_SLICES_PER_THREAD * (nWorkers + 1);
+    sContext.pasSlices = STATIC_CAST(
+        SHPEncodeSlice *, calloc(sContext.nSlices, sizeof(SHPEncodeSlice)));
+    bool bOK = sContext.pasSlices != SHPLIB_NULLPTR;
+
+    SHPThread *pahThreads = SHPLIB_NULLPTR;
+    int nStarted = 0;
+    if (bOK && nWorkers > 0)
+    {
+        pahThreads =
+            STATIC_CAST(SHPThread *, malloc(nWorkers * sizeof(SHPThread)));
+        bOK = pahThreads != SHPLIB_NULLPTR;
+    }
+
+    if (!bOK)
+        psSHP->sHooks.Error("Out of memory in SHPWriteObjects()");
+
+    SHPThreadJob sJob;
+    sJob.pfnRun = SHPEncodeWorker;
+    sJob.pData = &sContext;
+
+    SHPMutexInit(&sContext.hMutex);
+    SHPCondInit(&sContext.hCond);
+
+    /* -------------------------------------------------------------------- */
+    /*      Split the shapes in the free slices, and write encoded ones.    */
+    /* -------------------------------------------------------------------- */
+    const int nFirstRecord = psSHP->nRecords;
+    int iNext = 0;
+    int nNextSequence = 0;
+    int nNextToWrite = 0;
+    bool bSplitOK = true;
+    bool bStartWorkers = nWorkers > 0;
+
+    while (bOK)
+    {
+        for (int i = 0; bSplitOK && iNext < nCount && i < sContext.nSlices;
+             i++)
+        {
+            SHPEncodeSlice *psSlice = sContext.pasSlices + i;
+            SHPMutexLock(&sContext.hMutex);
+            const bool bFree = psSlice->eState == SHP_SLICE_FREE;
+            SHPMutexUnlock(&sContext.hMutex);
+            if (!bFree)
+                continue;
+
+            const int iRecord = nFirstRecord + iNext;
+            psSlice->papsObjects = papsObjects + iNext;
+            psSlice->nObjects = 0;
+            psSlice->nFirstRecordNumber = iRecord + 1;
+            psSlice->panRecSize = psSHP->panRecSize + iRecord;
+            psSlice->nMaxDataSize = 0;
+
+            while (iNext < nCount &&
+                   psSlice->nObjects < SHP_ENCODE_SLICE_RECORDS)
+            {
+                size_t nMaxSize;
+                if (!SHPGetRecordMaxSize(papsObjects[iNext], &nMaxSize))
+                {
+                    psSHP->sHooks.Error(
+                        "Failed to write shape object. Too big geometry.");
+                    bSplitOK = false;
+                    break;
+                }
+                if (psSlice->nObjects > 0 &&
+                    psSlice->nMaxDataSize + nMaxSize > SHP_PARALLEL_CHUNK_BYTES)
+                    break;
+
+                psSlice->nMaxDataSize += nMaxSize;
+                psSlice->nObjects++;
+                iNext++;
+            }
+            if (psSlice->nObjects == 0)
+                break;
+
+            SHPMutexLock(&sContext.hMutex);
+            psSlice->nSequence = nNextSequence++;
+            psSlice->eState = SHP_SLICE_SPLIT;
+            SHPCondBroadcast(&sContext.hCond);
+            SHPMutexUnlock(&sContext.hMutex);
+
+            /* One worker per slice after the first one */
+            if (bStartWorkers && nStarted < nNextSequence - 1)
+            {
+                bStartWorkers = SHPStartThread(pahThreads + nStarted, &sJob);
+                if (bStartWorkers)
+                    nStarted++;
+                bStartWorkers = bStartWorkers && nStarted < nWorkers;
+            }
+        }
+        if (nNextToWrite == nNextSequence)
+            break;
+
+        /* Wait for the next slice to write, or encode it if no worker */
+        /* has taken it yet */
+        SHPEncodeSlice *psSlice = SHPLIB_NULLPTR;
+        SHPMutexLock(&sContext.hMutex);
+        for (int i = 0; i < sContext.nSlices; i++)
+        {
+            if (sContext.pasSlices[i].eState != SHP_SLICE_FREE &&
+                sContext.pasSlices[i].nSequence == nNextToWrite)
+                psSlice = sContext.pasSlices + i;
+        }
+        if (psSlice->eState == SHP_SLICE_SPLIT)
+        {
+            psSlice->eState = SHP_SLICE_ENCODING;
+            SHPMutexUnlock(&sContext.hMutex);
+            SHPEncodeSliceRun(psSlice);
+            SHPMutexLock(&sContext.hMutex);
+            psSlice->eState = SHP_SLICE_ENCODED;
+        }
+        while (psSlice->eState != SHP_SLICE_ENCODED)
+            SHPCondWait(&sContext.hCond, &sContext.hMutex);
+        SHPMutexUnlock(&sContext.hMutex);
+
+        bOK = SHPWriteSlice(psSHP, psSlice);
+        nNextToWrite++;
+
+        SHPMutexLock(&sContext.hMutex);
+        psSlice->eState = SHP_SLICE_FREE;
+        SHPMutexUnlock(&sContext.hMutex);
+    }
+
+    /* -------------------------------------------------------------------- */
+    /*      Stop the workers, and cleanup.                                  */
+    /* -------------------------------------------------------------------- */
+    SHPMutexLock(&sContext.hMutex);
+    sContext.bNoMoreSlices = TRUE;
+    sContext.bAbort = TRUE;
+    SHPCondBroadcast(&sContext.hCond);
+    SHPMutexUnlock(&sContext.hMutex);
+    for (int i = 0; i < nStarted; i++)
+        SHPJoinThread(pahThreads[i]);
+    free(pahThreads);
+    SHPCondDestroy(&sContext.hCond);
+    SHPMutexDestroy(&sContext.hMutex);
+
+    for (int i = 0;
+         sContext.pasSlices != SHPLIB_NULLPTR && i < sContext.nSlices; i++)
+        free(sContext.pasSlices[i].pabyData);
+    free(sContext.pasSlices);
+
+    return psSHP->nRecords - nFirstRecord;
+}
+
+/************************************************************************/
+/*                       SHPParseRecordBounds()                         */
+/*                                                                      */
+/*      Extract the X/Y bounds from the first bytes of a record: the    */
+/*      bounding box stored after the shape type, or the point itself.  */
+/*      Null (and unknown) shapes get empty bounds at the origin.       */
+/************************************************************************/
+
+/* Bytes needed at the start of a record to know its bounds */
+#define SHP_BOUNDS_HEADER_SIZE (8 + 4 + 32)
+
+static int SHPParseRecordBounds(const SAHooks *psHooks, int hEntity,
+                                const unsigned char *pabyRec, int nBytes,
+                                double *padfMin, double *padfMax)
+{
+    padfMin[0] = padfMin[1] = padfMax[0] = padfMax[1] = 0.0;
+
+    int nRequiredSize = 8 + 4;
+    const int nSHPType =
+        nBytes >= nRequiredSize ? SHPGetInt32(pabyRec + 8) : SHPT_NULL;
+    const int bIsPoint = nSHPType == SHPT_POINT || nSHPType == SHPT_POINTM ||
+                         nSHPType == SHPT_POINTZ;
+    const int bHasBox =
+        nSHPType == SHPT_POLYGON || nSHPType == SHPT_ARC ||
+        nSHPType == SHPT_POLYGONZ || nSHPType == SHPT_POLYGONM ||
+        nSHPType == SHPT_ARCZ || nSHPType == SHPT_ARCM ||
+        nSHPType == SHPT_MULTIPATCH || nSHPType == SHPT_MULTIPOINT ||
+        nSHPType == SHPT_MULTIPOINTM || nSHPType == SHPT_MULTIPOINTZ;
+    if (bIsPoint)
+        nRequiredSize += 16;
+    else if (bHasBox)
+        nRequiredSize += 32;
+
+    if (nRequiredSize > nBytes)
+    {
+        char szErrorMsg[160];
+        snprintf(szErrorMsg, sizeof(szErrorMsg),
+                 "Corrupted .shp file : shape %d : nEntitySize = %d", hEntity,
+                 nBytes);
+        szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+        psHooks->Error(szErrorMsg);
+        return FALSE;
+    }
+
+    if (bIsPoint)
+    {
+        padfMin[0] = padfMax[0] = SHPGetDouble(pabyRec + 12);
+        padfMin[1] = padfMax[1] = SHPGetDouble(pabyRec + 20);
+    }
+    else if (bHasBox)
+    {
+        padfMin[0] = SHPGetDouble(pabyRec + 8 + 4);
+        padfMin[1] = SHPGetDouble(pabyRec + 8 + 12);
+        padfMax[0] = SHPGetDouble(pabyRec + 8 + 20);
+        padfMax[1] = SHPGetDouble(pabyRec + 8 + 28);
+    }
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                        SHPReadBoundsBytes()                          */
+/*                                                                      */
+/*      Fetch the start of a record holding its bounds, from psWindow   */
+/*      or the file mapping when possible.                              */
+/************************************************************************/
+
+static const unsigned char *SHPReadBoundsBytes(SHPHandle psSHP, int hEntity,
+                                               const SHPByteWindow *psWindow,
+                                               int *pnBytesRead)
+{
+    if (!SHPLoadRecordOffset(psSHP, hEntity))
+        return SHPLIB_NULLPTR;
+
+    int nBytes = SHP_BOUNDS_HEADER_SIZE;
+    if (psSHP->panRecSize[hEntity] + 8 < STATIC_CAST(unsigned int, nBytes))
+        nBytes = psSHP->panRecSize[hEntity] + 8;
+
+    return SHPReadRecordBytes(psSHP, hEntity, nBytes, psWindow,
+                              SHPLIB_NULLPTR, pnBytesRead);
+}
+
+/************************************************************************/
+/*                       SHPReadObjectBounds()                          */
+/*                                                                      */
+/*      Read the X/Y bounds of one shape without reading its vertices.  */
+/************************************************************************/
+
+int SHPAPI_CALL SHPReadObjectBounds(const SHPHandle psSHP, int hEntity,
+                                    double *padfMin, double *padfMax)
+{
+    if (hEntity < 0 || hEntity >= psSHP->nRecords)
+        return FALSE;
+
+    int nBytesRead = 0;
+    const unsigned char *pabyRec =
+        SHPReadBoundsBytes(psSHP, hEntity, SHPLIB_NULLPTR, &nBytesRead);
+    if (pabyRec == SHPLIB_NULLPTR)
+        return FALSE;
+
+    return SHPParseRecordBounds(&psSHP->sHooks, hEntity, pabyRec, nBytesRead,
+                                padfMin, padfMax);
+}
+
+/************************************************************************/
+/*                       SHPReadObjectsBounds()                         */
+/*                                                                      */
+/*      Read the X/Y bounds of nCount shapes starting at iFirst into    */
+/*      padfBounds, as (xmin, ymin, xmax, ymax) quadruplets.  Record    */
+/*      starts close enough to each other are fetched with a single     */
+/*      read, reading through the (small) gaps rather than seeking.     */
+/*      Shapes that cannot be read get zero bounds.  Returns the        */
+/*      number of shapes read, or -1 on invalid arguments.              */
+/************************************************************************/
+
+/* Largest gap between two record starts read through by */
+/* SHPReadObjectsBounds() instead of seeking */
+#define SHP_BOUNDS_MAX_GAP (64 * 1024)
+
+int SHPAPI_CALL SHPReadObjectsBounds(const SHPHandle psSHP, int iFirst,
+                                     int nCount, double *padfBounds)
+{
+    if (iFirst < 0 || nCount < 0 || iFirst > psSHP->nRecords ||
+        nCount > psSHP->nRecords - iFirst)
+        return -1;
+
+    if (!SHPFlushWriteBuffer(psSHP))
+        return -1;
+
+    SAOffset nMappingSize = 0;
+    const int bMapped =
+        psSHP->sHooks.FGetMapping != SHPLIB_NULLPTR &&
+        psSHP->sHooks.FGetMapping(psSHP->fpSHP, &nMappingSize) !=
+            SHPLIB_NULLPTR;
+
+    const int iEnd = iFirst + nCount;
+    int nRead = 0;
+    unsigned char *pabyWindow = SHPLIB_NULLPTR;
+    int nWindowBufSize = 0;
+    SHPByteWindow sWindow;
+    int iWindowEnd = iFirst;
+
+    for (int hEntity = iFirst; hEntity < iEnd; hEntity++)
+    {
+        double *padfMin = padfBounds + 4 * (hEntity - iFirst);
+        double *padfMax = padfMin + 2;
+
+        /* -------------------------------------------------------------------- */
+        /*      Read the starts of the next run of close records when needed.   */
+        /* -------------------------------------------------------------------- */
+        const SHPByteWindow *psWindow = SHPLIB_NULLPTR;
+        if (hEntity < iWindowEnd)
+        {
+            psWindow = &sWindow;
+        }
+        else if (!bMapped && SHPLoadRecordOffset(psSHP, hEntity))
+        {
+            const SAOffset nStart = SHPGetRecordOffset(psSHP, hEntity);
+            SAOffset nEnd = nStart;
+            int iNext = hEntity;
+            while (iNext < iEnd && SHPLoadRecordOffset(psSHP, iNext))
+            {
+                const SAOffset nOffset = SHPGetRecordOffset(psSHP, iNext);
+                unsigned int nSize = psSHP->panRecSize[iNext] + 8;
+                if (nSize > SHP_BOUNDS_HEADER_SIZE)
+                    nSize = SHP_BOUNDS_HEADER_SIZE;
+                if (nOffset < nEnd || nOffset - nEnd > SHP_BOUNDS_MAX_GAP ||
+                    nOffset - nStart > SHP_READ_WINDOW_MAX - nSize)
+                    break;
+                nEnd = nOffset + nSize;
+                iNext++;
+            }
+
+            /* A single record is as well read on its own */
+            const int nWindowSize = STATIC_CAST(int, nEnd - nStart);
+            if (iNext > hEntity + 1)
+            {
+                if (nWindowSize > nWindowBufSize)
+                {
+                    unsigned char *pabyNewWindow = STATIC_CAST(
+                        unsigned char *, realloc(pabyWindow, nWindowSize));
+                    if (pabyNewWindow != SHPLIB_NULLPTR)
+                    {
+                        pabyWindow = pabyNewWindow;
+                        nWindowBufSize = nWindowSize;
+                    }
+                }
+                if (nWindowSize <= nWindowBufSize)
+                {
+                    sWindow.pabyData = pabyWindow;
+                    sWindow.nOffset = nStart;
+                    sWindow.nSize = SAReadAt(&psSHP->sHooks, psSHP->fpSHP,
+                                             nStart, pabyWindow, nWindowSize);
+                    iWindowEnd = iNext;
+                    psWindow = &sWindow;
+                }
+            }
+        }
+
+        int nBytesRead = 0;
+        const unsigned char *pabyRec =
+            SHPReadBoundsBytes(psSHP, hEntity, psWindow, &nBytesRead);
+        if (pabyRec != SHPLIB_NULLPTR &&
+            SHPParseRecordBounds(&psSHP->sHooks, hEntity, pabyRec, nBytesRead,
+                                 padfMin, padfMax))
+        {
+            nRead++;
+        }
+        else
+        {
+            padfMin[0] = padfMin[1] = padfMax[0] = padfMax[1] = 0.0;
+        }
+    }
+
+    free(pabyWindow);
+
+    return nRead;
+}
+
+/************************************************************************/
+/*                             SHPScanInfo                              */
+/*                                                                      */
+/*      State of a sequential scan of a .shp: records are walked        */
+/*      through their own headers, either in the file mapping or in a   */
+/*      large buffer refilled by plain sequential reads.                */
+/************************************************************************/
+
+struct SHPScanInfo
+{
+    SAHooks sHooks;
+    SAFile fpSHP;
+
+    int nShapeType;
+    double adBoundsMin[4];
+    double adBoundsMax[4];
+
+    SAOffset nFileSize; /* from the .shp header */
+    SAOffset nOffset;   /* of the next record */
+    int nNextShapeId;
+    int bFinished;
+
+    const unsigned char *pabyMapping;
+    SAOffset nMappingSize;
+
+    unsigned char *pabyBuf;
+    int nBufSize;
+    int nBufStart;            /* position of the record at nOffset */
+    int nBufEnd;          /* end of the valid bytes */
+    SAOffset nReadOffset; /* file offset matching nBufEnd */
+
+    unsigned char abyHeader[100];
+};
+
+/* Size of the read buffer of a scan, grown for larger records */
+#define SHP_SCAN_BUFFER_SIZE (1024 * 1024)
+
+/************************************************************************/
+/*                            SHPScanOpen()                             */
+/************************************************************************/
+
+SHPScanHandle SHPAPI_CALL SHPScanOpen(const char *pszLayer)
+{
+    SAHooks sHooks;
+
+    SASetupDefaultHooks(&sHooks);
+
+    return SHPScanOpenLL(pszLayer, &sHooks);
+}
+
+/************************************************************************/
+/*                           SHPScanOpenLL()                            */
+/*                                                                      */
+/*      Open the .shp alone for a sequential scan.  Only its header is  */
+/*      read here, the .shx is never opened.                            */
+/************************************************************************/
+
+SHPScanHandle SHPAPI_CALL SHPScanOpenLL(const char *pszLayer,
+                                        const SAHooks *psHooks)
+{
+    /* -------------------------------------------------------------------- */
+    /*      Open the .shp file.                                             */
+    /* -------------------------------------------------------------------- */
+    const int nLenWithoutExtension = SHPGetLenWithoutExtension(pszLayer);
+    char *pszFullname = STATIC_CAST(char *, malloc(nLenWithoutExtension + 5));
+    memcpy(pszFullname, pszLayer, nLenWithoutExtension);
+    memcpy(pszFullname + nLenWithoutExtension, ".shp", 5);
+    SAFile fpSHP = psHooks->FOpen(pszFullname, "rb", psHooks->pvUserData);
+    if (fpSHP == SHPLIB_NULLPTR)
+    {
+        memcpy(pszFullname + nLenWithoutExtension, ".SHP", 5);
+        fpSHP = psHooks->FOpen(pszFullname, "rb", psHooks->pvUserData);
+    }
+
+    if (fpSHP == SHPLIB_NULLPTR)
+    {
+        const size_t nMessageLen = strlen(pszFullname) * 2 + 256;
+        char *pszMessage = STATIC_CAST(char *, malloc(nMessageLen));
+        pszFullname[nLenWithoutExtension] = 0;
+        snprintf(pszMessage, nMessageLen, "Unable to open %s.shp or %s.SHP.",
+                 pszFullname, pszFullname);
+        psHooks->Error(pszMessage);
+        free(pszMessage);
+
+        free(pszFullname);
+
+        return SHPLIB_NULLPTR;
+    }
+
+    free(pszFullname);
+
+    /* -------------------------------------------------------------------- */
+    /*      Read the header.                                                */
+    /* -------------------------------------------------------------------- */
+    unsigned char abyHeader[100];
+    if (psHooks->FRead(abyHeader, 100, 1, fpSHP) != 1 || abyHeader[0] != 0 ||
+        abyHeader[1] != 0 || abyHeader[2] != 0x27 ||
+        (abyHeader[3] != 0x0a && abyHeader[3] != 0x0d))
+    {
+        psHooks->Error(".shp file is unreadable, or corrupt.");
+        psHooks->FClose(fpSHP);
+
+        return SHPLIB_NULLPTR;
+    }
+
+    SHPScanHandle hScan = STATIC_CAST(
+        SHPScanHandle, calloc(1, sizeof(struct SHPScanInfo)));
+    SACopyHooks(&(hScan->sHooks), psHooks);
+    hScan->fpSHP = fpSHP;
+    memcpy(hScan->abyHeader, abyHeader, 100);
+
+    const unsigned int nFileSizeWords =
+        (STATIC_CAST(unsigned int, abyHeader[24]) << 24) |
+        (abyHeader[25] << 16) | (abyHeader[26] << 8) | abyHeader[27];
+    if (sizeof(SAOffset) < 8)
+    {
+        hScan->nFileSize = nFileSizeWords < UINT_MAX / 2
+                               ? STATIC_CAST(SAOffset, nFileSizeWords) * 2
+                               : (UINT_MAX / 2) * 2;
+    }
+    else if (nFileSizeWords < UINT_MAX)
+    {
+        hScan->nFileSize = STATIC_CAST(SAOffset, nFileSizeWords) * 2;
+    }
+    else
+    {
+        /* The header of files over 8 GB written in large file mode */
+        /* holds the largest size it can */
+        hScan->nFileSize = STATIC_CAST(SAOffset, nFileSizeWords) * 2;
+        if (psHooks->FSeek(fpSHP, 0, 2) == 0)
+            hScan->nFileSize = MAX(hScan->nFileSize, psHooks->FTell(fpSHP));
+        psHooks->FSeek(fpSHP, 100, 0);
+    }
+
+    hScan->nShapeType = abyHeader[32];
+
+    for (int i = 0; i < 4; i++)
+    {
+        hScan->adBoundsMin[i] =
+            SHPGetDouble(abyHeader + 36 + 16 * (i / 2) + 8 * (i % 2));
+        hScan->adBoundsMax[i] =
+            SHPGetDouble(abyHeader + 36 + 16 * (i / 2) + 8 * (i % 2) + 16);
+    }
+
+    hScan->nOffset = 100;
+    hScan->nReadOffset = 100;
+
+    if (psHooks->FGetMapping != SHPLIB_NULLPTR)
+        hScan->pabyMapping = STATIC_CAST(
+            const unsigned char *,
+            psHooks->FGetMapping(fpSHP, &hScan->nMappingSize));
+
+    return hScan;
+}
+
+/************************************************************************/
+/*                           SHPScanGetInfo()                           */
+/************************************************************************/
+
+void SHPAPI_CALL SHPScanGetInfo(const SHPScanHandle hScan, int *pnShapeType,
+                                double *padfMinBound, double *padfMaxBound)
+{
+    if (hScan == SHPLIB_NULLPTR)
+        return;
+
+    if (pnShapeType != SHPLIB_NULLPTR)
+        *pnShapeType = hScan->nShapeType;
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (padfMinBound != SHPLIB_NULLPTR)
+            padfMinBound[i] = hScan->adBoundsMin[i];
+        if (padfMaxBound != SHPLIB_NULLPTR)
+            padfMaxBound[i] = hScan->adBoundsMax[i];
+    }
+}
+
+/************************************************************************/
+/*                          SHPScanGetBytes()                           */
+/*                                                                      */
+/*      Return a pointer to the nBytes starting at the current record,  */
+/*      refilling the buffer if needed, or NULL if they are not all     */
+/*      available.                                                      */
+/************************************************************************/
+
+static const unsigned char *SHPScanGetBytes(SHPScanHandle hScan, int nBytes)
+{
+    if (hScan->pabyMapping != SHPLIB_NULLPTR)
+    {
+        if (hScan->nOffset > hScan->nMappingSize ||
+            hScan->nMappingSize - hScan->nOffset <
+                STATIC_CAST(SAOffset, nBytes))
+            return SHPLIB_NULLPTR;
+        return hScan->pabyMapping + hScan->nOffset;
+    }
+
+    if (hScan->nBufEnd - hScan->nBufStart >= nBytes)
+        return hScan->pabyBuf + hScan->nBufStart;
+
+    /* -------------------------------------------------------------------- */
+    /*      Move the bytes left to the start of the buffer, growing it      */
+    /*      if the record does not fit.                                     */
+    /* -------------------------------------------------------------------- */
+    const int nLeft = hScan->nBufEnd - hScan->nBufStart;
+    if (nBytes > hScan->nBufSize || hScan->pabyBuf == SHPLIB_NULLPTR)
+    {
+        const int nNewBufSize =
+            nBytes > SHP_SCAN_BUFFER_SIZE ? nBytes : SHP_SCAN_BUFFER_SIZE;
+        unsigned char *pabyNewBuf =
+            STATIC_CAST(unsigned char *, malloc(nNewBufSize));
+        if (pabyNewBuf == SHPLIB_NULLPTR)
+        {
+            char szErrorMsg[160];
+            snprintf(szErrorMsg, sizeof(szErrorMsg),
+                     "Not enough memory to allocate requested memory "
+                     "(nNewBufSize=%d). "
+                     "Probably broken SHP file",
+                     nNewBufSize);
+            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
+            hScan->sHooks.Error(szErrorMsg);
+            return SHPLIB_NULLPTR;
+        }
+        if (nLeft > 0)
+            memcpy(pabyNewBuf, hScan->pabyBuf + hScan->nBufStart, nLeft);
+        free(hScan->pabyBuf);
+        hScan->pabyBuf = pabyNewBuf;
+        hScan->nBufSize = nNewBufSize;
+    }
+    else if (nLeft > 0)
+    {
+        memmove(hScan->pabyBuf, hScan->pabyBuf + hScan->nBufStart, nLeft);
+    }
+    hScan->nBufStart = 0;
+    hScan->nBufEnd = nLeft;
+
+    /* -------------------------------------------------------------------- */
+    /*      Read as much as fits, without going past the advertized end.    */
+    /* -------------------------------------------------------------------- */
+    int nToRead = hScan->nBufSize - hScan->nBufEnd;
+    if (hScan->nFileSize - hScan->nReadOffset < STATIC_CAST(SAOffset, nToRead))
+        nToRead = STATIC_CAST(int, hScan->nFileSize - hScan->nReadOffset);
+    if (nToRead > 0)
+    {
+        const int nRead = STATIC_CAST(
+            int, hScan->sHooks.FRead(hScan->pabyBuf + hScan->nBufEnd, 1,
+                                     nToRead, hScan->fpSHP));
+        hScan->nBufEnd += nRead;
+        hScan->nReadOffset += nRead;
+    }
+
+    if (hScan->nBufEnd < nBytes)
+        return SHPLIB_NULLPTR;
+    return hScan->pabyBuf;
+}
+
+/************************************************************************/
+/*                         SHPScanNextRecord()                          */
+/*                                                                      */
+/*      Return the bytes of the next record (header included) and its  */
+/*      size, or NULL once the end of the file is reached or the        */
+/*      record structure is broken.  With bHeaderOnly, only the record  */
+/*      header and shape type (12 bytes) are read, and the rest of the  */
+/*      record is skipped without checking that it is there.            */
+/************************************************************************/
+
+static const unsigned char *SHPScanNextRecord(SHPScanHandle hScan,
+                                              int bHeaderOnly,
+                                              const char *pszErrorPrefix,
+                                              int *pnEntitySize)
+{
+    if (hScan->bFinished || hScan->nOffset >= hScan->nFileSize)
+    {
+        hScan->bFinished = TRUE;
+        return SHPLIB_NULLPTR;
+    }
+
+    const unsigned char *pabyRec = SHPScanGetBytes(hScan, 12);
+    if (pabyRec == SHPLIB_NULLPTR)
+    {
+        char szErrorMsg[200];
+        snprintf(szErrorMsg, sizeof(szErrorMsg),
+                 "%sCannot read first bytes of record starting at offset %.0f",
+                 pszErrorPrefix, STATIC_CAST(double, hScan->nOffset));
+        hScan->sHooks.Error(szErrorMsg);
+        hScan->bFinished = TRUE;
+        return SHPLIB_NULLPTR;
+    }
+
+    unsigned int nRecordLength;
+    memcpy(&nRecordLength, pabyRec + 4, 4);
+#if !defined(SHP_BIG_ENDIAN)
+    SHP_SWAP32(&nRecordLength);
+#endif
+
+    /* Room for the shape type at least, and within the file */
+    if (nRecordLength < 2 ||
+        nRecordLength > (hScan->nFileSize - hScan->nOffset - 8) / 2 ||
+        nRecordLength > STATIC_CAST(unsigned int, INT_MAX / 2 - 4))
+    {
+        char szErrorMsg[200];
+        snprintf(szErrorMsg, sizeof(szErrorMsg),
+                 "%sInvalid record length = %u at record starting at "
+                 "offset %.0f",
+                 pszErrorPrefix, nRecordLength,
+                 STATIC_CAST(double, hScan->nOffset));
+        hScan->sHooks.Error(szErrorMsg);
+        hScan->bFinished = TRUE;
+        return SHPLIB_NULLPTR;
+    }
+
+    const int nEntitySize = STATIC_CAST(int, 8 + 2 * nRecordLength);
+    if (bHeaderOnly)
+    {
+        /* Skip the rest of the record, seeking past the buffer if needed */
+        if (hScan->pabyMapping == SHPLIB_NULLPTR)
+        {
+            if (hScan->nBufEnd - hScan->nBufStart >= nEntitySize)
+            {
+                hScan->nBufStart += nEntitySize;
+            }
+            else
+            {
+                hScan->nBufStart = 0;
+                hScan->nBufEnd = 0;
+                hScan->nReadOffset = hScan->nOffset + nEntitySize;
+                hScan->sHooks.FSeek(hScan->fpSHP, hScan->nReadOffset, 0);
+            }
+        }
+        hScan->nOffset += nEntitySize;
+
+        *pnEntitySize = nEntitySize;
+        return pabyRec;
+    }
+
+    pabyRec = SHPScanGetBytes(hScan, nEntitySize);
+    if (pabyRec == SHPLIB_NULLPTR)
+    {
+        char szErrorMsg[200];
+        snprintf(szErrorMsg, sizeof(szErrorMsg),
+                 "%sError in fread() reading object of size %d at offset %.0f "
+                 "from .shp file",
+                 pszErrorPrefix, nEntitySize,
+                 STATIC_CAST(double, hScan->nOffset));
+        hScan->sHooks.Error(szErrorMsg);
+        hScan->bFinished = TRUE;
+        return SHPLIB_NULLPTR;
+    }
+
+    hScan->nOffset += nEntitySize;
+    hScan->nBufStart += nEntitySize;
+
+    *pnEntitySize = nEntitySize;
+    return pabyRec;
+}
+
+/************************************************************************/
+/*                          SHPScanNextView()                           */
+/*                                                                      */
+/*      Fill a view of the next shape, valid until the next call.       */
+/*      Records failing validation are reported and skipped.  Returns   */
+/*      FALSE once there are no more shapes.                            */
+/************************************************************************/
+
+int SHPAPI_CALL SHPScanNextView(SHPScanHandle hScan, SHPObjectView *psView)
+{
+    while (TRUE)
+    {
+        int nEntitySize = 0;
+        const unsigned char *pabyRec =
+            SHPScanNextRecord(hScan, FALSE, "", &nEntitySize);
+        if (pabyRec == SHPLIB_NULLPTR)
+            return FALSE;
+
+        const int hEntity = hScan->nNextShapeId++;
+        if (SHPParseRecord(&hScan->sHooks, hEntity, pabyRec, nEntitySize,
+                           psView))
+            return TRUE;
+    }
+}
+
+/************************************************************************/
+/*                            SHPScanNext()                             */
+/*                                                                      */
+/*      Read the next shape, to be freed with SHPDestroyObject().       */
+/*      Returns NULL once there are no more shapes.                     */
+/************************************************************************/
+
+SHPObject SHPAPI_CALL1(*) SHPScanNext(SHPScanHandle hScan)
+{
+    SHPObjectView sView;
+    while (SHPScanNextView(hScan, &sView))
+    {
+        SHPObject *psShape =
+            STATIC_CAST(SHPObject *, calloc(1, sizeof(SHPObject)));
+        if (SHPDecodeView(&hScan->sHooks, &sView, psShape, SHPLIB_NULLPTR,
+                          FALSE))
+            return psShape;
+        SHPDestroyObject(psShape);
+    }
+
+    return SHPLIB_NULLPTR;
+}
+
+/************************************************************************/
+/*                            SHPScanClose()                            */
+/************************************************************************/
+
+void SHPAPI_CALL SHPScanClose(SHPScanHandle hScan)
+{
+    if (hScan == SHPLIB_NULLPTR)
+        return;
 
-        /* -------------------------------------------------------------------- */
-        /*      Copy out the vertices from the record.                          */
-        /* -------------------------------------------------------------------- */
-        for (int i = 0; STATIC_CAST(uint32_t, i) < nPoints; i++)
-        {
-#if defined(SHP_BIG_ENDIAN)
-            SHP_SWAPDOUBLE_CPY(psShape->padfX + i,
-                               psSHP->pabyRec + nOffset + i * 16);
-            SHP_SWAPDOUBLE_CPY(psShape->padfY + i,
-                               psSHP->pabyRec + nOffset + i * 16 + 8);
-#else
-            memcpy(psShape->padfX + i, psSHP->pabyRec + nOffset + i * 16, 8);
-            memcpy(psShape->padfY + i, psSHP->pabyRec + nOffset + i * 16 + 8,
-                   8);
-#endif
-        }
+    hScan->sHooks.FClose(hScan->fpSHP);
+    free(hScan->pabyBuf);
+    free(hScan);
+}
 
-        nOffset += 16 * nPoints;
+/************************************************************************/
+/*                           SHPRestoreSHXEx()                          */
+/*                                                                      */
+/*      Rebuild the .shx in a single sequential scan of the .shp, the   */
+/*      index entries being accumulated and written in large blocks.    */
+/*      Optionally reports progress and the bounds of every record.     */
+/************************************************************************/
 
-        /* -------------------------------------------------------------------- */
-        /*      If we have a Z coordinate, collect that now.                    */
-        /* -------------------------------------------------------------------- */
-        if (psShape->nSHPType == SHPT_POLYGONZ ||
-            psShape->nSHPType == SHPT_ARCZ ||
-            psShape->nSHPType == SHPT_MULTIPATCH)
-        {
-#if defined(SHP_BIG_ENDIAN)
-            SHP_SWAPDOUBLE_CPY(&psShape->dfZMin, psSHP->pabyRec + nOffset);
-            SHP_SWAPDOUBLE_CPY(&psShape->dfZMax, psSHP->pabyRec + nOffset + 8);
-#else
-            memcpy(&psShape->dfZMin, psSHP->pabyRec + nOffset, 8);
-            memcpy(&psShape->dfZMax, psSHP->pabyRec + nOffset + 8, 8);
+/* Size of the buffer of .shx entries written at once, a multiple of 8 */
+#define SHP_RESTORE_BUFFER_SIZE (1024 * 1024)
 
-#endif
+/* Number of .shp bytes scanned between two progress reports */
+#define SHP_RESTORE_PROGRESS_STEP (16 * 1024 * 1024)
 
-            for (int i = 0; STATIC_CAST(uint32_t, i) < nPoints; i++)
-            {
-#if defined(SHP_BIG_ENDIAN)
-                SHP_SWAPDOUBLE_CPY(psShape->padfZ + i,
-                                   psSHP->pabyRec + nOffset + 16 + i * 8);
-#else
-                memcpy(psShape->padfZ + i,
-                       psSHP->pabyRec + nOffset + 16 + i * 8, 8);
-#endif
-            }
+int SHPAPI_CALL SHPRestoreSHXEx(const char *pszLayer, const SAHooks *psHooks,
+                                SHPProgressCallback pfnProgress,
+                                SHPRecordBoundsCallback pfnBounds,
+                                void *pUserData)
+{
+    SHPScanHandle hScan = SHPScanOpenLL(pszLayer, psHooks);
+    if (hScan == SHPLIB_NULLPTR)
+        return FALSE;
 
-            nOffset += 16 + 8 * nPoints;
-        }
-        else if (psShape->bFastModeReadObject)
-        {
-            psShape->padfZ = SHPLIB_NULLPTR;
-        }
+    /* -------------------------------------------------------------------- */
+    /*      Create the .shx, with the header of the .shp.                   */
+    /* -------------------------------------------------------------------- */
+    const int nLenWithoutExtension = SHPGetLenWithoutExtension(pszLayer);
+    char *pszFullname = STATIC_CAST(char *, malloc(nLenWithoutExtension + 5));
+    memcpy(pszFullname, pszLayer, nLenWithoutExtension);
+    memcpy(pszFullname + nLenWithoutExtension, ".shx", 5);
+    SAFile fpSHX = psHooks->FOpen(pszFullname, "w+b", psHooks->pvUserData);
+    if (fpSHX == SHPLIB_NULLPTR)
+    {
+        size_t nMessageLen = strlen(pszFullname) * 2 + 256;
+        char *pszMessage = STATIC_CAST(char *, malloc(nMessageLen));
+        pszFullname[nLenWithoutExtension] = 0;
+        snprintf(pszMessage, nMessageLen,
+                 "Error opening file %s.shx for writing", pszFullname);
+        psHooks->Error(pszMessage);
+        free(pszMessage);
 
-        /* -------------------------------------------------------------------- */
-        /*      If we have a M measure value, then read it now.  We assume      */
-        /*      that the measure can be present for any shape if the size is    */
-        /*      big enough, but really it will only occur for the Z shapes      */
-        /*      (options), and the M shapes.                                    */
-        /* -------------------------------------------------------------------- */
-        if (nEntitySize >= STATIC_CAST(int, nOffset + 16 + 8 * nPoints))
-        {
-#if defined(SHP_BIG_ENDIAN)
-            SHP_SWAPDOUBLE_CPY(&psShape->dfMMin, psSHP->pabyRec + nOffset);
-            SHP_SWAPDOUBLE_CPY(&psShape->dfMMax, psSHP->pabyRec + nOffset + 8);
-#else
-            memcpy(&psShape->dfMMin, psSHP->pabyRec + nOffset, 8);
-            memcpy(&psShape->dfMMax, psSHP->pabyRec + nOffset + 8, 8);
-#endif
+        free(pszFullname);
+        SHPScanClose(hScan);
 
-            for (int i = 0; STATIC_CAST(uint32_t, i) < nPoints; i++)
-            {
-#if defined(SHP_BIG_ENDIAN)
-                SHP_SWAPDOUBLE_CPY(psShape->padfM + i,
-                                   psSHP->pabyRec + nOffset + 16 + i * 8);
-#else
-                memcpy(psShape->padfM + i,
-                       psSHP->pabyRec + nOffset + 16 + i * 8, 8);
-#endif
-            }
-            psShape->bMeasureIsUsed = TRUE;
-        }
-        else if (psShape->bFastModeReadObject)
-        {
-            psShape->padfM = SHPLIB_NULLPTR;
-        }
+        return FALSE;
     }
 
-    /* ==================================================================== */
-    /*  Extract vertices for a MultiPoint.                                  */
-    /* ==================================================================== */
-    else if (psShape->nSHPType == SHPT_MULTIPOINT ||
-             psShape->nSHPType == SHPT_MULTIPOINTM ||
-             psShape->nSHPType == SHPT_MULTIPOINTZ)
+    unsigned char *pabyBuf =
+        STATIC_CAST(unsigned char *, malloc(SHP_RESTORE_BUFFER_SIZE));
+    if (pabyBuf == SHPLIB_NULLPTR)
     {
-        if (44 + 4 > nEntitySize)
-        {
-            char szErrorMsg[160];
-            snprintf(szErrorMsg, sizeof(szErrorMsg),
-                     "Corrupted .shp file : shape %d : nEntitySize = %d",
-                     hEntity, nEntitySize);
-            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
-            psSHP->sHooks.Error(szErrorMsg);
-            SHPDestroyObject(psShape);
-            return SHPLIB_NULLPTR;
-        }
-        uint32_t nPoints;
-        memcpy(&nPoints, psSHP->pabyRec + 44, 4);
+        psHooks->Error("Not enough memory to restore the .shx file.");
+        psHooks->FClose(fpSHX);
+        free(pszFullname);
+        SHPScanClose(hScan);
 
-#if defined(SHP_BIG_ENDIAN)
-        SHP_SWAP32(&nPoints);
-#endif
+        return FALSE;
+    }
 
-        /* nPoints is unsigned */
-        if (/* nPoints < 0 || */ nPoints > 50 * 1000 * 1000)
-        {
-            char szErrorMsg[160];
-            snprintf(szErrorMsg, sizeof(szErrorMsg),
-                     "Corrupted .shp file : shape %d : nPoints = %u", hEntity,
-                     nPoints);
-            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
-            psSHP->sHooks.Error(szErrorMsg);
-            SHPDestroyObject(psShape);
-            return SHPLIB_NULLPTR;
-        }
+    int bWriteError = psHooks->FWrite(hScan->abyHeader, 100, 1, fpSHX) != 1;
 
-        int nRequiredSize = 48 + nPoints * 16;
-        if (psShape->nSHPType == SHPT_MULTIPOINTZ)
-        {
-            nRequiredSize += 16 + nPoints * 8;
-        }
-        if (nRequiredSize > nEntitySize)
-        {
-            char szErrorMsg[160];
-            snprintf(szErrorMsg, sizeof(szErrorMsg),
-                     "Corrupted .shp file : shape %d : nPoints = %u, "
-                     "nEntitySize = %d",
-                     hEntity, nPoints, nEntitySize);
-            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
-            psSHP->sHooks.Error(szErrorMsg);
-            SHPDestroyObject(psShape);
-            return SHPLIB_NULLPTR;
-        }
+    /* -------------------------------------------------------------------- */
+    /*      Walk the records, appending an entry to the .shx for each.      */
+    /* -------------------------------------------------------------------- */
+    int nRetCode = TRUE;
+    int nBufUsed = 0;
+    unsigned int nRealSHXContentSize = 100;
+    SAOffset nNextProgress = SHP_RESTORE_PROGRESS_STEP;
+    int iShape = 0;
 
-        unsigned char *pBuffer = SHPLIB_NULLPTR;
-        unsigned char **ppBuffer = SHPLIB_NULLPTR;
+    /* The offsets of files over 8 GB may overflow the .shx, and are */
+    /* then also written to a .shx64 index as in large file mode */
+    const bool bLargeFile = hScan->nFileSize / 2 > UINT_MAX;
+    SAOffset *panOffset64 = SHPLIB_NULLPTR;
+    int nMaxOffset64 = 0;
 
-        if (psShape->bFastModeReadObject)
+    while (!bWriteError)
+    {
+        const SAOffset nRecordOffset = hScan->nOffset;
+        int nEntitySize = 0;
+        /* The whole record is only needed to compute its bounds */
+        const unsigned char *pabyRec = SHPScanNextRecord(
+            hScan, pfnBounds == SHPLIB_NULLPTR,
+            "Error parsing .shp to restore .shx. ", &nEntitySize);
+        if (pabyRec == SHPLIB_NULLPTR)
         {
-            const int nObjectBufSize = 4 * sizeof(double) * nPoints;
-            pBuffer = SHPReallocObjectBufIfNecessary(psSHP, nObjectBufSize);
-            ppBuffer = &pBuffer;
+            /* Errors are reported by SHPScanNextRecord() */
+            if (hScan->nOffset != hScan->nFileSize)
+                nRetCode = FALSE;
+            break;
         }
 
-        psShape->nVertices = nPoints;
-
-        psShape->padfX = STATIC_CAST(
-            double *, SHPAllocBuffer(ppBuffer, sizeof(double) * nPoints));
-        psShape->padfY = STATIC_CAST(
-            double *, SHPAllocBuffer(ppBuffer, sizeof(double) * nPoints));
-        psShape->padfZ = STATIC_CAST(
-            double *, SHPAllocBuffer(ppBuffer, sizeof(double) * nPoints));
-        psShape->padfM = STATIC_CAST(
-            double *, SHPAllocBuffer(ppBuffer, sizeof(double) * nPoints));
-
-        if (psShape->padfX == SHPLIB_NULLPTR ||
-            psShape->padfY == SHPLIB_NULLPTR ||
-            psShape->padfZ == SHPLIB_NULLPTR ||
-            psShape->padfM == SHPLIB_NULLPTR)
+        // Sanity check on record type
+        const int nSHPType = SHPGetInt32(pabyRec + 8);
+        if (nSHPType != SHPT_NULL && nSHPType != SHPT_POINT &&
+            nSHPType != SHPT_ARC && nSHPType != SHPT_POLYGON &&
+            nSHPType != SHPT_MULTIPOINT && nSHPType != SHPT_POINTZ &&
+            nSHPType != SHPT_ARCZ && nSHPType != SHPT_POLYGONZ &&
+            nSHPType != SHPT_MULTIPOINTZ && nSHPType != SHPT_POINTM &&
+            nSHPType != SHPT_ARCM && nSHPType != SHPT_POLYGONM &&
+            nSHPType != SHPT_MULTIPOINTM && nSHPType != SHPT_MULTIPATCH)
         {
-            char szErrorMsg[160];
+            char szErrorMsg[200];
             snprintf(szErrorMsg, sizeof(szErrorMsg),
-                     "Not enough memory to allocate requested memory "
-                     "(nPoints=%u) for shape %d. "
-                     "Probably broken SHP file",
-                     nPoints, hEntity);
-            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
-            psSHP->sHooks.Error(szErrorMsg);
-            SHPDestroyObject(psShape);
-            return SHPLIB_NULLPTR;
+                     "Error parsing .shp to restore .shx. "
+                     "Invalid shape type = %d at record starting at "
+                     "offset %.0f",
+                     nSHPType, STATIC_CAST(double, nRecordOffset));
+            psHooks->Error(szErrorMsg);
+
+            nRetCode = FALSE;
+            break;
         }
 
-        for (int i = 0; STATIC_CAST(uint32_t, i) < nPoints; i++)
+        if (pfnBounds != SHPLIB_NULLPTR)
         {
-#if defined(SHP_BIG_ENDIAN)
-            SHP_SWAPDOUBLE_CPY(psShape->padfX + i,
-                               psSHP->pabyRec + 48 + 16 * i);
-            SHP_SWAPDOUBLE_CPY(psShape->padfY + i,
-                               psSHP->pabyRec + 48 + 16 * i + 8);
-#else
-            memcpy(psShape->padfX + i, psSHP->pabyRec + 48 + 16 * i, 8);
-            memcpy(psShape->padfY + i, psSHP->pabyRec + 48 + 16 * i + 8, 8);
-#endif
+            double adfBounds[4];
+            SHPParseRecordBounds(psHooks, iShape, pabyRec, nEntitySize,
+                                 adfBounds, adfBounds + 2);
+            pfnBounds(iShape, adfBounds, pUserData);
         }
 
-        int nOffset = 48 + 16 * nPoints;
-
-        /* -------------------------------------------------------------------- */
-        /*      Get the X/Y bounds.                                             */
-        /* -------------------------------------------------------------------- */
-#if defined(SHP_BIG_ENDIAN)
-        SHP_SWAPDOUBLE_CPY(&psShape->dfXMin, psSHP->pabyRec + 8 + 4);
-        SHP_SWAPDOUBLE_CPY(&psShape->dfYMin, psSHP->pabyRec + 8 + 12);
-        SHP_SWAPDOUBLE_CPY(&psShape->dfXMax, psSHP->pabyRec + 8 + 20);
-        SHP_SWAPDOUBLE_CPY(&psShape->dfYMax, psSHP->pabyRec + 8 + 28);
-#else
-        memcpy(&psShape->dfXMin, psSHP->pabyRec + 8 + 4, 8);
-        memcpy(&psShape->dfYMin, psSHP->pabyRec + 8 + 12, 8);
-        memcpy(&psShape->dfXMax, psSHP->pabyRec + 8 + 20, 8);
-        memcpy(&psShape->dfYMax, psSHP->pabyRec + 8 + 28, 8);
-#endif
-
-        /* -------------------------------------------------------------------- */
-        /*      If we have a Z coordinate, collect that now.                    */
-        /* -------------------------------------------------------------------- */
-        if (psShape->nSHPType == SHPT_MULTIPOINTZ)
+        if (bLargeFile)
         {
-#if defined(SHP_BIG_ENDIAN)
-            SHP_SWAPDOUBLE_CPY(&psShape->dfZMin, psSHP->pabyRec + nOffset);
-            SHP_SWAPDOUBLE_CPY(&psShape->dfZMax, psSHP->pabyRec + nOffset + 8);
-#else
-            memcpy(&psShape->dfZMin, psSHP->pabyRec + nOffset, 8);
-            memcpy(&psShape->dfZMax, psSHP->pabyRec + nOffset + 8, 8);
-#endif
-
-            for (int i = 0; STATIC_CAST(uint32_t, i) < nPoints; i++)
+            if (iShape == nMaxOffset64)
             {
-#if defined(SHP_BIG_ENDIAN)
-                SHP_SWAPDOUBLE_CPY(psShape->padfZ + i,
-                                   psSHP->pabyRec + nOffset + 16 + i * 8);
-#else
-                memcpy(psShape->padfZ + i,
-                       psSHP->pabyRec + nOffset + 16 + i * 8, 8);
-#endif
+                nMaxOffset64 = MAX(1024, nMaxOffset64 + nMaxOffset64 / 3);
+                SAOffset *panNewOffset64 = STATIC_CAST(
+                    SAOffset *,
+                    realloc(panOffset64, sizeof(SAOffset) * nMaxOffset64));
+                if (panNewOffset64 == SHPLIB_NULLPTR)
+                {
+                    psHooks->Error(
+                        "Not enough memory to restore the .shx file.");
+                    nRetCode = FALSE;
+                    break;
+                }
+                panOffset64 = panNewOffset64;
             }
-
-            nOffset += 16 + 8 * nPoints;
+            panOffset64[iShape] = nRecordOffset;
         }
-        else if (psShape->bFastModeReadObject)
-            psShape->padfZ = SHPLIB_NULLPTR;
-
-        /* -------------------------------------------------------------------- */
-        /*      If we have a M measure value, then read it now.  We assume      */
-        /*      that the measure can be present for any shape if the size is    */
-        /*      big enough, but really it will only occur for the Z shapes      */
-        /*      (options), and the M shapes.                                    */
-        /* -------------------------------------------------------------------- */
-        if (nEntitySize >= STATIC_CAST(int, nOffset + 16 + 8 * nPoints))
-        {
-#if defined(SHP_BIG_ENDIAN)
-            SHP_SWAPDOUBLE_CPY(&psShape->dfMMin, psSHP->pabyRec + nOffset);
-            SHP_SWAPDOUBLE_CPY(&psShape->dfMMax, psSHP->pabyRec + nOffset + 8);
-#else
-            memcpy(&psShape->dfMMin, psSHP->pabyRec + nOffset, 8);
-            memcpy(&psShape->dfMMax, psSHP->pabyRec + nOffset + 8, 8);
-#endif
+        iShape++;
 
-            for (int i = 0; STATIC_CAST(uint32_t, i) < nPoints; i++)
-            {
-#if defined(SHP_BIG_ENDIAN)
-                SHP_SWAPDOUBLE_CPY(psShape->padfM + i,
-                                   psSHP->pabyRec + nOffset + 16 + i * 8);
-#else
-                memcpy(psShape->padfM + i,
-                       psSHP->pabyRec + nOffset + 16 + i * 8, 8);
+        /* The offset in words (only its low bits over 8 GB), and the */
+        /* content length copied as is */
+        uint32_t nRecordOffsetBE = STATIC_CAST(uint32_t, nRecordOffset / 2);
+#if !defined(SHP_BIG_ENDIAN)
+        SHP_SWAP32(&nRecordOffsetBE);
 #endif
-            }
-            psShape->bMeasureIsUsed = TRUE;
-        }
-        else if (psShape->bFastModeReadObject)
-            psShape->padfM = SHPLIB_NULLPTR;
-    }
+        memcpy(pabyBuf + nBufUsed, &nRecordOffsetBE, 4);
+        memcpy(pabyBuf + nBufUsed + 4, pabyRec + 4, 4);
+        nBufUsed += 8;
+        nRealSHXContentSize += 8;
 
-    /* ==================================================================== */
-    /*      Extract vertices for a point.                                   */
-    /* ==================================================================== */
-    else if (psShape->nSHPType == SHPT_POINT ||
-             psShape->nSHPType == SHPT_POINTM ||
-             psShape->nSHPType == SHPT_POINTZ)
-    {
-        psShape->nVertices = 1;
-        if (psShape->bFastModeReadObject)
-        {
-            psShape->padfX = &(psShape->dfXMin);
-            psShape->padfY = &(psShape->dfYMin);
-            psShape->padfZ = &(psShape->dfZMin);
-            psShape->padfM = &(psShape->dfMMin);
-            psShape->padfZ[0] = 0.0;
-            psShape->padfM[0] = 0.0;
-        }
-        else
+        if (nBufUsed == SHP_RESTORE_BUFFER_SIZE)
         {
-            psShape->padfX = STATIC_CAST(double *, calloc(1, sizeof(double)));
-            psShape->padfY = STATIC_CAST(double *, calloc(1, sizeof(double)));
-            psShape->padfZ = STATIC_CAST(double *, calloc(1, sizeof(double)));
-            psShape->padfM = STATIC_CAST(double *, calloc(1, sizeof(double)));
+            bWriteError = psHooks->FWrite(pabyBuf, nBufUsed, 1, fpSHX) != 1;
+            nBufUsed = 0;
         }
 
-        if (20 + 8 + ((psShape->nSHPType == SHPT_POINTZ) ? 8 : 0) > nEntitySize)
+        if (pfnProgress != SHPLIB_NULLPTR && hScan->nOffset >= nNextProgress)
         {
-            char szErrorMsg[160];
-            snprintf(szErrorMsg, sizeof(szErrorMsg),
-                     "Corrupted .shp file : shape %d : nEntitySize = %d",
-                     hEntity, nEntitySize);
-            szErrorMsg[sizeof(szErrorMsg) - 1] = '\0';
-            psSHP->sHooks.Error(szErrorMsg);
-            SHPDestroyObject(psShape);
-            return SHPLIB_NULLPTR;
+            nNextProgress = hScan->nOffset + SHP_RESTORE_PROGRESS_STEP;
+            if (!pfnProgress(STATIC_CAST(double, hScan->nOffset) /
+                                 hScan->nFileSize,
+                             pUserData))
+            {
+                psHooks->Error("Restoring of the .shx interrupted.");
+                nRetCode = FALSE;
+                break;
+            }
         }
-#if defined(SHP_BIG_ENDIAN)
-        SHP_SWAPDOUBLE_CPY(psShape->padfX, psSHP->pabyRec + 12);
-        SHP_SWAPDOUBLE_CPY(psShape->padfY, psSHP->pabyRec + 20);
-#else
-        memcpy(psShape->padfX, psSHP->pabyRec + 12, 8);
-        memcpy(psShape->padfY, psSHP->pabyRec + 20, 8);
-#endif
+    }
 
-        int nOffset = 20 + 8;
+    if (nBufUsed > 0 && !bWriteError)
+        bWriteError = psHooks->FWrite(pabyBuf, nBufUsed, 1, fpSHX) != 1;
+    free(pabyBuf);
 
-        /* -------------------------------------------------------------------- */
-        /*      If we have a Z coordinate, collect that now.                    */
-        /* -------------------------------------------------------------------- */
-        if (psShape->nSHPType == SHPT_POINTZ)
-        {
-#if defined(SHP_BIG_ENDIAN)
-            SHP_SWAPDOUBLE_CPY(psShape->padfZ, psSHP->pabyRec + nOffset);
-#else
-            memcpy(psShape->padfZ, psSHP->pabyRec + nOffset, 8);
+    /* -------------------------------------------------------------------- */
+    /*      Set the actual size of the .shx in its header.                  */
+    /* -------------------------------------------------------------------- */
+    nRealSHXContentSize /= 2;  // Bytes counted -> WORDs
+#if !defined(SHP_BIG_ENDIAN)
+    SHP_SWAP32(&nRealSHXContentSize);
 #endif
 
-            nOffset += 8;
-        }
+    if (!bWriteError)
+    {
+        psHooks->FSeek(fpSHX, 24, 0);
+        bWriteError = psHooks->FWrite(&nRealSHXContentSize, 4, 1, fpSHX) != 1;
+    }
+    if (bWriteError)
+    {
+        psHooks->Error("Failure writing .shx file.");
+        nRetCode = FALSE;
+    }
 
-        /* -------------------------------------------------------------------- */
-        /*      If we have a M measure value, then read it now.  We assume      */
-        /*      that the measure can be present for any shape if the size is    */
-        /*      big enough, but really it will only occur for the Z shapes      */
-        /*      (options), and the M shapes.                                    */
-        /* -------------------------------------------------------------------- */
-        if (nEntitySize >= nOffset + 8)
-        {
-#if defined(SHP_BIG_ENDIAN)
-            SHP_SWAPDOUBLE_CPY(psShape->padfM, psSHP->pabyRec + nOffset);
-#else
-            memcpy(psShape->padfM, psSHP->pabyRec + nOffset, 8);
-#endif
-            psShape->bMeasureIsUsed = TRUE;
-        }
+    psHooks->FClose(fpSHX);
+    SHPScanClose(hScan);
 
-        /* -------------------------------------------------------------------- */
-        /*      Since no extents are supplied in the record, we will apply      */
-        /*      them from the single vertex.                                    */
-        /* -------------------------------------------------------------------- */
-        psShape->dfXMin = psShape->dfXMax = psShape->padfX[0];
-        psShape->dfYMin = psShape->dfYMax = psShape->padfY[0];
-        psShape->dfZMin = psShape->dfZMax = psShape->padfZ[0];
-        psShape->dfMMin = psShape->dfMMax = psShape->padfM[0];
+    /* -------------------------------------------------------------------- */
+    /*      Write the .shx64 index if needed, or remove a stale one.        */
+    /* -------------------------------------------------------------------- */
+    if (nRetCode)
+    {
+        char *pszIndexFilename = SHPGetOffsetIndexFilename(pszFullname);
+        nRetCode = pszIndexFilename != SHPLIB_NULLPTR &&
+                   SHPWriteOffsetIndexFile(psHooks, pszIndexFilename,
+                                           panOffset64,
+                                           bLargeFile ? iShape : 0);
+        free(pszIndexFilename);
     }
+    free(panOffset64);
+    free(pszFullname);
 
-    return (psShape);
+    if (nRetCode && pfnProgress != SHPLIB_NULLPTR)
+        pfnProgress(1.0, pUserData);
+
+    return nRetCode;
 }
 
 /************************************************************************/
@@ -1,12 +1,16 @@
 #include <array>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include <gtest/gtest.h>
 #include "shapefil.h"
@@ -262,6 +266,669 @@ TEST(DBFFieldTest, SetAndGetLogicalInvalid)
     fs::remove(filename);
 }
 
+TEST(DBFFieldTest, GetFieldIndexFollowsFieldChanges)
+{
+    const auto filename =
+        fs::temp_directory_path() / GenerateUniqueFilename(".dbf");
+    auto hDBF = DBFCreate(filename.string().c_str());
+    ASSERT_NE(nullptr, hDBF);
+    const int nFields = 250;
+    for (int i = 0; i < nFields; i++)
+        ASSERT_EQ(i, DBFAddField(hDBF, ("COL" + std::to_string(i)).c_str(),
+                                 FTInteger, 4, 0));
+    /* Duplicate names resolve to the first field */
+    ASSERT_EQ(nFields, DBFAddField(hDBF, "col7", FTInteger, 4, 0));
+    ASSERT_TRUE(DBFWriteIntegerAttribute(hDBF, 0, 0, 1));
+    DBFClose(hDBF);
+
+    hDBF = DBFOpen(filename.string().c_str(), "rb+");
+    ASSERT_NE(nullptr, hDBF);
+    for (int i = 0; i < nFields; i++)
+    {
+        EXPECT_EQ(i,
+                  DBFGetFieldIndex(hDBF, ("COL" + std::to_string(i)).c_str()));
+        EXPECT_EQ(i,
+                  DBFGetFieldIndex(hDBF, ("col" + std::to_string(i)).c_str()));
+    }
+    EXPECT_EQ(7, DBFGetFieldIndex(hDBF, "Col7"));
+    EXPECT_EQ(-1, DBFGetFieldIndex(hDBF, "COL"));
+    EXPECT_EQ(-1, DBFGetFieldIndex(hDBF, "COL250"));
+    EXPECT_EQ(-1, DBFGetFieldIndex(hDBF, ""));
+
+    ASSERT_EQ(nFields + 1, DBFAddField(hDBF, "EXTRA", FTString, 8, 0));
+    EXPECT_EQ(nFields + 1, DBFGetFieldIndex(hDBF, "extra"));
+
+    ASSERT_TRUE(DBFDeleteField(hDBF, 0));
+    EXPECT_EQ(-1, DBFGetFieldIndex(hDBF, "COL0"));
+    EXPECT_EQ(0, DBFGetFieldIndex(hDBF, "COL1"));
+    EXPECT_EQ(nFields, DBFGetFieldIndex(hDBF, "EXTRA"));
+
+    ASSERT_TRUE(DBFAlterFieldDefn(hDBF, 0, "RENAMED", 'N', 4, 0));
+    EXPECT_EQ(-1, DBFGetFieldIndex(hDBF, "COL1"));
+    EXPECT_EQ(0, DBFGetFieldIndex(hDBF, "renamed"));
+
+    std::vector<int> anMap(DBFGetFieldCount(hDBF));
+    for (int i = 0; i < static_cast<int>(anMap.size()); i++)
+        anMap[i] = static_cast<int>(anMap.size()) - 1 - i;
+    ASSERT_TRUE(DBFReorderFields(hDBF, anMap.data()));
+    EXPECT_EQ(0, DBFGetFieldIndex(hDBF, "EXTRA"));
+    EXPECT_EQ(static_cast<int>(anMap.size()) - 1,
+              DBFGetFieldIndex(hDBF, "RENAMED"));
+    /* The duplicate is now before the original */
+    EXPECT_EQ(1, DBFGetFieldIndex(hDBF, "COL7"));
+
+    DBFClose(hDBF);
+    fs::remove(filename);
+}
+
+TEST(DBFFieldTest, SchemaChangeMatchesSingleChanges)
+{
+    const auto tmp = fs::temp_directory_path();
+    const std::string aosNames[] = {GenerateUniqueFilename(".single.dbf"),
+                                    GenerateUniqueFilename(".batch.dbf")};
+    for (const auto &osName : aosNames)
+    {
+        const auto hDBF = DBFCreate((tmp / osName).string().c_str());
+        ASSERT_NE(nullptr, hDBF);
+        ASSERT_EQ(0, DBFAddField(hDBF, "ID", FTInteger, 6, 0));
+        ASSERT_EQ(1, DBFAddField(hDBF, "NAME", FTString, 20, 0));
+        ASSERT_EQ(2, DBFAddField(hDBF, "VALUE", FTDouble, 12, 3));
+        for (int i = 0; i < 1000; i++)
+        {
+            EXPECT_TRUE(DBFWriteIntegerAttribute(hDBF, i, 0, i));
+            EXPECT_TRUE(DBFWriteStringAttribute(
+                hDBF, i, 1, ("name" + std::to_string(i)).c_str()));
+            if (i % 7 == 0)
+            {
+                EXPECT_TRUE(DBFWriteNULLAttribute(hDBF, i, 2));
+            }
+            else
+            {
+                EXPECT_TRUE(DBFWriteDoubleAttribute(hDBF, i, 2, i * 0.5));
+            }
+        }
+        DBFClose(hDBF);
+    }
+
+    /* The header grows while the records shrink */
+    const int anMap[] = {3, 0, 2, 1};
+    auto hDBF = DBFOpen((tmp / aosNames[0]).string().c_str(), "rb+");
+    ASSERT_NE(nullptr, hDBF);
+    EXPECT_EQ(3, DBFAddNativeFieldType(hDBF, "FLAG", 'L', 1, 0));
+    EXPECT_TRUE(DBFAlterFieldDefn(hDBF, 1, "NAME", 'C', 8, 0));
+    EXPECT_TRUE(DBFReorderFields(hDBF, anMap));
+    EXPECT_TRUE(DBFAlterFieldDefn(hDBF, 2, "VAL", 'N', 14, 3));
+    EXPECT_EQ(4, DBFAddNativeFieldType(hDBF, "CODE", 'C', 2, 0));
+    DBFClose(hDBF);
+
+    hDBF = DBFOpen((tmp / aosNames[1]).string().c_str(), "rb+");
+    ASSERT_NE(nullptr, hDBF);
+    const auto hChange = DBFBeginSchemaChange(hDBF);
+    ASSERT_NE(nullptr, hChange);
+    EXPECT_EQ(3, DBFSchemaAddNativeFieldType(hChange, "FLAG", 'L', 1, 0));
+    EXPECT_TRUE(DBFSchemaAlterFieldDefn(hChange, 1, "NAME", 'C', 8, 0));
+    EXPECT_TRUE(DBFSchemaReorderFields(hChange, anMap));
+    EXPECT_TRUE(DBFSchemaAlterFieldDefn(hChange, 2, "VAL", 'N', 14, 3));
+    EXPECT_EQ(4, DBFSchemaAddNativeFieldType(hChange, "CODE", 'C', 2, 0));
+    EXPECT_FALSE(DBFSchemaDeleteField(hChange, 5));
+    const int anBadMap[] = {0, 0, 1, 2, 3};
+    EXPECT_FALSE(DBFSchemaReorderFields(hChange, anBadMap));
+    /* Not applied until committed */
+    EXPECT_EQ(3, DBFGetFieldCount(hDBF));
+    EXPECT_TRUE(DBFCommitSchemaChange(hChange));
+    EXPECT_EQ(5, DBFGetFieldCount(hDBF));
+    EXPECT_EQ(2, DBFGetFieldIndex(hDBF, "VAL"));
+    DBFClose(hDBF);
+
+    /* Compare the field definitions and the records */
+    const auto hSingle = DBFOpen((tmp / aosNames[0]).string().c_str(), "rb");
+    const auto hBatch = DBFOpen((tmp / aosNames[1]).string().c_str(), "rb");
+    ASSERT_NE(nullptr, hSingle);
+    ASSERT_NE(nullptr, hBatch);
+    ASSERT_EQ(DBFGetFieldCount(hSingle), DBFGetFieldCount(hBatch));
+    ASSERT_EQ(DBFGetRecordCount(hSingle), DBFGetRecordCount(hBatch));
+    for (int iField = 0; iField < DBFGetFieldCount(hSingle); iField++)
+    {
+        char szSingleName[XBASE_FLDNAME_LEN_READ + 1];
+        char szBatchName[XBASE_FLDNAME_LEN_READ + 1];
+        int nSingleWidth, nBatchWidth, nSingleDecimals, nBatchDecimals;
+        EXPECT_EQ(DBFGetFieldInfo(hSingle, iField, szSingleName,
+                                  &nSingleWidth, &nSingleDecimals),
+                  DBFGetFieldInfo(hBatch, iField, szBatchName, &nBatchWidth,
+                                  &nBatchDecimals));
+        EXPECT_STREQ(szSingleName, szBatchName);
+        EXPECT_EQ(nSingleWidth, nBatchWidth);
+        EXPECT_EQ(nSingleDecimals, nBatchDecimals);
+    }
+    ASSERT_EQ(hSingle->nRecordLength, hBatch->nRecordLength);
+    for (int i = 0; i < DBFGetRecordCount(hSingle); i++)
+    {
+        EXPECT_EQ(
+            std::string(DBFReadTuple(hSingle, i), hSingle->nRecordLength),
+            std::string(DBFReadTuple(hBatch, i), hBatch->nRecordLength));
+    }
+    EXPECT_EQ(999, DBFReadIntegerAttribute(hBatch, 999, 1));
+    EXPECT_STREQ("name999", DBFReadStringAttribute(hBatch, 999, 3));
+    EXPECT_TRUE(DBFIsAttributeNULL(hBatch, 0, 2));
+    EXPECT_DOUBLE_EQ(499.5, DBFReadDoubleAttribute(hBatch, 999, 2));
+    DBFClose(hSingle);
+    DBFClose(hBatch);
+
+    for (const auto &osName : aosNames)
+        fs::remove(tmp / osName);
+}
+
+static bool bFailWrites = false;
+
+static SAOffset FailingWrite(const void *p, SAOffset size, SAOffset nmemb,
+                             SAFile file)
+{
+    if (bFailWrites)
+        return 0;
+    SAHooks sHooks;
+    SASetupDefaultHooks(&sHooks);
+    return sHooks.FWrite(p, size, nmemb, file);
+}
+
+TEST(DBFFieldTest, FailedSchemaChangeKeepsHeader)
+{
+    const auto filename =
+        fs::temp_directory_path() / GenerateUniqueFilename(".dbf");
+    auto hDBF = DBFCreate(filename.string().c_str());
+    ASSERT_NE(nullptr, hDBF);
+    ASSERT_EQ(0, DBFAddField(hDBF, "ID", FTInteger, 6, 0));
+    for (int i = 0; i < 100; i++)
+        EXPECT_TRUE(DBFWriteIntegerAttribute(hDBF, i, 0, i));
+    DBFClose(hDBF);
+
+    SAHooks sHooks;
+    SASetupDefaultHooks(&sHooks);
+    sHooks.FWrite = FailingWrite;
+    hDBF = DBFOpenLL(filename.string().c_str(), "rb+", &sHooks);
+    ASSERT_NE(nullptr, hDBF);
+    const auto hChange = DBFBeginSchemaChange(hDBF);
+    ASSERT_NE(nullptr, hChange);
+    EXPECT_EQ(1, DBFSchemaAddNativeFieldType(hChange, "NAME", 'C', 10, 0));
+    bFailWrites = true;
+    EXPECT_FALSE(DBFCommitSchemaChange(hChange));
+    bFailWrites = false;
+    EXPECT_EQ(1, DBFGetFieldCount(hDBF));
+    EXPECT_EQ(-1, DBFGetFieldIndex(hDBF, "NAME"));
+    DBFClose(hDBF);
+
+    /* The header on disk was not rewritten either */
+    hDBF = DBFOpen(filename.string().c_str(), "rb");
+    ASSERT_NE(nullptr, hDBF);
+    EXPECT_EQ(1, DBFGetFieldCount(hDBF));
+    EXPECT_EQ(100, DBFGetRecordCount(hDBF));
+    DBFClose(hDBF);
+
+    fs::remove(filename);
+}
+
+TEST(DBFReadTest, MmapHooksMatchDefaultHooks)
+{
+    const auto filename = kTestData / "CoHI_GCS12.dbf";
+    SAHooks sDefaultHooks;
+    SASetupDefaultHooks(&sDefaultHooks);
+    SAHooks sMmapHooks;
+    SASetupMmapHooks(&sMmapHooks);
+    const auto hDBF =
+        DBFOpenLL(filename.string().c_str(), "rb", &sDefaultHooks);
+    ASSERT_NE(nullptr, hDBF);
+    const auto hDBFMapped =
+        DBFOpenLL(filename.string().c_str(), "rb", &sMmapHooks);
+    ASSERT_NE(nullptr, hDBFMapped);
+    const int nRecords = DBFGetRecordCount(hDBF);
+    const int nFields = DBFGetFieldCount(hDBF);
+    ASSERT_EQ(nRecords, DBFGetRecordCount(hDBFMapped));
+    for (int i = 0; i < nRecords; i++)
+    {
+        for (int j = 0; j < nFields; j++)
+        {
+            EXPECT_EQ(std::string(DBFReadStringAttribute(hDBF, i, j)),
+                      std::string(DBFReadStringAttribute(hDBFMapped, i, j)));
+        }
+        EXPECT_EQ(0, std::memcmp(DBFReadTuple(hDBF, i),
+                                 DBFReadTuple(hDBFMapped, i),
+                                 hDBF->nRecordLength));
+    }
+    DBFClose(hDBF);
+    DBFClose(hDBFMapped);
+}
+
+TEST(DBFReadTest, AttributeViewMatchesStringAttribute)
+{
+    const auto filename = kTestData / "CoHI_GCS12.dbf";
+    SAHooks sDefaultHooks;
+    SASetupDefaultHooks(&sDefaultHooks);
+    SAHooks sMmapHooks;
+    SASetupMmapHooks(&sMmapHooks);
+    for (const SAHooks *psHooks : {&sDefaultHooks, &sMmapHooks})
+    {
+        const auto hDBF = DBFOpenLL(filename.string().c_str(), "rb", psHooks);
+        ASSERT_NE(nullptr, hDBF);
+        const int nRecords = DBFGetRecordCount(hDBF);
+        const int nFields = DBFGetFieldCount(hDBF);
+        for (int i = 0; i < nRecords; i++)
+        {
+            for (int j = 0; j < nFields; j++)
+            {
+                DBFFieldView sView;
+                ASSERT_TRUE(DBFReadAttributeView(hDBF, i, j, &sView));
+                EXPECT_EQ(std::string(DBFReadStringAttribute(hDBF, i, j)),
+                          std::string(sView.pachValue, sView.nLength));
+            }
+        }
+        DBFFieldView sView;
+        EXPECT_FALSE(DBFReadAttributeView(hDBF, nRecords, 0, &sView));
+        EXPECT_FALSE(DBFReadAttributeView(hDBF, 0, nFields, &sView));
+        DBFClose(hDBF);
+    }
+}
+
+TEST(DBFReadTest, AttributeViewIsTrimmed)
+{
+    const auto filename =
+        fs::temp_directory_path() / GenerateUniqueFilename(".dbf");
+    const auto hDBF = DBFCreate(filename.string().c_str());
+    ASSERT_NE(nullptr, hDBF);
+    ASSERT_EQ(0, DBFAddField(hDBF, "NAME", FTString, 10, 0));
+    ASSERT_EQ(1, DBFAddField(hDBF, "VALUE", FTInteger, 6, 0));
+    ASSERT_TRUE(DBFWriteStringAttribute(hDBF, 0, 0, "  ab c  "));
+    ASSERT_TRUE(DBFWriteIntegerAttribute(hDBF, 0, 1, 42));
+    ASSERT_TRUE(DBFWriteStringAttribute(hDBF, 1, 0, "   "));
+    ASSERT_TRUE(DBFWriteNULLAttribute(hDBF, 1, 1));
+    DBFFieldView sView;
+    ASSERT_TRUE(DBFReadAttributeView(hDBF, 0, 0, &sView));
+    EXPECT_EQ("ab c", std::string(sView.pachValue, sView.nLength));
+    ASSERT_TRUE(DBFReadAttributeView(hDBF, 0, 1, &sView));
+    EXPECT_EQ("42", std::string(sView.pachValue, sView.nLength));
+    ASSERT_TRUE(DBFReadAttributeView(hDBF, 1, 0, &sView));
+    EXPECT_EQ(0, sView.nLength);
+    ASSERT_TRUE(DBFReadAttributeView(hDBF, 1, 1, &sView));
+    EXPECT_EQ("******", std::string(sView.pachValue, sView.nLength));
+    DBFClose(hDBF);
+    fs::remove(filename);
+}
+
+TEST(DBFReadTest, ColumnsMatchAttributes)
+{
+    SAHooks sDefaultHooks;
+    SASetupDefaultHooks(&sDefaultHooks);
+    SAHooks sMmapHooks;
+    SASetupMmapHooks(&sMmapHooks);
+    for (const auto *pszName : {"CoHI_GCS12.dbf", "pline.dbf"})
+    {
+        const auto filename = kTestData / pszName;
+        for (const SAHooks *psHooks : {&sDefaultHooks, &sMmapHooks})
+        {
+            const auto hDBF =
+                DBFOpenLL(filename.string().c_str(), "rb", psHooks);
+            ASSERT_NE(nullptr, hDBF);
+            const int nRecords = DBFGetRecordCount(hDBF);
+            ASSERT_GT(nRecords, 1);
+            for (int iField = 0; iField < DBFGetFieldCount(hDBF); iField++)
+            {
+                /* Skip the first record to check the offsets */
+                const int nCount = nRecords - 1;
+                std::vector<int> anValues(nCount);
+                std::vector<double> adfValues(nCount);
+                std::vector<unsigned char> abyNullMask((nCount + 7) / 8);
+                ASSERT_EQ(nCount,
+                          DBFReadIntegerColumn(hDBF, iField, 1, nCount,
+                                               anValues.data(), nullptr));
+                ASSERT_EQ(nCount, DBFReadDoubleColumn(hDBF, iField, 1, nCount,
+                                                      adfValues.data(),
+                                                      abyNullMask.data()));
+                for (int i = 0; i < nCount; i++)
+                {
+                    EXPECT_EQ(DBFReadIntegerAttribute(hDBF, i + 1, iField),
+                              anValues[i]);
+                    EXPECT_EQ(DBFReadDoubleAttribute(hDBF, i + 1, iField),
+                              adfValues[i]);
+                    EXPECT_EQ(DBFIsAttributeNULL(hDBF, i + 1, iField) != 0,
+                              (abyNullMask[i / 8] >> (i % 8)) & 1);
+                }
+            }
+            EXPECT_EQ(-1, DBFReadDoubleColumn(hDBF, 0, 1, nRecords, nullptr,
+                                              nullptr));
+            EXPECT_EQ(0, DBFReadDoubleColumn(hDBF, 0, nRecords, 0, nullptr,
+                                             nullptr));
+            DBFClose(hDBF);
+        }
+    }
+}
+
+TEST(DBFReadTest, ColumnSeesUnflushedRecord)
+{
+    const auto filename =
+        fs::temp_directory_path() / GenerateUniqueFilename(".dbf");
+    const auto hDBF = DBFCreate(filename.string().c_str());
+    ASSERT_NE(nullptr, hDBF);
+    ASSERT_EQ(0, DBFAddField(hDBF, "VALUE", FTDouble, 12, 3));
+    ASSERT_TRUE(DBFWriteDoubleAttribute(hDBF, 0, 0, 1.5));
+    ASSERT_TRUE(DBFWriteNULLAttribute(hDBF, 1, 0));
+    ASSERT_TRUE(DBFWriteDoubleAttribute(hDBF, 2, 0, -2.25));
+    double adfValues[3];
+    unsigned char byNullMask = 0;
+    ASSERT_EQ(3, DBFReadDoubleColumn(hDBF, 0, 0, 3, adfValues, &byNullMask));
+    EXPECT_EQ(1.5, adfValues[0]);
+    EXPECT_EQ(0.0, adfValues[1]);
+    EXPECT_EQ(-2.25, adfValues[2]);
+    EXPECT_EQ(0x2, byNullMask);
+    DBFClose(hDBF);
+    fs::remove(filename);
+}
+
+TEST(DBFReadTest, NumbersMatchStrtod)
+{
+    const auto filename =
+        fs::temp_directory_path() / GenerateUniqueFilename(".dbf");
+    const auto hDBF = DBFCreate(filename.string().c_str());
+    ASSERT_NE(nullptr, hDBF);
+    ASSERT_EQ(0, DBFAddField(hDBF, "TEXT", FTString, 30, 0));
+    ASSERT_EQ(1, DBFAddField(hDBF, "VALUE", FTDouble, 24, 15));
+    const char *const apszValues[] = {"42",
+                                      "  -17  ",
+                                      "+8",
+                                      "12.50",
+                                      "-0.000",
+                                      ".5",
+                                      "7.",
+                                      "1.5e3",
+                                      "0x10",
+                                      "12,5",
+                                      "***",
+                                      "",
+                                      "-",
+                                      "2147483647",
+                                      "-2147483648",
+                                      "99999999999",
+                                      "9007199254740993",
+                                      "0.1000000000000000055511151231",
+                                      "123456789012345678901234",
+                                      "4.9406564584124654e-324",
+                                      "0.000000000000000000000123"};
+    int iRecord = 0;
+    for (const char *pszValue : apszValues)
+        ASSERT_TRUE(DBFWriteStringAttribute(hDBF, iRecord++, 0, pszValue));
+    const int nTextRecords = iRecord;
+    for (int i = 0; i < 1000; i++)
+    {
+        const double dfValue = (i - 500) * 1234.5678901 / (i + 1);
+        ASSERT_TRUE(DBFWriteDoubleAttribute(hDBF, iRecord++, 1, dfValue));
+    }
+
+    std::vector<int> anValues(iRecord);
+    std::vector<double> adfValues(iRecord);
+    for (int iField = 0; iField < 2; iField++)
+    {
+        const int iFirst = iField == 0 ? 0 : nTextRecords;
+        const int nCount = iField == 0 ? nTextRecords : iRecord - nTextRecords;
+        ASSERT_EQ(nCount, DBFReadIntegerColumn(hDBF, iField, iFirst, nCount,
+                                               anValues.data(), nullptr));
+        ASSERT_EQ(nCount, DBFReadDoubleColumn(hDBF, iField, iFirst, nCount,
+                                              adfValues.data(), nullptr));
+        for (int i = 0; i < nCount; i++)
+        {
+            const std::string osValue(
+                DBFReadStringAttribute(hDBF, iFirst + i, iField));
+            const double dfExpected = strtod(osValue.c_str(), nullptr);
+            EXPECT_EQ(0, std::memcmp(&dfExpected, &adfValues[i],
+                                     sizeof(double)))
+                << osValue;
+            EXPECT_EQ(dfExpected,
+                      DBFReadDoubleAttribute(hDBF, iFirst + i, iField))
+                << osValue;
+            /* atoi() is undefined on overflow */
+            if (dfExpected < std::numeric_limits<int>::min() ||
+                dfExpected > std::numeric_limits<int>::max())
+                continue;
+            EXPECT_EQ(atoi(osValue.c_str()), anValues[i]) << osValue;
+            EXPECT_EQ(atoi(osValue.c_str()),
+                      DBFReadIntegerAttribute(hDBF, iFirst + i, iField))
+                << osValue;
+        }
+    }
+    DBFClose(hDBF);
+    fs::remove(filename);
+}
+
+static double DoublingAtof(const char *pszValue)
+{
+    return 2 * atof(pszValue);
+}
+
+TEST(DBFReadTest, NumbersUseAtofHook)
+{
+    const auto filename =
+        fs::temp_directory_path() / GenerateUniqueFilename(".dbf");
+    SAHooks sHooks;
+    SASetupDefaultHooks(&sHooks);
+    sHooks.Atof = DoublingAtof;
+    const auto hDBF = DBFCreateLL(filename.string().c_str(), "LDID/87", &sHooks);
+    ASSERT_NE(nullptr, hDBF);
+    ASSERT_EQ(0, DBFAddField(hDBF, "VALUE", FTDouble, 12, 3));
+    ASSERT_TRUE(DBFWriteDoubleAttribute(hDBF, 0, 0, 1.5));
+    ASSERT_TRUE(DBFWriteDoubleAttribute(hDBF, 1, 0, -2.25));
+    EXPECT_EQ(3.0, DBFReadDoubleAttribute(hDBF, 0, 0));
+    double adfValues[2];
+    ASSERT_EQ(2, DBFReadDoubleColumn(hDBF, 0, 0, 2, adfValues, nullptr));
+    EXPECT_EQ(3.0, adfValues[0]);
+    EXPECT_EQ(-4.5, adfValues[1]);
+    DBFClose(hDBF);
+    fs::remove(filename);
+}
+
+static int nReadAtCalls = 0;
+
+static SAOffset CountingReadAt(SAFile file, SAOffset offset, void *p,
+                               SAOffset size)
+{
+    SAHooks sHooks;
+    SASetupDefaultHooks(&sHooks);
+    nReadAtCalls++;
+    if (sHooks.FSeek(file, offset, SEEK_SET) != 0)
+        return 0;
+    return sHooks.FRead(p, 1, size, file);
+}
+
+TEST(DBFReadTest, ReadAheadRecords)
+{
+    const auto filename =
+        fs::temp_directory_path() / GenerateUniqueFilename(".dbf");
+    auto hDBF = DBFCreate(filename.string().c_str());
+    ASSERT_NE(nullptr, hDBF);
+    ASSERT_EQ(0, DBFAddField(hDBF, "ID", FTInteger, 8, 0));
+    for (int i = 0; i < 100; i++)
+        ASSERT_TRUE(DBFWriteIntegerAttribute(hDBF, i, 0, i));
+    DBFClose(hDBF);
+
+    SAHooks sHooks;
+    SASetupDefaultHooks(&sHooks);
+    sHooks.FReadAt = CountingReadAt;
+    hDBF = DBFOpenLL(filename.string().c_str(), "rb+", &sHooks);
+    ASSERT_NE(nullptr, hDBF);
+    ASSERT_TRUE(DBFSetReadAheadRecords(hDBF, 32));
+    EXPECT_FALSE(DBFSetReadAheadRecords(hDBF, -1));
+
+    /* Sequential reads are served by blocks of 32 records */
+    nReadAtCalls = 0;
+    for (int i = 0; i < 100; i++)
+        EXPECT_EQ(i, DBFReadIntegerAttribute(hDBF, i, 0));
+    EXPECT_EQ(4, nReadAtCalls);
+
+    /* Writes are seen by cached and reloaded records */
+    EXPECT_EQ(96, DBFReadIntegerAttribute(hDBF, 96, 0));
+    ASSERT_TRUE(DBFWriteIntegerAttribute(hDBF, 97, 0, -97));
+    EXPECT_EQ(98, DBFReadIntegerAttribute(hDBF, 98, 0));
+    EXPECT_EQ(-97, DBFReadIntegerAttribute(hDBF, 97, 0));
+    ASSERT_TRUE(DBFWriteIntegerAttribute(hDBF, 5, 0, -5));
+    EXPECT_EQ(-97, DBFReadIntegerAttribute(hDBF, 97, 0));
+    EXPECT_EQ(-5, DBFReadIntegerAttribute(hDBF, 5, 0));
+
+    /* And so are layout changes */
+    ASSERT_EQ(1, DBFAddField(hDBF, "NAME", FTString, 4, 0));
+    ASSERT_TRUE(DBFWriteStringAttribute(hDBF, 6, 1, "six"));
+    for (int i = 0; i < 100; i++)
+    {
+        const int nExpected = i == 5 || i == 97 ? -i : i;
+        EXPECT_EQ(nExpected, DBFReadIntegerAttribute(hDBF, i, 0));
+        EXPECT_STREQ(i == 6 ? "six" : "", DBFReadStringAttribute(hDBF, i, 1));
+    }
+
+    ASSERT_TRUE(DBFSetReadAheadRecords(hDBF, 0));
+    EXPECT_EQ(-5, DBFReadIntegerAttribute(hDBF, 5, 0));
+    DBFClose(hDBF);
+    fs::remove(filename);
+}
+
+TEST(DBFCreateTest, ReserveRecords)
+{
+    const auto filename =
+        fs::temp_directory_path() / GenerateUniqueFilename(".dbf");
+    const auto hDBF = DBFCreate(filename.string().c_str());
+    ASSERT_NE(nullptr, hDBF);
+    ASSERT_EQ(0, DBFAddField(hDBF, "ID", FTInteger, 8, 0));
+    ASSERT_TRUE(DBFReserveRecords(hDBF, 100));
+    EXPECT_FALSE(DBFReserveRecords(hDBF, -1));
+    for (int i = 0; i < 10; i++)
+        EXPECT_TRUE(DBFWriteIntegerAttribute(hDBF, i, 0, i));
+    const int nHeaderLength = hDBF->nHeaderLength;
+    const int nRecordLength = hDBF->nRecordLength;
+    DBFClose(hDBF);
+
+    /* The reserved storage does not change the size of the file */
+    EXPECT_EQ(nHeaderLength + 10 * nRecordLength + 1, fs::file_size(filename));
+    fs::remove(filename);
+}
+
+TEST(DBFCreateTest, WriteBufferMatchesUnbufferedWrites)
+{
+    const auto tmp = fs::temp_directory_path();
+    const std::string aosNames[] = {GenerateUniqueFilename(".unbuffered.dbf"),
+                                    GenerateUniqueFilename(".buffered.dbf")};
+    for (int iPass = 0; iPass < 2; iPass++)
+    {
+        const auto filename = tmp / aosNames[iPass];
+        const auto hDBF = DBFCreate(filename.string().c_str());
+        ASSERT_NE(nullptr, hDBF);
+        ASSERT_EQ(0, DBFAddField(hDBF, "ID", FTInteger, 8, 0));
+        ASSERT_EQ(1, DBFAddField(hDBF, "NAME", FTString, 12, 0));
+        /* Small enough to get flushed several times */
+        if (iPass == 1)
+        {
+            ASSERT_TRUE(DBFSetWriteBufferSize(hDBF, 200));
+        }
+        EXPECT_FALSE(DBFSetWriteBufferSize(hDBF, -1));
+
+        for (int i = 0; i < 100; i++)
+        {
+            EXPECT_TRUE(DBFWriteIntegerAttribute(hDBF, i, 0, i));
+            EXPECT_TRUE(DBFWriteStringAttribute(
+                hDBF, i, 1, ("name" + std::to_string(i)).c_str()));
+
+            if (i % 10 == 4)
+            {
+                /* Buffered records must be visible to reads */
+                EXPECT_EQ(i - 1, DBFReadIntegerAttribute(hDBF, i - 1, 0));
+                EXPECT_EQ(i, DBFReadIntegerAttribute(hDBF, i, 0));
+            }
+        }
+
+        /* Rewrite a record that is still in the buffer */
+        EXPECT_TRUE(DBFWriteIntegerAttribute(hDBF, 98, 0, -98));
+        EXPECT_TRUE(DBFMarkRecordDeleted(hDBF, 97, true));
+        ASSERT_TRUE(DBFWriteIntegerAttribute(hDBF, 100, 0, 100));
+        DBFClose(hDBF);
+    }
+
+    const auto ReadContent = [&tmp](const std::string &osName)
+    {
+        std::ifstream f(tmp / osName, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(f),
+                           std::istreambuf_iterator<char>());
+    };
+    const auto osBuffered = ReadContent(aosNames[1]);
+    EXPECT_FALSE(osBuffered.empty());
+    EXPECT_EQ(ReadContent(aosNames[0]), osBuffered);
+
+    for (const auto &osName : aosNames)
+        fs::remove(tmp / osName);
+}
+
+TEST(DBFCreateTest, NumbersMatchSnprintf)
+{
+    const auto filename =
+        fs::temp_directory_path() / GenerateUniqueFilename(".dbf");
+    const auto hDBF = DBFCreate(filename.string().c_str());
+    ASSERT_NE(nullptr, hDBF);
+    const int anWidths[] = {10, 12, 19, 8};
+    const int anDecimals[] = {0, 3, 8, 2};
+    ASSERT_EQ(0, DBFAddField(hDBF, "I", FTInteger, anWidths[0], 0));
+    ASSERT_EQ(1, DBFAddField(hDBF, "D3", FTDouble, anWidths[1], anDecimals[1]));
+    ASSERT_EQ(2, DBFAddField(hDBF, "D8", FTDouble, anWidths[2], anDecimals[2]));
+    ASSERT_EQ(3, DBFAddField(hDBF, "D2", FTDouble, anWidths[3], anDecimals[3]));
+
+    /* Ties, values rounding to zero, overflows and non finite values */
+    const double adfValues[] = {0.0,
+                                -0.0,
+                                1.0,
+                                -1.0,
+                                0.1,
+                                0.5,
+                                2.5,
+                                -2.5,
+                                0.125,
+                                0.0005,
+                                -0.0004,
+                                0.005,
+                                1.0 / 3,
+                                -2.0 / 3,
+                                123456.789,
+                                99999.995,
+                                9999999.999,
+                                2147483647.0,
+                                -2147483648.0,
+                                4503599627370495.5,
+                                1e15,
+                                1e300,
+                                std::numeric_limits<double>::min(),
+                                std::numeric_limits<double>::infinity(),
+                                -std::numeric_limits<double>::infinity(),
+                                std::nan("")};
+
+    int iRecord = 0;
+    for (const double dfValue : adfValues)
+    {
+        int nOffset = 1;
+        for (int iField = 0; iField < 4; iField++)
+        {
+            const bool bWritten =
+                DBFWriteDoubleAttribute(hDBF, iRecord, iField, dfValue);
+
+            char szExpected[64];
+            snprintf(szExpected, sizeof(szExpected), "%*.*f",
+                     anWidths[iField], anDecimals[iField], dfValue);
+            EXPECT_EQ(static_cast<int>(strlen(szExpected)) <= anWidths[iField],
+                      bWritten)
+                << szExpected;
+            szExpected[anWidths[iField]] = '\0';
+
+            const char *pszRecord = DBFReadTuple(hDBF, iRecord);
+            ASSERT_NE(nullptr, pszRecord);
+            EXPECT_EQ(std::string(szExpected),
+                      std::string(pszRecord + nOffset, anWidths[iField]));
+            nOffset += anWidths[iField];
+        }
+        iRecord++;
+    }
+
+    DBFClose(hDBF);
+    fs::remove(filename);
+}
+
 }  // namespace
 
 int main(int argc, char **argv)
@@ -1,8 +1,18 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
 #include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 #include "shapefil.h"
@@ -14,6 +24,18 @@ namespace
 
 static const auto kTestData = fs::path{"shape_eg_data"};
 
+static auto GenerateUniqueFilename(std::string_view ext) -> auto
+{
+    const auto now = std::chrono::system_clock::now();
+    const auto timestamp =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            now.time_since_epoch())
+            .count();
+    std::ostringstream oss;
+    oss << "test_" << timestamp << ext;
+    return oss.str();
+}
+
 TEST(SHPOpenTest, OpenDoesNotExist_rb)
 {
     const auto handle = SHPOpen("/does/not/exist.shp", "rb");
@@ -64,6 +86,497 @@ TEST(SHPOpenTest, OpenExistingWithRestoreSHX)
     EXPECT_TRUE(fs::exists(filename));
 }
 
+TEST(SHPReadObjectTest, MmapHooksMatchDefaultHooks)
+{
+    const auto filename = kTestData / "polygon.shp";
+    SAHooks sDefaultHooks;
+    SASetupDefaultHooks(&sDefaultHooks);
+    SAHooks sMmapHooks;
+    SASetupMmapHooks(&sMmapHooks);
+    const auto hSHP =
+        SHPOpenLL(filename.string().c_str(), "rb", &sDefaultHooks);
+    ASSERT_NE(nullptr, hSHP);
+    const auto hSHPMapped =
+        SHPOpenLL(filename.string().c_str(), "rb", &sMmapHooks);
+    ASSERT_NE(nullptr, hSHPMapped);
+    int nEntities = 0;
+    SHPGetInfo(hSHP, &nEntities, nullptr, nullptr, nullptr);
+    ASSERT_GT(nEntities, 0);
+    for (int i = 0; i < nEntities; i++)
+    {
+        SHPObject *psObj = SHPReadObject(hSHP, i);
+        SHPObject *psObjMapped = SHPReadObject(hSHPMapped, i);
+        ASSERT_NE(nullptr, psObj);
+        ASSERT_NE(nullptr, psObjMapped);
+        EXPECT_EQ(psObj->nSHPType, psObjMapped->nSHPType);
+        EXPECT_EQ(psObj->nParts, psObjMapped->nParts);
+        ASSERT_EQ(psObj->nVertices, psObjMapped->nVertices);
+        for (int j = 0; j < psObj->nVertices; j++)
+        {
+            EXPECT_EQ(psObj->padfX[j], psObjMapped->padfX[j]);
+            EXPECT_EQ(psObj->padfY[j], psObjMapped->padfY[j]);
+        }
+        SHPDestroyObject(psObj);
+        SHPDestroyObject(psObjMapped);
+    }
+    SHPClose(hSHP);
+    SHPClose(hSHPMapped);
+}
+
+TEST(SHPReadObjectTest, MmapHooksRejectNegativeSeek)
+{
+    const auto filename = kTestData / "polygon.shp";
+    SAHooks sMmapHooks;
+    SASetupMmapHooks(&sMmapHooks);
+    const auto fp = sMmapHooks.FOpen(filename.string().c_str(), "rb", nullptr);
+    ASSERT_NE(nullptr, fp);
+    ASSERT_EQ(0u, sMmapHooks.FSeek(fp, 4, SEEK_SET));
+    EXPECT_NE(0u, sMmapHooks.FSeek(fp, static_cast<SAOffset>(-8), SEEK_CUR));
+    EXPECT_EQ(4u, sMmapHooks.FTell(fp));
+    EXPECT_EQ(0u, sMmapHooks.FSeek(fp, static_cast<SAOffset>(-4), SEEK_CUR));
+    EXPECT_EQ(0u, sMmapHooks.FTell(fp));
+    char abyBuf[4];
+    EXPECT_EQ(0u, sMmapHooks.FReadAt(fp, static_cast<SAOffset>(-4), abyBuf, 4));
+    sMmapHooks.FClose(fp);
+}
+
+TEST(SHPReadObjectTest, ViewMatchesObject)
+{
+    const auto filename = kTestData / "multipatch.shp";
+    const auto hSHP = SHPOpen(filename.string().c_str(), "rb");
+    ASSERT_NE(nullptr, hSHP);
+    int nEntities = 0;
+    SHPGetInfo(hSHP, &nEntities, nullptr, nullptr, nullptr);
+    ASSERT_GT(nEntities, 0);
+    for (int i = 0; i < nEntities; i++)
+    {
+        SHPObject *psObj = SHPReadObject(hSHP, i);
+        ASSERT_NE(nullptr, psObj);
+        SHPObjectView sView;
+        ASSERT_TRUE(SHPReadObjectView(hSHP, i, &sView));
+        EXPECT_EQ(psObj->nSHPType, sView.nSHPType);
+        EXPECT_EQ(psObj->dfXMin, sView.dfXMin);
+        EXPECT_EQ(psObj->dfZMax, sView.dfZMax);
+        ASSERT_EQ(psObj->nParts, sView.nParts);
+        for (int j = 0; j < sView.nParts; j++)
+        {
+            int nPartStart;
+            std::memcpy(&nPartStart, sView.pabyPartStart + 4 * j, 4);
+            EXPECT_EQ(psObj->panPartStart[j], nPartStart);
+        }
+        ASSERT_EQ(psObj->nVertices, sView.nVertices);
+        for (int j = 0; j < sView.nVertices; j++)
+        {
+            double adfXY[2];
+            std::memcpy(adfXY, sView.pabyXY + 16 * j, 16);
+            EXPECT_EQ(psObj->padfX[j], adfXY[0]);
+            EXPECT_EQ(psObj->padfY[j], adfXY[1]);
+            if (sView.pabyZ)
+            {
+                double dfZ;
+                std::memcpy(&dfZ, sView.pabyZ + 8 * j, 8);
+                EXPECT_EQ(psObj->padfZ[j], dfZ);
+            }
+        }
+        SHPDestroyObject(psObj);
+    }
+    SHPClose(hSHP);
+}
+
+TEST(SHPReadObjectTest, ReadObjectsMatchesReadObject)
+{
+    const auto filename = kTestData / "CoHI_GCS12.shp";
+    const auto hSHP = SHPOpen(filename.string().c_str(), "rb");
+    ASSERT_NE(nullptr, hSHP);
+    int nEntities = 0;
+    SHPGetInfo(hSHP, &nEntities, nullptr, nullptr, nullptr);
+    ASSERT_GT(nEntities, 0);
+    const auto hArena = SHPCreateObjectArena();
+    ASSERT_NE(nullptr, hArena);
+    constexpr int kBatchSize = 7;
+    SHPObject *apsObjects[kBatchSize];
+    for (int iFirst = 0; iFirst < nEntities; iFirst += kBatchSize)
+    {
+        const int nCount = std::min(kBatchSize, nEntities - iFirst);
+        ASSERT_EQ(nCount,
+                  SHPReadObjects(hSHP, iFirst, nCount, hArena, apsObjects));
+        for (int i = 0; i < nCount; i++)
+        {
+            SHPObject *psObj = SHPReadObject(hSHP, iFirst + i);
+            ASSERT_NE(nullptr, psObj);
+            const SHPObject *psBatchObj = apsObjects[i];
+            ASSERT_NE(nullptr, psBatchObj);
+            EXPECT_EQ(psObj->nShapeId, psBatchObj->nShapeId);
+            EXPECT_EQ(psObj->dfYMax, psBatchObj->dfYMax);
+            ASSERT_EQ(psObj->nParts, psBatchObj->nParts);
+            for (int j = 0; j < psObj->nParts; j++)
+                EXPECT_EQ(psObj->panPartStart[j], psBatchObj->panPartStart[j]);
+            ASSERT_EQ(psObj->nVertices, psBatchObj->nVertices);
+            for (int j = 0; j < psObj->nVertices; j++)
+            {
+                EXPECT_EQ(psObj->padfX[j], psBatchObj->padfX[j]);
+                EXPECT_EQ(psObj->padfY[j], psBatchObj->padfY[j]);
+                EXPECT_EQ(psObj->padfZ[j], psBatchObj->padfZ[j]);
+            }
+            SHPDestroyObject(psObj);
+        }
+    }
+    EXPECT_EQ(-1, SHPReadObjects(hSHP, nEntities, 1, hArena, apsObjects));
+    SHPDestroyObjectArena(hArena);
+    SHPClose(hSHP);
+}
+
+TEST(SHPReadObjectTest, ReadBoundsMatchesReadObject)
+{
+    for (const auto *pszName : {"polygon.shp", "3dpoints.shp"})
+    {
+        const auto filename = kTestData / pszName;
+        const auto hSHP = SHPOpen(filename.string().c_str(), "rb");
+        ASSERT_NE(nullptr, hSHP);
+        int nEntities = 0;
+        SHPGetInfo(hSHP, &nEntities, nullptr, nullptr, nullptr);
+        ASSERT_GT(nEntities, 0);
+        std::vector<double> adfBounds(4 * nEntities);
+        EXPECT_EQ(nEntities,
+                  SHPReadObjectsBounds(hSHP, 0, nEntities, adfBounds.data()));
+        for (int i = 0; i < nEntities; i++)
+        {
+            SHPObject *psObj = SHPReadObject(hSHP, i);
+            ASSERT_NE(nullptr, psObj);
+            double adfMin[2];
+            double adfMax[2];
+            ASSERT_TRUE(SHPReadObjectBounds(hSHP, i, adfMin, adfMax));
+            EXPECT_EQ(psObj->dfXMin, adfMin[0]);
+            EXPECT_EQ(psObj->dfYMin, adfMin[1]);
+            EXPECT_EQ(psObj->dfXMax, adfMax[0]);
+            EXPECT_EQ(psObj->dfYMax, adfMax[1]);
+            EXPECT_EQ(psObj->dfXMin, adfBounds[4 * i + 0]);
+            EXPECT_EQ(psObj->dfYMin, adfBounds[4 * i + 1]);
+            EXPECT_EQ(psObj->dfXMax, adfBounds[4 * i + 2]);
+            EXPECT_EQ(psObj->dfYMax, adfBounds[4 * i + 3]);
+            SHPDestroyObject(psObj);
+        }
+        SHPClose(hSHP);
+    }
+}
+
+TEST(SHPScanTest, ScanWithoutSHXMatchesReadObject)
+{
+    const auto filename = kTestData / "CoHI_GCS12.shp";
+    /* Without a .shx next to it */
+    const auto scanFilename =
+        fs::temp_directory_path() / GenerateUniqueFilename(".shp");
+    fs::copy_file(filename, scanFilename);
+
+    const auto hSHP = SHPOpen(filename.string().c_str(), "rb");
+    ASSERT_NE(nullptr, hSHP);
+    int nEntities = 0;
+    int nShapeType = 0;
+    SHPGetInfo(hSHP, &nEntities, &nShapeType, nullptr, nullptr);
+    const auto hScan = SHPScanOpen(scanFilename.string().c_str());
+    ASSERT_NE(nullptr, hScan);
+    int nScanShapeType = 0;
+    SHPScanGetInfo(hScan, &nScanShapeType, nullptr, nullptr);
+    EXPECT_EQ(nShapeType, nScanShapeType);
+
+    int nScanned = 0;
+    SHPObject *psScanObj;
+    while ((psScanObj = SHPScanNext(hScan)) != nullptr)
+    {
+        SHPObject *psObj = SHPReadObject(hSHP, nScanned);
+        ASSERT_NE(nullptr, psObj);
+        EXPECT_EQ(psObj->nShapeId, psScanObj->nShapeId);
+        EXPECT_EQ(psObj->nParts, psScanObj->nParts);
+        ASSERT_EQ(psObj->nVertices, psScanObj->nVertices);
+        for (int j = 0; j < psObj->nVertices; j++)
+        {
+            EXPECT_EQ(psObj->padfX[j], psScanObj->padfX[j]);
+            EXPECT_EQ(psObj->padfY[j], psScanObj->padfY[j]);
+        }
+        SHPDestroyObject(psObj);
+        SHPDestroyObject(psScanObj);
+        nScanned++;
+    }
+    EXPECT_EQ(nEntities, nScanned);
+
+    SHPScanClose(hScan);
+    SHPClose(hSHP);
+    fs::remove(scanFilename);
+}
+
+static int nReadAtCalls = 0;
+
+static SAOffset CountingReadAt(SAFile file, SAOffset offset, void *p,
+                               SAOffset size)
+{
+    SAHooks sHooks;
+    SASetupDefaultHooks(&sHooks);
+    nReadAtCalls++;
+    if (sHooks.FSeek(file, offset, SEEK_SET) != 0)
+        return 0;
+    return sHooks.FRead(p, 1, size, file);
+}
+
+TEST(SHPReadObjectTest, LazySHXLoadingReadsByPages)
+{
+    const auto filename = kTestData / "polygon.shp";
+    SAHooks sHooks;
+    SASetupDefaultHooks(&sHooks);
+    sHooks.FReadAt = CountingReadAt;
+
+    const auto hSHP = SHPOpen(filename.string().c_str(), "rb");
+    ASSERT_NE(nullptr, hSHP);
+    const auto hLazySHP = SHPOpenLL(filename.string().c_str(), "rbl", &sHooks);
+    ASSERT_NE(nullptr, hLazySHP);
+    int nEntities = 0;
+    SHPGetInfo(hSHP, &nEntities, nullptr, nullptr, nullptr);
+
+    nReadAtCalls = 0;
+    for (int i = nEntities - 1; i >= 0; i--)
+    {
+        SHPObject *psObj = SHPReadObject(hSHP, i);
+        SHPObject *psLazyObj = SHPReadObject(hLazySHP, i);
+        ASSERT_NE(nullptr, psObj);
+        ASSERT_NE(nullptr, psLazyObj);
+        ASSERT_EQ(psObj->nVertices, psLazyObj->nVertices);
+        for (int j = 0; j < psObj->nVertices; j++)
+        {
+            EXPECT_EQ(psObj->padfX[j], psLazyObj->padfX[j]);
+            EXPECT_EQ(psObj->padfY[j], psLazyObj->padfY[j]);
+        }
+        SHPDestroyObject(psObj);
+        SHPDestroyObject(psLazyObj);
+    }
+    /* One read per .shp record, and a single one for the whole .shx */
+    EXPECT_EQ(nEntities + 1, nReadAtCalls);
+
+    SHPClose(hLazySHP);
+    SHPClose(hSHP);
+}
+
+TEST(SHPReaderTest, ConcurrentReadersMatchReadObject)
+{
+    const auto filename = kTestData / "CoHI_GCS12.shp";
+    /* Lazy .shx loading: offsets are loaded by SHPCreateReader() */
+    const auto hSHP = SHPOpen(filename.string().c_str(), "rbl");
+    ASSERT_NE(nullptr, hSHP);
+    int nEntities = 0;
+    SHPGetInfo(hSHP, &nEntities, nullptr, nullptr, nullptr);
+
+    std::vector<SHPReader> ahReaders;
+    for (int i = 0; i < 4; i++)
+    {
+        ahReaders.push_back(SHPCreateReader(hSHP));
+        ASSERT_NE(nullptr, ahReaders.back());
+    }
+
+    std::vector<int> anMismatches(ahReaders.size());
+    std::vector<std::thread> aoThreads;
+    for (size_t i = 0; i < ahReaders.size(); i++)
+    {
+        aoThreads.emplace_back(
+            [&, i]()
+            {
+                /* Each thread walks the shapes in a different order */
+                for (int k = 0; k < nEntities; k++)
+                {
+                    const int iShape =
+                        static_cast<int>((k * (2 * i + 1)) % nEntities);
+                    SHPObject *psObj =
+                        SHPReaderReadObject(ahReaders[i], iShape);
+                    if (psObj == nullptr || psObj->nShapeId != iShape)
+                        anMismatches[i]++;
+                    SHPDestroyObject(psObj);
+                }
+            });
+    }
+    for (auto &oThread : aoThreads)
+        oThread.join();
+
+    for (int iShape = 0; iShape < nEntities; iShape++)
+    {
+        SHPObject *psObj = SHPReadObject(hSHP, iShape);
+        SHPObject *psReaderObj = SHPReaderReadObject(ahReaders[0], iShape);
+        ASSERT_NE(nullptr, psObj);
+        ASSERT_NE(nullptr, psReaderObj);
+        ASSERT_EQ(psObj->nVertices, psReaderObj->nVertices);
+        for (int j = 0; j < psObj->nVertices; j++)
+        {
+            EXPECT_EQ(psObj->padfX[j], psReaderObj->padfX[j]);
+            EXPECT_EQ(psObj->padfY[j], psReaderObj->padfY[j]);
+        }
+        SHPDestroyObject(psObj);
+        SHPDestroyObject(psReaderObj);
+    }
+
+    for (size_t i = 0; i < ahReaders.size(); i++)
+    {
+        EXPECT_EQ(0, anMismatches[i]);
+        SHPDestroyReader(ahReaders[i]);
+    }
+    SHPClose(hSHP);
+}
+
+TEST(SHPReadObjectsParallelTest, MatchesReadObject)
+{
+    const auto filename = kTestData / "polygon.shp";
+    const auto hSHP = SHPOpen(filename.string().c_str(), "rb");
+    ASSERT_NE(nullptr, hSHP);
+    int nEntities = 0;
+    SHPGetInfo(hSHP, &nEntities, nullptr, nullptr, nullptr);
+
+    struct Collector
+    {
+        SHPHandle hSHP;
+        std::vector<int> anShapeIds;
+        int nMismatches;
+        int nStopAfter;
+    };
+
+    const SHPReadObjectsCallback pfnCallback =
+        [](int iShape, SHPObject *psObj, void *pUserData) -> int
+    {
+        auto psCollector = static_cast<Collector *>(pUserData);
+        psCollector->anShapeIds.push_back(iShape);
+        SHPObject *psRef = SHPReadObject(psCollector->hSHP, iShape);
+        if (psObj == nullptr || psRef == nullptr ||
+            psObj->nShapeId != iShape ||
+            psObj->nVertices != psRef->nVertices ||
+            !std::equal(psObj->padfX, psObj->padfX + psObj->nVertices,
+                        psRef->padfX) ||
+            !std::equal(psObj->padfY, psObj->padfY + psObj->nVertices,
+                        psRef->padfY))
+            psCollector->nMismatches++;
+        SHPDestroyObject(psRef);
+        SHPDestroyObject(psObj);
+        return static_cast<int>(static_cast<int>(
+                   psCollector->anShapeIds.size()) != psCollector->nStopAfter);
+    };
+
+    for (const int nFlags : {0, SHP_READ_UNORDERED})
+    {
+        Collector sCollector{hSHP, {}, 0, -1};
+        EXPECT_EQ(nEntities, SHPReadObjectsParallel(hSHP, 0, nEntities, 3,
+                                                    nFlags, pfnCallback,
+                                                    &sCollector));
+        EXPECT_EQ(0, sCollector.nMismatches);
+        if (nFlags == 0)
+        {
+            EXPECT_TRUE(std::is_sorted(sCollector.anShapeIds.begin(),
+                                       sCollector.anShapeIds.end()));
+        }
+        std::sort(sCollector.anShapeIds.begin(), sCollector.anShapeIds.end());
+        ASSERT_EQ(static_cast<size_t>(nEntities), sCollector.anShapeIds.size());
+        for (int i = 0; i < nEntities; i++)
+            EXPECT_EQ(i, sCollector.anShapeIds[i]);
+    }
+
+    /* The callback can stop the read */
+    Collector sCollector{hSHP, {}, 0, 5};
+    EXPECT_EQ(5, SHPReadObjectsParallel(hSHP, 2, nEntities - 2, 0, 0,
+                                        pfnCallback, &sCollector));
+    EXPECT_EQ(0, sCollector.nMismatches);
+    EXPECT_EQ(2, sCollector.anShapeIds.front());
+
+    SHPClose(hSHP);
+}
+
+static std::mutex oErrorMutex;
+static std::vector<std::thread::id> aoErrorThreads;
+
+TEST(SHPReadObjectsParallelTest, ReportsErrorsFromCallingThread)
+{
+    const auto filename =
+        fs::temp_directory_path() / GenerateUniqueFilename(".parallel.shp");
+    auto shxFilename = filename;
+    shxFilename.replace_extension(".shx");
+    fs::copy_file(kTestData / "polygon.shp", filename);
+    fs::copy_file(kTestData / "polygon.shx", shxFilename);
+
+    /* Corrupt the part count of the second record */
+    unsigned char abyOffset[4] = {};
+    {
+        std::ifstream oSHX(shxFilename, std::ios::binary);
+        oSHX.seekg(100 + 8);
+        oSHX.read(reinterpret_cast<char *>(abyOffset), 4);
+    }
+    const long nOffset = 2 * ((static_cast<long>(abyOffset[0]) << 24) |
+                              (abyOffset[1] << 16) | (abyOffset[2] << 8) |
+                              abyOffset[3]);
+    {
+        std::fstream oSHP(filename,
+                          std::ios::in | std::ios::out | std::ios::binary);
+        oSHP.seekp(nOffset + 8 + 4 + 32);
+        oSHP.write("\xff\xff\xff\x7f", 4);
+    }
+
+    SAHooks sHooks;
+    SASetupDefaultHooks(&sHooks);
+    sHooks.Error = [](const char *)
+    {
+        std::lock_guard<std::mutex> oLock(oErrorMutex);
+        aoErrorThreads.push_back(std::this_thread::get_id());
+    };
+    const auto hSHP = SHPOpenLL(filename.string().c_str(), "rb", &sHooks);
+    ASSERT_NE(nullptr, hSHP);
+    int nEntities = 0;
+    SHPGetInfo(hSHP, &nEntities, nullptr, nullptr, nullptr);
+
+    const SHPReadObjectsCallback pfnCallback =
+        [](int, SHPObject *psObj, void *pUserData) -> int
+    {
+        if (psObj == nullptr)
+            (*static_cast<int *>(pUserData))++;
+        SHPDestroyObject(psObj);
+        return 1;
+    };
+
+    for (const int nThreads : {0, 1, 3})
+    {
+        aoErrorThreads.clear();
+        int nFailed = 0;
+        EXPECT_EQ(nEntities,
+                  SHPReadObjectsParallel(hSHP, 0, nEntities, nThreads, 0,
+                                         pfnCallback, &nFailed));
+        EXPECT_EQ(1, nFailed);
+        ASSERT_EQ(1U, aoErrorThreads.size());
+        EXPECT_EQ(std::this_thread::get_id(), aoErrorThreads[0]);
+    }
+    SHPClose(hSHP);
+
+    fs::remove(filename);
+    fs::remove(shxFilename);
+}
+
+TEST(SHPCreateObjectTest, ComputeExtentsMatchesMinMax)
+{
+    /* Cover the vector loops as well as their scalar tails */
+    for (int nVertices = 1; nVertices < 24; nVertices++)
+    {
+        std::vector<double> adfX, adfY, adfZ, adfM;
+        for (int i = 0; i < nVertices; i++)
+        {
+            adfX.push_back(((i * 7919) % 101) - 50.5);
+            adfY.push_back(((i * 104729) % 61) * 0.25);
+            adfZ.push_back(-i * 1.5);
+            adfM.push_back(i % 3 == 0 ? 1e10 : -1e-10 * i);
+        }
+        SHPObject *psObj = SHPCreateObject(
+            SHPT_ARCZ, -1, 0, nullptr, nullptr, nVertices, adfX.data(),
+            adfY.data(), adfZ.data(), adfM.data());
+        ASSERT_NE(nullptr, psObj);
+        EXPECT_EQ(*std::min_element(adfX.begin(), adfX.end()), psObj->dfXMin);
+        EXPECT_EQ(*std::max_element(adfX.begin(), adfX.end()), psObj->dfXMax);
+        EXPECT_EQ(*std::min_element(adfY.begin(), adfY.end()), psObj->dfYMin);
+        EXPECT_EQ(*std::max_element(adfY.begin(), adfY.end()), psObj->dfYMax);
+        EXPECT_EQ(*std::min_element(adfZ.begin(), adfZ.end()), psObj->dfZMin);
+        EXPECT_EQ(*std::max_element(adfZ.begin(), adfZ.end()), psObj->dfZMax);
+        EXPECT_EQ(*std::min_element(adfM.begin(), adfM.end()), psObj->dfMMin);
+        EXPECT_EQ(*std::max_element(adfM.begin(), adfM.end()), psObj->dfMMax);
+        SHPDestroyObject(psObj);
+    }
+}
+
 TEST(SHPCreateTest, CreateDoesNotExist)
 {
     const auto handle = SHPCreate("/does/not/exist", 42);
@@ -83,6 +596,719 @@ TEST(SHPCreateTest, CreateAndClose)
     }
 }
 
+TEST(SHPCreateTest, ReadBackBeforeClose)
+{
+    const auto filename =
+        fs::temp_directory_path() / GenerateUniqueFilename(".shp");
+    const auto hSHP = SHPCreate(filename.string().c_str(), SHPT_ARC);
+    ASSERT_NE(nullptr, hSHP);
+
+    for (int i = 0; i < 3; i++)
+    {
+        const double adfX[] = {0.0 + i, 1.0 + i, 2.0 + i};
+        const double adfY[] = {0.5 * i, 1.5 * i, 2.5 * i};
+        SHPObject *psObj = SHPCreateSimpleObject(SHPT_ARC, 3, adfX, adfY,
+                                                 nullptr);
+        EXPECT_EQ(i, SHPWriteObject(hSHP, -1, psObj));
+        SHPDestroyObject(psObj);
+
+        /* Pending writes must be visible to positional reads */
+        SHPObject *psRead = SHPReadObject(hSHP, i);
+        ASSERT_NE(nullptr, psRead);
+        ASSERT_EQ(3, psRead->nVertices);
+        for (int j = 0; j < 3; j++)
+        {
+            EXPECT_EQ(adfX[j], psRead->padfX[j]);
+            EXPECT_EQ(adfY[j], psRead->padfY[j]);
+        }
+        SHPDestroyObject(psRead);
+    }
+
+    SHPClose(hSHP);
+    fs::remove(filename);
+    fs::remove(fs::path(filename).replace_extension(".shx"));
+}
+
+static std::string ReadFileContent(const fs::path &path)
+{
+    std::ifstream oFile(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(oFile)),
+                       std::istreambuf_iterator<char>());
+}
+
+TEST(SHPCreateTest, WriteBufferMatchesUnbufferedWrites)
+{
+    const auto tmp = fs::temp_directory_path();
+    const std::string aosNames[] = {GenerateUniqueFilename("_unbuffered"),
+                                    GenerateUniqueFilename("_buffered")};
+    for (int iPass = 0; iPass < 2; iPass++)
+    {
+        const auto filename = tmp / (aosNames[iPass] + ".shp");
+        const auto hSHP = SHPCreate(filename.string().c_str(), SHPT_ARC);
+        ASSERT_NE(nullptr, hSHP);
+        /* Small enough to get flushed several times */
+        if (iPass == 1)
+        {
+            ASSERT_TRUE(SHPSetWriteBufferSize(hSHP, 1000));
+        }
+
+        for (int i = 0; i < 100; i++)
+        {
+            const int nVertices = 2 + i % 7;
+            std::vector<double> adfX(nVertices);
+            std::vector<double> adfY(nVertices);
+            for (int j = 0; j < nVertices; j++)
+            {
+                adfX[j] = i + 0.25 * j;
+                adfY[j] = i - 0.5 * j;
+            }
+            SHPObject *psObj = SHPCreateSimpleObject(
+                SHPT_ARC, nVertices, adfX.data(), adfY.data(), nullptr);
+            EXPECT_EQ(i, SHPWriteObject(hSHP, -1, psObj));
+            SHPDestroyObject(psObj);
+
+            if (i % 10 == 4)
+            {
+                /* Buffered records must be visible to reads */
+                SHPObject *psRead = SHPReadObject(hSHP, i);
+                ASSERT_NE(nullptr, psRead);
+                ASSERT_EQ(nVertices, psRead->nVertices);
+                EXPECT_EQ(adfX[nVertices - 1], psRead->padfX[nVertices - 1]);
+                SHPDestroyObject(psRead);
+            }
+        }
+
+        /* Rewrite a record that is still in the buffer, in place */
+        const double adfX[] = {-1.0, -2.0};
+        const double adfY[] = {-3.0, -4.0};
+        SHPObject *psObj =
+            SHPCreateSimpleObject(SHPT_ARC, 2, adfX, adfY, nullptr);
+        EXPECT_EQ(98, SHPWriteObject(hSHP, 98, psObj));
+        SHPDestroyObject(psObj);
+
+        SHPClose(hSHP);
+    }
+
+    for (const char *pszExt : {".shp", ".shx"})
+    {
+        const auto osBuffered = ReadFileContent(tmp / (aosNames[1] + pszExt));
+        EXPECT_FALSE(osBuffered.empty());
+        EXPECT_EQ(ReadFileContent(tmp / (aosNames[0] + pszExt)), osBuffered)
+            << pszExt;
+    }
+
+    for (const auto &osName : aosNames)
+    {
+        fs::remove(tmp / (osName + ".shp"));
+        fs::remove(tmp / (osName + ".shx"));
+    }
+}
+
+TEST(SHPCreateTest, WriteObjectsMatchesWriteObject)
+{
+    /* Enough vertices for several slices per thread */
+    std::vector<SHPObject *> apsObjects;
+    for (int i = 0; i < 3000; i++)
+    {
+        const int nVertices = 1 + (i * 37) % 300;
+        std::vector<double> adfX(nVertices);
+        std::vector<double> adfY(nVertices);
+        std::vector<double> adfZ(nVertices);
+        for (int j = 0; j < nVertices; j++)
+        {
+            adfX[j] = i + 0.5 * j;
+            adfY[j] = -i - 0.25 * j;
+            adfZ[j] = j;
+        }
+        apsObjects.push_back(SHPCreateSimpleObject(
+            i % 100 == 5 ? SHPT_NULL : SHPT_ARCZ, nVertices, adfX.data(),
+            adfY.data(), adfZ.data()));
+    }
+
+    const auto tmp = fs::temp_directory_path();
+    const std::string aosNames[] = {GenerateUniqueFilename("_writeobject"),
+                                    GenerateUniqueFilename("_writeobjects")};
+    for (int iPass = 0; iPass < 2; iPass++)
+    {
+        const auto filename = tmp / (aosNames[iPass] + ".shp");
+        const auto hSHP = SHPCreate(filename.string().c_str(), SHPT_ARCZ);
+        ASSERT_NE(nullptr, hSHP);
+        if (iPass == 0)
+        {
+            for (SHPObject *psObject : apsObjects)
+                SHPWriteObject(hSHP, -1, psObject);
+        }
+        else
+        {
+            /* Exercise appending to existing records too */
+            EXPECT_EQ(1, SHPWriteObjects(hSHP, apsObjects.data(), 1, 3));
+            EXPECT_EQ(static_cast<int>(apsObjects.size()) - 1,
+                      SHPWriteObjects(hSHP, apsObjects.data() + 1,
+                                      static_cast<int>(apsObjects.size()) - 1,
+                                      3));
+        }
+        SHPClose(hSHP);
+    }
+
+    for (const char *pszExt : {".shp", ".shx"})
+    {
+        const auto osWriteObjects =
+            ReadFileContent(tmp / (aosNames[1] + pszExt));
+        EXPECT_FALSE(osWriteObjects.empty());
+        EXPECT_EQ(ReadFileContent(tmp / (aosNames[0] + pszExt)), osWriteObjects)
+            << pszExt;
+    }
+
+    for (SHPObject *psObject : apsObjects)
+        SHPDestroyObject(psObject);
+    for (const auto &osName : aosNames)
+    {
+        fs::remove(tmp / (osName + ".shp"));
+        fs::remove(tmp / (osName + ".shx"));
+    }
+}
+
+TEST(SHPCreateTest, WriteObjectFromArraysMatchesWriteObject)
+{
+    const double adfX[] = {1.0, 4.0, 3.0, -2.0, 0.5, 7.0};
+    const double adfY[] = {2.0, -1.0, 5.0, 0.0, 3.5, 6.0};
+    const double adfZ[] = {0.5, 8.0, -3.0, 1.0, 2.0, 4.0};
+    const double adfM[] = {10.0, 11.0, 9.0, 12.0, 13.0, 8.0};
+    std::vector<double> adfXY;
+    for (int i = 0; i < 6; i++)
+    {
+        adfXY.push_back(adfX[i]);
+        adfXY.push_back(adfY[i]);
+    }
+    const int anPartStart[] = {0, 2};
+    const int anPartType[] = {SHPP_TRISTRIP, SHPP_RING};
+
+    const auto tmp = fs::temp_directory_path();
+    for (const int nSHPType :
+         {SHPT_POINTZ, SHPT_ARCM, SHPT_POLYGONZ, SHPT_MULTIPOINTZ,
+          SHPT_MULTIPATCH})
+    {
+        const bool bPoint = nSHPType == SHPT_POINTZ;
+        const std::string aosNames[] = {
+            GenerateUniqueFilename("_fromobject"),
+            GenerateUniqueFilename("_fromarrays"),
+            GenerateUniqueFilename("_frominterleaved")};
+        for (int iPass = 0; iPass < 3; iPass++)
+        {
+            const auto filename = tmp / (aosNames[iPass] + ".shp");
+            const auto hSHP = SHPCreate(filename.string().c_str(), nSHPType);
+            ASSERT_NE(nullptr, hSHP);
+            for (int i = 0; i < 4; i++)
+            {
+                /* Various vertex counts, with or without Z/M and parts */
+                const int nVertices = bPoint ? 1 : 6 - i;
+                const int nParts = i % 2 == 0 ? 2 : 0;
+                const double *padfZ = i == 1 ? nullptr : adfZ;
+                const double *padfM = i == 2 ? nullptr : adfM;
+                if (iPass == 0)
+                {
+                    SHPObject *psObj = SHPCreateObject(
+                        nSHPType, -1, nParts, anPartStart, anPartType,
+                        nVertices, adfX, adfY, padfZ, padfM);
+                    EXPECT_EQ(i, SHPWriteObject(hSHP, -1, psObj));
+                    SHPDestroyObject(psObj);
+                }
+                else if (iPass == 1)
+                {
+                    EXPECT_EQ(i, SHPWriteObjectFromArrays(
+                                     hSHP, -1, nSHPType, nParts, anPartStart,
+                                     anPartType, nVertices, adfX, adfY, padfZ,
+                                     padfM, nullptr, nullptr));
+                }
+                else
+                {
+                    EXPECT_EQ(i, SHPWriteObjectFromInterleavedXY(
+                                     hSHP, -1, nSHPType, nParts, anPartStart,
+                                     anPartType, nVertices, adfXY.data(),
+                                     padfZ, padfM, nullptr, nullptr));
+                }
+            }
+            SHPClose(hSHP);
+        }
+
+        for (const char *pszExt : {".shp", ".shx"})
+        {
+            const auto osFromObject =
+                ReadFileContent(tmp / (aosNames[0] + pszExt));
+            EXPECT_FALSE(osFromObject.empty());
+            for (int iPass = 1; iPass < 3; iPass++)
+            {
+                EXPECT_EQ(osFromObject,
+                          ReadFileContent(tmp / (aosNames[iPass] + pszExt)))
+                    << nSHPType << " " << aosNames[iPass] << pszExt;
+            }
+        }
+        for (const auto &osName : aosNames)
+        {
+            fs::remove(tmp / (osName + ".shp"));
+            fs::remove(tmp / (osName + ".shx"));
+        }
+    }
+}
+
+static SAOffset nReservedSize = 0;
+
+static int RecordingReserve(SAFile, SAOffset nSize)
+{
+    nReservedSize = nSize;
+    return 0;
+}
+
+TEST(SHPCreateTest, ReserveRecords)
+{
+    const auto filename =
+        fs::temp_directory_path() / GenerateUniqueFilename(".shp");
+    SAHooks sHooks;
+    SASetupDefaultHooks(&sHooks);
+    sHooks.FReserve = RecordingReserve;
+    const auto hSHP =
+        SHPCreateLL(filename.string().c_str(), SHPT_POINT, &sHooks);
+    ASSERT_NE(nullptr, hSHP);
+
+    nReservedSize = 0;
+    ASSERT_TRUE(SHPReserveRecords(hSHP, 500));
+    EXPECT_EQ(100 + 8 * 500, nReservedSize);
+    EXPECT_GE(hSHP->nMaxRecords, 500);
+
+    /* The record index is not reallocated anymore */
+    const unsigned int *panRecOffset = hSHP->panRecOffset;
+    for (int i = 0; i < 500; i++)
+    {
+        const double dfX = i;
+        const double dfY = -i;
+        SHPObject *psObj =
+            SHPCreateSimpleObject(SHPT_POINT, 1, &dfX, &dfY, nullptr);
+        EXPECT_EQ(i, SHPWriteObject(hSHP, -1, psObj));
+        SHPDestroyObject(psObj);
+    }
+    EXPECT_EQ(panRecOffset, hSHP->panRecOffset);
+    SHPClose(hSHP);
+
+    EXPECT_EQ(100 + 28 * 500, fs::file_size(filename));
+    fs::remove(filename);
+    fs::remove(fs::path(filename).replace_extension(".shx"));
+}
+
+struct RestoreSHXCollector
+{
+    std::vector<double> adfBounds;
+    double dfLastProgress = 0;
+};
+
+static int RestoreSHXProgress(double dfComplete, void *pUserData)
+{
+    static_cast<RestoreSHXCollector *>(pUserData)->dfLastProgress = dfComplete;
+    return true;
+}
+
+static void RestoreSHXBounds(int iShape, const double *padfBounds,
+                             void *pUserData)
+{
+    auto &adfBounds = static_cast<RestoreSHXCollector *>(pUserData)->adfBounds;
+    EXPECT_EQ(4 * static_cast<size_t>(iShape), adfBounds.size());
+    adfBounds.insert(adfBounds.end(), padfBounds, padfBounds + 4);
+}
+
+TEST(SHPRestoreSHXTest, RestoreSHXExMatchesSHX)
+{
+    const auto filename = kTestData / "CoHI_GCS12.shp";
+    const auto restoreFilename =
+        fs::temp_directory_path() / GenerateUniqueFilename(".shp");
+    fs::copy_file(filename, restoreFilename);
+    const auto restoreSHXFilename =
+        fs::path(restoreFilename).replace_extension(".shx");
+
+    SAHooks sHooks;
+    SASetupDefaultHooks(&sHooks);
+    RestoreSHXCollector sCollector;
+    ASSERT_TRUE(SHPRestoreSHXEx(restoreFilename.string().c_str(), &sHooks,
+                                RestoreSHXProgress, RestoreSHXBounds,
+                                &sCollector));
+    EXPECT_EQ(1.0, sCollector.dfLastProgress);
+
+    /* The .shx only differs from the original one by its header bounds */
+    const auto osSHX = ReadFileContent(kTestData / "CoHI_GCS12.shx");
+    const auto osRestoredSHX = ReadFileContent(restoreSHXFilename);
+    ASSERT_EQ(osSHX.size(), osRestoredSHX.size());
+    EXPECT_EQ(osSHX.substr(100), osRestoredSHX.substr(100));
+
+    const auto hSHP = SHPOpen(filename.string().c_str(), "rb");
+    ASSERT_NE(nullptr, hSHP);
+    int nEntities = 0;
+    SHPGetInfo(hSHP, &nEntities, nullptr, nullptr, nullptr);
+    std::vector<double> adfBounds(4 * nEntities);
+    EXPECT_EQ(nEntities,
+              SHPReadObjectsBounds(hSHP, 0, nEntities, adfBounds.data()));
+    EXPECT_EQ(adfBounds, sCollector.adfBounds);
+    SHPClose(hSHP);
+
+    fs::remove(restoreFilename);
+    fs::remove(restoreSHXFilename);
+}
+
+TEST(SHPRestoreSHXTest, RestoreSHXWithTruncatedLastRecord)
+{
+    const auto restoreFilename =
+        fs::temp_directory_path() / GenerateUniqueFilename(".shp");
+    const auto restoreSHXFilename =
+        fs::path(restoreFilename).replace_extension(".shx");
+
+    /* Only the record headers are needed to restore the .shx */
+    const auto osSHP = ReadFileContent(kTestData / "CoHI_GCS12.shp");
+    {
+        std::ofstream oFile(restoreFilename, std::ios::binary);
+        oFile << osSHP.substr(0, osSHP.size() - 4);
+    }
+    SAHooks sHooks;
+    SASetupDefaultHooks(&sHooks);
+    ASSERT_TRUE(SHPRestoreSHX(restoreFilename.string().c_str(), "rb", &sHooks));
+
+    const auto osSHX = ReadFileContent(kTestData / "CoHI_GCS12.shx");
+    const auto osRestoredSHX = ReadFileContent(restoreSHXFilename);
+    ASSERT_EQ(osSHX.size(), osRestoredSHX.size());
+    EXPECT_EQ(osSHX.substr(100), osRestoredSHX.substr(100));
+
+    fs::remove(restoreFilename);
+    fs::remove(restoreSHXFilename);
+}
+
+static SHPObject *CreateCompactTestArc(int iShape, int nVertices)
+{
+    std::vector<double> adfX(nVertices);
+    std::vector<double> adfY(nVertices);
+    for (int j = 0; j < nVertices; j++)
+    {
+        adfX[j] = iShape + 0.5 * j / nVertices;
+        adfY[j] = iShape - 0.5 * j / nVertices;
+    }
+    return SHPCreateSimpleObject(SHPT_ARC, nVertices, adfX.data(),
+                                 adfY.data(), nullptr);
+}
+
+TEST(SHPCompactTest, ReclaimsRewrittenRecords)
+{
+    const auto tmp = fs::temp_directory_path();
+    const std::string aosNames[] = {GenerateUniqueFilename("_compact"),
+                                    GenerateUniqueFilename("_compact_ref")};
+    for (int iPass = 0; iPass < 2; iPass++)
+    {
+        const auto filename = tmp / (aosNames[iPass] + ".shp");
+        const auto hSHP = SHPCreate(filename.string().c_str(), SHPT_ARC);
+        ASSERT_NE(nullptr, hSHP);
+        for (int i = 0; i < 50; i++)
+        {
+            /* The reference file is written with the final shapes */
+            const bool bGrown = iPass == 1 && i % 10 == 3;
+            SHPObject *psObj = CreateCompactTestArc(i, bGrown ? 6 : 2);
+            EXPECT_EQ(i, SHPWriteObject(hSHP, -1, psObj));
+            SHPDestroyObject(psObj);
+        }
+        EXPECT_EQ(0U, SHPGetWastedBytes(hSHP));
+        if (iPass == 0)
+        {
+            /* Grown shapes do not fit in place and are moved at the end */
+            for (int i = 3; i < 50; i += 10)
+            {
+                SHPObject *psObj = CreateCompactTestArc(i, 6);
+                EXPECT_EQ(i, SHPWriteObject(hSHP, i, psObj));
+                SHPDestroyObject(psObj);
+            }
+            EXPECT_EQ(5U * (8 + 48 + 2 * 16), SHPGetWastedBytes(hSHP));
+        }
+        SHPClose(hSHP);
+    }
+
+    const std::string osLayer = (tmp / aosNames[0]).string();
+    ASSERT_TRUE(SHPCompact(osLayer.c_str()));
+
+    const auto hSHP = SHPOpen(osLayer.c_str(), "rb");
+    ASSERT_NE(nullptr, hSHP);
+    EXPECT_EQ(0U, SHPGetWastedBytes(hSHP));
+    SHPClose(hSHP);
+
+    for (const char *pszExt : {".shp", ".shx"})
+    {
+        const auto osReference = ReadFileContent(tmp / (aosNames[1] + pszExt));
+        EXPECT_FALSE(osReference.empty());
+        EXPECT_EQ(osReference, ReadFileContent(tmp / (aosNames[0] + pszExt)))
+            << pszExt;
+    }
+    EXPECT_FALSE(fs::exists(tmp / (aosNames[0] + ".shp.tmp")));
+
+    for (const auto &osName : aosNames)
+    {
+        fs::remove(tmp / (osName + ".shp"));
+        fs::remove(tmp / (osName + ".shx"));
+    }
+}
+
+/* In memory files storing only the bytes written, so that offsets over */
+/* 4 GB can be tested without writing that much */
+struct SparseFile
+{
+    std::map<SAOffset, unsigned char> oBytes;
+    SAOffset nSize = 0;
+};
+
+struct SparseHandle
+{
+    SparseFile *poFile;
+    SAOffset nPos;
+};
+
+static std::map<std::string, SparseFile> oSparseFiles;
+
+static SAFile SparseOpen(const char *pszFilename, const char *pszAccess, void *)
+{
+    if (pszAccess[0] == 'w')
+        oSparseFiles[pszFilename] = SparseFile();
+    else if (oSparseFiles.find(pszFilename) == oSparseFiles.end())
+        return nullptr;
+    return reinterpret_cast<SAFile>(
+        new SparseHandle{&oSparseFiles[pszFilename], 0});
+}
+
+static SAOffset SparseRead(void *p, SAOffset nSize, SAOffset nCount,
+                           SAFile file)
+{
+    auto psHandle = reinterpret_cast<SparseHandle *>(file);
+    SAOffset nItems = 0;
+    for (; nItems < nCount && psHandle->nPos + nSize <= psHandle->poFile->nSize;
+         nItems++)
+    {
+        for (SAOffset i = 0; i < nSize; i++, psHandle->nPos++)
+        {
+            const auto oIter = psHandle->poFile->oBytes.find(psHandle->nPos);
+            static_cast<unsigned char *>(p)[nItems * nSize + i] =
+                oIter == psHandle->poFile->oBytes.end() ? 0 : oIter->second;
+        }
+    }
+    return nItems;
+}
+
+static SAOffset SparseWrite(const void *p, SAOffset nSize, SAOffset nCount,
+                            SAFile file)
+{
+    auto psHandle = reinterpret_cast<SparseHandle *>(file);
+    for (SAOffset i = 0; i < nSize * nCount; i++, psHandle->nPos++)
+        psHandle->poFile->oBytes[psHandle->nPos] =
+            static_cast<const unsigned char *>(p)[i];
+    psHandle->poFile->nSize = std::max(psHandle->poFile->nSize, psHandle->nPos);
+    return nCount;
+}
+
+static SAOffset SparseSeek(SAFile file, SAOffset nOffset, int nWhence)
+{
+    auto psHandle = reinterpret_cast<SparseHandle *>(file);
+    psHandle->nPos =
+        nWhence == SEEK_END ? psHandle->poFile->nSize + nOffset : nOffset;
+    return 0;
+}
+
+static SAOffset SparseTell(SAFile file)
+{
+    return reinterpret_cast<SparseHandle *>(file)->nPos;
+}
+
+static int SparseFlush(SAFile)
+{
+    return 0;
+}
+
+static int SparseClose(SAFile file)
+{
+    delete reinterpret_cast<SparseHandle *>(file);
+    return 0;
+}
+
+static int SparseRemove(const char *pszFilename, void *)
+{
+    return oSparseFiles.erase(pszFilename) == 1 ? 0 : -1;
+}
+
+static void SetupSparseHooks(SAHooks *psHooks)
+{
+    SASetupDefaultHooks(psHooks);
+    psHooks->FOpen = SparseOpen;
+    psHooks->FRead = SparseRead;
+    psHooks->FWrite = SparseWrite;
+    psHooks->FSeek = SparseSeek;
+    psHooks->FTell = SparseTell;
+    psHooks->FFlush = SparseFlush;
+    psHooks->FClose = SparseClose;
+    psHooks->Remove = SparseRemove;
+    /* FReadAt and FReserve are left to the defaults, which must be */
+    /* ignored */
+}
+
+static void WriteLargeFileTestPoint(SHPHandle hSHP, int iShape)
+{
+    const double dfX = iShape;
+    const double dfY = -iShape;
+    SHPObject *psObj =
+        SHPCreateSimpleObject(SHPT_POINT, 1, &dfX, &dfY, nullptr);
+    EXPECT_EQ(iShape, SHPWriteObject(hSHP, -1, psObj));
+    SHPDestroyObject(psObj);
+}
+
+static void CheckLargeFileTestPoints(SHPHandle hSHP, int nShapes)
+{
+    int nEntities = 0;
+    SHPGetInfo(hSHP, &nEntities, nullptr, nullptr, nullptr);
+    ASSERT_EQ(nShapes, nEntities);
+    for (int i = 0; i < nShapes; i++)
+    {
+        SHPObject *psObj = SHPReadObject(hSHP, i);
+        ASSERT_NE(nullptr, psObj) << i;
+        EXPECT_EQ(i, psObj->padfX[0]);
+        EXPECT_EQ(-i, psObj->padfY[0]);
+        SHPDestroyObject(psObj);
+    }
+}
+
+TEST(SHPLargeFileTest, OffsetsOver8GB)
+{
+    static_assert(sizeof(SAOffset) >= 8, "64 bit file offsets required");
+    const SAOffset nGap = SAOffset{9} * 1024 * 1024 * 1024;
+
+    SAHooks sHooks;
+    SetupSparseHooks(&sHooks);
+    const auto hSHP = SHPCreateLL("large.shp", SHPT_POINT, &sHooks);
+    ASSERT_NE(nullptr, hSHP);
+    ASSERT_TRUE(SHPSetLargeFileMode(hSHP, true));
+    ASSERT_TRUE(SHPReserveRecords(hSHP, 3));
+    WriteLargeFileTestPoint(hSHP, 0);
+
+    /* Append the next records after 9 GB of unused space */
+    hSHP->nFileSize64 += nGap;
+    WriteLargeFileTestPoint(hSHP, 1);
+    WriteLargeFileTestPoint(hSHP, 2);
+    EXPECT_EQ(100 + 28 + nGap, hSHP->panRecOffset64[1]);
+    EXPECT_EQ(UINT_MAX, hSHP->nFileSize);
+    EXPECT_FALSE(SHPSetLargeFileMode(hSHP, false));
+    CheckLargeFileTestPoints(hSHP, 3);
+    SHPClose(hSHP);
+    EXPECT_EQ(1U, oSparseFiles.count("large.shx64"));
+
+    /* The .shx64 index is needed to read the records */
+    for (const char *pszAccess : {"rbx", "rblx", "r+bx"})
+    {
+        const auto hSHPRead = SHPOpenLL("large", pszAccess, &sHooks);
+        ASSERT_NE(nullptr, hSHPRead) << pszAccess;
+        EXPECT_EQ(100 + 3 * 28 + nGap, hSHPRead->nFileSize64);
+        CheckLargeFileTestPoints(hSHPRead, 3);
+        if (pszAccess[1] == '+')
+            WriteLargeFileTestPoint(hSHPRead, 3);
+        SHPClose(hSHPRead);
+    }
+
+    const auto hSHPRead = SHPOpenLL("large", "rbx", &sHooks);
+    ASSERT_NE(nullptr, hSHPRead);
+    CheckLargeFileTestPoints(hSHPRead, 4);
+    EXPECT_EQ(100 + 3 * 28 + nGap, hSHPRead->panRecOffset64[3]);
+    SHPClose(hSHPRead);
+
+    /* Files that fit in the .shx do not get a .shx64 index */
+    const auto hSHPSmall = SHPCreateLL("small.shp", SHPT_POINT, &sHooks);
+    ASSERT_NE(nullptr, hSHPSmall);
+    ASSERT_TRUE(SHPSetLargeFileMode(hSHPSmall, true));
+    WriteLargeFileTestPoint(hSHPSmall, 0);
+    SHPClose(hSHPSmall);
+    EXPECT_EQ(0U, oSparseFiles.count("small.shx64"));
+
+    oSparseFiles.clear();
+}
+
+TEST(SHPCompactTest, CompactsLargeFile)
+{
+    const SAOffset nGap = SAOffset{9} * 1024 * 1024 * 1024;
+
+    SAHooks sHooks;
+    SetupSparseHooks(&sHooks);
+    const auto hSHP = SHPCreateLL("large.shp", SHPT_POINT, &sHooks);
+    ASSERT_NE(nullptr, hSHP);
+    ASSERT_TRUE(SHPSetLargeFileMode(hSHP, true));
+    WriteLargeFileTestPoint(hSHP, 0);
+    hSHP->nFileSize64 += nGap;
+    WriteLargeFileTestPoint(hSHP, 1);
+    WriteLargeFileTestPoint(hSHP, 2);
+    EXPECT_EQ(nGap, SHPGetWastedBytes(hSHP));
+    SHPClose(hSHP);
+    ASSERT_EQ(1U, oSparseFiles.count("large.shx64"));
+
+    /* The records past 8 GB are found through the .shx64 index, which */
+    /* is no longer needed once the gap is reclaimed */
+    ASSERT_TRUE(SHPCompactLL("large", &sHooks));
+    EXPECT_EQ(0U, oSparseFiles.count("large.shx64"));
+    EXPECT_EQ(0U, oSparseFiles.count("large.shp.tmp"));
+    EXPECT_EQ(SAOffset{100 + 3 * 28}, oSparseFiles["large.shp"].nSize);
+
+    const auto hSHPRead = SHPOpenLL("large", "rb", &sHooks);
+    ASSERT_NE(nullptr, hSHPRead);
+    CheckLargeFileTestPoints(hSHPRead, 3);
+    EXPECT_EQ(0U, SHPGetWastedBytes(hSHPRead));
+    SHPClose(hSHPRead);
+
+    oSparseFiles.clear();
+}
+
+TEST(SHPRestoreSHXTest, RestoreSHXOfLargeFile)
+{
+    /* Multipoint records of 2 GB, whose content is left unwritten as */
+    /* only their headers are read */
+    const unsigned int nRecordLength = 0x3FFFFFF0;
+    const SAOffset nEntitySize = 8 + SAOffset{2} * nRecordLength;
+    const int nRecords = 5;
+    const SAOffset nFileSize = 100 + nRecords * nEntitySize;
+
+    SAHooks sHooks;
+    SetupSparseHooks(&sHooks);
+    SAFile fp = sHooks.FOpen("huge.shp", "wb", nullptr);
+    ASSERT_NE(nullptr, fp);
+    unsigned char abyHeader[100] = {0, 0, 0x27, 0x0a};
+    /* Over 8 GB, the header holds the largest size it can */
+    memset(abyHeader + 24, 0xff, 4);
+    abyHeader[28] = 1000 % 256;
+    abyHeader[29] = 1000 / 256;
+    abyHeader[32] = SHPT_MULTIPOINT;
+    sHooks.FWrite(abyHeader, 100, 1, fp);
+    for (int i = 0; i < nRecords; i++)
+    {
+        const unsigned char abyRecord[12] = {
+            0, 0, 0, static_cast<unsigned char>(i + 1),
+            static_cast<unsigned char>(nRecordLength >> 24),
+            static_cast<unsigned char>(nRecordLength >> 16),
+            static_cast<unsigned char>(nRecordLength >> 8),
+            static_cast<unsigned char>(nRecordLength), SHPT_MULTIPOINT};
+        sHooks.FSeek(fp, 100 + i * nEntitySize, SEEK_SET);
+        sHooks.FWrite(abyRecord, 12, 1, fp);
+    }
+    const unsigned char byLast = 0;
+    sHooks.FSeek(fp, nFileSize - 1, SEEK_SET);
+    sHooks.FWrite(&byLast, 1, 1, fp);
+    sHooks.FClose(fp);
+
+    ASSERT_TRUE(SHPRestoreSHXEx("huge", &sHooks, nullptr, nullptr, nullptr));
+    EXPECT_EQ(1U, oSparseFiles.count("huge.shx64"));
+
+    const auto hSHP = SHPOpenLL("huge", "rbx", &sHooks);
+    ASSERT_NE(nullptr, hSHP);
+    ASSERT_EQ(nRecords, hSHP->nRecords);
+    for (int i = 0; i < nRecords; i++)
+    {
+        EXPECT_EQ(100 + i * nEntitySize, hSHP->panRecOffset64[i]);
+        EXPECT_EQ(2 * nRecordLength, hSHP->panRecSize[i]);
+    }
+    SHPClose(hSHP);
+
+    oSparseFiles.clear();
+}
+
 }  // namespace
 
 int main(int argc, char **argv)